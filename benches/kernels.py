@@ -0,0 +1,369 @@
+#! /usr/bin/env python3
+"""Microbenchmarks of Calzone hot kernels.
+
+Kernels are exercised through the Python interface, using fixed seeds and data
+sizes, such that successive runs (e.g. before and after a change) are
+comparable. Results are written in JSON format.
+
+Synthetic meshes are tessellated cubes, with a tunable number of facets. Note
+that OBJ meshes are limited to 65535 distinct vertices, such that larger sizes
+are only benchmarked for the STL format.
+"""
+import argparse
+import json
+import platform
+import statistics
+import sys
+from pathlib import Path
+from tempfile import TemporaryDirectory
+import time
+
+import calzone
+import numpy
+
+
+SEED = 20240725
+
+HALF_WIDTH = 10.0 # cm
+
+OBJ_MAX_VERTICES = 65535
+
+
+# =============================================================================
+#
+# Synthetic data.
+#
+# =============================================================================
+
+def cube_mesh(size):
+    """Return a tessellated cube, with about size facets.
+
+    The cube is returned as a tuple of vertices, normals and triangles
+    (i.e. vertex indices). Each face is a regular grid of vertices.
+    """
+
+    m = max(int(round((size / 12)**0.5)), 1)
+    t = numpy.linspace(-HALF_WIDTH, HALF_WIDTH, m + 1)
+    u, v = (x.ravel() for x in numpy.meshgrid(t, t, indexing="ij"))
+    i, j = (x.ravel() for x in numpy.meshgrid(
+        numpy.arange(m), numpy.arange(m), indexing="ij"
+    ))
+    p00 = i * (m + 1) + j
+    p10 = p00 + m + 1
+    quads = numpy.concatenate((
+        numpy.stack((p00, p10, p10 + 1), axis=1),
+        numpy.stack((p00, p10 + 1, p00 + 1), axis=1),
+    ))
+
+    vertices, normals, triangles = [], [], []
+    eye = numpy.eye(3)
+    for k in range(3):
+        for sign in (1.0, -1.0):
+            a, b = eye[(k + 1) % 3], eye[(k + 2) % 3]
+            if sign < 0.0:
+                a, b = b, a # Facets are oriented outwards.
+            offset = len(normals) * (m + 1)**2
+            vertices.append(
+                sign * HALF_WIDTH * eye[k] + u[:,None] * a + v[:,None] * b
+            )
+            normals.append(sign * eye[k])
+            triangles.append(quads + offset)
+    return (
+        numpy.concatenate(vertices),
+        numpy.array(normals),
+        numpy.concatenate(triangles),
+    )
+
+
+def dump_obj(path, mesh):
+    """Dump a mesh in OBJ format."""
+
+    vertices, normals, triangles = mesh
+    n = len(triangles) // len(normals)
+    faces = numpy.empty((len(triangles), 6), dtype=int)
+    faces[:,0::2] = triangles + 1
+    faces[:,1::2] = numpy.repeat(numpy.arange(len(normals)) + 1, n)[:,None]
+    with open(path, "w") as f:
+        numpy.savetxt(f, vertices, fmt="v %.9g %.9g %.9g")
+        numpy.savetxt(f, normals, fmt="vn %.9g %.9g %.9g")
+        numpy.savetxt(f, faces, fmt="f %d//%d %d//%d %d//%d")
+
+
+def dump_stl(path, mesh):
+    """Dump a mesh in binary STL format."""
+
+    vertices, _, triangles = mesh
+    dtype = numpy.dtype([
+        ("normal", "<f4", 3),
+        ("vertices", "<f4", (3, 3)),
+        ("control", "<u2"),
+    ])
+    data = numpy.zeros(len(triangles), dtype=dtype)
+    data["vertices"] = vertices[triangles]
+    with open(path, "wb") as f:
+        f.write(bytes(80))
+        f.write(numpy.uint32(len(triangles)).tobytes())
+        f.write(data.tobytes())
+
+
+def mesh_geometry(path):
+    """Return a geometry containing the mesh, using the BVH algorithm."""
+
+    data = { "World": {
+        "box": 4 * HALF_WIDTH,
+        "Mesh": { "mesh": { "path": str(path), "algorithm": "bvh" }},
+    }}
+    return calzone.Geometry(data)
+
+
+def random_directions(rng, n):
+    """Return isotropic directions."""
+
+    cos_theta = rng.uniform(-1.0, 1.0, n)
+    sin_theta = numpy.sqrt(1.0 - cos_theta**2)
+    phi = rng.uniform(0.0, 2.0 * numpy.pi, n)
+    return numpy.stack((
+        sin_theta * numpy.cos(phi),
+        sin_theta * numpy.sin(phi),
+        cos_theta,
+    ), axis=1)
+
+
+# =============================================================================
+#
+# Benchmarks.
+#
+# =============================================================================
+
+class Bench:
+    """Collect timings of benchmarked kernels."""
+
+    def __init__(self, repeat, pattern):
+        self.repeat = repeat
+        self.pattern = pattern
+        self.results = []
+
+    def enabled(self, name):
+        return (self.pattern is None) or (self.pattern in name)
+
+    def run(self, name, items, function, setup=None, **params):
+        """Time a function, over items. An optional setup is called before
+        each repetition (e.g. in order to avoid caching effects)."""
+
+        times = []
+        for i in range(self.repeat):
+            args = () if setup is None else (setup(i),)
+            t0 = time.perf_counter()
+            function(*args)
+            times.append(time.perf_counter() - t0)
+        result = {
+            "name": name,
+            "params": params,
+            "items": items,
+            "times": times,
+            "min": min(times),
+            "median": statistics.median(times),
+            "throughput": items / min(times), # items / s
+        }
+        self.results.append(result)
+        print(
+            f"{name:<20} {json.dumps(params):<32} "
+            f"{result['min']:.3e} s  {result['throughput']:.3e} /s",
+            file = sys.stderr,
+        )
+
+
+def bench_meshes(bench, sizes, tmpdir, points):
+    """Benchmark meshes loading, building, and queries."""
+
+    rng = numpy.random.default_rng(SEED)
+    for size in sizes:
+        mesh = cube_mesh(size)
+        facets = len(mesh[2])
+
+        # Loading & acceleration structure building (load_stl / load_obj and
+        # SortedFacets::new). Distinct files are used for each repetition,
+        # since built meshes are cached.
+        formats = [("stl", dump_stl)]
+        if len(mesh[0]) <= OBJ_MAX_VERTICES:
+            formats.append(("obj", dump_obj))
+        for fmt, dump in formats:
+            name = f"mesh_build_{fmt}"
+            if not bench.enabled(name):
+                continue
+            def setup(i):
+                path = tmpdir / f"cube-{facets}-{i}.{fmt}"
+                dump(path, mesh)
+                return path
+            bench.run(name, facets, mesh_geometry, setup, facets=facets)
+
+        path = tmpdir / f"cube-{facets}.stl"
+        dump_stl(path, mesh)
+        geometry = mesh_geometry(path)
+        volume = geometry["World.Mesh"]
+
+        # Inside queries (MeshHandle::inside).
+        if bench.enabled("mesh_inside"):
+            positions = rng.uniform(-2 * HALF_WIDTH, 2 * HALF_WIDTH,
+                                    (points, 3))
+            bench.run("mesh_inside", points, lambda: volume.side(positions),
+                      facets=facets)
+
+        # Ray intersections (MeshHandle::intersect), from inside and outside
+        # of the mesh.
+        if bench.enabled("mesh_intersect"):
+            positions = rng.uniform(-1.5 * HALF_WIDTH, 1.5 * HALF_WIDTH,
+                                    (points, 3))
+            directions = random_directions(rng, points)
+            bench.run(
+                "mesh_intersect",
+                points,
+                lambda: geometry.trace(positions, directions),
+                facets = facets,
+            )
+
+        # Surface normals (MeshHandle::surface_normal), including the
+        # sampling of surface points.
+        if bench.enabled("mesh_surface_normal"):
+            random = calzone.Random(SEED)
+            generator = calzone.ParticlesGenerator(
+                geometry = geometry,
+                random = random,
+            ).on("World.Mesh", "outgoing")
+            bench.run(
+                "mesh_surface_normal",
+                points,
+                lambda: generator.generate(points),
+                facets = facets,
+            )
+
+
+def bench_map(bench, sizes, tmpdir):
+    """Benchmark topography meshing (Map::build_mesh)."""
+
+    if not bench.enabled("map_build_mesh"):
+        return
+    rng = numpy.random.default_rng(SEED)
+    for size in sizes:
+        n = max(int(round((size / 2)**0.5)), 2)
+        z = rng.uniform(0.0, 1.0, (n, n))
+        topography = calzone.Map.from_array(z, [-1E+03, 1E+03],
+                                            [-1E+03, 1E+03])
+        path = tmpdir / f"map-{n}.stl"
+        bench.run("map_build_mesh", n * n, lambda: topography.dump(path),
+                  nodes=n * n)
+
+
+def bench_random(bench, sizes):
+    """Benchmark pseudo-random draws, for both engines."""
+
+    if not bench.enabled("random_uniform01"):
+        return
+    for engine in ("pcg64mcg", "philox"):
+        random = calzone.Random(SEED, engine=engine)
+        for size in sizes:
+            bench.run("random_uniform01", size,
+                      lambda: random.uniform01(size), engine=engine,
+                      draws=size)
+
+
+def bench_samplers(bench, events):
+    """Benchmark energy deposits and particles sampling (Deposits::push and
+    ParticlesSampler::push). The transport baseline should be subtracted."""
+
+    configurations = (
+        ("transport", None, False, []),
+        ("sampler_deposits", "detailed", False, ["record_deposits"]),
+        ("sampler_particles", None, True, ["record_outgoing"]),
+    )
+    for name, deposits, particles, role in configurations:
+        if not bench.enabled(name):
+            continue
+        data = { "World": {
+            "box": 1E+04,
+            "Detector": {
+                "box": 1E+02, "material": "G4_WATER", "role": role
+            },
+        }}
+        simulation = calzone.Simulation(data)
+        simulation.random.seed = SEED
+        simulation.sample_deposits = deposits
+        simulation.sample_particles = particles
+        primaries = simulation.particles() \
+            .pid("gamma")                  \
+            .energy(1.0)                   \
+            .inside("World.Detector")      \
+            .generate(events)
+        simulation.run(primaries[:1]) # Warm up (i.e. build physics tables).
+        def run():
+            simulation.random.index = 0
+            simulation.run(primaries)
+        bench.run(name, events, run, events=events)
+
+
+# =============================================================================
+#
+# Command line interface.
+#
+# =============================================================================
+
+def main():
+    parser = argparse.ArgumentParser(
+        description = "Microbenchmarks of Calzone hot kernels."
+    )
+    parser.add_argument("-e", "--events",
+        help = "number of Monte Carlo events (samplers).",
+        type = int,
+        default = 10000,
+    )
+    parser.add_argument("-k", "--pattern",
+        help = "only run benchmarks whose name contains the pattern.",
+    )
+    parser.add_argument("-n", "--points",
+        help = "number of queried points (meshes).",
+        type = int,
+        default = 100000,
+    )
+    parser.add_argument("-o", "--output",
+        help = "output JSON file (defaults to stdout).",
+        type = Path,
+    )
+    parser.add_argument("-r", "--repeat",
+        help = "number of repetitions.",
+        type = int,
+        default = 5,
+    )
+    parser.add_argument("-s", "--sizes",
+        help = "data sizes (e.g. numbers of facets).",
+        type = lambda s: int(float(s)),
+        nargs = "+",
+        default = [1000, 10000, 100000, 1000000],
+    )
+    args = parser.parse_args()
+
+    bench = Bench(args.repeat, args.pattern)
+    with TemporaryDirectory() as tmpdir:
+        tmpdir = Path(tmpdir)
+        bench_meshes(bench, args.sizes, tmpdir, args.points)
+        bench_map(bench, args.sizes, tmpdir)
+    bench_random(bench, args.sizes)
+    bench_samplers(bench, args.events)
+
+    report = {
+        "calzone": calzone.VERSION,
+        "geant4": calzone.GEANT4_VERSION,
+        "machine": platform.machine(),
+        "processor": platform.processor(),
+        "python": platform.python_version(),
+        "seed": SEED,
+        "benchmarks": bench.results,
+    }
+    report = json.dumps(report, indent=2)
+    if args.output is None:
+        print(report)
+    else:
+        args.output.write_text(report)
+
+
+if __name__ == "__main__":
+    main()
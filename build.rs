@@ -69,10 +69,14 @@ fn main() {
         "src/geometry/solids.cc",
         "src/geometry/mesh.cc",
         "src/simulation.cc",
+        "src/simulation/adjoint.cc",
+        "src/simulation/biasing.cc",
+        "src/simulation/fast.cc",
         "src/simulation/geometry.cc",
         "src/simulation/physics.cc",
         "src/simulation/random.cc",
         "src/simulation/sampler.cc",
+        "src/simulation/scoring.cc",
         "src/simulation/source.cc",
         "src/simulation/tracker.cc",
         "src/utils/convert.cc",
@@ -85,10 +89,14 @@ fn main() {
         "src/calzone.h",
         "src/geometry/solids.h",
         "src/geometry/mesh.h",
+        "src/simulation/adjoint.h",
+        "src/simulation/biasing.h",
+        "src/simulation/fast.h",
         "src/simulation/geometry.h",
         "src/simulation/physics.h",
         "src/simulation/random.h",
         "src/simulation/sampler.h",
+        "src/simulation/scoring.h",
         "src/simulation/source.h",
         "src/simulation/tracker.h",
     ];
@@ -45,12 +45,21 @@ struct GeometryBorrow {
 
     // Geant4 interface.
     std::shared_ptr<Error> check(int resolution) const;
+    bool has_tallies() const;
     std::uint64_t id() const;
     G4VPhysicalVolume * world() const;
 
     // Goupil & mulder interfaces.
     void export_data() const;
 
+    // Navigation interface.
+    std::shared_ptr<Error> trace(
+        rust::Slice<const double> positions,
+        rust::Slice<const double> directions,
+        rust::Vec<TraceSegment> & segments,
+        rust::Vec<TraceVolume> & volumes
+    ) const;
+
 private:
     GeometryData * data;
 };
@@ -83,6 +92,11 @@ struct VolumeBorrow {
     const rust::Box<MeshHandle> & describe_mesh() const;
     TransformInfo describe_transform() const;
     TubsInfo describe_tubs() const;
+    double distance_to_in(
+        const std::array<double, 3> &,
+        const std::array<double, 3> &,
+        const G4AffineTransform &
+    ) const;
     bool eq(const VolumeBorrow & other) const;
     std::array<double, 6> generate_onto(
         RandomContext &,
@@ -102,7 +116,7 @@ struct VolumeBorrow {
     // Roles interface.
     void clear_roles() const;
     Roles get_roles() const;
-    void set_roles(Roles) const;
+    std::shared_ptr<Error> set_roles(Roles) const;
 
 private:
     GeometryData * geometry;
@@ -111,6 +125,7 @@ private:
 
 class G4TessellatedSolid;
 G4TessellatedSolid * create_tessellated_solid(rust::Vec<float> facets);
+void drop_tessellated_solid(G4TessellatedSolid * solid);
 
 void get_facets(
     const TessellatedSolidHandle & solid,
@@ -132,6 +147,18 @@ G4Material * get_material(const rust::String & name);
 Mixture describe_material(rust::Str);
 
 
+// ============================================================================
+//
+// Memory interface.
+//
+// ============================================================================
+
+void geometries_memory(rust::Vec<MemoryUsage> &);
+std::array<std::size_t, 2> materials_memory();
+std::size_t physics_memory();
+std::size_t tessellated_solid_memory(const TessellatedSolidHandle &);
+
+
 // ============================================================================
 //
 // Simulation interface.
@@ -142,6 +169,12 @@ extern RunAgent * RUN_AGENT;
 
 void drop_simulation();
 std::shared_ptr<Error> run_simulation(RunAgent &, RandomContext &, bool);
+std::shared_ptr<Error> run_adjoint(
+    RunAgent &,
+    RandomContext &,
+    const AdjointSource &,
+    bool
+);
 
 
 // ============================================================================
@@ -173,6 +206,28 @@ rust::Str as_str(const G4String &);
 std::array<double, 3> to_vec(const G4ThreeVector &);
 
 
+// ============================================================================
+//
+// Tracing interface.
+//
+// ============================================================================
+
+// Scoped timer, recorded as a trace event if CALZONE_TRACE is set (see
+// src/utils/trace.rs).
+struct TraceScope {
+    TraceScope(const char * name_): name(name_), start(trace_now()) {}
+    ~TraceScope() {
+        if (this->start >= 0.0) trace_event(this->name, this->start);
+    }
+
+    TraceScope(const TraceScope &) = delete; // Forbid copy.
+
+private:
+    const char * name;
+    double start;
+};
+
+
 // ============================================================================
 //
 // OS utilities.
@@ -4,6 +4,7 @@ use crate::geometry::volume::Volume;
 use crate::geometry::mesh::{collect_meshes, MeshHandle, TessellatedSolidHandle};
 use crate::simulation::{RandomContext, RunAgent};
 use crate::utils::error::ctrlc_catched;
+use crate::utils::trace::{trace_event, trace_now};
 
 
 #[cxx::bridge]
@@ -63,6 +64,15 @@ pub mod ffi {
         padding: [f64; 6],
     }
 
+    #[derive(Deserialize, Serialize)]
+    struct DensityMap {
+        shape: [usize; 3],
+        values: Vec<f64>,
+        gradient: f64,
+        bins: usize,
+        layered: bool,
+    }
+
     struct DaughterInfo {
         path: String,
         solid: String,
@@ -93,6 +103,20 @@ pub mod ffi {
         Voxels,
     }
 
+    #[derive(Clone, Copy)]
+    struct TraceSegment {
+        ray: usize,
+        volume: usize,
+        distance: f64,
+        length: f64,
+    }
+
+    struct TraceVolume {
+        path: String,
+        material: String,
+        density: f64,
+    }
+
     struct VolumeInfo { // From Geant4.
         path: String,
         material: String,
@@ -195,6 +219,17 @@ pub mod ffi {
         weight: u32,
     }
 
+    // ===========================================================================================
+    //
+    // Memory interface.
+    //
+    // ===========================================================================================
+
+    struct MemoryUsage {
+        name: String,
+        bytes: usize,
+    }
+
     // ===========================================================================================
     //
     // Physics interface.
@@ -227,11 +262,36 @@ pub mod ffi {
 
     #[derive(Clone, Copy)]
     struct Physics {
+        adjoint: bool,
         default_cut: f64,
         em_model: EmPhysicsModel,
+        fast: bool,
         had_model: HadPhysicsModel,
     }
 
+    #[derive(Clone)]
+    struct BiasingRule {
+        particle: String,
+        process: String,
+        factor: f64,
+        volume: String,
+    }
+
+    #[derive(Clone)]
+    struct FastModel {
+        volume: String,
+        table: FastTable,
+    }
+
+    #[derive(Clone)]
+    struct FastTable {
+        energy_min: f64,
+        energy_max: f64,
+        depth_max: f64,
+        shape: [usize; 2],
+        values: Vec<f64>,
+    }
+
     // ===========================================================================================
     //
     // Sampler interface.
@@ -246,6 +306,7 @@ pub mod ffi {
         Catch,
         Kill,
         Record,
+        Tally,
     }
 
     #[derive(Clone, Copy, Deserialize, Serialize)]
@@ -253,6 +314,14 @@ pub mod ffi {
         ingoing: Action,
         outgoing: Action,
         deposits: Action,
+        ingoing_filter: ParticleFilter,
+        outgoing_filter: ParticleFilter,
+    }
+
+    #[derive(Clone, Copy, Deserialize, PartialEq, Serialize)]
+    struct ParticleFilter {
+        pids: [i32; 8],
+        energy: [f64; 2],
     }
 
     #[derive(Clone, Copy)]
@@ -264,6 +333,14 @@ pub mod ffi {
         tid: i32,
     }
 
+    #[derive(Clone)]
+    struct ScoringMesh {
+        frame: String,
+        lower: [f64; 3],
+        upper: [f64; 3],
+        shape: [usize; 3],
+    }
+
     // ===========================================================================================
     //
     // Source interface.
@@ -278,6 +355,13 @@ pub mod ffi {
         direction: [f64; 3],
     }
 
+    struct AdjointSource {
+        detector: String,
+        source: String,
+        energy_min: f64,
+        energy_max: f64,
+    }
+
     // ===========================================================================================
     //
     // Tracker interface.
@@ -344,6 +428,14 @@ pub mod ffi {
         fn check(self: &GeometryBorrow, resolution: i32) -> SharedPtr<Error>;
         fn find_volume(self: &GeometryBorrow, stem: &str) -> SharedPtr<VolumeBorrow>;
         fn export_data(self: &GeometryBorrow);
+        fn has_tallies(self: &GeometryBorrow) -> bool;
+        fn trace(
+            self: &GeometryBorrow,
+            positions: &[f64],
+            directions: &[f64],
+            segments: &mut Vec<TraceSegment>,
+            volumes: &mut Vec<TraceVolume>,
+        ) -> SharedPtr<Error>;
 
         type VolumeBorrow;
         fn compute_box(self: &VolumeBorrow, frame: &str) -> [f64; 6];
@@ -359,6 +451,12 @@ pub mod ffi {
         fn describe_tessellated_solid(self: &VolumeBorrow) -> &Box<TessellatedSolidHandle>;
         fn describe_transform(self: &VolumeBorrow) -> TransformInfo;
         fn describe_tubs(self: &VolumeBorrow) -> TubsInfo;
+        fn distance_to_in(
+            self: &VolumeBorrow,
+            point: &[f64; 3],
+            direction: &[f64; 3],
+            transform: &G4AffineTransform,
+        ) -> f64;
         fn eq(self: &VolumeBorrow, other: &VolumeBorrow) -> bool;
         fn generate_onto(
             self: &VolumeBorrow,
@@ -380,10 +478,11 @@ pub mod ffi {
 
         fn clear_roles(self: &VolumeBorrow);
         fn get_roles(self: &VolumeBorrow) -> Roles;
-        fn set_roles(self: &VolumeBorrow, roles: Roles);
+        fn set_roles(self: &VolumeBorrow, roles: Roles) -> SharedPtr<Error>;
 
         type G4TessellatedSolid;
         fn create_tessellated_solid(facets: Vec<f32>) -> *mut G4TessellatedSolid;
+        unsafe fn drop_tessellated_solid(solid: *mut G4TessellatedSolid);
         fn get_facets(solid: &TessellatedSolidHandle, data: &mut Vec<f32>);
 
         // Material interface.
@@ -393,6 +492,12 @@ pub mod ffi {
         fn add_molecule(element: &Molecule) -> SharedPtr<Error>;
         fn describe_material(name: &str) -> Mixture;
 
+        // Memory interface.
+        fn geometries_memory(usage: &mut Vec<MemoryUsage>);
+        fn materials_memory() -> [usize; 2];
+        fn physics_memory() -> usize;
+        fn tessellated_solid_memory(solid: &TessellatedSolidHandle) -> usize;
+
         // Simulation interface.
         fn drop_simulation();
         fn run_simulation(
@@ -400,6 +505,12 @@ pub mod ffi {
             random: &mut RandomContext,
             verbose: bool
         ) -> SharedPtr<Error>;
+        fn run_adjoint(
+            agent: &mut RunAgent,
+            random: &mut RandomContext,
+            source: &AdjointSource,
+            verbose: bool
+        ) -> SharedPtr<Error>;
 
         type G4VPhysicalVolume;
         fn GetName(self: &G4VPhysicalVolume) -> &G4String;
@@ -439,9 +550,11 @@ pub mod ffi {
 
         fn box_shape(self: &Volume) -> &BoxShape;
         fn cylinder_shape(self: &Volume) -> &CylinderShape;
+        fn density_map(self: &Volume) -> &DensityMap;
         fn envelope_shape(self: &Volume) -> &EnvelopeShape;
         fn get_mesh(self: &Volume) -> Box<MeshHandle>;
         fn get_tessellated_solid(self: &Volume) -> Box<TessellatedSolidHandle>;
+        fn has_density_map(self: &Volume) -> bool;
         fn is_rotated(self: &Volume) -> bool;
         fn is_translated(self: &Volume) -> bool;
         fn material(self: &Volume) -> &String;
@@ -487,15 +600,23 @@ pub mod ffi {
         // Simulation interface.
         type RunAgent<'a>;
 
+        unsafe fn biasing<'b>(self: &'b RunAgent) -> &'b [BiasingRule];
         fn events(self: &RunAgent) -> usize;
+        unsafe fn fast_models<'b>(self: &'b RunAgent) -> &'b [FastModel];
         unsafe fn geometry<'b>(self: &'b RunAgent) -> &'b GeometryBorrow;
+        fn is_aborted(self: &RunAgent) -> bool;
+        fn is_adjoint(self: &RunAgent) -> bool;
         fn is_deposits(self: &RunAgent) -> bool;
         fn is_particles(self: &RunAgent) -> bool;
         fn is_random_indices(self: &RunAgent) -> bool;
+        fn is_scoring(self: &RunAgent) -> bool;
         fn is_secondaries(self: &RunAgent) -> bool;
         fn is_tracker(self: &RunAgent) -> bool;
         fn next_random_index(self: &RunAgent) -> [u64; 2];
-        unsafe fn next_primary(self: &mut RunAgent, random_index: &[u64; 2]) -> Particle;
+        unsafe fn next_primaries<'b>(
+            self: &'b mut RunAgent,
+            random_index: &[u64; 2],
+        ) -> &'b [Particle];
         unsafe fn physics<'b>(self: &'b RunAgent) -> &'b Physics;
         unsafe fn push_deposit(
             self: &mut RunAgent,
@@ -507,15 +628,40 @@ pub mod ffi {
             point_deposit: f64,
             start: &G4ThreeVector,
             end: &G4ThreeVector,
+            weight: f64,
         );
         unsafe fn push_particle(
             self: &mut RunAgent,
             volume: *const G4VPhysicalVolume,
             tid: i32,
             mut particle: Particle,
+            weight: f64,
+        );
+        fn push_adjoint(
+            self: &mut RunAgent,
+            random_index: &[u64; 2],
+            mut primary: Particle,
+            weight: f64,
+        );
+        fn push_adjoint_particle(self: &mut RunAgent, mut particle: Particle, weight: f64);
+        fn push_score(
+            self: &mut RunAgent,
+            mesh: usize,
+            voxel: usize,
+            deposit: f64,
+            length: f64,
+        );
+        unsafe fn push_tally(
+            self: &mut RunAgent,
+            volume: *const G4VPhysicalVolume,
+            pid: i32,
+            energy: f64,
+            cos_theta: f64,
+            weight: f64,
         );
         fn push_track(self: &mut RunAgent, mut track: Track);
         fn push_vertex(self: &mut RunAgent, mut vertex: Vertex);
+        unsafe fn scoring_meshes<'b>(self: &'b RunAgent) -> &'b [ScoringMesh];
 
         // Random interface.
         type RandomContext<'a>;
@@ -524,5 +670,9 @@ pub mod ffi {
         fn next_open01(self: &mut RandomContext) -> f64;
         fn prng_name(self: &RandomContext) -> &'static str;
         fn set_index(self: &mut RandomContext, index: [u64; 2]);
+
+        // Tracing interface.
+        fn trace_event(name: &str, start: f64);
+        fn trace_now() -> f64;
     }
 }
@@ -3,11 +3,16 @@
 #include "geometry/mesh.h"
 #include "simulation/sampler.h"
 // standard library.
+#include <limits>
 #include <list>
+#include <mutex>
 // fmt library.
 #include <fmt/core.h>
 // Geant4 interface.
+#include "G4Navigator.hh"
 #include "G4NistManager.hh"
+#include "G4PhantomParameterisation.hh"
+#include "G4PVParameterised.hh"
 #include "G4PVPlacement.hh"
 #include "G4SmartVoxelHeader.hh"
 #include "G4TriangularFacet.hh"
@@ -36,7 +41,9 @@ struct GeometryData {
 
     GeometryData * clone();
     void drop();
+    std::size_t memory() const;
 
+    static void export_memory(rust::Vec<MemoryUsage> &);
     static GeometryData * get(const G4VPhysicalVolume *);
 
     std::uint64_t id = 0;
@@ -212,6 +219,10 @@ G4TessellatedSolid * create_tessellated_solid(rust::Vec<float> facets) {
     return solid;
 }
 
+void drop_tessellated_solid(G4TessellatedSolid * solid) {
+    delete solid;
+}
+
 void get_facets(
     const TessellatedSolidHandle & handle,
     rust::Vec<float> & data
@@ -230,6 +241,10 @@ void get_facets(
     }
 }
 
+std::size_t tessellated_solid_memory(const TessellatedSolidHandle & handle) {
+    return (std::size_t)handle.ptr()->AllocatedMemory();
+}
+
 static G4VSolid * build_mesh(
     const std::string & pathname,
     const Volume & volume
@@ -445,9 +460,160 @@ static void drop_them_all(const G4VPhysicalVolume * volume) {
     // Delete any sub-volume(s).
     auto && logical = volume->GetLogicalVolume();
     drop_them_all(logical);
+    if (volume->IsParameterised()) {
+        delete volume->GetParameterisation();
+    }
     delete volume;
 }
 
+
+// ============================================================================
+//
+// Density maps.
+//
+// A density map is implemented as a regular (phantom) parameterisation filling
+// the container box. In order to limit the number of materials, voxels are
+// bucketed by density bin, with the bin mean density.
+//
+// ============================================================================
+
+struct DensityMapImpl : public G4PhantomParameterisation {
+    std::vector<std::size_t> indices;
+};
+
+static G4Material * get_scaled_material(G4Material * base, double density) {
+    auto name = fmt::format(
+        "{}@{:.6g}",
+        std::string(base->GetName()),
+        density / (CLHEP::g / CLHEP::cm3)
+    );
+    auto material = G4Material::GetMaterial(name, false);
+    if (material == nullptr) {
+        material = new G4Material(
+            name,
+            density,
+            base,
+            base->GetState(),
+            base->GetTemperature(),
+            base->GetPressure()
+        );
+    }
+    return material;
+}
+
+static G4VPhysicalVolume * build_density_map(
+    const std::string & pathname,
+    const DensityMap & map,
+    G4LogicalVolume * container
+) {
+    auto box = dynamic_cast<G4Box *>(container->GetSolid());
+    if (box == nullptr) {
+        auto msg = fmt::format(
+            "bad '{}' volume (expected an undisplaced box for density map)",
+            pathname
+        );
+        set_error(ErrorType::ValueError, msg.c_str());
+        return nullptr;
+    }
+
+    // Compute voxels densities (using Geant4 ordering).
+    const std::size_t nx = map.shape[0];
+    const std::size_t ny = map.shape[1];
+    const std::size_t nz = map.shape[2];
+    const std::size_t n = nx * ny * nz;
+    const double hx = box->GetXHalfLength() / nx;
+    const double hy = box->GetYHalfLength() / ny;
+    const double hz = box->GetZHalfLength() / nz;
+
+    std::vector<double> densities(n);
+    double rho_min = DBL_MAX;
+    double rho_max = -DBL_MAX;
+    for (std::size_t ix = 0; ix < nx; ix++) {
+        for (std::size_t iy = 0; iy < ny; iy++) {
+            for (std::size_t iz = 0; iz < nz; iz++) {
+                double rho;
+                if (map.layered) {
+                    const double depth = (nz - iz - 0.5) * 2.0 * hz / CLHEP::cm;
+                    rho = map.values[ix * ny + iy] + map.gradient * depth;
+                } else {
+                    rho = map.values[(ix * ny + iy) * nz + iz];
+                }
+                if (!(rho > 0.0)) {
+                    auto msg = fmt::format(
+                        "bad '{}' volume (expected strictly positive "
+                        "densities, found {} g/cm3)",
+                        pathname,
+                        rho
+                    );
+                    set_error(ErrorType::ValueError, msg.c_str());
+                    return nullptr;
+                }
+                densities[ix + nx * (iy + ny * iz)] = rho;
+                if (rho < rho_min) rho_min = rho;
+                if (rho > rho_max) rho_max = rho;
+            }
+        }
+    }
+
+    // Bucket densities.
+    const std::size_t bins = std::max<std::size_t>(map.bins, 1);
+    const double width = (rho_max - rho_min) / bins;
+    std::vector<double> sums(bins, 0.0);
+    std::vector<std::size_t> counts(bins, 0);
+    auto parameterisation = new DensityMapImpl();
+    auto && indices = parameterisation->indices;
+    indices.resize(n);
+    for (std::size_t i = 0; i < n; i++) {
+        std::size_t bin = 0;
+        if (width > 0.0) {
+            bin = std::min(
+                (std::size_t)((densities[i] - rho_min) / width),
+                bins - 1
+            );
+        }
+        indices[i] = bin;
+        sums[bin] += densities[i];
+        counts[bin]++;
+    }
+
+    // Build materials (for non-empty bins only).
+    auto base = container->GetMaterial();
+    std::vector<G4Material *> materials;
+    std::vector<std::size_t> mapping(bins, 0);
+    for (std::size_t bin = 0; bin < bins; bin++) {
+        if (counts[bin] == 0) continue;
+        mapping[bin] = materials.size();
+        const double rho = sums[bin] / counts[bin];
+        materials.push_back(get_scaled_material(
+            base, rho * (CLHEP::g / CLHEP::cm3)
+        ));
+    }
+    for (auto && index: indices) {
+        index = mapping[index];
+    }
+
+    // Build the parameterised volume.
+    parameterisation->SetVoxelDimensions(hx, hy, hz);
+    parameterisation->SetNoVoxels(nx, ny, nz);
+    parameterisation->SetMaterials(materials);
+    parameterisation->SetMaterialIndices(indices.data());
+    parameterisation->BuildContainerSolid(box);
+    parameterisation->SetSkipEqualMaterials(true);
+
+    auto voxel = new Box(pathname, hx, hy, hz);
+    auto logical = new G4LogicalVolume(voxel, materials[0], pathname);
+    auto physical = new G4PVParameterised(
+        pathname,
+        logical,
+        container,
+        kUndefined,
+        (G4int)n,
+        parameterisation
+    );
+    physical->SetRegularStructureId(1);
+    return physical;
+}
+
 static G4LogicalVolume * build_volumes(
     const Volume & volume,
     const std::string & path,
@@ -496,6 +662,19 @@ static G4LogicalVolume * build_volumes(
         logical->SetSensitiveDetector(sampler);
     }
 
+    // Build any density map.
+    if (volume.has_density_map()) {
+        auto voxels = build_density_map(
+            pathname,
+            volume.density_map(),
+            logical
+        );
+        if (voxels == nullptr) {
+            drop_them_all(logical);
+            return nullptr;
+        }
+    }
+
     // Build sub-volumes.
     for (auto && v: volume.volumes()) {
         auto l = build_volumes(v, pathname, solids);
@@ -544,6 +723,7 @@ static void map_volumes(
     int n = logical->GetNoDaughters();
     for (int i = 0; i < n; i++) {
         auto daughter = logical->GetDaughter(i);
+        if (daughter->IsParameterised()) continue; // Density map voxels.
         elements[daughter->GetName()] = daughter;
         mothers[daughter] = self;
         map_volumes(daughter, elements, mothers);
@@ -551,6 +731,7 @@ static void map_volumes(
 }
 
 GeometryData::GeometryData(const rust::Box<Volume> & volume) {
+    TraceScope trace("GeometryData");
     clear_error();
     this->id = ++GeometryData::LAST_ID;
     this->world = nullptr;
@@ -665,6 +846,81 @@ GeometryData * GeometryData::get(const G4VPhysicalVolume * volume) {
     return GeometryData::INSTANCES[volume];
 }
 
+// Memory is accounted for explicitly, from allocated Geant4 objects and
+// lookup tables. Note that the data of meshes are accounted for by the Rust
+// registries, since they might be shared between geometries.
+
+static std::size_t solid_memory(const G4VSolid * solid) {
+    if (solid == nullptr) {
+        return 0;
+    } else if (dynamic_cast<const Box *>(solid) != nullptr) {
+        return sizeof(Box);
+    } else if (dynamic_cast<const DisplacedSolid *>(solid) != nullptr) {
+        return sizeof(DisplacedSolid);
+    } else if (dynamic_cast<const Mesh *>(solid) != nullptr) {
+        return sizeof(Mesh);
+    } else if (dynamic_cast<const Orb *>(solid) != nullptr) {
+        return sizeof(Orb);
+    } else if (dynamic_cast<const Sphere *>(solid) != nullptr) {
+        return sizeof(Sphere);
+    } else if (dynamic_cast<const SubtractionSolid *>(solid) != nullptr) {
+        return sizeof(SubtractionSolid);
+    } else if (dynamic_cast<const TessellatedSolid *>(solid) != nullptr) {
+        return sizeof(TessellatedSolid);
+    } else if (dynamic_cast<const Tubs *>(solid) != nullptr) {
+        return sizeof(Tubs);
+    } else {
+        return sizeof(G4VSolid);
+    }
+}
+
+std::size_t GeometryData::memory() const {
+    constexpr std::size_t NODE_SIZE = 4 * sizeof(void *); // std containers.
+    std::size_t size = sizeof(GeometryData);
+    for (auto && [path, volume]: this->elements) {
+        size += NODE_SIZE + sizeof(path) + path.capacity() + sizeof(volume);
+        auto logical = volume->GetLogicalVolume();
+        size += sizeof(G4PVPlacement) + sizeof(G4LogicalVolume);
+        size += solid_memory(logical->GetSolid());
+
+        // Density maps are not mapped as elements, but as parameterised
+        // daughters of their container.
+        const int n = logical->GetNoDaughters();
+        for (int i = 0; i < n; i++) {
+            auto daughter = logical->GetDaughter(i);
+            if (!daughter->IsParameterised()) continue;
+            auto map = dynamic_cast<const DensityMapImpl *>(
+                daughter->GetParameterisation()
+            );
+            if (map != nullptr) {
+                size += sizeof(G4PVParameterised) + sizeof(G4LogicalVolume);
+                size += solid_memory(daughter->GetLogicalVolume()->GetSolid());
+                size += sizeof(DensityMapImpl) +
+                    map->indices.capacity() * sizeof(std::size_t);
+            }
+        }
+    }
+    size += this->mothers.size() * (NODE_SIZE + 2 * sizeof(void *));
+    for (auto solid: this->orphans) {
+        size += NODE_SIZE + solid_memory(solid);
+    }
+    return size;
+}
+
+void GeometryData::export_memory(rust::Vec<MemoryUsage> & usage) {
+    for (auto && [world, data]: GeometryData::INSTANCES) {
+        if ((world == nullptr) || (data == nullptr)) continue;
+        MemoryUsage item;
+        item.name = rust::String(std::string(world->GetName()));
+        item.bytes = data->memory();
+        usage.push_back(std::move(item));
+    }
+}
+
+void geometries_memory(rust::Vec<MemoryUsage> & usage) {
+    GeometryData::export_memory(usage);
+}
+
 
 // ============================================================================
 //
@@ -747,6 +1003,7 @@ std::shared_ptr<VolumeBorrow> GeometryBorrow::find_volume(
         std::uint64_t n = logical->GetNoDaughters();
         for (std::uint64_t i = 0; i < n; i++) {
             auto && daughter = logical->GetDaughter(i);
+            if (daughter->IsParameterised()) continue;
             auto result = inspect(daughter);
             if (result != nullptr) {
                 return result;
@@ -780,6 +1037,7 @@ static void check_overlaps(G4VPhysicalVolume * volume, int resolution) {
     int n = logical->GetNoDaughters();
     for (int i = 0; i < n; i++) {
         auto daughter = logical->GetDaughter(i);
+        if (daughter->IsParameterised()) continue;
         check_overlaps(daughter, resolution);
         if (any_error()) return;
     }
@@ -820,7 +1078,8 @@ static void optimise(G4VPhysicalVolume * physical) {
     auto && head = volume->GetVoxelHeader();
     if (head == nullptr) {
         if ((volume->IsToOptimise() && (n >= MIN_VOXEL_VOLUMES_LEVEL_1)) ||
-            ((n == 1) && (volume->GetDaughter(0)->IsReplicated()))) {
+            ((n == 1) && (volume->GetDaughter(0)->IsReplicated()) &&
+             (volume->GetDaughter(0)->GetRegularStructureId() != 1))) {
             auto && head = new G4SmartVoxelHeader(volume);
             volume->SetVoxelHeader(head);
         }
@@ -854,6 +1113,128 @@ void G4Mulder::DropGeometry(const G4VPhysicalVolume * volume) {
 }
 
 
+// ============================================================================
+//
+// Navigation interface.
+//
+// Rays are traced with a navigator that is reused across calls. Note that
+// tracing holds the GIL, since the navigator and the error state are global.
+//
+// ============================================================================
+
+static G4Navigator * get_navigator(const GeometryData * geometry) {
+    static std::unique_ptr<G4Navigator> navigator = nullptr;
+    static std::uint64_t geometry_id = 0;
+    if (navigator == nullptr) {
+        navigator = std::make_unique<G4Navigator>();
+    }
+    if (geometry_id != geometry->id) {
+        navigator->SetWorldVolume(geometry->world);
+        geometry_id = geometry->id;
+    }
+    return navigator.get();
+}
+
+std::shared_ptr<Error> GeometryBorrow::trace(
+    rust::Slice<const double> positions,
+    rust::Slice<const double> directions,
+    rust::Vec<TraceSegment> & segments,
+    rust::Vec<TraceVolume> & volumes
+) const {
+    clear_error();
+
+    {
+        // Voxelise the geometry, if not already done.
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+        optimise(this->data->world);
+    }
+
+    auto navigator = get_navigator(this->data);
+    auto world = this->data->world->GetLogicalVolume()->GetSolid();
+
+    using Key = std::pair<const G4VPhysicalVolume *, const G4Material *>;
+    std::map<Key, std::size_t> indices;
+    auto get_index = [&](G4VPhysicalVolume * volume) -> std::size_t {
+        const G4Material * material;
+        if (volume->IsParameterised()) {
+            // Density map voxel.
+            material = volume->GetParameterisation()->ComputeMaterial(
+                volume->GetCopyNo(), volume
+            );
+        } else {
+            material = volume->GetLogicalVolume()->GetMaterial();
+        }
+        auto key = std::make_pair(volume, material);
+        auto i = indices.find(key);
+        if (i != indices.end()) {
+            return i->second;
+        }
+        TraceVolume info = {
+            rust::String(volume->GetName()),
+            rust::String(material->GetName()),
+            material->GetDensity() / (CLHEP::g / CLHEP::cm3)
+        };
+        const std::size_t index = volumes.size();
+        volumes.push_back(std::move(info));
+        indices[key] = index;
+        return index;
+    };
+
+    const std::size_t n = positions.size() / 3;
+    for (std::size_t i = 0; i < n; i++) {
+        auto r = G4ThreeVector(
+            positions[3 * i + 0] * CLHEP::cm,
+            positions[3 * i + 1] * CLHEP::cm,
+            positions[3 * i + 2] * CLHEP::cm
+        );
+        auto u = G4ThreeVector(
+            directions[3 * i + 0],
+            directions[3 * i + 1],
+            directions[3 * i + 2]
+        ).unit();
+
+        // Move to the world volume, if starting from outside.
+        double distance = 0.0;
+        if (world->Inside(r) == EInside::kOutside) {
+            distance = world->DistanceToIn(r, u);
+            if (distance == kInfinity) continue;
+            r += distance * u;
+        }
+
+        // Step through volumes.
+        navigator->ResetStackAndState();
+        auto volume = navigator->LocateGlobalPointAndSetup(
+            r, &u, false, false
+        );
+        while (volume != nullptr) {
+            double safety;
+            const double step = navigator->ComputeStep(
+                r, u, kInfinity, safety
+            );
+            if (step == kInfinity) break;
+            if (step > 0.0) {
+                TraceSegment segment = {
+                    i,
+                    get_index(volume),
+                    distance / CLHEP::cm,
+                    step / CLHEP::cm
+                };
+                segments.push_back(std::move(segment));
+                r += step * u;
+                distance += step;
+            }
+            navigator->SetGeometricallyLimitedStep();
+            volume = navigator->LocateGlobalPointAndSetup(
+                r, &u, true, false
+            );
+        }
+    }
+
+    return get_error();
+}
+
+
 // ============================================================================
 //
 // Volume interface.
@@ -968,6 +1349,7 @@ double VolumeBorrow::compute_volume(bool include_daughters) const {
         std::uint64_t n = logical->GetNoDaughters();
         for (std::uint64_t i = 0; i < n; i++) {
             auto && daughter = logical->GetDaughter(i);
+            if (daughter->IsParameterised()) continue;
             volume -= daughter
                 -> GetLogicalVolume()
                 -> GetSolid()
@@ -1023,6 +1405,7 @@ VolumeInfo VolumeBorrow::describe() const {
     int n = logical->GetNoDaughters();
     for (int i = 0; i < n; i++) {
         auto daughter = logical->GetDaughter(i);
+        if (daughter->IsParameterised()) continue;
         info.daughters.push_back({
             std::move(std::string(daughter->GetName())),
             std::move(std::string(
@@ -1137,6 +1520,33 @@ TubsInfo VolumeBorrow::describe_tubs() const {
     };
 }
 
+double VolumeBorrow::distance_to_in(
+    const std::array<double, 3> & point_,
+    const std::array<double, 3> & direction_,
+    const G4AffineTransform & transform
+) const {
+    G4ThreeVector point(
+        point_[0] * CLHEP::cm,
+        point_[1] * CLHEP::cm,
+        point_[2] * CLHEP::cm
+    );
+    G4ThreeVector direction(direction_[0], direction_[1], direction_[2]);
+    if (transform.IsTranslated() || transform.IsRotated()) {
+        point = transform.InverseTransformPoint(point);
+        direction = transform.InverseTransformAxis(direction);
+    }
+    auto && solid = this->volume->GetLogicalVolume()->GetSolid();
+    if (solid->Inside(point) != EInside::kOutside) {
+        return 0.0;
+    }
+    auto distance = solid->DistanceToIn(point, direction);
+    if (distance == kInfinity) {
+        return std::numeric_limits<double>::infinity();
+    } else {
+        return distance / CLHEP::cm;
+    }
+}
+
 bool VolumeBorrow::eq(const VolumeBorrow & other) const {
     return this->volume == other.volume;
 }
@@ -1190,6 +1600,7 @@ EInside VolumeBorrow::inside(
     std::uint64_t n = logical->GetNoDaughters();
     for (std::uint64_t i = 0; i < n; i++) {
         auto && daughter = logical->GetDaughter(i);
+        if (daughter->IsParameterised()) continue;
         auto && translation = daughter->GetTranslation();
         auto && rotation = daughter->GetRotation();
         G4AffineTransform t;
@@ -1254,6 +1665,20 @@ void VolumeBorrow::clear_roles() const {
     }
 }
 
+bool GeometryBorrow::has_tallies() const {
+    for (auto && [path, volume]: this->data->elements) {
+        auto sensitive = static_cast<SamplerImpl *>(
+            volume->GetLogicalVolume()->GetSensitiveDetector()
+        );
+        if ((sensitive != nullptr) &&
+            ((sensitive->roles.ingoing == Action::Tally) ||
+             (sensitive->roles.outgoing == Action::Tally))) {
+            return true;
+        }
+    }
+    return false;
+}
+
 Roles VolumeBorrow::get_roles() const {
     auto && logical = this->volume->GetLogicalVolume();
     auto sensitive = static_cast<SamplerImpl *>(
@@ -1262,14 +1687,27 @@ Roles VolumeBorrow::get_roles() const {
     if (sensitive == nullptr) {
         Roles roles;
         std::memset(&roles, 0x0, sizeof(Roles));
+        auto infinity = std::numeric_limits<double>::infinity();
+        roles.ingoing_filter.energy[1] = infinity;
+        roles.outgoing_filter.energy[1] = infinity;
         return roles;
     } else {
         return sensitive->roles;
     }
 }
 
-void VolumeBorrow::set_roles(Roles roles) const {
+std::shared_ptr<Error> VolumeBorrow::set_roles(Roles roles) const {
+    clear_error();
     auto && logical = this->volume->GetLogicalVolume();
+    if ((logical->GetNoDaughters() == 1) &&
+        logical->GetDaughter(0)->IsParameterised()) {
+        auto msg = fmt::format(
+            "bad '{}' volume (cannot assign roles to a density map)",
+            std::string(this->volume->GetName())
+        );
+        set_error(ErrorType::ValueError, msg.c_str());
+        return get_error();
+    }
     SamplerImpl * sensitive = static_cast<SamplerImpl *>(
         logical->GetSensitiveDetector()
     );
@@ -1279,4 +1717,5 @@ void VolumeBorrow::set_roles(Roles roles) const {
     } else {
         sensitive->roles = std::move(roles);
     }
+    return get_error();
 }
@@ -1,14 +1,17 @@
 #![allow(deprecated)]
 
 use crate::utils::extract::{Extractor, Rotation, Strings, Property, Tag, TryFromBound};
-use crate::utils::error::{Error, variant_error};
+use crate::utils::error::{Error, Failure, variant_error};
 use crate::utils::error::ErrorKind::{Exception, IndexError, NotImplementedError, TypeError,
     ValueError};
+use crate::utils::export::Export;
 use crate::utils::float::f64x3;
 use crate::utils::io::DictLike;
 use crate::utils::namespace::Namespace;
 use crate::utils::numpy::{PyArray, PyArrayMethods};
+use crate::utils::trace;
 use cxx::SharedPtr;
+use derive_more::{AsMut, AsRef, From};
 use enum_variants_strings::EnumVariantsStrings;
 use indexmap::IndexMap;
 use pyo3::prelude::*;
@@ -16,10 +19,12 @@ use pyo3::types::{PyBytes, PyDict, PyTuple};
 use rmp_serde::{Deserializer, Serializer};
 use serde::{Deserialize, Serialize};
 use super::cxx::ffi;
+use std::borrow::Cow;
 use std::collections::HashMap;
 use std::path::Path;
 
 mod bytes;
+mod density;
 mod goupil;
 mod map;
 mod mulder;
@@ -66,11 +71,13 @@ impl Geometry {
     /// The geometry root volume.
     #[getter]
     fn get_root(&self) -> PyResult<Volume> {
-        Volume::new(&self.0, "__root__", true)
+        let volume = Volume::new(&self.0, "__root__", true)?;
+        Ok(volume)
     }
 
     fn __getitem__(&self, path: &str) -> PyResult<Volume> {
-        Volume::new(&self.0, path, true)
+        let volume = Volume::new(&self.0, path, true)?;
+        Ok(volume)
     }
 
     /// Check the geometry by looking for overlapping volumes.
@@ -123,7 +130,101 @@ impl Geometry {
 
     /// Find a geometry volume matching the given stem.
     fn find(&self, stem: &str) -> PyResult<Volume> {
-        Volume::new(&self.0, stem, false)
+        let volume = Volume::new(&self.0, stem, false)?;
+        Ok(volume)
+    }
+
+    /// Trace straight rays through the geometry.
+    #[pyo3(signature=(positions, directions, /))]
+    fn trace<'py>(
+        &self,
+        py: Python<'py>,
+        positions: &PyArray<f64>,
+        directions: &PyArray<f64>,
+    ) -> PyResult<Bound<'py, PyAny>> {
+        let mut shape = positions.shape();
+        let dim = shape.pop().unwrap_or(0);
+        if dim != 3 {
+            let why = format!("expected 3-d positions, found {}-d values", dim);
+            let err = Error::new(TypeError).what("positions").why(&why);
+            return Err(err.to_err());
+        }
+        if directions.shape() != positions.shape() {
+            let why = format!(
+                "expected a {:?} array, found a {:?} array",
+                positions.shape(),
+                directions.shape(),
+            );
+            let err = Error::new(ValueError).what("directions").why(&why);
+            return Err(err.to_err());
+        }
+        let positions = contiguous(positions)?;
+        let directions = contiguous(directions)?;
+
+        // Trace rays (holding the GIL, since Geant4 navigation and errors are global).
+        let mut segments = Vec::<ffi::TraceSegment>::new();
+        let mut volumes = Vec::<ffi::TraceVolume>::new();
+        self.0.trace(&positions, &directions, &mut segments, &mut volumes)
+            .to_result()?;
+
+        // Integrate the grammage per material.
+        let n = positions.len() / 3;
+        let mut grammage = IndexMap::<&str, Vec<f64>>::new();
+        let materials: Vec<usize> = volumes
+            .iter()
+            .map(|volume| {
+                grammage
+                    .entry(volume.material.as_str())
+                    .or_insert_with(|| vec![0.0; n]);
+                grammage.get_index_of(volume.material.as_str()).unwrap()
+            })
+            .collect();
+        for segment in segments.iter() {
+            let density = volumes[segment.volume].density;
+            let column = &mut grammage[materials[segment.volume]];
+            column[segment.ray] += segment.length * density;
+        }
+        let grammage = {
+            let result = PyDict::new_bound(py);
+            for (material, values) in grammage.into_iter() {
+                let values: PyObject = if shape.len() == 0 {
+                    values[0].into_py(py)
+                } else {
+                    PyArray::<f64>::from_iter(py, &shape, values.into_iter())?
+                        .into_any()
+                        .unbind()
+                };
+                result.set_item(material, values)?;
+            }
+            result
+        };
+
+        let volumes: Vec<&str> = volumes
+            .iter()
+            .map(|volume| volume.path.as_str())
+            .collect();
+        let segments = Export::export::<TraceSegmentsExport>(py, segments)?;
+        Namespace::new(py, &[
+            ("segments", segments),
+            ("volumes", volumes.into_py(py)),
+            ("grammage", grammage.into_any().unbind()),
+        ])
+    }
+}
+
+#[derive(AsMut, AsRef, From)]
+#[pyclass(module="calzone")]
+struct TraceSegmentsExport (Export<ffi::TraceSegment>);
+
+fn contiguous<'a>(array: &'a PyArray<f64>) -> PyResult<Cow<'a, [f64]>> {
+    match unsafe { array.slice() } {
+        Ok(values) => Ok(Cow::Borrowed(values)),
+        Err(_) => {
+            let values = (0..array.size())
+                .map(|i| array.get(i))
+                .collect::<PyResult<Vec<f64>>>()?;
+            Ok(Cow::Owned(values))
+        },
     }
 }
 
@@ -166,28 +267,7 @@ impl GeometryBuilder {
 
     /// Build the Monte Carlo `Geometry`.
     fn build(&mut self, py: Python) -> PyResult<Geometry> {
-        // Validate volumes.
-        self.definition.volume.validate()?;
-
-        // Build meshes.
-        self.definition.volume.build_meshes(py, self.algorithm)?;
-
-        // Build materials.
-        self.definition.materials = MaterialsDefinition::drain(
-            self.definition.materials.take(),
-            &mut self.definition.volume,
-        );
-        if let Some(materials) = self.definition.materials.as_ref() {
-            materials.build()?;
-        }
-
-        // Build volumes.
-        let geometry = ffi::create_geometry(&self.definition.volume);
-        if geometry.is_null() {
-            ffi::get_error().to_result()?;
-            unreachable!()
-        }
-        let geometry = Geometry (geometry);
+        let geometry = self.build_with(Some(py))?;
         Ok(geometry)
     }
 
@@ -247,10 +327,12 @@ impl GeometryBuilder {
             volume.rotation = Some(rotation.into_mat());
         }
         if let Some(role) = role {
+            let filters = volume.roles;
             volume.roles = role.into_vec().as_slice().try_into()
                 .map_err(|why: String| {
                     Error::new(ValueError).what("role").why(&why).to_err()
                 })?;
+            volume.roles.copy_filters(&filters);
         }
         if let Some(shape) = shape {
             let tag = Tag::new("", "shape", None);
@@ -386,20 +468,56 @@ impl GeometryBuilder {
     }
 
     fn __setstate__(&mut self, state: &Bound<PyBytes>) -> PyResult<()> {
-        let mut deserializer = Deserializer::new(state.as_bytes());
-        *self = Deserialize::deserialize(&mut deserializer)
+        *self = Self::from_bytes(state.as_bytes())?;
+        Ok(())
+    }
+}
+
+impl GeometryBuilder {
+    pub(crate) fn build_with(&mut self, py: Option<Python>) -> Result<Geometry, Failure> {
+        let _span = trace::span("GeometryBuilder::build");
+
+        // Validate volumes.
+        self.definition.volume.validate()?;
+
+        // Build meshes.
+        self.definition.volume.build_meshes(py, self.algorithm)?;
+
+        // Build materials.
+        self.definition.materials = MaterialsDefinition::drain(
+            self.definition.materials.take(),
+            &mut self.definition.volume,
+        );
+        if let Some(materials) = self.definition.materials.as_ref() {
+            let _span = trace::span("materials");
+            materials.build()?;
+        }
+
+        // Build volumes.
+        let geometry = {
+            let _span = trace::span("create_geometry");
+            ffi::create_geometry(&self.definition.volume)
+        };
+        if geometry.is_null() {
+            ffi::get_error().to_result()?;
+            unreachable!()
+        }
+        let geometry = Geometry (geometry);
+        Ok(geometry)
+    }
+
+    pub(crate) fn from_bytes(bytes: &[u8]) -> Result<Self, Failure> {
+        let mut deserializer = Deserializer::new(bytes);
+        Deserialize::deserialize(&mut deserializer)
             .map_err(|err| {
                 let why = format!("{}", err);
                 Error::new(Exception)
                     .what("serialisation")
                     .why(&why)
-                    .to_err()
-            })?;
-        Ok(())
+                    .to_failure()
+            })
     }
-}
 
-impl GeometryBuilder {
     fn contains(&self, path: &str) -> bool {
         let mut names = path.split(".");
         let volume = match names.next() {
@@ -573,6 +691,21 @@ impl Volume {
         PyTuple::new_bound(py, &self.daughters)
     }
 
+    /// Particles filter(s) conditioning the volume role(s), if any.
+    #[getter]
+    fn get_filter<'py>(&self, py: Python<'py>) -> PyResult<Option<Bound<'py, PyDict>>> {
+        self.volume.get_roles().filters_to_dict(py)
+    }
+
+    #[setter]
+    fn set_filter(&self, filter: Option<&Bound<PyAny>>) -> PyResult<()> {
+        let tag = Tag::new("", "filter", None);
+        let mut roles = self.volume.get_roles();
+        roles.set_filters(&tag, filter)?;
+        self.update_roles(roles)?;
+        Ok(())
+    }
+
     /// The volume name.
     #[getter]
     fn get_name<'py>(&self) -> &str {
@@ -612,15 +745,7 @@ impl Volume {
     #[setter]
     fn set_role(&self, role: Option<Strings>) -> PyResult<()> {
         let roles = role.map(|role| role.into_vec()).unwrap_or(Vec::new());
-        if roles.is_empty() {
-            self.volume.clear_roles()
-        } else {
-            let roles: ffi::Roles = roles.as_slice().try_into()
-                .map_err(|why: String| {
-                    Error::new(ValueError).what("role").why(&why).to_err()
-                })?;
-            self.volume.set_roles(roles)
-        };
+        self.set_roles(&roles)?;
         Ok(())
     }
 
@@ -936,14 +1061,14 @@ impl Volume {
         geometry: &SharedPtr<ffi::GeometryBorrow>,
         name: &str,
         exact: bool
-    ) -> PyResult<Self> {
+    ) -> Result<Self, Failure> {
         let volume = match exact {
             true => geometry.borrow_volume(name),
             false => geometry.find_volume(name),
         };
         if let Some(msg) = ffi::get_error().value() {
             let err = Error::new(IndexError).what("volume").why(msg);
-            return Err(err.into())
+            return Err(err.to_failure())
         }
         let ffi::VolumeInfo { path, material, solid, mother, mut daughters } =
             volume.describe();
@@ -993,6 +1118,25 @@ impl Volume {
         };
         Ok(volume)
     }
+
+    pub(crate) fn set_roles(&self, roles: &[String]) -> Result<(), Failure> {
+        let mut roles: ffi::Roles = roles.try_into()
+            .map_err(|why: String| {
+                Error::new(ValueError).what("role").why(&why).to_failure()
+            })?;
+        roles.copy_filters(&self.volume.get_roles());
+        self.update_roles(roles)
+    }
+
+    fn update_roles(&self, roles: ffi::Roles) -> Result<(), Failure> {
+        // A sampler is only attached if the volume has a role, or a particles filter.
+        if roles.any() || roles.is_filtered() {
+            self.volume.set_roles(roles).to_result()?
+        } else {
+            self.volume.clear_roles()
+        }
+        Ok(())
+    }
 }
 
 impl SolidProperties {
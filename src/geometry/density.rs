@@ -0,0 +1,123 @@
+use crate::utils::error::ErrorKind::{IOError, TypeError, ValueError};
+use crate::utils::extract::{Extractor, Property, Tag, TryFromBound};
+use crate::utils::numpy::{PyArray, PyArrayMethods};
+use pyo3::prelude::*;
+use pyo3::types::PyDict;
+use std::path::Path;
+use super::ffi;
+
+
+// ===============================================================================================
+//
+// Density map (of a box volume).
+//
+// The map is given as a 3D grid of densities (in g/cm3), or as a 2D (x, y) map of densities
+// at the top of the volume, supplemented by a linear depth law (in g/cm3/cm) over a number of
+// layers.
+//
+// ===============================================================================================
+
+impl ffi::DensityMap {
+    const DEFAULT_BINS: u32 = 100;
+    const DEFAULT_LAYERS: u32 = 1;
+}
+
+impl TryFromBound for ffi::DensityMap {
+    fn try_from_any<'py>(tag: &Tag, value: &Bound<'py, PyAny>) -> PyResult<Self> {
+        let tag = tag.cast("density_map");
+        let mut bins: u32 = Self::DEFAULT_BINS;
+        let mut gradient: Option<f64> = None;
+        let mut layers: Option<u32> = None;
+        let values = if value.is_instance_of::<PyDict>() {
+            const EXTRACTOR: Extractor<4> = Extractor::new([
+                Property::required_any("values"),
+                Property::new_u32("bins", ffi::DensityMap::DEFAULT_BINS),
+                Property::optional_f64("gradient"),
+                Property::optional_u32("layers"),
+            ]);
+
+            let [values, b, g, l] = EXTRACTOR.extract_any(&tag, value, None)?;
+            bins = b.into();
+            gradient = g.into();
+            layers = l.into();
+            values.into()
+        } else {
+            value.clone()
+        };
+        let (mut shape, values) = load_values(&tag, &values)?;
+        let layered = shape.len() == 2;
+
+        match shape.len() {
+            2 => {
+                let layers = layers.unwrap_or(Self::DEFAULT_LAYERS);
+                if layers == 0 {
+                    let why = "expected a strictly positive value".to_string();
+                    return Err(tag.bad().what("layers").why(why).to_err(ValueError));
+                }
+                shape.push(layers as usize);
+            },
+            3 => {
+                if gradient.is_some() || layers.is_some() {
+                    let why = "invalid option for a 3D map".to_string();
+                    let what = if gradient.is_some() { "gradient" } else { "layers" };
+                    return Err(tag.bad().what(what).why(why).to_err(ValueError));
+                }
+            },
+            n => {
+                let why = format!("expected a 2D or 3D array, found a {}D array", n);
+                return Err(tag.bad().what("values").why(why).to_err(ValueError));
+            },
+        }
+        if bins == 0 {
+            let why = "expected a strictly positive value".to_string();
+            return Err(tag.bad().what("bins").why(why).to_err(ValueError));
+        }
+        let size: usize = shape.iter().product();
+        if (size == 0) || (size > (i32::MAX as usize)) {
+            let why = format!("bad number of voxels ({})", size);
+            return Err(tag.bad().what("values").why(why).to_err(ValueError));
+        }
+        if let Some(value) = values.iter().find(|value| !(**value > 0.0)) {
+            let why = format!("expected strictly positive densities, found {}", value);
+            return Err(tag.bad().what("values").why(why).to_err(ValueError));
+        }
+
+        let map = Self {
+            shape: [shape[0], shape[1], shape[2]],
+            values,
+            gradient: gradient.unwrap_or(0.0),
+            bins: bins as usize,
+            layered,
+        };
+        Ok(map)
+    }
+}
+
+fn load_values<'py>(tag: &Tag, value: &Bound<'py, PyAny>) -> PyResult<(Vec<usize>, Vec<f64>)> {
+    let py = value.py();
+    let numpy = py.import_bound("numpy")?;
+    let array = match value.extract::<String>() {
+        Ok(path) => {
+            let path = match tag.file().and_then(Path::parent) {
+                Some(parent) => parent.join(path),
+                None => Path::new(&path).to_path_buf(),
+            };
+            numpy.getattr("load")
+                .and_then(|load| load.call1((path.as_path(),)))
+                .map_err(|err| {
+                    let why = format!("{}: {}", path.display(), err.value_bound(py));
+                    tag.bad().what("values").why(why).to_err(IOError)
+                })?
+        },
+        Err(_) => value.clone(),
+    };
+    let array: &PyArray<f64> = numpy.getattr("ascontiguousarray")
+        .and_then(|f| f.call1((array, "f8")))
+        .and_then(|array| array.extract())
+        .map_err(|err| {
+            let why = format!("{}", err.value_bound(py));
+            tag.bad().what("values").why(why).to_err(TypeError)
+        })?;
+    let values = unsafe { array.slice()? }.to_vec();
+    Ok((array.shape(), values))
+}
@@ -5,7 +5,11 @@
 #include <fmt/core.h>
 // Geant4 interface.
 #include "G4Element.hh"
+#include "G4IonisParamElm.hh"
+#include "G4IonisParamMat.hh"
+#include "G4Isotope.hh"
 #include "G4NistManager.hh"
+#include "G4SandiaTable.hh"
 #include "G4SystemOfUnits.hh"
 
 
@@ -251,3 +255,44 @@ Mixture describe_material(rust::Str name) {
     }
     return info;
 }
+
+
+// ============================================================================
+//
+// Memory interface.
+//
+// Sizes are estimated from the number of components of Geant4 objects, i.e.
+// internal caches are not accounted for.
+//
+// ============================================================================
+
+std::array<std::size_t, 2> materials_memory() {
+    std::size_t materials = 0;
+    for (auto material: *G4Material::GetMaterialTable()) {
+        if (material == nullptr) continue;
+        const std::size_t n = material->GetNumberOfElements();
+        materials += sizeof(G4Material) + material->GetName().capacity() +
+            n * (sizeof(G4Element *) + 3 * sizeof(double)) +
+            sizeof(G4IonisParamMat);
+        auto sandia = material->GetSandiaTable();
+        if (sandia != nullptr) {
+            materials += sizeof(G4SandiaTable) +
+                sandia->GetMatNbOfIntervals() * 5 * sizeof(double);
+        }
+    }
+
+    std::size_t elements = 0;
+    for (auto element: *G4Element::GetElementTable()) {
+        if (element == nullptr) continue;
+        const std::size_t n = element->GetNumberOfIsotopes();
+        elements += sizeof(G4Element) + element->GetName().capacity() +
+            n * (sizeof(G4Isotope *) + sizeof(double)) +
+            sizeof(G4IonisParamElm);
+    }
+    for (auto isotope: *G4Isotope::GetIsotopeTable()) {
+        if (isotope == nullptr) continue;
+        elements += sizeof(G4Isotope) + isotope->GetName().capacity();
+    }
+
+    return { materials, elements };
+}
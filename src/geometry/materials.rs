@@ -1,5 +1,5 @@
 use crate::utils::error::ErrorKind::ValueError;
-use crate::utils::error::{Error, variant_error};
+use crate::utils::error::{Error, Failure, variant_error};
 use crate::utils::extract::{Extractor, Property, Tag, TryFromBound};
 use crate::utils::io::DictLike;
 use crate::utils::namespace::Namespace;
@@ -32,7 +32,7 @@ pub struct MaterialsDefinition {
 }
 
 impl MaterialsDefinition {
-    pub fn build(&self) -> PyResult<()> {
+    pub fn build(&self) -> Result<(), Failure> {
         for element in &self.elements {
             ffi::add_element(&element)
                 .to_result()?;
@@ -74,7 +74,7 @@ impl MaterialsDefinition {
         }
     }
 
-    fn sorted_mixtures<'a>(&'a self) -> PyResult<Vec<&'a ffi::Mixture>> {
+    fn sorted_mixtures<'a>(&'a self) -> Result<Vec<&'a ffi::Mixture>, Failure> {
         if self.mixtures.len() <= 1 {
             let mixtures: Vec<_> = self.mixtures.iter().collect();
             return Ok(mixtures)
@@ -92,7 +92,7 @@ impl MaterialsDefinition {
             mixture: &ffi::Mixture,
             map: &'a HashMap<&str, &ffi::Mixture>,
             mut deps: Dependencies<'a>,
-        ) -> PyResult<Dependencies<'a>> {
+        ) -> Result<Dependencies<'a>, Failure> {
             for component in mixture.components.iter() {
                 if &component.name == root {
                     let why = format!(
@@ -103,7 +103,7 @@ impl MaterialsDefinition {
                     let err = Error::new(ValueError)
                         .what("mixture")
                         .why(&why);
-                    return Err(err.into())
+                    return Err(err.to_failure())
                 } else {
                     if let Some((name, mixture)) = map.get_key_value(component.name.as_str()) {
                         deps = find_deps(root, mixture, map, deps)?;
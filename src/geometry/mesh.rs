@@ -2,12 +2,13 @@ use bvh::aabb::{Aabb, Bounded};
 use bvh::bounding_hierarchy::BHShape;
 use bvh::bvh::{Bvh, BvhNode};
 use bvh::ray::Ray;
-use crate::utils::error::Error;
-use crate::utils::error::ErrorKind::{MemoryError, ValueError};
+use crate::utils::error::{Error, Failure};
+use crate::utils::error::ErrorKind::{MemoryError, NotImplementedError, ValueError};
 use crate::utils::extract::{Extractor, Tag, TryFromBound};
 use crate::utils::float::f64x3;
 use crate::utils::namespace::Namespace;
 use crate::utils::io::{DictLike, load_mesh};
+use crate::utils::trace;
 use enum_variants_strings::EnumVariantsStrings;
 use indexmap::IndexMap;
 use nalgebra::{Point3, Vector3};
@@ -17,7 +18,9 @@ use serde::{Deserialize, Serialize};
 use super::{ffi, map::Map, volume::MeshShape};
 use std::collections::HashMap;
 use std::path::PathBuf;
-use std::sync::{Arc, LazyLock, RwLock};
+use std::sync::{Arc, LazyLock, Mutex, RwLock};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Instant;
 use super::Algorithm;
 
 
@@ -27,21 +30,35 @@ use super::Algorithm;
 //
 // ===============================================================================================
 
-static MESHES: LazyLock<RwLock<HashMap<MeshDefinition, MeshHandle>>> =
+type Registry<T> = RwLock<HashMap<MeshDefinition, Cached<T>>>;
+
+static MESHES: LazyLock<Registry<MeshHandle>> =
     LazyLock::new(|| RwLock::new(HashMap::new()));
 
-static TESSELLATED_SOLIDS: LazyLock<RwLock<HashMap<MeshDefinition, TessellatedSolidHandle>>> =
+static TESSELLATED_SOLIDS: LazyLock<Registry<TessellatedSolidHandle>> =
     LazyLock::new(|| RwLock::new(HashMap::new()));
 
-pub fn collect_meshes() {
-    MESHES
-        .write()
-        .unwrap()
-        .retain(|_, v| Arc::strong_count(&v.facets) > 1);
-    TESSELLATED_SOLIDS
-        .write()
-        .unwrap()
-        .retain(|_, v| Arc::strong_count(&v.solid) > 1);
+// Memory usage of registries, per mesh path (including lookup tables).
+pub fn meshes_memory() -> Vec<(String, usize)> {
+    let registry = MESHES.read().unwrap();
+    let entry_size = size_of::<(MeshDefinition, Cached<MeshHandle>)>() + 1;
+    registry
+        .iter()
+        .map(|(definition, mesh)| {
+            (definition.path.display().to_string(), entry_size + mesh.size)
+        })
+        .collect()
+}
+
+pub fn tessellated_solids_memory() -> Vec<(String, usize)> {
+    let registry = TESSELLATED_SOLIDS.read().unwrap();
+    let entry_size = size_of::<(MeshDefinition, Cached<TessellatedSolidHandle>)>() + 1;
+    registry
+        .iter()
+        .map(|(definition, solid)| {
+            (definition.path.display().to_string(), entry_size + solid.size)
+        })
+        .collect()
 }
 
 #[derive(Clone, PartialEq, Eq, Hash, Deserialize, Serialize)]
@@ -64,23 +81,21 @@ impl MeshDefinition {
         Self { path, scale, map }
     }
 
-    pub fn build(
-        &self,
-        py: Python,
-        algorithm: Option<ffi::TSTAlgorithm>
-    ) -> PyResult<ffi::TSTAlgorithm> {
-        let algorithm = algorithm
+    pub fn algorithm(&self, algorithm: Option<ffi::TSTAlgorithm>) -> ffi::TSTAlgorithm {
+        algorithm
             .unwrap_or_else(|| if self.map.is_none() {
                 ffi::TSTAlgorithm::Voxels
             } else {
                 ffi::TSTAlgorithm::Bvh
-            });
+            })
+    }
+
+    fn is_built(&self, algorithm: ffi::TSTAlgorithm) -> bool {
         match algorithm {
-            ffi::TSTAlgorithm::Bvh => MeshHandle::build(py, self)?,
-            ffi::TSTAlgorithm::Voxels => TessellatedSolidHandle::build(py, self)?,
+            ffi::TSTAlgorithm::Bvh => MESHES.read().unwrap().contains_key(self),
+            ffi::TSTAlgorithm::Voxels => TESSELLATED_SOLIDS.read().unwrap().contains_key(self),
             _ => unreachable!(),
         }
-        Ok(algorithm)
     }
 
     pub fn get_mesh(&self) -> Box<MeshHandle> {
@@ -89,6 +104,7 @@ impl MeshDefinition {
             .unwrap()
             .get(self)
             .unwrap()
+            .get()
             .clone();
         Box::new(mesh)
     }
@@ -99,23 +115,31 @@ impl MeshDefinition {
             .unwrap()
             .get(self)
             .unwrap()
+            .get()
             .clone();
         Box::new(solid)
     }
 
-    fn load_facets(&self, py: Python) -> PyResult<Vec<f32>> {
-        let mut facets = match self.map.as_ref() {
-            Some(params) => {
-                let map = Map::from_file(py, self.path.as_path())?;
-                let origin = params.origin.map(|origin| {
-                    let origin: [f64; 3] = std::array::from_fn(|i| origin[i].into());
-                    (&origin).into()
-                });
-                let padding = params.padding.map(|padding| padding.into());
-                map.build_mesh(py, params.regular, origin, padding)?
-            },
-            None => load_mesh(self.path.as_path())
-                .map_err(|msg| Error::new(ValueError).why(&msg).to_err())?,
+    fn memory(&self) -> usize {
+        self.path.capacity()
+    }
+
+    fn load_map(&self, py: Python, params: &MapParameters) -> PyResult<Vec<f32>> {
+        let _span = trace::span_with("map load", || self.path.display().to_string());
+        let map = Map::from_file(py, self.path.as_path())?;
+        let origin = params.origin.map(|origin| {
+            let origin: [f64; 3] = std::array::from_fn(|i| origin[i].into());
+            (&origin).into()
+        });
+        let padding = params.padding.map(|padding| padding.into());
+        map.build_mesh(py, params.regular, origin, padding)
+    }
+
+    fn load_facets(&self, facets: Option<Vec<f32>>) -> Result<Vec<f32>, String> {
+        let _span = trace::span_with("mesh load", || self.path.display().to_string());
+        let mut facets = match facets {
+            Some(facets) => facets,
+            None => load_mesh(self.path.as_path())?,
         };
 
         let scale = f64::from(self.scale) as f32;
@@ -139,35 +163,345 @@ impl MapParameters {
     }
 }
 
-#[derive(Clone)]
-pub struct MeshHandle {
-    facets: Arc<SortedFacets>,
+
+// ===============================================================================================
+//
+// Meshes cache.
+//
+// Built meshes are kept in the registries once unreferenced, up to a budget (in MB, set by the
+// CALZONE_MESH_CACHE variable). When the budget is exceeded, unreferenced meshes are evicted in
+// least recently used order. Note that referenced meshes are never evicted.
+//
+// ===============================================================================================
+
+struct Cached<T> {
+    item: T,
+    size: usize,
+    last_used: AtomicU64,
 }
 
-impl MeshHandle {
-    fn build(
-        py: Python,
-        definition: &MeshDefinition,
-    ) -> PyResult<()> {
-        if !MESHES
-            .read()
-            .unwrap()
-            .contains_key(&definition) {
+struct CacheStats {
+    hits: usize,
+    misses: usize,
+    evictions: usize,
+    build_time: f64,
+}
+
+static CACHE_CLOCK: AtomicU64 = AtomicU64::new(0);
+
+static CACHE_STATS: Mutex<CacheStats> = Mutex::new(CacheStats {
+    hits: 0,
+    misses: 0,
+    evictions: 0,
+    build_time: 0.0,
+});
 
-            let facets = definition.load_facets(py)?;
-            let facets = Arc::new(SortedFacets::new(facets));
-            let mesh = Self { facets };
+impl<T> Cached<T> {
+    fn new(item: T, size: usize) -> Self {
+        let last_used = AtomicU64::new(CACHE_CLOCK.fetch_add(1, Ordering::Relaxed));
+        Self { item, size, last_used }
+    }
+
+    fn get(&self) -> &T {
+        self.last_used.store(CACHE_CLOCK.fetch_add(1, Ordering::Relaxed), Ordering::Relaxed);
+        &self.item
+    }
+
+    fn last_used(&self) -> u64 {
+        self.last_used.load(Ordering::Relaxed)
+    }
+}
 
-            MESHES
-                .write()
-                .unwrap()
-                .insert(definition.clone(), mesh);
+impl Cached<MeshHandle> {
+    fn references(&self) -> usize {
+        Arc::strong_count(&self.item.facets) - 1
+    }
+}
+
+impl Cached<TessellatedSolidHandle> {
+    fn references(&self) -> usize {
+        Arc::strong_count(&self.item.solid) - 1
+    }
+}
+
+fn cache_budget() -> usize {
+    const DEFAULT_BUDGET: f64 = 512.0; // MB
+    let budget = std::env::var("CALZONE_MESH_CACHE")
+        .ok()
+        .and_then(|value| value.parse::<f64>().ok())
+        .map(|value| value.max(0.0))
+        .unwrap_or(DEFAULT_BUDGET);
+    (budget * 1E+06) as usize
+}
+
+pub fn collect_meshes() {
+    evict_meshes(cache_budget());
+}
+
+fn evict_meshes(budget: usize) {
+    let mut meshes = MESHES.write().unwrap();
+    let mut solids = TESSELLATED_SOLIDS.write().unwrap();
+    let mut total = meshes.values().map(|entry| entry.size).sum::<usize>() +
+        solids.values().map(|entry| entry.size).sum::<usize>();
+    if total <= budget {
+        return
+    }
+
+    let mut candidates: Vec<_> = meshes
+        .iter()
+        .filter(|(_, entry)| entry.references() == 0)
+        .map(|(definition, entry)| (entry.last_used(), Algorithm::Bvh, definition.clone()))
+        .chain(solids
+            .iter()
+            .filter(|(_, entry)| entry.references() == 0)
+            .map(|(definition, entry)| (entry.last_used(), Algorithm::Voxels, definition.clone()))
+        )
+        .collect();
+    candidates.sort_by_key(|(last_used, ..)| *last_used);
+
+    let mut evictions = 0;
+    for (_, algorithm, definition) in candidates.iter() {
+        if total <= budget {
+            break
         }
+        let size = match algorithm {
+            Algorithm::Bvh => meshes.remove(definition).map(|entry| entry.size),
+            Algorithm::Voxels => solids.remove(definition).map(|entry| entry.size),
+        };
+        total -= size.unwrap_or(0);
+        evictions += 1;
+    }
+    CACHE_STATS.lock().unwrap().evictions += evictions;
+}
 
-        Ok(())
+/// Evict all unreferenced meshes, and reset the cache statistics.
+#[pyfunction]
+#[pyo3(name="clear")]
+pub fn cache_clear() {
+    evict_meshes(0);
+    let mut stats = CACHE_STATS.lock().unwrap();
+    stats.hits = 0;
+    stats.misses = 0;
+    stats.evictions = 0;
+    stats.build_time = 0.0;
+}
+
+/// Return the meshes cache statistics.
+#[pyfunction]
+#[pyo3(name="stats")]
+pub fn cache_stats(py: Python) -> PyResult<PyObject> {
+    let (meshes, solids) = {
+        let meshes = MESHES.read().unwrap();
+        let solids = TESSELLATED_SOLIDS.read().unwrap();
+        let meshes: Vec<_> = meshes
+            .values()
+            .map(|entry| (entry.size, entry.references()))
+            .collect();
+        let solids: Vec<_> = solids
+            .values()
+            .map(|entry| (entry.size, entry.references()))
+            .collect();
+        (meshes, solids)
+    };
+    let entries = meshes.len() + solids.len();
+    let referenced = meshes
+        .iter()
+        .chain(solids.iter())
+        .filter(|(_, references)| *references > 0)
+        .count();
+    let size: usize = meshes
+        .iter()
+        .chain(solids.iter())
+        .map(|(size, _)| *size)
+        .sum();
+
+    let stats = CACHE_STATS.lock().unwrap();
+    let result = Namespace::new(py, &[
+        ("budget", cache_budget().into_py(py)),
+        ("build_time", stats.build_time.into_py(py)),
+        ("entries", entries.into_py(py)),
+        ("evictions", stats.evictions.into_py(py)),
+        ("hits", stats.hits.into_py(py)),
+        ("misses", stats.misses.into_py(py)),
+        ("referenced", referenced.into_py(py)),
+        ("size", size.into_py(py)),
+    ])?;
+    Ok(result.unbind())
+}
+
+
+// ===============================================================================================
+//
+// Concurrent building.
+//
+// Pending mesh definitions are loaded, and their acceleration structures are built, on a pool of
+// threads (without the GIL). Maps are read beforehand, since this requires the GIL, while Geant4
+// tessellated solids are created afterwards on the calling thread, since Geant4 stores are not
+// thread-safe. Thus, the reported error (if any) is always the first one w.r.t. definitions
+// order, whatever the threads scheduling.
+//
+// ===============================================================================================
+
+enum LoadedMesh {
+    Facets(Vec<f32>),
+    Sorted(SortedFacets),
+}
+
+// Note: without the interpreter (i.e. from the native interface), maps cannot be read.
+pub fn build_meshes(
+    py: Option<Python>,
+    definitions: &[(MeshDefinition, ffi::TSTAlgorithm)],
+) -> Result<(), Failure> {
+    let mut pending: Vec<_> = definitions
+        .iter()
+        .filter(|(definition, algorithm)| !definition.is_built(*algorithm))
+        .collect();
+    {
+        let mut stats = CACHE_STATS.lock().unwrap();
+        stats.hits += definitions.len() - pending.len();
+        stats.misses += pending.len();
+    }
+    if pending.is_empty() {
+        return Ok(())
+    }
+    let start = Instant::now();
+
+    // Read maps (with the GIL). On error, subsequent definitions are discarded.
+    let mut error: Option<Failure> = None;
+    let mut inputs = Vec::<Option<Vec<f32>>>::with_capacity(pending.len());
+    for (definition, _) in pending.iter() {
+        let Some(params) = definition.map.as_ref() else {
+            inputs.push(None);
+            continue
+        };
+        let facets = match py {
+            Some(py) => definition.load_map(py, params).map_err(Failure::from),
+            None => {
+                let why = format!("'{}' map requires Python", definition.path.display());
+                Err(Error::new(NotImplementedError).what("mesh").why(&why).to_failure())
+            },
+        };
+        match facets {
+            Ok(facets) => inputs.push(Some(facets)),
+            Err(err) => {
+                error = Some(err);
+                break
+            },
+        }
+    }
+    pending.truncate(inputs.len());
+
+    // Load facets and build acceleration structures (without the GIL).
+    let load = || -> Vec<Result<LoadedMesh, String>> {
+        let threads = std::thread::available_parallelism()
+            .map(|n| n.get())
+            .unwrap_or(1)
+            .min(pending.len());
+        let queue = Mutex::new(pending.iter().zip(inputs.into_iter()).enumerate());
+        let mut results: Vec<Option<Result<LoadedMesh, String>>> = pending
+            .iter()
+            .map(|_| None)
+            .collect();
+        std::thread::scope(|scope| {
+            let handles: Vec<_> = (0..threads)
+                .map(|_| scope.spawn(|| {
+                    let mut loaded = Vec::new();
+                    loop {
+                        let Some((i, (job, facets))) = queue.lock().unwrap().next() else {
+                            break
+                        };
+                        let (definition, algorithm) = job;
+                        let result = definition
+                            .load_facets(facets)
+                            .map(|facets| match *algorithm {
+                                ffi::TSTAlgorithm::Bvh => {
+                                    let _span = trace::span_with(
+                                        "BVH build",
+                                        || definition.path.display().to_string(),
+                                    );
+                                    LoadedMesh::Sorted(SortedFacets::new(facets))
+                                },
+                                _ => LoadedMesh::Facets(facets),
+                            });
+                        loaded.push((i, result));
+                    }
+                    loaded
+                }))
+                .collect();
+            for handle in handles.into_iter() {
+                for (i, result) in handle.join().unwrap() {
+                    results[i] = Some(result);
+                }
+            }
+        });
+        results
+            .into_iter()
+            .map(|result| result.unwrap())
+            .collect()
+    };
+    let results = match py {
+        Some(py) => py.allow_threads(load),
+        None => load(),
+    };
+
+    // Create Geant4 solids (with the GIL), in order.
+    let mut meshes = Vec::<(MeshDefinition, Cached<MeshHandle>)>::new();
+    let mut solids = Vec::<(MeshDefinition, Cached<TessellatedSolidHandle>)>::new();
+    for ((definition, _), result) in pending.iter().zip(results.into_iter()) {
+        let loaded = match result {
+            Ok(loaded) => loaded,
+            Err(msg) => {
+                error = Some(Error::new(ValueError).why(&msg).to_failure());
+                break
+            },
+        };
+        match loaded {
+            LoadedMesh::Sorted(facets) => {
+                let size = definition.memory() + facets.memory();
+                let facets = Arc::new(facets);
+                let mesh = Cached::new(MeshHandle { facets }, size);
+                meshes.push((definition.clone(), mesh));
+            },
+            LoadedMesh::Facets(facets) => match TessellatedSolidHandle::new(definition, facets) {
+                Ok(solid) => {
+                    let size = definition.memory() + ffi::tessellated_solid_memory(&solid);
+                    solids.push((definition.clone(), Cached::new(solid, size)));
+                },
+                Err(err) => {
+                    error = Some(err);
+                    break
+                },
+            },
+        }
+    }
+
+    // Update registries. Already registered entries are kept, e.g. if another thread built the
+    // same definition in the meantime.
+    {
+        let mut registry = MESHES.write().unwrap();
+        for (definition, mesh) in meshes.into_iter() {
+            registry.entry(definition).or_insert(mesh);
+        }
+    }
+    {
+        let mut registry = TESSELLATED_SOLIDS.write().unwrap();
+        for (definition, solid) in solids.into_iter() {
+            registry.entry(definition).or_insert(solid);
+        }
+    }
+    CACHE_STATS.lock().unwrap().build_time += start.elapsed().as_secs_f64();
+
+    match error {
+        Some(err) => Err(err),
+        None => Ok(()),
     }
 }
 
+#[derive(Clone)]
+pub struct MeshHandle {
+    facets: Arc<SortedFacets>,
+}
+
 // C++ interface.
 impl MeshHandle {
     pub fn area(&self) -> f64 {
@@ -403,52 +737,48 @@ impl From<&MeshHandle> for Vec<f32> {
 
 #[derive(Clone)]
 pub struct TessellatedSolidHandle {
-    solid: Arc<*mut ffi::G4TessellatedSolid>,
+    solid: Arc<TessellatedSolidPtr>,
 }
 
-unsafe impl Send for TessellatedSolidHandle {}
-unsafe impl Sync for TessellatedSolidHandle {}
+// Owned Geant4 solid, which is deleted once the last handle is dropped.
+struct TessellatedSolidPtr (*mut ffi::G4TessellatedSolid);
+
+unsafe impl Send for TessellatedSolidPtr {}
+unsafe impl Sync for TessellatedSolidPtr {}
+
+impl Drop for TessellatedSolidPtr {
+    fn drop(&mut self) {
+        unsafe { ffi::drop_tessellated_solid(self.0) }
+    }
+}
 
 impl TessellatedSolidHandle {
-    fn build(
-        py: Python,
-        definition: &MeshDefinition,
-    ) -> PyResult<()> {
-        if !TESSELLATED_SOLIDS
-            .read()
-            .unwrap()
-            .contains_key(&definition) {
-
-            let facets = definition.load_facets(py)?;
-            let solid = ffi::create_tessellated_solid(facets);
-            let result = ffi::get_error();
-            match result.tp {
-                ffi::ErrorType::None => (),
-                ffi::ErrorType::MemoryError => {
-                    let why = format!("{}", definition.path.display());
-                    let err = Error::new(MemoryError).what("mesh").why(&why);
-                    return Err(err.into());
-                },
-                _ => {
-                    let why = format!("{}: {}", definition.path.display(), result.message);
-                    let err = Error::new(ValueError).what("mesh").why(&why);
-                    return Err(err.into());
-                }
+    fn new(definition: &MeshDefinition, facets: Vec<f32>) -> Result<Self, Failure> {
+        let _span = trace::span_with(
+            "G4TessellatedSolid",
+            || definition.path.display().to_string(),
+        );
+        let solid = ffi::create_tessellated_solid(facets);
+        let result = ffi::get_error();
+        match result.tp {
+            ffi::ErrorType::None => (),
+            ffi::ErrorType::MemoryError => {
+                let why = format!("{}", definition.path.display());
+                let err = Error::new(MemoryError).what("mesh").why(&why);
+                return Err(err.to_failure());
+            },
+            _ => {
+                let why = format!("{}: {}", definition.path.display(), result.message);
+                let err = Error::new(ValueError).what("mesh").why(&why);
+                return Err(err.to_failure());
             }
-            let solid = Arc::new(solid);
-            let solid = Self { solid };
-
-            TESSELLATED_SOLIDS
-                .write()
-                .unwrap()
-                .insert(definition.clone(), solid);
         }
-
-        Ok(())
+        let solid = Arc::new(TessellatedSolidPtr(solid));
+        Ok(Self { solid })
     }
 
     pub fn ptr(&self) -> *mut ffi::G4TessellatedSolid {
-        *self.solid
+        self.solid.0
     }
 }
 
@@ -644,6 +974,12 @@ impl SortedFacets {
         let tree = Bvh::build(&mut facets);
         Self { envelope, facets, tree, area }
     }
+
+    fn memory(&self) -> usize {
+        size_of::<Self>() +
+            self.facets.capacity() * size_of::<TriangularFacet>() +
+            self.tree.nodes.capacity() * size_of::<BvhNode<f64, 3>>()
+    }
 }
 
 fn ray_intersects_aabb(ray: &Ray<f64, 3>, aabb: &Aabb<f64, 3>) -> bool {
@@ -703,6 +1039,19 @@ impl NamedMesh {
         Ok(())
     }
 
+    pub fn memory() -> Vec<(String, usize)> {
+        let entry_size = size_of::<(String, MeshShape)>() + 1;
+        NAMED_MESHES
+            .read()
+            .unwrap()
+            .iter()
+            .map(|(name, shape)| {
+                let size = entry_size + name.capacity() + shape.definition.memory();
+                (name.clone(), size)
+            })
+            .collect()
+    }
+
     pub fn describe(name: &str) -> Option<MeshShape> {
         NAMED_MESHES
             .read()
@@ -738,12 +1087,12 @@ impl ToPyObject for MeshShape {
         let mut references = 0;
         if self.algorithm.map(|algorithm| algorithm == Algorithm::Bvh).unwrap_or(true) {
             if let Some(mesh) = MESHES.read().unwrap().get(&self.definition) {
-                references += Arc::strong_count(&mesh.facets) - 1;
+                references += mesh.references();
             }
         }
         if self.algorithm.map(|algorithm| algorithm == Algorithm::Voxels).unwrap_or(true) {
             if let Some(solid) = TESSELLATED_SOLIDS.read().unwrap().get(&self.definition) {
-                references += Arc::strong_count(&solid.solid) - 1;
+                references += solid.references();
             }
         }
         let references = references.to_object(py);
@@ -1,5 +1,5 @@
 use crate::utils::error::ErrorKind::{KeyError, IOError, NotImplementedError, ValueError};
-use crate::utils::error::{variant_error, variant_explain};
+use crate::utils::error::{Failure, variant_error, variant_explain};
 use crate::utils::extract::{extract, Extractor, Vector, Padding, Property, PropertyValue, Tag,
                             TryFromBound};
 use crate::utils::float::{f64x3, f64x3x3};
@@ -15,7 +15,8 @@ use std::cmp::Ordering::{Equal, Greater};
 use std::ffi::OsStr;
 use std::path::Path;
 use super::{ffi, MaterialsDefinition};
-use super::mesh::{MapParameters, MeshDefinition, MeshHandle, NamedMesh, TessellatedSolidHandle};
+use super::mesh::{build_meshes, MapParameters, MeshDefinition, MeshHandle, NamedMesh,
+                  TessellatedSolidHandle};
 
 
 // ===============================================================================================
@@ -38,6 +39,7 @@ pub struct Volume {
     pub(super) roles: ffi::Roles,
     pub(super) subtract: Vec<String>,
     pub(super) materials: Option<MaterialsDefinition>,
+    pub(super) density_map: Option<ffi::DensityMap>,
 }
 
 #[derive(Deserialize, Serialize)]
@@ -129,17 +131,30 @@ pub struct Include {
 impl Volume {
     pub(super) fn build_meshes(
         &mut self,
-        py: Python,
+        py: Option<Python>,
         algorithm: Option<Algorithm>
-    ) -> PyResult<()> {
+    ) -> Result<(), Failure> {
+        let mut definitions = Vec::new();
+        self.collect_meshes(algorithm, &mut definitions);
+        build_meshes(py, &definitions)
+    }
+
+    fn collect_meshes(
+        &mut self,
+        algorithm: Option<Algorithm>,
+        definitions: &mut Vec<(MeshDefinition, ffi::TSTAlgorithm)>,
+    ) {
         if let Shape::Mesh(ref mut mesh) = self.shape {
             let algorithm = algorithm.or_else(|| mesh.algorithm);
-            mesh.applied = mesh.definition.build(py, algorithm.map(|a| a.into()))?;
+            mesh.applied = mesh.definition.algorithm(algorithm.map(|a| a.into()));
+            let item = (mesh.definition.clone(), mesh.applied);
+            if !definitions.contains(&item) {
+                definitions.push(item);
+            }
         }
         for daughter in self.volumes.iter_mut() {
-            daughter.build_meshes(py, algorithm)?;
+            daughter.collect_meshes(algorithm, definitions);
         }
-        Ok(())
     }
 
     pub(super) fn check(name: &str) -> Result<(), &'static str> {
@@ -221,8 +236,8 @@ impl Volume {
         Ok(o)
     }
 
-    pub(super) fn validate(&self) -> PyResult<()> {
-        fn inspect(tag: &Tag, volume: &Volume) -> PyResult<()> {
+    pub(super) fn validate(&self) -> Result<(), Failure> {
+        fn inspect(tag: &Tag, volume: &Volume) -> Result<(), Failure> {
             let daughters: Vec<_> = volume.volumes.iter()
                 .map(|v| (v.name(), !v.subtract.is_empty()))
                 .collect();
@@ -231,13 +246,13 @@ impl Volume {
                 for subtract in v.subtract.iter() {
                     if subtract == v.name() {
                         let why = format!("cannot subtract self ('{}.{}')", tag.path(), subtract);
-                        return Err(vtag.bad().what("subtract").why(why).to_err(ValueError))
+                        return Err(vtag.bad().what("subtract").why(why).to_failure(ValueError))
                     }
 
                     match daughters.iter().find(|v| v.0 == subtract) {
                         None => {
                             let why = format!("unknown volume '{}.{}'", tag.path(), subtract);
-                            return Err(vtag.bad().what("subtract").why(why).to_err(ValueError))
+                            return Err(vtag.bad().what("subtract").why(why).to_failure(ValueError))
                         },
                         Some((_, subtracted)) => if *subtracted {
                             let why = format!(
@@ -246,7 +261,7 @@ impl Volume {
                                 subtract
                             );
                             return Err(vtag.bad().what("subtract").why(why)
-                                .to_err(NotImplementedError))
+                                .to_failure(NotImplementedError))
                         } else {
                             // Check overlaps.
                             let mut is_vol = false;
@@ -267,22 +282,42 @@ impl Volume {
                                         subtract,
                                     );
                                     return Err(vtag.bad().what("subtract").why(why)
-                                        .to_err(NotImplementedError))
+                                        .to_failure(NotImplementedError))
                                 }
                             }
                         },
                     }
                 }
+                check_density_map(&vtag, v)?;
                 inspect(&vtag, v)?;
             }
             Ok(())
         }
 
+        fn check_density_map(tag: &Tag, volume: &Volume) -> Result<(), Failure> {
+            if volume.density_map.is_none() {
+                return Ok(())
+            }
+            let why = if !matches!(volume.shape, Shape::Box(_)) {
+                "expected a box shape"
+            } else if !volume.subtract.is_empty() {
+                "cannot subtract from a density map"
+            } else if !volume.volumes.is_empty() {
+                "cannot place daughter volumes inside a density map"
+            } else if volume.roles.any() {
+                "cannot assign roles to a density map"
+            } else {
+                return Ok(())
+            };
+            Err(tag.bad().what("density_map").why(why.to_string()).to_failure(NotImplementedError))
+        }
+
         let tag = Tag::new("volume", self.name.as_ref(), None);
         if !self.subtract.is_empty() {
             let why = format!("unknown volume '{}'", self.subtract[0]);
-            return Err(tag.bad().what("subtract").why(why).to_err(ValueError))
+            return Err(tag.bad().what("subtract").why(why).to_failure(ValueError))
         }
+        check_density_map(&tag, self)?;
         inspect(&tag, self)
     }
 }
@@ -337,9 +372,10 @@ impl TryFromBound for Volume {
             .map_err(|why| tag.bad().what("name").why(why.to_string()).to_err(ValueError))?;
 
         // Extract base properties.
-        const EXTRACTOR: Extractor<9> = Extractor::new([
+        const EXTRACTOR: Extractor<11> = Extractor::new([
             Property::optional_str("material"),
             Property::optional_strs("role"),
+            Property::optional_any("filter"),
             Property::optional_vec("position"),
             Property::optional_mat("rotation"),
             Property::optional_dict("disentangle"),
@@ -347,17 +383,19 @@ impl TryFromBound for Volume {
             Property::optional_any("materials"),
             Property::optional_any("meshes"),
             Property::optional_any("include"),
+            Property::optional_any("density_map"),
         ]);
 
         let py = value.py();
         let tag = tag.cast("volume");
         let mut remainder = IndexMap::<String, Bound<PyAny>>::new();
-        let [material, role, position, rotation, disentangle, subtract, materials, meshes,
-             include] = EXTRACTOR.extract(&tag, value, Some(&mut remainder))?;
+        let [material, role, filter, position, rotation, disentangle, subtract, materials,
+             meshes, include, density_map] = EXTRACTOR.extract(&tag, value, Some(&mut remainder))?;
 
         let name = tag.name().to_string();
         let material: Option<String> = material.into();
         let role: Vec<String> = role.into();
+        let filter: Option<Bound<PyAny>> = filter.into();
         let position: Option<f64x3> = position.into();
         let rotation: Option<f64x3x3> = rotation.into();
         let overlaps: Option<DictLike> = disentangle.into();
@@ -375,10 +413,13 @@ impl TryFromBound for Volume {
 
         // Parse role(s).
         let (_, tag) = tag.resolve(value)?;
-        let roles: ffi::Roles = role.as_slice().try_into()
+        let mut roles: ffi::Roles = role.as_slice().try_into()
             .map_err(|why| {
                 tag.bad().what("role").why(why).to_err(ValueError)
             })?;
+        if let Some(filter) = filter {
+            roles.set_filters(&tag, Some(&filter))?;
+        }
 
         // Split shape(s) and volumes from remainder.
         let (volumes, shapes) = {
@@ -489,9 +530,15 @@ impl TryFromBound for Volume {
             .transpose();
         let materials = materials?;
 
+        // Extract density map.
+        let density_map: Option<Bound<PyAny>> = density_map.into();
+        let density_map: Option<ffi::DensityMap> = density_map
+            .map(|density_map| ffi::DensityMap::try_from_any(&tag, &density_map))
+            .transpose()?;
+
         let volume = Self {
             name, material, roles, shape, position, rotation, volumes, overlaps, subtract,
-            materials
+            materials, density_map
         };
 
         Ok(volume)
@@ -834,6 +881,13 @@ impl Volume {
         }
     }
 
+    pub fn density_map(&self) -> &ffi::DensityMap {
+        match &self.density_map {
+            Some(density_map) => &density_map,
+            None => unreachable!(),
+        }
+    }
+
     pub fn envelope_shape(&self) -> &ffi::EnvelopeShape {
         match &self.shape {
             Shape::Envelope(shape) => &shape,
@@ -855,6 +909,10 @@ impl Volume {
         }
     }
 
+    pub fn has_density_map(&self) -> bool {
+        self.density_map.is_some()
+    }
+
     pub fn is_rotated(&self) -> bool {
         return self.rotation.is_some()
     }
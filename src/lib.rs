@@ -6,6 +6,7 @@ use std::env;
 
 mod cxx;
 mod geometry;
+pub mod native;
 mod simulation;
 mod utils;
 
@@ -36,19 +37,8 @@ fn init(module: &Bound<PyModule>) -> PyResult<()> {
         filename
     };
 
-    // Set data path.
-    const DATA_KEY: &str = "GEANT4_DATA_DIR";
-    if let Err(_) = env::var(DATA_KEY) {
-        // Note: we modify the env from within the C++ layer, because doing it from Rust does not
-        // seem to propagate down to the C++ layer, on Windows.
-        cxx::ffi::set_env(
-            DATA_KEY.to_owned(),
-            utils::data::default_path().to_string_lossy().into_owned(),
-        );
-    }
-
     // Initialise interfaces.
-    utils::error::initialise();
+    initialise();
     utils::numpy::initialise(py)?;
     utils::units::initialise(py);
 
@@ -69,8 +59,16 @@ fn init(module: &Bound<PyModule>) -> PyResult<()> {
     module.add_function(wrap_pyfunction!(utils::data::download, module)?)?;
     module.add_function(wrap_pyfunction!(geometry::define, module)?)?;
     module.add_function(wrap_pyfunction!(geometry::describe, module)?)?;
+    module.add_function(wrap_pyfunction!(utils::memory::memory, module)?)?;
+    module.add_function(wrap_pyfunction!(simulation::pileup::pileup, module)?)?;
     module.add_function(wrap_pyfunction!(simulation::source::particles, module)?)?;
 
+    // Register submodule(s).
+    let cache = PyModule::new_bound(py, "cache")?;
+    cache.add_function(wrap_pyfunction!(geometry::mesh::cache_clear, &cache)?)?;
+    cache.add_function(wrap_pyfunction!(geometry::mesh::cache_stats, &cache)?)?;
+    module.add_submodule(&cache)?;
+
     // Register constant(s).
     module.add("_DLL", dll)?;
     module.add("GEANT4_VERSION", GEANT4_VERSION)?;
@@ -82,3 +80,20 @@ fn init(module: &Bound<PyModule>) -> PyResult<()> {
 
     Ok(())
 }
+
+// Initialisation common to the Python and native interfaces.
+fn initialise() {
+    // Set data path.
+    const DATA_KEY: &str = "GEANT4_DATA_DIR";
+    if let Err(_) = env::var(DATA_KEY) {
+        // Note: we modify the env from within the C++ layer, because doing it from Rust does not
+        // seem to propagate down to the C++ layer, on Windows.
+        cxx::ffi::set_env(
+            DATA_KEY.to_owned(),
+            utils::data::default_path().to_string_lossy().into_owned(),
+        );
+    }
+
+    // Initialise errors handling.
+    utils::error::initialise();
+}
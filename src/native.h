@@ -0,0 +1,171 @@
+#ifndef CALZONE_NATIVE_H
+#define CALZONE_NATIVE_H
+/*
+ * Native (C) interface to Calzone simulations.
+ *
+ * This interface runs Geant4 simulations without the Python interpreter. The
+ * functions are exported by the Calzone extension module (calzone/_core.*).
+ * Note that the module references (but does not initialise) the Python
+ * runtime. Thus, an application must link against libpython.
+ *
+ * Geometries are loaded from serialised builders, which are obtained from
+ * Python as, e.g.
+ *
+ *     data = calzone.GeometryBuilder("geometry.toml").__getstate__()
+ *
+ * Mesh definitions are supported, but maps are not (since they are decoded
+ * with Python).
+ *
+ * Functions returning an int return 0 on success, and -1 on failure. The
+ * message of the last error is returned by calzone_error. Since Geant4 is a
+ * process wide singleton, calls are serialised. Thus, callbacks must not call
+ * back into this interface.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ==========================================================================
+ *
+ * Data layouts.
+ *
+ * ==========================================================================
+ */
+
+/* A Monte Carlo particle (in MeV and cm, using the PDG numbering scheme). */
+struct calzone_particle {
+    int32_t pid;
+    double energy;
+    double position[3];
+    double direction[3];
+};
+
+/* A buffer of primary particles. Weights and event keys are optional (per
+ * particle). Consecutive particles with the same key belong to the same
+ * event, and must share the same weight. Without keys, each particle is a
+ * distinct event.
+ */
+struct calzone_primaries {
+    const struct calzone_particle * particles;
+    size_t size;
+    const double * weight;
+    const uint64_t * event;
+};
+
+/* The total energy deposit (in MeV) of an event, in a volume. */
+struct calzone_deposit {
+    size_t event;
+    double value;
+    double weight;
+    uint64_t random_index[2];
+};
+
+/* A particle sampled at a volume boundary. */
+struct calzone_sampled_particle {
+    size_t event;
+    struct calzone_particle state;
+    double weight;
+    uint64_t random_index[2];
+    int32_t tid;
+};
+
+/* Callbacks receiving the results of a run, per volume. Deposits (particles)
+ * are only sampled if the corresponding callback is set. Data are valid
+ * during the callback only.
+ */
+struct calzone_results {
+    void * user;
+    void (*deposits)(
+        void * user,
+        const char * volume,
+        const struct calzone_deposit * deposits,
+        size_t size
+    );
+    void (*particles)(
+        void * user,
+        const char * volume,
+        const struct calzone_sampled_particle * particles,
+        size_t size
+    );
+};
+
+
+/* ==========================================================================
+ *
+ * Simulation interface.
+ *
+ * ==========================================================================
+ */
+
+struct calzone_simulation;
+
+/* Create a simulation from a serialised geometry builder (NULL on failure). */
+struct calzone_simulation * calzone_simulation_create(
+    const uint8_t * geometry,
+    size_t size
+);
+
+/* Destroy a simulation. */
+void calzone_simulation_destroy(struct calzone_simulation * simulation);
+
+/* Set the physics lists, e.g. "standard" and "FTFP_BERT" (NULL selects the
+ * default list).
+ */
+int calzone_simulation_physics(
+    struct calzone_simulation * simulation,
+    const char * em_model,
+    const char * had_model
+);
+
+/* Set the role(s) of a volume, given its full path (e.g. "World.Detector"),
+ * as a comma separated list (e.g. "catch_ingoing,record_deposits"). A NULL
+ * role clears the volume roles.
+ */
+int calzone_simulation_role(
+    struct calzone_simulation * simulation,
+    const char * volume,
+    const char * role
+);
+
+/* Enable (or disable) the production of secondary particles. */
+int calzone_simulation_secondaries(
+    struct calzone_simulation * simulation,
+    int secondaries
+);
+
+/* Reset the pseudo-random stream with the given seed. */
+int calzone_simulation_seed(
+    struct calzone_simulation * simulation,
+    uint64_t seed
+);
+
+/* Run a Geant4 Monte Carlo simulation. */
+int calzone_simulation_run(
+    struct calzone_simulation * simulation,
+    const struct calzone_primaries * primaries,
+    const struct calzone_results * results
+);
+
+
+/* ==========================================================================
+ *
+ * Library interface.
+ *
+ * ==========================================================================
+ */
+
+/* Return the message of the last error (on the calling thread). */
+const char * calzone_error(void);
+
+/* Finalise Geant4. Simulations must not be used afterwards. */
+void calzone_finalise(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
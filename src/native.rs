@@ -0,0 +1,277 @@
+use crate::cxx::ffi;
+use crate::geometry::{Geometry, GeometryBuilder, Volume};
+use crate::simulation::{self, DepositsCallback, ParticlesCallback, Physics, Random};
+use crate::simulation::source::ParticlesBuffer;
+use crate::utils::error::{self, Error, Failure};
+use crate::utils::error::ErrorKind::{TypeError, ValueError};
+use std::cell::RefCell;
+use std::ffi::{c_char, c_int, c_void, CStr, CString};
+use std::panic::{catch_unwind, AssertUnwindSafe};
+use std::sync::{Mutex, Once};
+
+
+// ===============================================================================================
+//
+// Native (C) interface.
+//
+// This interface runs simulations without the Python interpreter, e.g. from a C or C++ service
+// (see the native.h header). Geometries are loaded from serialised builders, primaries are read
+// from contiguous buffers, and results are returned through callbacks. Since Geant4 is a process
+// wide singleton, calls are serialised.
+//
+// ===============================================================================================
+
+pub use ffi::{Particle, SampledParticle};
+pub use crate::simulation::sampler::TotalDeposit;
+
+/// A native simulation context.
+pub struct Simulation {
+    geometry: Geometry,
+    physics: Physics,
+    random: Random,
+    secondaries: bool,
+}
+
+/// A buffer of primary particles, with optional weights and event keys (per particle).
+#[repr(C)]
+pub struct Primaries {
+    pub particles: *const Particle,
+    pub size: usize,
+    pub weight: *const f64,
+    pub event: *const u64,
+}
+
+/// Callbacks receiving the results of a run, per volume.
+#[repr(C)]
+pub struct Results {
+    pub user: *mut c_void,
+    pub deposits: Option<
+        unsafe extern "C" fn(*mut c_void, *const c_char, *const TotalDeposit, usize)
+    >,
+    pub particles: Option<
+        unsafe extern "C" fn(*mut c_void, *const c_char, *const SampledParticle, usize)
+    >,
+}
+
+const SUCCESS: c_int = 0;
+const FAILURE: c_int = -1;
+
+static INITIALISE: Once = Once::new();
+static LOCK: Mutex<()> = Mutex::new(());
+
+thread_local! {
+    static LAST_ERROR: RefCell<CString> = RefCell::new(CString::default());
+}
+
+/// Return the message of the last error (on the calling thread).
+#[no_mangle]
+pub extern "C" fn calzone_error() -> *const c_char {
+    LAST_ERROR.with_borrow(|msg| msg.as_ptr())
+}
+
+/// Finalise Geant4. Simulations must not be used afterwards.
+#[no_mangle]
+pub extern "C" fn calzone_finalise() {
+    let _lock = LOCK.lock().unwrap_or_else(|err| err.into_inner());
+    ffi::drop_simulation();
+}
+
+/// Create a simulation context from a serialised geometry builder.
+#[no_mangle]
+pub unsafe extern "C" fn calzone_simulation_create(
+    geometry: *const u8,
+    size: usize,
+) -> *mut Simulation {
+    guard(|| {
+        let geometry = slice(geometry, size)
+            .ok_or_else(|| null_pointer("geometry"))?;
+        let mut builder = GeometryBuilder::from_bytes(geometry)?;
+        let geometry = builder.build_with(None)?;
+        let simulation = Simulation {
+            geometry,
+            physics: Physics::default(),
+            random: Random::from_seed(None)?,
+            secondaries: true,
+        };
+        Ok(Box::into_raw(Box::new(simulation)))
+    })
+    .unwrap_or(std::ptr::null_mut())
+}
+
+/// Destroy a simulation context.
+#[no_mangle]
+pub unsafe extern "C" fn calzone_simulation_destroy(simulation: *mut Simulation) {
+    if !simulation.is_null() {
+        let _lock = LOCK.lock().unwrap_or_else(|err| err.into_inner());
+        drop(Box::from_raw(simulation));
+    }
+}
+
+/// Set the physics lists (a null model selects the default one).
+#[no_mangle]
+pub unsafe extern "C" fn calzone_simulation_physics(
+    simulation: *mut Simulation,
+    em_model: *const c_char,
+    had_model: *const c_char,
+) -> c_int {
+    status(guard(|| {
+        let simulation = simulation.as_mut().ok_or_else(|| null_pointer("simulation"))?;
+        let em_model = string(em_model, "em_model")?;
+        let had_model = string(had_model, "had_model")?;
+        simulation.physics = Physics::with_models(em_model, had_model)?;
+        Ok(())
+    }))
+}
+
+/// Set the role(s) of a volume, as a comma separated list (a null role clears them).
+#[no_mangle]
+pub unsafe extern "C" fn calzone_simulation_role(
+    simulation: *mut Simulation,
+    volume: *const c_char,
+    role: *const c_char,
+) -> c_int {
+    status(guard(|| {
+        let simulation = simulation.as_ref().ok_or_else(|| null_pointer("simulation"))?;
+        let volume = string(volume, "volume")?.ok_or_else(|| null_pointer("volume"))?;
+        let roles: Vec<String> = string(role, "role")?
+            .map(|role| {
+                role.split(',')
+                    .map(|role| role.trim())
+                    .filter(|role| !role.is_empty())
+                    .map(|role| role.to_string())
+                    .collect()
+            })
+            .unwrap_or(Vec::new());
+        let volume = Volume::new(&simulation.geometry.0, volume, true)?;
+        volume.set_roles(&roles)
+    }))
+}
+
+/// Enable (or disable) the production of secondary particles.
+#[no_mangle]
+pub unsafe extern "C" fn calzone_simulation_secondaries(
+    simulation: *mut Simulation,
+    secondaries: c_int,
+) -> c_int {
+    status(guard(|| {
+        let simulation = simulation.as_mut().ok_or_else(|| null_pointer("simulation"))?;
+        simulation.secondaries = secondaries != 0;
+        Ok(())
+    }))
+}
+
+/// Reset the pseudo-random stream with the given seed.
+#[no_mangle]
+pub unsafe extern "C" fn calzone_simulation_seed(
+    simulation: *mut Simulation,
+    seed: u64,
+) -> c_int {
+    status(guard(|| {
+        let simulation = simulation.as_mut().ok_or_else(|| null_pointer("simulation"))?;
+        simulation.random = Random::from_seed(Some(seed as u128))?;
+        Ok(())
+    }))
+}
+
+/// Run a Geant4 Monte Carlo simulation. Deposits and particles are only sampled if the
+/// corresponding callback is set.
+#[no_mangle]
+pub unsafe extern "C" fn calzone_simulation_run(
+    simulation: *mut Simulation,
+    primaries: *const Primaries,
+    results: *const Results,
+) -> c_int {
+    status(guard(|| {
+        let simulation = simulation.as_mut().ok_or_else(|| null_pointer("simulation"))?;
+        let primaries = primaries.as_ref().ok_or_else(|| null_pointer("primaries"))?;
+        let particles = match slice(primaries.particles, primaries.size) {
+            Some(particles) => particles,
+            None if primaries.size == 0 => &[],
+            None => return Err(null_pointer("particles")),
+        };
+        let weight = slice(primaries.weight, primaries.size);
+        let event = slice(primaries.event, primaries.size);
+        let primaries = ParticlesBuffer::new(particles, weight, event);
+
+        let (user, on_deposits, on_particles) = match results.as_ref() {
+            Some(results) => (results.user, results.deposits, results.particles),
+            None => (std::ptr::null_mut(), None, None),
+        };
+        let mut deposits = on_deposits.map(|callback| {
+            move |volume: &str, deposits: &[TotalDeposit]| {
+                let volume = CString::new(volume).unwrap_or_default();
+                callback(user, volume.as_ptr(), deposits.as_ptr(), deposits.len())
+            }
+        });
+        let mut particles = on_particles.map(|callback| {
+            move |volume: &str, particles: &[SampledParticle]| {
+                let volume = CString::new(volume).unwrap_or_default();
+                callback(user, volume.as_ptr(), particles.as_ptr(), particles.len())
+            }
+        });
+
+        simulation::run_native(
+            &simulation.geometry,
+            &simulation.physics,
+            &mut simulation.random,
+            primaries,
+            simulation.secondaries,
+            deposits.as_mut().map(|callback| callback as DepositsCallback),
+            particles.as_mut().map(|callback| callback as ParticlesCallback),
+        )
+    }))
+}
+
+
+// ===============================================================================================
+//
+// Native interface utilities.
+//
+// ===============================================================================================
+
+// Run a native call, recording its error (if any).
+fn guard<T>(f: impl FnOnce() -> Result<T, Failure>) -> Option<T> {
+    INITIALISE.call_once(crate::initialise);
+    let _lock = LOCK.lock().unwrap_or_else(|err| err.into_inner());
+    let result = error::without_signals(|| catch_unwind(AssertUnwindSafe(f)));
+    let msg = match result {
+        Ok(Ok(value)) => return Some(value),
+        Ok(Err(err)) => err.message().unwrap_or("unexpected Python error").to_string(),
+        Err(_) => "unexpected panic".to_string(),
+    };
+    let msg = if msg.is_empty() { "unknown error".to_string() } else { msg };
+    let msg = CString::new(msg.replace('\0', "")).unwrap_or_default();
+    LAST_ERROR.set(msg);
+    None
+}
+
+fn null_pointer(what: &str) -> Failure {
+    Error::new(ValueError).what(what).why("null pointer").to_failure()
+}
+
+unsafe fn slice<'a, T>(data: *const T, size: usize) -> Option<&'a [T]> {
+    if data.is_null() {
+        None
+    } else {
+        Some(std::slice::from_raw_parts(data, size))
+    }
+}
+
+fn status(result: Option<()>) -> c_int {
+    match result {
+        Some(_) => SUCCESS,
+        None => FAILURE,
+    }
+}
+
+unsafe fn string<'a>(value: *const c_char, what: &str) -> Result<Option<&'a str>, Failure> {
+    if value.is_null() {
+        return Ok(None)
+    }
+    CStr::from_ptr(value)
+        .to_str()
+        .map(Some)
+        .map_err(|_| {
+            Error::new(TypeError).what(what).why("invalid UTF-8 string").to_failure()
+        })
+}
@@ -1,12 +1,17 @@
 // User interface.
 #include "calzone.h"
+#include "simulation/adjoint.h"
+#include "simulation/biasing.h"
+#include "simulation/fast.h"
 #include "simulation/geometry.h"
 #include "simulation/physics.h"
 #include "simulation/random.h"
 #include "simulation/sampler.h"
+#include "simulation/scoring.h"
 #include "simulation/source.h"
 #include "simulation/tracker.h"
 // Geant4 interface.
+#include "G4AdjointSimManager.hh"
 #include "G4RunManager.hh"
 #include "G4UImanager.hh"
 #include "Randomize.hh"
@@ -16,20 +21,15 @@ RunAgent * RUN_AGENT = nullptr;
 
 
 void drop_simulation() {
-    // Gracefully exit Geant4. That is, detach any pending geometry before
-    // deleting the run manager.
+    // Gracefully exit Geant4. That is, detach any pending geometry and remove
+    // cached physics tables before deleting the run manager.
     GeometryImpl::Get()->Reset();
+    PhysicsImpl::Get()->ClearCache();
     auto manager = G4RunManager::GetRunManager();
     delete manager;
 }
 
-std::shared_ptr<Error> run_simulation(
-    RunAgent & agent,
-    RandomContext &, // Implicit scope.
-    bool verbose
-) {
-    clear_error();
-
+static G4RunManager * initialise_simulation(RunAgent & agent) {
     // Configure the simulation.
     auto geometryImpl = GeometryImpl::Get();
     auto physicsImpl = PhysicsImpl::Get();
@@ -37,6 +37,7 @@ std::shared_ptr<Error> run_simulation(
     RUN_AGENT = &agent;
     geometryImpl->Update();
     physicsImpl->Update();
+    if (any_error()) return nullptr;
 
     physicsImpl->DisableVerbosity();
     static G4RunManager * manager = nullptr;
@@ -53,9 +54,36 @@ std::shared_ptr<Error> run_simulation(
                                              // physics.
         manager->SetUserAction(sourceImpl);
         manager->SetUserAction(SteppingImpl::Get());
-        manager->Initialize();
+        {
+            TraceScope trace("G4RunManager::Initialize");
+            manager->Initialize();
+        }
+        if (any_error()) return nullptr;
     }
 
+    BiasingImpl::Get()->Update();
+    if (any_error()) return nullptr;
+
+    FastImpl::Get()->Update();
+    if (any_error()) return nullptr;
+
+    ScoringImpl::Get()->Update();
+    if (any_error()) return nullptr;
+
+    return manager;
+}
+
+std::shared_ptr<Error> run_simulation(
+    RunAgent & agent,
+    RandomContext &, // Implicit scope.
+    bool verbose
+) {
+    TraceScope trace("run_simulation");
+    clear_error();
+
+    auto manager = initialise_simulation(agent);
+    if (manager == nullptr) return get_error();
+
     if (RUN_AGENT->is_tracker()) {
         manager->SetUserAction(TrackingImpl::Get());
     } else {
@@ -81,6 +109,7 @@ std::shared_ptr<Error> run_simulation(
     for (std::uint64_t i = 0; i <= a; i++) {
         int r = (i < a) ? bunch_size : b;
         if (r > 0) {
+            TraceScope trace("BeamOn");
             manager->BeamOn(r);
         }
         if (any_error()) break;
@@ -88,3 +117,49 @@ std::shared_ptr<Error> run_simulation(
 
     return get_error();
 }
+
+std::shared_ptr<Error> run_adjoint(
+    RunAgent & agent,
+    RandomContext &, // Implicit scope.
+    const AdjointSource & source,
+    bool verbose
+) {
+    TraceScope trace("run_adjoint");
+    clear_error();
+
+    // The energy range of adjoint models is derived from the source spectrum,
+    // if adjoint physics is built by this run.
+    PhysicsImpl::Get()->SetAdjointEnergyMax(source.energy_max * CLHEP::MeV);
+
+    auto manager = initialise_simulation(agent);
+    if (manager == nullptr) return get_error();
+
+    AdjointEventImpl::Get()->Update(source);
+    if (any_error()) return get_error();
+
+    manager->SetUserAction(TrackingImpl::None());
+    manager->SetUserAction(StackingImpl::None());
+
+    if (verbose) {
+        auto ui = G4UImanager::GetUIpointer();
+        ui->ApplyCommand("/tracking/verbose 1");
+    }
+
+    // Process events in bunches (in order to check for Ctrl+C). Note that
+    // Geant4 generates one event per bunch and per adjoint primary type.
+    auto adjoint = G4AdjointSimManager::GetInstance();
+    constexpr int bunch_size = 100;
+    const std::uint64_t n = agent.events();
+    const std::uint64_t a = n / bunch_size;
+    const int b = n % bunch_size;
+    for (std::uint64_t i = 0; i <= a; i++) {
+        int r = (i < a) ? bunch_size : b;
+        if (r > 0) {
+            TraceScope trace("RunAdjointSimulation");
+            adjoint->RunAdjointSimulation(r);
+        }
+        if (any_error()) break;
+    }
+
+    return get_error();
+}
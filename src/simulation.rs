@@ -1,26 +1,40 @@
 #![allow(deprecated)]
 
 use crate::geometry::Geometry;
-use crate::utils::error::Error;
+use crate::utils::error::{Error, Failure};
 use crate::utils::error::ErrorKind::ValueError;
+use crate::utils::extract::{Tag, TryFromBound};
 use crate::utils::namespace::Namespace;
 use crate::utils::numpy::{PyArray, PyArrayMethods};
-use crate::utils::io::DictLike;
+use crate::utils::io::{DictLike, PathString};
+use crate::utils::memory;
+use crate::utils::trace;
 use cxx::SharedPtr;
 use enum_variants_strings::EnumVariantsStrings;
+use indexmap::IndexMap;
 use pyo3::prelude::*;
-use pyo3::types::PyString;
+use pyo3::types::{PyDict, PyString};
 use std::pin::Pin;
 
+mod adjoint;
+mod coincidence;
+mod fast;
 mod physics;
+pub mod pileup;
 mod random;
+mod scoring;
 pub mod sampler;
 pub mod source;
+mod tally;
 pub mod tracker;
 
+use adjoint::AdjointSampler;
+use coincidence::{CoincidenceRule, Coincidences};
 pub use physics::Physics;
 pub use random::{Random, RandomContext};
-use sampler::{Deposits, ParticlesSampler, SamplerMode};
+use sampler::{Deposits, MaxSamples, ParticlesSampler, SamplerMode};
+use scoring::Scorer;
+use tally::{Tallies, TallyBinning};
 use tracker::Tracker;
 pub use super::cxx::ffi;
 
@@ -34,9 +48,14 @@ pub use super::cxx::ffi;
 /// Interface to a Geant4 simulation.
 #[pyclass(module="calzone")]
 pub struct Simulation {
+    coincidences: IndexMap<String, CoincidenceRule>,
+    fast_models: IndexMap<String, String>,
     /// The Monte Carlo `Geometry`.
     #[pyo3(get)]
     geometry: Option<Py<Geometry>>,
+    /// Maximum number of samples, per volume.
+    #[pyo3(get)]
+    max_samples: Option<MaxSamples>,
     /// Monte Carlo `Physics` settings.
     #[pyo3(get)]
     physics: Py<Physics>,
@@ -49,9 +68,11 @@ pub struct Simulation {
     /// Flag controlling the sampling of particles at volume boundaries.
     #[pyo3(get, set)]
     sample_particles: bool,
+    scoring: IndexMap<String, ffi::ScoringMesh>,
     /// Flag controlling the production of secondary particles.
     #[pyo3(get, set)]
     secondaries: bool,
+    tally: TallyBinning,
     /// Flag controlling the recording of Monte Carlo tracks.
     #[pyo3(get, set)]
     tracking: bool,
@@ -60,6 +81,11 @@ pub struct Simulation {
 #[pymethods]
 impl Simulation {
     #[new]
+    #[pyo3(signature=(
+        geometry=None, physics=None, random=None, sample_deposits=None, sample_particles=None,
+        secondaries=None, tracking=None, *, coincidences=None, fast_models=None, max_samples=None,
+        scoring=None, tally=None,
+    ))]
     fn new<'py>(
         py: Python<'py>,
         geometry: Option<GeometryArg>,
@@ -69,6 +95,11 @@ impl Simulation {
         sample_particles: Option<bool>,
         secondaries: Option<bool>,
         tracking: Option<bool>,
+        coincidences: Option<Bound<'py, PyDict>>,
+        fast_models: Option<Bound<'py, PyDict>>,
+        max_samples: Option<MaxSamples>,
+        scoring: Option<Bound<'py, PyDict>>,
+        tally: Option<Bound<'py, PyDict>>,
     ) -> PyResult<Self> {
         let geometry = geometry
             .map(|geometry| {
@@ -84,23 +115,91 @@ impl Simulation {
             .unwrap_or_else(|| Py::new(py, Physics::default()))?;
         let random = random
             .map(|random| Ok(random.clone().unbind()))
-            .unwrap_or_else(|| Py::new(py, Random::new(None, None)?))?;
+            .unwrap_or_else(|| Py::new(py, Random::new(None, None, None)?))?;
         let sample_deposits = sample_deposits.or_else(|| Some(SamplerMode::Brief));
         let sample_particles = sample_particles.unwrap_or(true);
         let secondaries = secondaries.unwrap_or(true);
         let tracking = tracking.unwrap_or(false);
+        let coincidences = coincidences
+            .map(|coincidences| extract_coincidences(&coincidences))
+            .transpose()?
+            .unwrap_or_else(|| IndexMap::new());
+        let fast_models = fast_models
+            .map(|fast_models| extract_fast_models(&fast_models))
+            .transpose()?
+            .unwrap_or_else(|| IndexMap::new());
+        let max_samples = max_samples
+            .map(|max_samples| max_samples.validate())
+            .transpose()?;
+        let scoring = scoring
+            .map(|scoring| extract_scoring(&scoring))
+            .transpose()?
+            .unwrap_or_else(|| IndexMap::new());
+        let tally = tally
+            .map(|tally| extract_tally(&tally))
+            .transpose()?
+            .unwrap_or_else(|| TallyBinning::default());
         let simulation = Self {
+            coincidences,
+            fast_models,
             geometry,
+            max_samples,
             physics,
             random,
             sample_deposits,
             sample_particles,
+            scoring,
             secondaries,
+            tally,
             tracking
         };
         Ok(simulation)
     }
 
+    /// Coincidence rules for energy deposits, by name.
+    #[getter]
+    fn get_coincidences<'py>(&self, py: Python<'py>) -> PyResult<Option<Bound<'py, PyDict>>> {
+        if self.coincidences.is_empty() {
+            return Ok(None)
+        }
+        let result = PyDict::new_bound(py);
+        for (name, rule) in self.coincidences.iter() {
+            result.set_item(name, rule.to_dict(py)?)?;
+        }
+        Ok(Some(result))
+    }
+
+    #[setter]
+    fn set_coincidences(&mut self, coincidences: Option<Bound<PyDict>>) -> PyResult<()> {
+        self.coincidences = match coincidences {
+            None => IndexMap::new(),
+            Some(coincidences) => extract_coincidences(&coincidences)?,
+        };
+        Ok(())
+    }
+
+    /// Fast simulation models (i.e. containment tables), per volume.
+    #[getter]
+    fn get_fast_models<'py>(&self, py: Python<'py>) -> PyResult<Option<Bound<'py, PyDict>>> {
+        if self.fast_models.is_empty() {
+            return Ok(None)
+        }
+        let result = PyDict::new_bound(py);
+        for (volume, path) in self.fast_models.iter() {
+            result.set_item(volume, path)?;
+        }
+        Ok(Some(result))
+    }
+
+    #[setter]
+    fn set_fast_models(&mut self, fast_models: Option<Bound<PyDict>>) -> PyResult<()> {
+        self.fast_models = match fast_models {
+            None => IndexMap::new(),
+            Some(fast_models) => extract_fast_models(&fast_models)?,
+        };
+        Ok(())
+    }
+
     #[setter]
     fn set_geometry(&mut self, geometry: Option<GeometryArg>) -> PyResult<()> {
         match geometry {
@@ -113,6 +212,14 @@ impl Simulation {
         Ok(())
     }
 
+    #[setter]
+    fn set_max_samples(&mut self, max_samples: Option<MaxSamples>) -> PyResult<()> {
+        self.max_samples = max_samples
+            .map(|max_samples| max_samples.validate())
+            .transpose()?;
+        Ok(())
+    }
+
     #[setter]
     fn set_physics(&mut self, py: Python, physics: Option<PhysicsArg>) -> PyResult<()> {
         let physics: Py<Physics> = match physics {
@@ -123,6 +230,61 @@ impl Simulation {
         Ok(())
     }
 
+    /// Scoring meshes (i.e. 3D grids of deposits and track lengths), by name.
+    #[getter]
+    fn get_scoring<'py>(&self, py: Python<'py>) -> PyResult<Option<Bound<'py, PyDict>>> {
+        if self.scoring.is_empty() {
+            return Ok(None)
+        }
+        let result = PyDict::new_bound(py);
+        for (name, mesh) in self.scoring.iter() {
+            result.set_item(name, mesh.to_dict(py)?)?;
+        }
+        Ok(Some(result))
+    }
+
+    #[setter]
+    fn set_scoring(&mut self, scoring: Option<Bound<PyDict>>) -> PyResult<()> {
+        self.scoring = match scoring {
+            None => IndexMap::new(),
+            Some(scoring) => extract_scoring(&scoring)?,
+        };
+        Ok(())
+    }
+
+    /// Histograms binning for boundary tallies.
+    #[getter]
+    fn get_tally<'py>(&self, py: Python<'py>) -> PyResult<Bound<'py, PyDict>> {
+        self.tally.to_dict(py)
+    }
+
+    #[setter]
+    fn set_tally(&mut self, tally: Option<Bound<PyDict>>) -> PyResult<()> {
+        self.tally = match tally {
+            None => TallyBinning::default(),
+            Some(tally) => extract_tally(&tally)?,
+        };
+        Ok(())
+    }
+
+    /// Generate a fast simulation model for a volume, from a full simulation.
+    #[pyo3(signature = (volume, path, /, *, bins=None, energy=None, events=None))]
+    fn calibrate(
+        &self,
+        py: Python,
+        volume: &str,
+        path: PathString,
+        bins: Option<[usize; 2]>,
+        energy: Option<[f64; 2]>,
+        events: Option<usize>,
+    ) -> PyResult<()> {
+        let path = path.to_string();
+        let bins = bins.unwrap_or([32, 16]);
+        let energy = energy.unwrap_or([1E-02, 1E+01]);
+        let events = events.unwrap_or(100000);
+        fast::calibrate(py, self, volume, &path, energy, bins, events)
+    }
+
     /// Create a Monte Carlo particles generator.
     fn particles(
         &self,
@@ -137,25 +299,74 @@ impl Simulation {
     }
 
     /// Run a Geant4 Monte Carlo simulation.
-    #[pyo3(signature = (particles, /, *, random_indices=None, verbose=false))]
-    #[pyo3(text_signature = "(particles, /, *, random_indices=None)")]
+    #[pyo3(signature = (particles, /, *, events=None, group_events=false, random_indices=None,
+                        verbose=false))]
+    #[pyo3(text_signature = "(particles, /, *, events=None, group_events=False, \
+                             random_indices=None)")]
     fn run<'py>(
         &self,
         particles: &Bound<'py, PyAny>,
+        events: Option<usize>,
+        group_events: Option<bool>,
         random_indices: Option<&PyArray<u64>>,
         verbose: Option<bool>, // Hidden argument.
     ) -> PyResult<PyObject> {
         let py = particles.py();
+        let _span = trace::span("Simulation::run");
         let verbose = verbose.unwrap_or(false);
-        let particles = source::ParticlesIterator::new(particles)?;
+        let group_events = group_events.unwrap_or(false);
+        let particles = source::Primaries::new(particles, events, group_events)?;
         let mut agent = RunAgent::new(py, self, particles, random_indices)?;
         let mut binding = self.random.bind(py).borrow_mut();
         let mut random = RandomContext::new(&mut binding);
         let result = ffi::run_simulation(&mut agent, &mut random, verbose)
             .to_result();
+        memory::end_run(agent.memory());
+
+        let mut agent = Pin::into_inner(agent);
+        if let Some(err) = agent.error.take() {
+            return Err(err.into())
+        }
+        result?;
+        agent.export(py)
+    }
+
+    /// Run an adjoint Geant4 Monte Carlo simulation.
+    #[pyo3(signature = (events, /, *, detector, source, energy, verbose=false))]
+    #[pyo3(text_signature = "(events, /, *, detector, source, energy)")]
+    fn run_adjoint<'py>(
+        &self,
+        py: Python<'py>,
+        events: usize,
+        detector: String,
+        source: String,
+        energy: [f64; 2],
+        verbose: Option<bool>, // Hidden argument.
+    ) -> PyResult<PyObject> {
+        let _span = trace::span("Simulation::run_adjoint");
+        let verbose = verbose.unwrap_or(false);
+        let [energy_min, energy_max] = energy;
+        if !(energy_min > 0.0) || !(energy_max > energy_min) {
+            let why = format!(
+                "expected an increasing range of positive values, found [{}, {}]",
+                energy_min,
+                energy_max,
+            );
+            let err = Error::new(ValueError).what("energy").why(&why);
+            return Err(err.to_err())
+        }
+        let source = ffi::AdjointSource { detector, source, energy_min, energy_max };
+        let mut agent = RunAgent::new_adjoint(py, self, events)?;
+        let mut binding = self.random.bind(py).borrow_mut();
+        let mut random = RandomContext::new(&mut binding);
+        let result = ffi::run_adjoint(&mut agent, &mut random, &source, verbose)
+            .to_result();
+        memory::end_run(agent.memory());
 
         let agent = Pin::into_inner(agent);
-        result.and_then(|_| agent.export(py))
+        result?;
+        let _span = trace::span("AdjointSampler::export");
+        agent.adjoint.unwrap().export(py)
     }
 }
 
@@ -207,18 +418,126 @@ impl<'py> TryFrom<PhysicsArg<'py>> for Py<Physics> {
                         (Some(model.as_ref()), None)
                     },
                 };
-                let physics = Physics::new(em_model, None, had_model)?;
+                let physics = Physics::new(em_model, None, None, None, had_model)?;
                 Py::new(py, physics)
             },
         }
     }
 }
 
+fn extract_coincidences(
+    coincidences: &Bound<PyDict>
+) -> PyResult<IndexMap<String, CoincidenceRule>> {
+    let mut result = IndexMap::new();
+    for (name, rule) in coincidences.iter() {
+        let name: String = name.extract()?;
+        let tag = Tag::new("coincidence rule", name.as_str(), None);
+        let rule = CoincidenceRule::try_from_any(&tag, &rule)?;
+        result.insert(name, rule);
+    }
+    Ok(result)
+}
+
+fn extract_fast_models(fast_models: &Bound<PyDict>) -> PyResult<IndexMap<String, String>> {
+    let mut result = IndexMap::new();
+    for (volume, path) in fast_models.iter() {
+        let volume: String = volume.extract()?;
+        let path: PathString = path.extract()?;
+        result.insert(volume, path.to_string());
+    }
+    Ok(result)
+}
+
+fn extract_scoring(scoring: &Bound<PyDict>) -> PyResult<IndexMap<String, ffi::ScoringMesh>> {
+    let mut result = IndexMap::new();
+    for (name, mesh) in scoring.iter() {
+        let name: String = name.extract()?;
+        let tag = Tag::new("scoring mesh", name.as_str(), None);
+        let mesh = ffi::ScoringMesh::try_from_any(&tag, &mesh)?;
+        result.insert(name, mesh);
+    }
+    Ok(result)
+}
+
+fn extract_tally(tally: &Bound<PyDict>) -> PyResult<TallyBinning> {
+    let tag = Tag::new("", "tally", None);
+    TallyBinning::try_from_any(&tag, tally.as_any())
+}
+
 #[pyfunction]
 pub fn drop_simulation() {
     ffi::drop_simulation();
 }
 
+// ===============================================================================================
+//
+// Native interface.
+//
+// Runs a simulation from a buffer of primaries, without the interpreter. Energy deposits (in
+// brief mode) and sampled particles are exported per volume, through callbacks.
+//
+// ===============================================================================================
+
+pub type DepositsCallback<'c> = &'c mut dyn FnMut(&str, &[sampler::TotalDeposit]);
+pub type ParticlesCallback<'c> = &'c mut dyn FnMut(&str, &[ffi::SampledParticle]);
+
+pub fn run_native(
+    geometry: &Geometry,
+    physics: &Physics,
+    random: &mut Random,
+    primaries: source::ParticlesBuffer,
+    secondaries: bool,
+    deposits: Option<DepositsCallback>,
+    particles: Option<ParticlesCallback>,
+) -> Result<(), Failure> {
+    let _span = trace::span("run_native");
+    let rng = random.fork();
+    let deposits_sampler = deposits
+        .as_ref()
+        .map(|_| Deposits::new(SamplerMode::Brief, None, None, rng.clone()));
+    let particles_sampler = particles
+        .as_ref()
+        .map(|_| ParticlesSampler::new(None, rng));
+    let primaries = source::Primaries::Buffer(primaries);
+    let mut agent = RunAgent::with_defaults(
+        geometry.0.clone(),
+        physics,
+        Vec::new(),
+        TallyBinning::default(),
+        primaries.events(),
+    );
+    agent.primaries = Some(primaries);
+    agent.deposits = deposits_sampler;
+    agent.particles = particles_sampler;
+    agent.secondaries = secondaries;
+    let mut agent = agent.start();
+    let mut random = RandomContext::new(random);
+    let result = ffi::run_simulation(&mut agent, &mut random, false)
+        .to_result();
+    memory::end_run(agent.memory());
+
+    let mut agent = Pin::into_inner(agent);
+    if let Some(err) = agent.error.take() {
+        return Err(err)
+    }
+    result?;
+
+    let _span = trace::span("RunAgent::export_native");
+    if let Some(sampler) = agent.deposits.as_mut() {
+        if agent.index > 0 {
+            sampler.close_event(agent.index - 1);
+        }
+    }
+    if let (Some(sampler), Some(callback)) = (agent.deposits, deposits) {
+        sampler.export_native(callback);
+    }
+    if let (Some(sampler), Some(callback)) = (agent.particles, particles) {
+        sampler.export_native(callback);
+    }
+    Ok(())
+}
+
+
 // ===============================================================================================
 //
 // Run agent (C++ interface).
@@ -228,7 +547,11 @@ pub fn drop_simulation() {
 pub struct RunAgent<'a> {
     geometry: SharedPtr<ffi::GeometryBorrow>,
     physics: ffi::Physics,
-    primaries: source::ParticlesIterator<'a>,
+    biasing: Vec<ffi::BiasingRule>,
+    fast_models: Vec<ffi::FastModel>,
+    primaries: Option<source::Primaries<'a>>,
+    primaries_buffer: Vec<ffi::Particle>,
+    events: usize,
     indices: Option<&'a PyArray<u64>>,
     // Iterator.
     index: usize,
@@ -238,78 +561,96 @@ pub struct RunAgent<'a> {
     deposits: Option<Deposits>,
     // Sampled particles.
     particles: Option<ParticlesSampler>,
+    // Scoring meshes.
+    scorer: Option<Scorer>,
+    // Boundary tallies.
+    tallies: Tallies,
     // tracks.
     tracker: Option<Tracker>,
     tracker_index: Vec<[u64; 2]>,
     // secondaries.
     secondaries: bool,
+    // Adjoint mode.
+    adjoint: Option<AdjointSampler>,
+    // Deferred error (e.g. from a primaries stream).
+    error: Option<Failure>,
 }
 
 impl<'a> RunAgent<'a> {
+    // Period (in events) of the run memory updates, matching the size of bunches of events.
+    const MEMORY_PERIOD: usize = 100;
+
+    pub fn biasing<'b>(&'b self) -> &'b [ffi::BiasingRule] {
+        &self.biasing
+    }
+
     pub fn events(&self) -> usize {
-        self.primaries.size()
+        self.events
+    }
+
+    pub fn fast_models<'b>(&'b self) -> &'b [ffi::FastModel] {
+        &self.fast_models
     }
 
     fn export(mut self, py: Python) -> PyResult<PyObject> {
-        let deposits = self.deposits.map(|deposits| deposits.export(py)).transpose()?;
-        let particles = self.particles.map(|particles| particles.export(py)).transpose()?;
-        let tracker = self.tracker.map(|tracker| tracker.export(py)).transpose()?;
-        let random_index = if tracker.is_some() {
+        let _span = trace::span("RunAgent::export");
+        let has_tallies = self.geometry().has_tallies();
+        if let Some(deposits) = self.deposits.as_mut() {
+            if self.index > 0 {
+                deposits.close_event(self.index - 1);
+            }
+        }
+        let mut summaries = Vec::<(&str, PyObject)>::new();
+        if let Some(summary) = self.deposits
+            .as_ref()
+            .map(|deposits| deposits.summary(py))
+            .transpose()?
+            .flatten() {
+            summaries.push(("deposits", summary));
+        }
+        if let Some(summary) = self.particles
+            .as_ref()
+            .map(|particles| particles.summary(py))
+            .transpose()?
+            .flatten() {
+            summaries.push(("particles", summary));
+        }
+
+        let mut items = Vec::<(&str, PyObject)>::new();
+        if let Some(deposits) = self.deposits {
+            items.push(("deposits", deposits.export(py)?));
+        }
+        if let Some(particles) = self.particles {
+            items.push(("particles", particles.export(py)?));
+        }
+        if let Some(tracker) = self.tracker {
             let array = PyArray::<u64>::empty(py, &[self.index, 2])?;
             let random_index = unsafe { array.slice_mut()? };
             for (i, index) in self.tracker_index.drain(..).enumerate() {
                 random_index[2 * i] = index[0];
                 random_index[2 * i + 1] = index[1];
             }
-            Some(array.into_any().unbind())
-        } else {
-            None
-        };
+            let (tracks, vertices) = tracker.export(py)?;
+            items.push(("random_index", array.into_any().unbind()));
+            items.push(("tracks", tracks));
+            items.push(("vertices", vertices));
+        }
+        if let Some(scorer) = self.scorer {
+            items.push(("scoring", scorer.export(py)?));
+        }
+        if !summaries.is_empty() {
+            items.push(("summary", Namespace::new(py, &summaries)?.unbind()));
+        }
+        if has_tallies {
+            // Tallies are exported whenever a volume has a tally role, even if empty, such that
+            // the type of the result does not depend on the data.
+            items.push(("tallies", self.tallies.export(py)?));
+        }
 
-        let result = match deposits {
-            Some(deposits) => match particles {
-                Some(particles) => match tracker {
-                    Some((tracks, vertices)) => Namespace::new(py, &[
-                            ("deposits", deposits),
-                            ("particles", particles),
-                            ("random_index", random_index.unwrap()),
-                            ("tracks", tracks),
-                            ("vertices", vertices),
-                        ])?.unbind(),
-                    None => Namespace::new(py, &[
-                            ("deposits", deposits),
-                            ("particles", particles),
-                        ])?.unbind(),
-                },
-                None => match tracker {
-                    Some((tracks, vertices)) => Namespace::new(py, &[
-                            ("deposits", deposits),
-                            ("random_index", random_index.unwrap()),
-                            ("tracks", tracks),
-                            ("vertices", vertices),
-                        ])?.unbind(),
-                    None => deposits,
-                },
-            },
-            None => match particles {
-                Some(particles) => match tracker {
-                    Some((tracks, vertices)) => Namespace::new(py, &[
-                            ("particles", particles),
-                            ("random_index", random_index.unwrap()),
-                            ("tracks", tracks),
-                            ("vertices", vertices),
-                        ])?.unbind(),
-                    None => particles,
-                },
-                None => match tracker {
-                    Some((tracks, vertices)) => Namespace::new(py, &[
-                            ("random_index", random_index.unwrap()),
-                            ("tracks", tracks),
-                            ("vertices", vertices),
-                        ])?.unbind(),
-                    None => py.None(),
-                },
-            },
+        let result = match items.len() {
+            0 => py.None(),
+            1 => items.pop().unwrap().1,
+            _ => Namespace::new(py, &items)?.unbind(),
         };
         Ok(result)
     }
@@ -318,6 +659,14 @@ impl<'a> RunAgent<'a> {
         self.geometry.as_ref().unwrap()
     }
 
+    pub fn is_aborted(&self) -> bool {
+        self.error.is_some()
+    }
+
+    pub fn is_adjoint(&self) -> bool {
+        self.adjoint.is_some()
+    }
+
     pub fn is_deposits(&self) -> bool {
         self.deposits.is_some()
     }
@@ -330,6 +679,10 @@ impl<'a> RunAgent<'a> {
         self.indices.is_some()
     }
 
+    pub fn is_scoring(&self) -> bool {
+        self.scorer.is_some()
+    }
+
     pub fn is_secondaries(&self) -> bool {
         self.secondaries
     }
@@ -341,14 +694,14 @@ impl<'a> RunAgent<'a> {
     fn new(
         py: Python,
         simulation: &Simulation,
-        primaries: source::ParticlesIterator<'a>,
+        primaries: source::Primaries<'a>,
         indices: Option<&'a PyArray<u64>>,
     ) -> PyResult<Pin<Box<RunAgent<'a>>>> {
         if let Some(indices) = indices {
-            if indices.size() != 2 * primaries.size() {
+            if indices.size() != 2 * primaries.events() {
                 let why = format!(
                     "expected a size {} array, found a size {} array",
-                    2 * primaries.size(),
+                    2 * primaries.events(),
                     indices.size(),
                 );
                 let err = Error::new(ValueError)
@@ -357,40 +710,148 @@ impl<'a> RunAgent<'a> {
                 return Err(err.to_err())
             }
         }
+        let mut agent = Self::from_simulation(py, simulation, primaries.events())?;
+        let coincidences = if simulation.coincidences.is_empty() {
+            None
+        } else {
+            match simulation.sample_deposits {
+                Some(SamplerMode::Brief) => Some(
+                    Coincidences::new(&simulation.coincidences, agent.geometry())?
+                ),
+                _ => {
+                    let why = "expected 'brief' deposits sampling";
+                    let err = Error::new(ValueError).what("coincidences").why(why);
+                    return Err(err.to_err())
+                },
+            }
+        };
+        let rng = simulation.random.bind(py).borrow().fork();
+        agent.deposits = simulation.sample_deposits.map(|mode| Deposits::new(
+            mode, coincidences, simulation.max_samples.clone(), rng.clone()
+        ));
+        if simulation.sample_particles {
+            agent.particles = Some(ParticlesSampler::new(simulation.max_samples.clone(), rng));
+        }
+        if !simulation.scoring.is_empty() {
+            agent.scorer = Some(Scorer::new(&simulation.scoring));
+        }
+        if simulation.tracking {
+            agent.tracker = Some(Tracker::new());
+        }
+        agent.primaries = Some(primaries);
+        agent.indices = indices;
+        agent.secondaries = simulation.secondaries;
+        Ok(agent.start())
+    }
+
+    fn new_adjoint(
+        py: Python,
+        simulation: &Simulation,
+        events: usize,
+    ) -> PyResult<Pin<Box<RunAgent<'a>>>> {
+        let mut agent = Self::from_simulation(py, simulation, events)?;
+        agent.adjoint = Some(AdjointSampler::new());
+        Ok(agent.start())
+    }
+
+    // Shared constructor, with all samplers disabled. Specific settings are then set by the
+    // caller.
+    fn with_defaults(
+        geometry: SharedPtr<ffi::GeometryBorrow>,
+        physics: &Physics,
+        fast_models: Vec<ffi::FastModel>,
+        tally: TallyBinning,
+        events: usize,
+    ) -> Self {
+        Self {
+            geometry,
+            physics: physics.0,
+            biasing: physics.1.clone(),
+            fast_models,
+            primaries: None,
+            primaries_buffer: Vec::new(),
+            events,
+            indices: None,
+            index: 0,
+            random_index: [0, 0],
+            weight: 0.0,
+            deposits: None,
+            particles: None,
+            scorer: None,
+            tallies: Tallies::new(tally),
+            tracker: None,
+            tracker_index: Vec::new(),
+            secondaries: true,
+            adjoint: None,
+            error: None,
+        }
+    }
+
+    // Shared constructor, from the settings of a Python simulation object.
+    fn from_simulation(py: Python, simulation: &Simulation, events: usize) -> PyResult<Self> {
         let geometry = simulation.geometry
             .as_ref()
             .ok_or_else(|| Error::new(ValueError).what("geometry").why("undefined").to_err())?;
         let geometry = geometry.get().0.clone();
-        let physics = simulation.physics.bind(py).borrow().0;
-        let index = 0;
-        let random_index = [0, 0];
-        let weight = 0.0;
-        let deposits = simulation.sample_deposits.map(|mode| Deposits::new(mode));
-        let particles = if simulation.sample_particles {
-            Some(ParticlesSampler::new())
-        } else {
-            None
-        };
-        let tracker = if simulation.tracking { Some(Tracker::new()) } else { None };
-        let tracker_index = Vec::new();
-        let secondaries = simulation.secondaries;
-        let agent = RunAgent {
-            geometry, physics, primaries, indices, index, random_index, weight, deposits,
-            particles, tracker, tracker_index, secondaries
-        };
-        Ok(Box::pin(agent))
+        let physics = simulation.physics.bind(py).borrow();
+        let fast_models = fast::load_models(&simulation.fast_models)?;
+        let agent = Self::with_defaults(geometry, &physics, fast_models, simulation.tally, events);
+        Ok(agent)
+    }
+
+    // Start a run with this agent.
+    fn start(self) -> Pin<Box<Self>> {
+        memory::start_run();
+        Box::pin(self)
+    }
+
+    // Memory held by samplers and buffers (in bytes).
+    fn memory(&self) -> usize {
+        let size = memory::vec_size(&self.primaries_buffer) +
+            memory::vec_size(&self.tracker_index) +
+            self.tallies.memory();
+        let deposits = self.deposits.as_ref().map(|deposits| deposits.memory());
+        let particles = self.particles.as_ref().map(|particles| particles.memory());
+        let scorer = self.scorer.as_ref().map(|scorer| scorer.memory());
+        let tracker = self.tracker.as_ref().map(|tracker| tracker.memory());
+        let adjoint = self.adjoint.as_ref().map(|adjoint| adjoint.memory());
+        [deposits, particles, scorer, tracker, adjoint]
+            .into_iter()
+            .flatten()
+            .fold(size, |size, other| size + other)
+    }
+
+    // Update the run memory statistics, once per period of events, since walking the samplers is
+    // not free.
+    fn update_memory(&self) {
+        if (self.index % Self::MEMORY_PERIOD) == 0 {
+            memory::update_run(self.memory());
+        }
     }
 
-    pub fn next_primary(&mut self, random_index: &[u64; 2]) -> ffi::Particle {
+    pub fn next_primaries<'b>(&'b mut self, random_index: &[u64; 2]) -> &'b [ffi::Particle] {
+        self.update_memory();
         if self.tracker.is_some() {
             self.tracker_index.push(*random_index);
         }
 
+        if let Some(deposits) = self.deposits.as_mut() {
+            if self.index > 0 {
+                deposits.close_event(self.index - 1);
+            }
+        }
+
         self.index += 1;
         self.random_index = *random_index;
-        let (particle, weight) = self.primaries.next().unwrap().unwrap();
-        self.weight = weight;
-        particle
+        match self.primaries.as_mut().unwrap().next_event(&mut self.primaries_buffer) {
+            Ok(weight) => self.weight = weight,
+            Err(err) => {
+                // The run is aborted on the C++ side, and the error is raised afterwards.
+                self.primaries_buffer.clear();
+                self.error = Some(err);
+            },
+        }
+        &self.primaries_buffer
     }
 
     pub fn next_random_index(&self) -> [u64; 2] {
@@ -415,11 +876,12 @@ impl<'a> RunAgent<'a> {
         point_deposit: f64,
         start: &ffi::G4ThreeVector,
         end: &ffi::G4ThreeVector,
+        weight: f64,
     ) {
         if let Some(deposits) = self.deposits.as_mut() {
             deposits.push(
                 volume, self.index - 1, tid, pid, energy, total_deposit, point_deposit, start, end,
-                self.weight, &self.random_index
+                self.weight, weight, &self.random_index
             )
         }
     }
@@ -429,12 +891,48 @@ impl<'a> RunAgent<'a> {
         volume: *const ffi::G4VPhysicalVolume,
         tid: i32,
         particle: ffi::Particle,
+        weight: f64,
     ) {
         if let Some(particles) = self.particles.as_mut() {
-            particles.push(volume, self.index - 1, tid, particle, self.weight, &self.random_index)
+            let weight = self.weight * weight;
+            particles.push(volume, self.index - 1, tid, particle, weight, &self.random_index)
         }
     }
 
+    pub fn push_adjoint(&mut self, random_index: &[u64; 2], primary: ffi::Particle, weight: f64) {
+        self.update_memory();
+        self.index += 1;
+        self.random_index = *random_index;
+        self.weight = weight;
+        if let Some(adjoint) = self.adjoint.as_mut() {
+            adjoint.push_primary(self.index - 1, primary, weight, random_index)
+        }
+    }
+
+    pub fn push_adjoint_particle(&mut self, particle: ffi::Particle, weight: f64) {
+        if let Some(adjoint) = self.adjoint.as_mut() {
+            adjoint.push_particle(self.index - 1, particle, weight, &self.random_index)
+        }
+    }
+
+    pub fn push_score(&mut self, mesh: usize, voxel: usize, deposit: f64, length: f64) {
+        if let Some(scorer) = self.scorer.as_mut() {
+            scorer.push(mesh, voxel, self.weight * deposit, self.weight * length)
+        }
+    }
+
+    pub fn push_tally(
+        &mut self,
+        volume: *const ffi::G4VPhysicalVolume,
+        pid: i32,
+        energy: f64,
+        cos_theta: f64,
+        weight: f64,
+    ) {
+        let weight = self.weight * weight;
+        self.tallies.push(volume, pid, energy, cos_theta, weight)
+    }
+
     pub fn push_track(&mut self, mut track: ffi::Track) {
         if let Some(tracker) = self.tracker.as_mut() {
             track.event = self.index - 1;
@@ -448,4 +946,11 @@ impl<'a> RunAgent<'a> {
             tracker.push_vertex(vertex)
         }
     }
+
+    pub fn scoring_meshes<'b>(&'b self) -> &'b [ffi::ScoringMesh] {
+        match self.scorer.as_ref() {
+            Some(scorer) => scorer.meshes(),
+            None => &[],
+        }
+    }
 }
@@ -0,0 +1,297 @@
+// fmt library.
+#include <fmt/core.h>
+// User interface.
+#include "adjoint.h"
+#include "physics.h"
+#include "random.h"
+// Geant4 interface.
+#include "G4AdjointAlongStepWeightCorrection.hh"
+#include "G4AdjointBremsstrahlungModel.hh"
+#include "G4AdjointComptonModel.hh"
+#include "G4AdjointCSManager.hh"
+#include "G4AdjointElectron.hh"
+#include "G4AdjointeIonisationModel.hh"
+#include "G4AdjointGamma.hh"
+#include "G4AdjointPhotoElectricModel.hh"
+#include "G4AdjointSimManager.hh"
+#include "G4ContinuousGainOfEnergy.hh"
+#include "G4eAdjointMultipleScattering.hh"
+#include "G4eInverseBremsstrahlung.hh"
+#include "G4eInverseCompton.hh"
+#include "G4eInverseIonisation.hh"
+#include "G4Electron.hh"
+#include "G4Event.hh"
+#include "G4InversePEEffect.hh"
+#include "G4ParticleTable.hh"
+#include "G4PhysicalVolumeStore.hh"
+#include "G4ProcessManager.hh"
+#include "G4UrbanMscModel.hh"
+#include "G4VEnergyLossProcess.hh"
+// C++ standard library.
+#include <functional>
+
+
+// ============================================================================
+//
+// Adjoint physics.
+//
+// Adjoint processes are built on top of the forward electromagnetic physics,
+// following Geant4 ReverseMC01 example. Only gamma and e- are considered. The
+// upper energy limit of adjoint models is set at construction, e.g. from the
+// source spectrum of the first adjoint run.
+//
+// ============================================================================
+
+const double AdjointPhysics::DEFAULT_ENERGY_MAX = 100.0 * CLHEP::MeV;
+const double AdjointPhysics::ENERGY_MIN = 1.0 * CLHEP::keV;
+
+AdjointPhysics::AdjointPhysics(double energy_max):
+    G4VPhysicsConstructor("Adjoint"),
+    energy_max(energy_max)
+{}
+
+void AdjointPhysics::ConstructParticle() {
+    G4AdjointElectron::AdjointElectronDefinition();
+    G4AdjointGamma::AdjointGammaDefinition();
+}
+
+void AdjointPhysics::ConstructProcess() {
+    // Fetch direct (forward) processes.
+    auto electron = G4Electron::Electron();
+    auto manager = electron->GetProcessManager();
+    auto eIoni = dynamic_cast<G4VEnergyLossProcess *>(
+        manager->GetProcess("eIoni")
+    );
+    auto eBrem = dynamic_cast<G4VEnergyLossProcess *>(
+        manager->GetProcess("eBrem")
+    );
+    if ((eIoni == nullptr) || (eBrem == nullptr)) {
+        set_error(
+            ErrorType::ValueError,
+            "bad physics (adjoint mode requires electromagnetic interactions)"
+        );
+        return;
+    }
+
+    auto csManager = G4AdjointCSManager::GetAdjointCSManager();
+    csManager->RegisterEnergyLossProcess(eIoni, electron);
+    csManager->RegisterEnergyLossProcess(eBrem, electron);
+    csManager->RegisterAdjointParticle(G4AdjointElectron::AdjointElectron());
+    csManager->RegisterAdjointParticle(G4AdjointGamma::AdjointGamma());
+
+    // Build adjoint models and processes.
+    auto ioniModel = new G4AdjointeIonisationModel();
+    ioniModel->SetHighEnergyLimit(this->energy_max);
+    ioniModel->SetLowEnergyLimit(ENERGY_MIN);
+    auto ioniProjToProj = new G4eInverseIonisation(
+        true, "Inv_eIon", ioniModel);
+    auto ioniProdToProj = new G4eInverseIonisation(
+        false, "Inv_eIon1", ioniModel);
+
+    auto bremModel = new G4AdjointBremsstrahlungModel();
+    bremModel->SetHighEnergyLimit(this->energy_max * 1.01);
+    bremModel->SetLowEnergyLimit(ENERGY_MIN);
+    auto bremProjToProj = new G4eInverseBremsstrahlung(
+        true, "Inv_eBrem", bremModel);
+    auto bremProdToProj = new G4eInverseBremsstrahlung(
+        false, "Inv_eBrem1", bremModel);
+
+    auto comptonModel = new G4AdjointComptonModel();
+    comptonModel->SetHighEnergyLimit(this->energy_max);
+    comptonModel->SetLowEnergyLimit(ENERGY_MIN);
+    comptonModel->SetUseMatrix(false);
+    auto comptonProjToProj = new G4eInverseCompton(
+        true, "Inv_Compt", comptonModel);
+    auto comptonProdToProj = new G4eInverseCompton(
+        false, "Inv_Compt1", comptonModel);
+
+    auto peModel = new G4AdjointPhotoElectricModel();
+    peModel->SetHighEnergyLimit(this->energy_max);
+    peModel->SetLowEnergyLimit(ENERGY_MIN);
+    auto peEffect = new G4InversePEEffect("Inv_PEEffect", peModel);
+
+    auto simManager = G4AdjointSimManager::GetInstance();
+    simManager->ConsiderParticleAsPrimary("e-");
+    simManager->ConsiderParticleAsPrimary("gamma");
+
+    // Adjoint electrons.
+    {
+        auto manager = G4AdjointElectron::AdjointElectron()
+            ->GetProcessManager();
+        auto gain = new G4ContinuousGainOfEnergy();
+        gain->SetLossFluctuations(false);
+        gain->SetDirectEnergyLossProcess(eIoni);
+        gain->SetDirectParticle(electron);
+        manager->AddProcess(gain);
+
+        auto msc = new G4eAdjointMultipleScattering();
+        msc->SetEmModel(new G4UrbanMscModel());
+        manager->AddProcess(msc);
+        manager->SetProcessOrdering(msc, idxAlongStep, 1);
+        manager->SetProcessOrdering(gain, idxAlongStep, 2);
+
+        auto correction = new G4AdjointAlongStepWeightCorrection();
+        manager->AddProcess(correction);
+        manager->SetProcessOrdering(correction, idxAlongStep, 3);
+        manager->SetProcessOrdering(msc, idxPostStep, 1);
+
+        manager->AddDiscreteProcess(ioniProjToProj);
+        manager->AddDiscreteProcess(ioniProdToProj);
+        manager->AddDiscreteProcess(bremProjToProj);
+        manager->AddDiscreteProcess(comptonProdToProj);
+        manager->AddDiscreteProcess(peEffect);
+    }
+
+    // Adjoint gammas.
+    {
+        auto manager = G4AdjointGamma::AdjointGamma()->GetProcessManager();
+        auto correction = new G4AdjointAlongStepWeightCorrection();
+        manager->AddProcess(correction);
+        manager->SetProcessOrdering(correction, idxAlongStep, 1);
+        manager->AddDiscreteProcess(bremProdToProj);
+        manager->AddDiscreteProcess(comptonProjToProj);
+    }
+}
+
+
+// ============================================================================
+//
+// Adjoint event action.
+//
+// ============================================================================
+
+static Particle get_forward_state(
+    int pid,
+    double energy,
+    const G4ThreeVector & position,
+    const G4ThreeVector & direction
+) {
+    // Adjoint particles move backwards. Thus, their direction is reversed in
+    // order to report forward states.
+    auto && r = position / CLHEP::cm;
+    Particle particle = {
+        pid,
+        energy / CLHEP::MeV,
+        { r.x(), r.y(), r.z() },
+        { -direction.x(), -direction.y(), -direction.z() },
+    };
+    return particle;
+}
+
+static int get_forward_pid(const G4ParticleDefinition * definition) {
+    std::string name = definition->GetParticleName();
+    if (name.rfind("adj_", 0) == 0) {
+        name = name.substr(4);
+    }
+    auto forward = G4ParticleTable::GetParticleTable()->FindParticle(name);
+    return (forward == nullptr) ? 0 : forward->GetPDGEncoding();
+}
+
+void AdjointEventImpl::BeginOfEventAction(const G4Event *) {
+    this->random_index = RandomImpl::Get()->GetIndex();
+}
+
+void AdjointEventImpl::EndOfEventAction(const G4Event * event) {
+    auto manager = G4AdjointSimManager::GetInstance();
+    auto vertex = event->GetPrimaryVertex();
+    if (vertex == nullptr) {
+        manager->ClearEndOfAdjointTrackInfoVectors();
+        return;
+    }
+    auto primary = vertex->GetPrimary();
+    auto weight = vertex->GetWeight() * primary->GetWeight();
+    auto state = get_forward_state(
+        get_forward_pid(primary->GetParticleDefinition()),
+        primary->GetKineticEnergy(),
+        vertex->GetPosition(),
+        primary->GetMomentumDirection()
+    );
+    RUN_AGENT->push_adjoint(this->random_index, std::move(state), weight);
+
+    // Adjoint tracks reaching the external source.
+    auto n = manager->GetNbOfAdointTracksReachingTheExternalSurface();
+    for (std::size_t i = 0; i < (std::size_t)n; i++) {
+        auto && r = manager->GetPositionAtEndOfLastAdjointTrack(i);
+        auto && u = manager->GetDirectionAtEndOfLastAdjointTrack(i);
+        auto particle = get_forward_state(
+            manager->GetFwdParticlePDGEncodingAtEndOfLastAdjointTrack(i),
+            manager->GetEkinAtEndOfLastAdjointTrack(i),
+            r,
+            u
+        );
+        auto weight = manager->GetWeightAtEndOfLastAdjointTrack(i);
+        RUN_AGENT->push_adjoint_particle(std::move(particle), weight);
+    }
+    manager->ClearEndOfAdjointTrackInfoVectors();
+}
+
+static bool check_volume(const std::string & name) {
+    // Geant4 resolves volumes by name, from the physical volumes store (taking
+    // the last match). Thus, let us check that this is consistent with the
+    // current geometry.
+    G4VPhysicalVolume * volume = nullptr;
+    for (auto && v: *G4PhysicalVolumeStore::GetInstance()) {
+        if (v->GetName() == name) volume = v;
+    }
+    if (volume == nullptr) {
+        auto msg = fmt::format("unknown volume '{}'", name);
+        set_error(ErrorType::ValueError, msg.c_str());
+        return false;
+    }
+
+    std::function<bool (const G4VPhysicalVolume *)> contains;
+    contains = [&](const G4VPhysicalVolume * current) -> bool {
+        if (current == volume) return true;
+        auto && logical = current->GetLogicalVolume();
+        std::size_t n = logical->GetNoDaughters();
+        for (std::size_t i = 0; i < n; i++) {
+            auto && daughter = logical->GetDaughter(i);
+            if (daughter->IsParameterised()) continue;
+            if (contains(daughter)) return true;
+        }
+        return false;
+    };
+    if (!contains(RUN_AGENT->geometry().world())) {
+        auto msg = fmt::format(
+            "ambiguous volume '{}' (shadowed by another geometry)",
+            name
+        );
+        set_error(ErrorType::ValueError, msg.c_str());
+        return false;
+    }
+    return true;
+}
+
+void AdjointEventImpl::Update(const AdjointSource & source) {
+    const double emin = source.energy_min * CLHEP::MeV;
+    const double emax = source.energy_max * CLHEP::MeV;
+    const double limit = PhysicsImpl::Get()->AdjointEnergyMax();
+    if ((emin < AdjointPhysics::ENERGY_MIN) || (emax > limit)) {
+        auto msg = fmt::format(
+            "bad energy (expected a range within [{}, {}] MeV)",
+            AdjointPhysics::ENERGY_MIN / CLHEP::MeV,
+            limit / CLHEP::MeV
+        );
+        set_error(ErrorType::ValueError, msg.c_str());
+        return;
+    }
+
+    std::string detector(source.detector);
+    std::string external(source.source);
+    if (!check_volume(detector) || !check_volume(external)) {
+        return;
+    }
+
+    auto manager = G4AdjointSimManager::GetInstance();
+    manager->DefineAdjointSourceOnTheExtSurfaceOfAVolume(detector);
+    manager->SetAdjointSourceEmin(emin);
+    manager->SetAdjointSourceEmax(emax);
+    manager->DefineExtSourceOnTheExtSurfaceOfAVolume(external);
+    manager->SetExtSourceEmax(emax);
+    manager->SetAdjointEventAction(this);
+}
+
+AdjointEventImpl * AdjointEventImpl::Get() {
+    static AdjointEventImpl * instance = new AdjointEventImpl();
+    return instance;
+}
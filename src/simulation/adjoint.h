@@ -0,0 +1,39 @@
+#pragma once
+// Geant4 interface.
+#include "G4UserEventAction.hh"
+#include "G4VPhysicsConstructor.hh"
+// User interface.
+#include "calzone.h"
+
+
+struct AdjointPhysics: public G4VPhysicsConstructor {
+    AdjointPhysics(double energy_max);
+
+    // Geant4 interface.
+    void ConstructParticle();
+    void ConstructProcess();
+
+    // User interface.
+    static const double DEFAULT_ENERGY_MAX;
+    static const double ENERGY_MIN;
+    const double energy_max;
+};
+
+struct AdjointEventImpl: public G4UserEventAction {
+    AdjointEventImpl(const AdjointEventImpl &) = delete;
+
+    // Geant4 interface.
+    void BeginOfEventAction(const G4Event *);
+    void EndOfEventAction(const G4Event *);
+
+    // User interface.
+    void Update(const AdjointSource &);
+
+    static AdjointEventImpl * Get();
+
+private:
+    AdjointEventImpl() = default;
+
+    // User interface.
+    std::array<std::uint64_t, 2> random_index = { 0, 0 };
+};
@@ -0,0 +1,66 @@
+use crate::utils::export::Export;
+use crate::utils::memory::vec_size;
+use crate::utils::namespace::Namespace;
+use pyo3::prelude::*;
+use super::ffi;
+use super::sampler::SampledParticlesExport;
+
+
+// ===============================================================================================
+//
+// Adjoint sampler.
+//
+// Adjoint primaries are generated on the detector surface, while adjoint tracks are collected
+// when reaching the source surface. Both are reported as forward states.
+//
+// ===============================================================================================
+
+#[derive(Default)]
+pub struct AdjointSampler {
+    primaries: Vec<ffi::SampledParticle>,
+    particles: Vec<ffi::SampledParticle>,
+}
+
+impl AdjointSampler {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn export(self, py: Python) -> PyResult<PyObject> {
+        let primaries = Export::export::<SampledParticlesExport>(py, self.primaries)?;
+        let particles = Export::export::<SampledParticlesExport>(py, self.particles)?;
+        let result = Namespace::new(py, &[
+            ("primaries", primaries),
+            ("particles", particles),
+        ])?;
+        Ok(result.unbind())
+    }
+
+    pub fn memory(&self) -> usize {
+        vec_size(&self.primaries) + vec_size(&self.particles)
+    }
+
+    pub fn push_primary(
+        &mut self,
+        event: usize,
+        state: ffi::Particle,
+        weight: f64,
+        random_index: &[u64; 2],
+    ) {
+        let random_index = *random_index;
+        let sample = ffi::SampledParticle { event, tid: 1, state, weight, random_index };
+        self.primaries.push(sample);
+    }
+
+    pub fn push_particle(
+        &mut self,
+        event: usize,
+        state: ffi::Particle,
+        weight: f64,
+        random_index: &[u64; 2],
+    ) {
+        let random_index = *random_index;
+        let sample = ffi::SampledParticle { event, tid: 0, state, weight, random_index };
+        self.particles.push(sample);
+    }
+}
@@ -0,0 +1,196 @@
+// fmt library.
+#include <fmt/core.h>
+// User interface.
+#include "biasing.h"
+// Geant4 interface.
+#include "G4BiasingProcessInterface.hh"
+#include "G4BiasingProcessSharedData.hh"
+#include "G4ParticleTable.hh"
+// C++ standard library.
+#include <algorithm>
+
+
+BiasingImpl::BiasingImpl() : G4VBiasingOperator("calzone") {}
+
+G4VBiasingOperation * BiasingImpl::ProposeOccurenceBiasingOperation(
+    const G4Track * track,
+    const G4BiasingProcessInterface * callingProcess
+) {
+    auto && physical = track->GetVolume();
+    if (physical == nullptr) {
+        return nullptr;
+    }
+    auto && rules = this->rules.find({
+        physical->GetLogicalVolume(),
+        track->GetParticleDefinition()
+    });
+    if (rules == this->rules.end()) {
+        return nullptr;
+    }
+
+    // Combine the factors of matching rules.
+    auto && process = callingProcess->GetWrappedProcess();
+    auto && name = process->GetProcessName();
+    double factor = 1.0;
+    for (auto && rule: rules->second) {
+        if (rule.process.empty() || (rule.process == name)) {
+            factor *= rule.factor;
+        }
+    }
+    if (factor == 1.0) {
+        return nullptr;
+    }
+
+    const double length = process->GetCurrentInteractionLength();
+    if (length > DBL_MAX / 10.0) {
+        return nullptr;
+    }
+    const double cross_section = factor / length;
+
+    // Update the interaction law, following Geant4 GB01 example.
+    auto && operation = this->operations[callingProcess];
+    if (!operation) {
+        operation.reset(new G4BOptnChangeCrossSection(
+            fmt::format("XSchange-{}", name)
+        ));
+    }
+    auto previous = callingProcess->GetPreviousOccurenceBiasingOperation();
+    if ((previous != operation.get()) || operation->GetInteractionOccured()) {
+        operation->SetBiasedCrossSection(cross_section);
+        operation->Sample();
+    } else {
+        operation->UpdateForStep(callingProcess->GetPreviousStepSize());
+        operation->SetBiasedCrossSection(cross_section);
+        operation->UpdateForStep(0.0);
+    }
+    return operation.get();
+}
+
+G4VBiasingOperation * BiasingImpl::ProposeFinalStateBiasingOperation(
+    const G4Track *,
+    const G4BiasingProcessInterface *
+) {
+    return nullptr;
+}
+
+G4VBiasingOperation * BiasingImpl::ProposeNonPhysicsBiasingOperation(
+    const G4Track *,
+    const G4BiasingProcessInterface *
+) {
+    return nullptr;
+}
+
+void BiasingImpl::Update() {
+    // Detach volumes on geometry change. Note that Geant4 does not provide a
+    // detach method. Thus, the stale volumes of previous geometries remain
+    // mapped to this operator, which however proposes no operation for them
+    // (since they have no rules).
+    auto && geometry = RUN_AGENT->geometry();
+    if (geometry.id() != this->geometry_id) {
+        this->attached.clear();
+        this->operations.clear();
+        this->geometry_id = geometry.id();
+    }
+    this->rules.clear();
+    auto && definitions = RUN_AGENT->biasing();
+    if (definitions.empty()) {
+        return;
+    }
+
+    // Map the logical volumes of the current geometry.
+    std::map<std::string, std::vector<const G4LogicalVolume *>> volumes;
+    auto && world = geometry.world()->GetLogicalVolume();
+    std::vector<G4LogicalVolume *> stack = { world };
+    while (!stack.empty()) {
+        auto logical = stack.back();
+        stack.pop_back();
+        auto && mapped = volumes[logical->GetName()];
+        if (std::find(mapped.begin(), mapped.end(), logical) != mapped.end()) {
+            continue;
+        }
+        mapped.push_back(logical);
+        for (size_t i = 0; i < logical->GetNoDaughters(); i++) {
+            stack.push_back(logical->GetDaughter(i)->GetLogicalVolume());
+        }
+    }
+
+    // Resolve biasing rules.
+    auto bad_rule = [&](const std::string & why) {
+        auto msg = fmt::format("bad biasing rule ({})", why);
+        set_error(ErrorType::ValueError, msg.c_str());
+        this->rules.clear();
+    };
+
+    for (auto && rule: definitions) {
+        std::string particle_name(rule.particle);
+        auto particle = G4ParticleTable::GetParticleTable()->FindParticle(
+            particle_name
+        );
+        if (particle == nullptr) {
+            bad_rule(fmt::format("unknown particle '{}'", particle_name));
+            return;
+        }
+        auto data = G4BiasingProcessInterface::GetSharedData(
+            particle->GetProcessManager()
+        );
+        if (data == nullptr) {
+            bad_rule(fmt::format(
+                "cannot bias '{}' after the first run",
+                particle_name
+            ));
+            return;
+        }
+
+        std::string process(rule.process);
+        if (!process.empty()) {
+            bool found = false;
+            for (auto && wrapper: data->GetPhysicsBiasingProcessInterfaces()) {
+                auto && name = wrapper->GetWrappedProcess()->GetProcessName();
+                if (name == process) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                bad_rule(fmt::format(
+                    "unknown process '{}' for '{}'",
+                    process,
+                    particle_name
+                ));
+                return;
+            }
+        }
+
+        std::string volume(rule.volume);
+        std::vector<const G4LogicalVolume *> logicals;
+        if (volume.empty()) {
+            for (auto && [_, mapped]: volumes) {
+                logicals.insert(logicals.end(), mapped.begin(), mapped.end());
+            }
+        } else {
+            auto && mapped = volumes.find(volume);
+            if (mapped == volumes.end()) {
+                bad_rule(fmt::format("unknown volume '{}'", volume));
+                return;
+            }
+            logicals = mapped->second;
+        }
+
+        for (auto && logical: logicals) {
+            this->rules[{logical, particle}].push_back({process, rule.factor});
+        }
+    }
+
+    // Attach the targeted volumes.
+    for (auto && [key, _]: this->rules) {
+        auto && logical = key.first;
+        if (this->attached.insert(logical).second) {
+            this->AttachTo(logical);
+        }
+    }
+}
+
+BiasingImpl * BiasingImpl::Get() {
+    static BiasingImpl * instance = new BiasingImpl();
+    return instance;
+}
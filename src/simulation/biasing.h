@@ -0,0 +1,52 @@
+#pragma once
+// Geant4 interface.
+#include "G4BOptnChangeCrossSection.hh"
+#include "G4VBiasingOperator.hh"
+// User interface.
+#include "calzone.h"
+// C++ standard library.
+#include <map>
+#include <set>
+
+
+struct BiasingImpl: public G4VBiasingOperator {
+    BiasingImpl(const BiasingImpl &) = delete; // Forbid copy.
+
+    // Geant4 interface.
+    G4VBiasingOperation * ProposeOccurenceBiasingOperation(
+        const G4Track *,
+        const G4BiasingProcessInterface *
+    );
+    G4VBiasingOperation * ProposeFinalStateBiasingOperation(
+        const G4Track *,
+        const G4BiasingProcessInterface *
+    );
+    G4VBiasingOperation * ProposeNonPhysicsBiasingOperation(
+        const G4Track *,
+        const G4BiasingProcessInterface *
+    );
+
+    // User interface.
+    void Update();
+
+    static BiasingImpl * Get();
+
+private:
+    BiasingImpl();
+
+    struct Rule {
+        std::string process;
+        double factor;
+    };
+
+    using Key = std::pair<const G4LogicalVolume *, const G4ParticleDefinition *>;
+
+    // User interface.
+    std::set<const G4LogicalVolume *> attached;
+    std::uint64_t geometry_id = 0;
+    std::map<Key, std::vector<Rule>> rules;
+    std::map<
+        const G4BiasingProcessInterface *,
+        std::unique_ptr<G4BOptnChangeCrossSection>
+    > operations;
+};
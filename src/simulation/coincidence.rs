@@ -0,0 +1,201 @@
+use crate::utils::error::Error;
+use crate::utils::error::ErrorKind::ValueError;
+use crate::utils::extract::{extract, Extractor, Property, Tag, TryFromBound};
+use crate::utils::io::DictLike;
+use crate::utils::memory::vec_size;
+use crate::utils::numpy::{PyArray, PyArrayMethods};
+use indexmap::IndexMap;
+use pyo3::prelude::*;
+use pyo3::types::PyDict;
+use super::ffi;
+use super::sampler::TotalDeposit;
+
+
+// ===============================================================================================
+//
+// Coincidence rules.
+//
+// A rule sums up the deposits of a set of volumes, per event. The event is accepted if this sum
+// exceeds the rule threshold, if all coincident volumes exceed their own threshold, and if no
+// veto volume exceeds its threshold.
+//
+// ===============================================================================================
+
+#[derive(Clone)]
+pub struct CoincidenceRule {
+    volumes: Vec<String>,
+    threshold: f64,
+    coincidence: Vec<(String, f64)>,
+    veto: Vec<(String, f64)>,
+}
+
+impl CoincidenceRule {
+    fn accept(&self, deposits: &[(&str, f64)]) -> Option<f64> {
+        let get = |volume: &str| -> f64 {
+            deposits
+                .iter()
+                .find(|(name, _)| *name == volume)
+                .map(|(_, value)| *value)
+                .unwrap_or(0.0)
+        };
+        let value: f64 = self.volumes
+            .iter()
+            .map(|volume| get(volume))
+            .sum();
+        if !(value > self.threshold) {
+            return None
+        }
+        for (volume, threshold) in self.coincidence.iter() {
+            if !(get(volume) > *threshold) {
+                return None
+            }
+        }
+        for (volume, threshold) in self.veto.iter() {
+            if get(volume) > *threshold {
+                return None
+            }
+        }
+        Some(value)
+    }
+
+    pub fn to_dict<'py>(&self, py: Python<'py>) -> PyResult<Bound<'py, PyDict>> {
+        let to_dict = |thresholds: &[(String, f64)]| -> PyResult<Bound<'py, PyDict>> {
+            let dict = PyDict::new_bound(py);
+            for (volume, threshold) in thresholds.iter() {
+                dict.set_item(volume, threshold)?;
+            }
+            Ok(dict)
+        };
+
+        let dict = PyDict::new_bound(py);
+        dict.set_item("volumes", &self.volumes)?;
+        dict.set_item("threshold", self.threshold)?;
+        if !self.coincidence.is_empty() {
+            dict.set_item("coincidence", to_dict(&self.coincidence)?)?;
+        }
+        if !self.veto.is_empty() {
+            dict.set_item("veto", to_dict(&self.veto)?)?;
+        }
+        Ok(dict)
+    }
+}
+
+impl TryFromBound for CoincidenceRule {
+    fn try_from_any<'py>(tag: &Tag, value: &Bound<'py, PyAny>) -> PyResult<Self> {
+        const EXTRACTOR: Extractor<4> = Extractor::new([
+            Property::required_strs("volumes"),
+            Property::new_f64("threshold", 0.0),
+            Property::optional_dict("coincidence"),
+            Property::optional_dict("veto"),
+        ]);
+
+        let [volumes, threshold, coincidence, veto] = EXTRACTOR.extract_any(tag, value, None)?;
+        let volumes: Vec<String> = volumes.into();
+        if volumes.is_empty() {
+            let why = "expected one or more volumes, found none".to_string();
+            return Err(tag.bad().what("volumes").why(why).to_err(ValueError));
+        }
+
+        let thresholds = |what: &str, value: Option<DictLike>| -> PyResult<Vec<(String, f64)>> {
+            let Some(value) = value else { return Ok(Vec::new()) };
+            let (dict, tag) = tag.resolve(&value)?;
+            let mut thresholds = Vec::new();
+            for (volume, threshold) in dict.iter() {
+                let volume: String = extract(&volume)
+                    .or_else(|| tag.bad().what(what).into())?;
+                let threshold: f64 = extract(&threshold)
+                    .or_else(|| tag.bad().what(what).into())?;
+                thresholds.push((volume, threshold));
+            }
+            Ok(thresholds)
+        };
+
+        let rule = Self {
+            volumes,
+            threshold: threshold.into(),
+            coincidence: thresholds("coincidence", coincidence.into())?,
+            veto: thresholds("veto", veto.into())?,
+        };
+        Ok(rule)
+    }
+}
+
+
+// ===============================================================================================
+//
+// Coincidences sampler.
+//
+// Rules are evaluated when an event closes. Only accepted events are recorded. Rule volumes are
+// validated at run start, against the current geometry.
+//
+// ===============================================================================================
+
+pub struct Coincidences {
+    rules: Vec<(String, CoincidenceRule, Vec<TotalDeposit>)>,
+}
+
+impl Coincidences {
+    pub fn new(
+        rules: &IndexMap<String, CoincidenceRule>,
+        geometry: &ffi::GeometryBorrow,
+    ) -> PyResult<Self> {
+        for (name, rule) in rules.iter() {
+            let volumes = rule.volumes
+                .iter()
+                .chain(rule.coincidence.iter().map(|(volume, _)| volume))
+                .chain(rule.veto.iter().map(|(volume, _)| volume));
+            for volume in volumes {
+                let borrow = geometry.borrow_volume(volume);
+                let why = if ffi::get_error().value().is_some() {
+                    format!("unknown volume '{}'", volume)
+                } else if borrow.get_roles().deposits != ffi::Action::Record {
+                    format!("expected a 'record_deposits' role for '{}'", volume)
+                } else {
+                    continue
+                };
+                let what = format!("'{}' coincidence", name);
+                let err = Error::new(ValueError).what(&what).why(&why);
+                return Err(err.to_err())
+            }
+        }
+        let rules = rules
+            .iter()
+            .map(|(name, rule)| (name.clone(), rule.clone(), Vec::new()))
+            .collect();
+        Ok(Self { rules })
+    }
+
+    pub fn export(self, py: Python) -> PyResult<PyObject> {
+        let data = PyDict::new_bound(py);
+        for (name, _, accepted) in self.rules.into_iter() {
+            let array = PyArray::<TotalDeposit>::empty(py, &[accepted.len()])?;
+            for (i, deposit) in accepted.into_iter().enumerate() {
+                array.set(i, deposit)?;
+            }
+            data.set_item(name, array)?;
+        }
+        Ok(data.into_any().unbind())
+    }
+
+    pub fn memory(&self) -> usize {
+        let accepted: usize = self.rules
+            .iter()
+            .map(|(_, _, accepted)| vec_size(accepted))
+            .sum();
+        vec_size(&self.rules) + accepted
+    }
+
+    pub fn push(
+        &mut self,
+        event: usize,
+        deposits: &[(&str, f64)],
+        weight: f64,
+        random_index: [u64; 2],
+    ) {
+        for (_, rule, accepted) in self.rules.iter_mut() {
+            if let Some(value) = rule.accept(deposits) {
+                accepted.push(TotalDeposit { event, value, weight, random_index });
+            }
+        }
+    }
+}
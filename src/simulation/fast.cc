@@ -0,0 +1,255 @@
+// fmt library.
+#include <fmt/core.h>
+// User interface.
+#include "fast.h"
+// Geant4 interface.
+#include "G4Electron.hh"
+#include "G4FastSimulationManager.hh"
+#include "G4Gamma.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4Positron.hh"
+#include "G4ProductionCutsTable.hh"
+#include "G4RunManager.hh"
+#include "Randomize.hh"
+// C++ standard library.
+#include <algorithm>
+#include <cmath>
+
+
+// ============================================================================
+//
+// Fast simulation model.
+//
+// Electrons and positrons entering the envelope are killed. Their kinetic
+// energy is deposited according to a containment table, tabulated over the
+// log of the kinetic energy and over the depth to exit along the direction of
+// motion.
+//
+// ============================================================================
+
+FastModelImpl::FastModelImpl(
+    const std::string & name,
+    G4Region * envelope
+) : G4VFastSimulationModel(name, envelope) {}
+
+G4bool FastModelImpl::IsApplicable(const G4ParticleDefinition & definition) {
+    return (&definition == G4Electron::Electron()) ||
+           (&definition == G4Positron::Positron());
+}
+
+G4bool FastModelImpl::ModelTrigger(const G4FastTrack & fastTrack) {
+    if (!this->enabled) {
+        return false;
+    }
+    auto && energy = fastTrack.GetPrimaryTrack()->GetKineticEnergy();
+    return std::log(energy / CLHEP::MeV) <= this->log_energy_max;
+}
+
+void FastModelImpl::DoIt(
+    const G4FastTrack & fastTrack,
+    G4FastStep & fastStep
+) {
+    auto && track = fastTrack.GetPrimaryTrack();
+    auto && energy = track->GetKineticEnergy();
+    auto && depth = fastTrack.GetEnvelopeSolid()->DistanceToOut(
+        fastTrack.GetPrimaryTrackLocalPosition(),
+        fastTrack.GetPrimaryTrackLocalDirection()
+    );
+    auto && containment = this->Containment(
+        energy / CLHEP::MeV,
+        depth / CLHEP::cm
+    );
+
+    fastStep.KillPrimaryTrack();
+    fastStep.ProposePrimaryTrackPathLength(0.0);
+    fastStep.ProposeTotalEnergyDeposited(energy * containment);
+
+    if (track->GetDefinition() == G4Positron::Positron()) {
+        // Positrons annihilate at rest.
+        const double cos_theta = 2.0 * G4UniformRand() - 1.0;
+        const double sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
+        const double phi = CLHEP::twopi * G4UniformRand();
+        const G4ThreeVector direction(
+            sin_theta * std::cos(phi),
+            sin_theta * std::sin(phi),
+            cos_theta
+        );
+        fastStep.SetNumberOfSecondaryTracks(2);
+        for (auto sign: { 1.0, -1.0 }) {
+            G4DynamicParticle photon(
+                G4Gamma::Gamma(),
+                sign * direction,
+                CLHEP::electron_mass_c2
+            );
+            fastStep.CreateSecondaryTrack(
+                photon,
+                track->GetPosition(),
+                track->GetGlobalTime(),
+                false
+            );
+        }
+    }
+}
+
+double FastModelImpl::Containment(double energy, double depth) const {
+    // Locate the nodes, which are set at bins centres, with clamping.
+    auto locate = [](double x, size_t n, size_t & i0, size_t & i1) {
+        double u = std::clamp(x * n - 0.5, 0.0, (double)(n - 1));
+        i0 = std::min((size_t)u, n - 1);
+        i1 = std::min(i0 + 1, n - 1);
+        return u - i0;
+    };
+
+    size_t i0, i1, j0, j1;
+    const double hi = locate(
+        (std::log(energy) - this->log_energy_min) /
+            (this->log_energy_max - this->log_energy_min),
+        this->n_energy,
+        i0,
+        i1
+    );
+    const double hj = locate(
+        depth / this->depth_max,
+        this->n_depth,
+        j0,
+        j1
+    );
+
+    auto && v = this->values;
+    const size_t n = this->n_depth;
+    const double c0 = v[i0 * n + j0] * (1.0 - hj) + v[i0 * n + j1] * hj;
+    const double c1 = v[i1 * n + j0] * (1.0 - hj) + v[i1 * n + j1] * hj;
+    return std::clamp(c0 * (1.0 - hi) + c1 * hi, 0.0, 1.0);
+}
+
+void FastModelImpl::Disable() {
+    this->enabled = false;
+}
+
+void FastModelImpl::Enable(const FastTable & table) {
+    this->log_energy_min = std::log(table.energy_min);
+    this->log_energy_max = std::log(table.energy_max);
+    this->depth_max = table.depth_max;
+    this->n_energy = table.shape[0];
+    this->n_depth = table.shape[1];
+    this->values.assign(table.values.begin(), table.values.end());
+    this->enabled = true;
+}
+
+
+// ============================================================================
+//
+// Fast simulation manager.
+//
+// Each fast volume is promoted to a dedicated region, which lives as long as
+// the corresponding geometry.
+//
+// ============================================================================
+
+void FastImpl::Reset() {
+    auto && store = *G4LogicalVolumeStore::GetInstance();
+    for (auto && [_, envelope]: this->envelopes) {
+        // Detach the root volume, if still alive. Otherwise, the volume would
+        // refer to a dangling region.
+        auto && logical = envelope.logical;
+        auto && region = envelope.region;
+        if ((std::find(store.begin(), store.end(), logical) != store.end()) &&
+            (logical->GetRegion() == region.get())) {
+            region->RemoveRootLogicalVolume(logical, false);
+            logical->SetRegionRootFlag(false);
+            logical->SetRegion(nullptr);
+        }
+
+        // The model must be deleted before its manager, which must itself be
+        // deleted before its envelope.
+        auto manager = region->GetFastSimulationManager();
+        envelope.model.reset(nullptr);
+        delete manager;
+        region.reset(nullptr);
+    }
+    this->envelopes.clear();
+}
+
+void FastImpl::Update() {
+    auto id = RUN_AGENT->geometry().id();
+    if (id != this->geometry_id) {
+        this->Reset();
+        this->geometry_id = id;
+    }
+    for (auto && [_, envelope]: this->envelopes) {
+        envelope.model->Disable();
+    }
+
+    auto && models = RUN_AGENT->fast_models();
+    if (models.empty()) {
+        return;
+    }
+
+    // Map the physical volumes of the current geometry.
+    std::map<std::string, G4VPhysicalVolume *> volumes;
+    std::vector<G4VPhysicalVolume *> stack = { RUN_AGENT->geometry().world() };
+    while (!stack.empty()) {
+        auto physical = stack.back();
+        stack.pop_back();
+        volumes[physical->GetName()] = physical;
+        auto && logical = physical->GetLogicalVolume();
+        for (size_t i = 0; i < logical->GetNoDaughters(); i++) {
+            auto && daughter = logical->GetDaughter(i);
+            if (daughter->IsParameterised()) continue;
+            stack.push_back(daughter);
+        }
+    }
+
+    // Enable fast models.
+    bool modified = false;
+    for (auto && model: models) {
+        std::string path(model.volume);
+        auto envelope = this->envelopes.find(path);
+        if (envelope == this->envelopes.end()) {
+            auto && volume = volumes.find(path);
+            if (volume == volumes.end()) {
+                auto msg = fmt::format(
+                    "bad fast model (unknown volume '{}')",
+                    path
+                );
+                set_error(ErrorType::ValueError, msg.c_str());
+                return;
+            }
+            auto && logical = volume->second->GetLogicalVolume();
+            if (logical->IsRootRegion()) {
+                auto msg = fmt::format(
+                    "bad fast model (volume '{}' already defines a region)",
+                    path
+                );
+                set_error(ErrorType::ValueError, msg.c_str());
+                return;
+            }
+
+            auto region = new G4Region(fmt::format("{}@fast", path));
+            region->AddRootLogicalVolume(logical);
+            region->SetProductionCuts(
+                G4ProductionCutsTable::GetProductionCutsTable()
+                    ->GetDefaultProductionCuts()
+            );
+            Envelope value;
+            value.logical = logical;
+            value.region.reset(region);
+            value.model.reset(new FastModelImpl(path, region));
+            envelope = this->envelopes.emplace(path, std::move(value)).first;
+            modified = true;
+        }
+        envelope->second.model->Enable(model.table);
+    }
+
+    if (modified) {
+        auto manager = G4RunManager::GetRunManager();
+        if (manager != nullptr) {
+            manager->GeometryHasBeenModified();
+        }
+    }
+}
+
+FastImpl * FastImpl::Get() {
+    static FastImpl * instance = new FastImpl();
+    return instance;
+}
@@ -0,0 +1,59 @@
+#pragma once
+// Geant4 interface.
+#include "G4Region.hh"
+#include "G4VFastSimulationModel.hh"
+// User interface.
+#include "calzone.h"
+// C++ standard library.
+#include <map>
+
+
+struct FastModelImpl: public G4VFastSimulationModel {
+    FastModelImpl(const std::string & name, G4Region * envelope);
+    FastModelImpl(const FastModelImpl &) = delete; // Forbid copy.
+
+    // Geant4 interface.
+    G4bool IsApplicable(const G4ParticleDefinition &);
+    G4bool ModelTrigger(const G4FastTrack &);
+    void DoIt(const G4FastTrack &, G4FastStep &);
+
+    // User interface.
+    void Disable();
+    void Enable(const FastTable &);
+
+private:
+    double Containment(double energy, double depth) const;
+
+    // User interface.
+    bool enabled = false;
+    double log_energy_min = 0.0;
+    double log_energy_max = 0.0;
+    double depth_max = 0.0;
+    size_t n_energy = 0;
+    size_t n_depth = 0;
+    std::vector<double> values;
+};
+
+struct FastImpl {
+    FastImpl(const FastImpl &) = delete; // Forbid copy.
+
+    // User interface.
+    void Update();
+
+    static FastImpl * Get();
+
+private:
+    FastImpl() = default;
+
+    struct Envelope {
+        G4LogicalVolume * logical;
+        std::unique_ptr<G4Region> region;
+        std::unique_ptr<FastModelImpl> model;
+    };
+
+    void Reset();
+
+    // User interface.
+    std::map<std::string, Envelope> envelopes;
+    std::uint64_t geometry_id = 0;
+};
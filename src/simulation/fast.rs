@@ -0,0 +1,323 @@
+use crate::utils::error::Error;
+use crate::utils::error::ErrorKind::{IndexError, TypeError, ValueError};
+use crate::utils::numpy::PyArray;
+use indexmap::IndexMap;
+use pyo3::prelude::*;
+use pyo3::types::{IntoPyDict, PyDict};
+use super::{ffi, Physics, Simulation};
+use super::sampler::{SamplerMode, TotalDeposit};
+use super::tally::TallyBinning;
+
+
+// ===============================================================================================
+//
+// Fast models (containment tables).
+//
+// Tables are serialised as a compact little-endian binary format, i.e. a header followed by
+// f32 values, row-major w.r.t. (energy, depth).
+//
+// ===============================================================================================
+
+const MAGIC: &[u8; 4] = b"CZFT";
+const VERSION: u32 = 1;
+const WHAT: &str = "fast model";
+
+impl ffi::FastTable {
+    pub fn dump(&self, path: &str) -> PyResult<()> {
+        let mut bytes = Vec::<u8>::with_capacity(44 + 4 * self.values.len());
+        bytes.extend_from_slice(MAGIC);
+        bytes.extend_from_slice(&VERSION.to_le_bytes());
+        for n in self.shape {
+            bytes.extend_from_slice(&(n as u32).to_le_bytes());
+        }
+        for x in [self.energy_min, self.energy_max, self.depth_max] {
+            bytes.extend_from_slice(&x.to_le_bytes());
+        }
+        for value in self.values.iter() {
+            bytes.extend_from_slice(&(*value as f32).to_le_bytes());
+        }
+        std::fs::write(path, bytes)?;
+        Ok(())
+    }
+
+    pub fn load(path: &str) -> PyResult<Self> {
+        let bad_format = |why: &str| -> PyErr {
+            let why = format!("{}: {}", path, why);
+            Error::new(TypeError).what(WHAT).why(&why).to_err()
+        };
+
+        let bytes = std::fs::read(path)?;
+        let mut reader = Reader { bytes: &bytes, offset: 0 };
+        let eof = || bad_format("unexpected end-of-file");
+        if reader.take(4).ok_or_else(eof)? != MAGIC {
+            return Err(bad_format("not a calzone table"))
+        }
+        let version = reader.u32().ok_or_else(eof)?;
+        if version != VERSION {
+            let why = format!("unsupported version ({})", version);
+            return Err(bad_format(&why))
+        }
+        let n_energy = reader.u32().ok_or_else(eof)? as usize;
+        let n_depth = reader.u32().ok_or_else(eof)? as usize;
+        let energy_min = reader.f64().ok_or_else(eof)?;
+        let energy_max = reader.f64().ok_or_else(eof)?;
+        let depth_max = reader.f64().ok_or_else(eof)?;
+        if (n_energy == 0) || (n_depth == 0) {
+            return Err(bad_format("empty table"))
+        }
+        if !(energy_min > 0.0) || !(energy_max > energy_min) || !(depth_max > 0.0) ||
+           !energy_max.is_finite() || !depth_max.is_finite() {
+            return Err(bad_format("bad table range"))
+        }
+        let size = n_energy * n_depth;
+        let values = (0..size)
+            .map(|_| reader.f32().map(|value| value as f64))
+            .collect::<Option<Vec<f64>>>()
+            .ok_or_else(eof)?;
+        if reader.offset != bytes.len() {
+            return Err(bad_format("unexpected trailing data"))
+        }
+
+        let table = Self {
+            energy_min,
+            energy_max,
+            depth_max,
+            shape: [n_energy, n_depth],
+            values,
+        };
+        Ok(table)
+    }
+}
+
+struct Reader<'a> {
+    bytes: &'a [u8],
+    offset: usize,
+}
+
+impl<'a> Reader<'a> {
+    fn take(&mut self, n: usize) -> Option<&'a [u8]> {
+        let end = self.offset + n;
+        if end > self.bytes.len() {
+            None
+        } else {
+            let chunk = &self.bytes[self.offset..end];
+            self.offset = end;
+            Some(chunk)
+        }
+    }
+
+    fn f32(&mut self) -> Option<f32> {
+        self.take(4).map(|chunk| f32::from_le_bytes(chunk.try_into().unwrap()))
+    }
+
+    fn f64(&mut self) -> Option<f64> {
+        self.take(8).map(|chunk| f64::from_le_bytes(chunk.try_into().unwrap()))
+    }
+
+    fn u32(&mut self) -> Option<u32> {
+        self.take(4).map(|chunk| u32::from_le_bytes(chunk.try_into().unwrap()))
+    }
+}
+
+pub fn load_models(models: &IndexMap<String, String>) -> PyResult<Vec<ffi::FastModel>> {
+    models
+        .iter()
+        .map(|(volume, path)| {
+            let table = ffi::FastTable::load(path)?;
+            Ok(ffi::FastModel { volume: volume.clone(), table })
+        })
+        .collect()
+}
+
+
+// ===============================================================================================
+//
+// Calibration.
+//
+// Electrons are generated uniformly inside the volume, with a log-uniform kinetic energy. The
+// containment is the mean energy fraction deposited in the volume (excluding daughters), binned
+// w.r.t. the initial kinetic energy and the depth to exit along the initial direction.
+//
+// ===============================================================================================
+
+pub fn calibrate(
+    py: Python,
+    simulation: &Simulation,
+    volume: &str,
+    path: &str,
+    energy: [f64; 2],
+    bins: [usize; 2],
+    events: usize,
+) -> PyResult<()> {
+    let [energy_min, energy_max] = energy;
+    if !(energy_min > 0.0) || !(energy_max > energy_min) {
+        let why = format!(
+            "expected an increasing range of positive values, found [{}, {}]",
+            energy_min,
+            energy_max,
+        );
+        let err = Error::new(ValueError).what("energy").why(&why);
+        return Err(err.to_err())
+    }
+    let [n_energy, n_depth] = bins;
+    if (n_energy == 0) || (n_depth == 0) {
+        let why = format!("expected strictly positive values, found [{}, {}]", n_energy, n_depth);
+        let err = Error::new(ValueError).what("bins").why(&why);
+        return Err(err.to_err())
+    }
+
+    let geometry = simulation.geometry
+        .as_ref()
+        .ok_or_else(|| Error::new(ValueError).what("geometry").why("undefined").to_err())?;
+    let borrow = geometry.bind(py).borrow().0.clone();
+    let target = borrow.borrow_volume(volume);
+    if let Some(msg) = ffi::get_error().value() {
+        let err = Error::new(IndexError).what("volume").why(msg);
+        return Err(err.into())
+    }
+
+    // Run a full simulation, recording deposits in the target volume. Note that the fast
+    // simulation process is registered (but not used), since fast runs are expected next.
+    let physics = {
+        let physics = simulation.physics.bind(py).borrow();
+        let mut settings = physics.0;
+        settings.fast = true;
+        Py::new(py, Physics (settings, physics.1.clone()))?
+    };
+    let calibration = Simulation {
+        coincidences: IndexMap::new(),
+        fast_models: IndexMap::new(),
+        geometry: Some(geometry.clone_ref(py)),
+        max_samples: None,
+        physics,
+        random: simulation.random.clone_ref(py),
+        sample_deposits: Some(SamplerMode::Brief),
+        sample_particles: false,
+        scoring: IndexMap::new(),
+        secondaries: true,
+        tally: TallyBinning::default(),
+        tracking: false,
+    };
+    let particles = Bound::new(py, calibration.particles(py, None)?)?
+        .call_method1("inside", (volume,))?
+        .call_method1("pid", (11,))?
+        .call_method(
+            "powerlaw",
+            (energy_min, energy_max),
+            Some(&[("exponent", -1.0)].into_py_dict_bound(py)),
+        )?
+        .call_method1("generate", (events,))?;
+
+    let roles = target.get_roles();
+    let mut recording = roles;
+    recording.deposits = ffi::Action::Record;
+    target.set_roles(recording).to_result()?;
+    let result = calibration.run(&particles, None, None, None);
+    target.set_roles(roles).to_result()?;
+    let result = result?;
+
+    let particles: &PyArray<ffi::SampledParticle> = particles.extract()?;
+    let particles = unsafe { particles.slice()? };
+    let mut deposits = vec![0.0; particles.len()];
+    let result = result.bind(py);
+    let result = match result.downcast::<PyDict>() {
+        Ok(result) => result.clone(),
+        Err(_) => result.getattr("deposits")?.downcast_into::<PyDict>()?, // E.g. with tallies.
+    };
+    if let Some(values) = result.get_item(volume)? {
+        let values: &PyArray<TotalDeposit> = values.extract()?;
+        for value in unsafe { values.slice()? } {
+            deposits[value.event] = value.value;
+        }
+    }
+
+    // Compute depths to exit, ignoring daughter volumes (as Geant4 DistanceToOut does for fast
+    // models). That is, leading traced segments are summed up as long as they remain within the
+    // volume, or within its daughters.
+    let mut positions = Vec::<f64>::with_capacity(3 * particles.len());
+    let mut directions = Vec::<f64>::with_capacity(3 * particles.len());
+    for particle in particles.iter() {
+        positions.extend_from_slice(&particle.state.position);
+        directions.extend_from_slice(&particle.state.direction);
+    }
+    let mut segments = Vec::<ffi::TraceSegment>::new();
+    let mut volumes = Vec::<ffi::TraceVolume>::new();
+    borrow.trace(&positions, &directions, &mut segments, &mut volumes)
+        .to_result()?;
+
+    let prefix = format!("{}.", volume);
+    let inside: Vec<bool> = volumes
+        .iter()
+        .map(|other| (other.path == volume) || other.path.starts_with(&prefix))
+        .collect();
+    let mut depths: Vec<Option<f64>> = vec![None; particles.len()];
+    let mut exited = vec![false; particles.len()];
+    for segment in segments.iter() {
+        if exited[segment.ray] {
+            continue
+        }
+        if inside[segment.volume] {
+            *depths[segment.ray].get_or_insert(0.0) += segment.length;
+        } else {
+            exited[segment.ray] = true;
+        }
+    }
+    let depth_max = depths
+        .iter()
+        .filter_map(|depth| *depth)
+        .fold(0.0, f64::max);
+    if !(depth_max > 0.0) {
+        let why = format!("no valid sample in '{}'", volume);
+        let err = Error::new(ValueError).what("calibration").why(&why);
+        return Err(err.to_err())
+    }
+
+    // Bin the containment.
+    let log_min = energy_min.ln();
+    let log_max = energy_max.ln();
+    let mut sums = vec![0.0; n_energy * n_depth];
+    let mut counts = vec![0_usize; n_energy * n_depth];
+    for ((particle, depth), deposit) in particles.iter().zip(depths.iter()).zip(deposits.iter()) {
+        let Some(depth) = depth else { continue };
+        let energy = particle.state.energy;
+        let u = (energy.ln() - log_min) / (log_max - log_min);
+        let i = ((u * n_energy as f64) as usize).min(n_energy - 1);
+        let j = ((depth / depth_max * n_depth as f64) as usize).min(n_depth - 1);
+        sums[i * n_depth + j] += deposit / energy;
+        counts[i * n_depth + j] += 1;
+    }
+
+    // Average, and fill empty bins from their closest neighbour (depth-wise).
+    let mut values = vec![0.0; n_energy * n_depth];
+    for i in 0..n_energy {
+        let row = i * n_depth;
+        let filled: Vec<usize> = (0..n_depth)
+            .filter(|j| counts[row + j] > 0)
+            .collect();
+        if filled.is_empty() {
+            let why = format!(
+                "no sample in energy bin [{:.3e}, {:.3e}] MeV (consider increasing events)",
+                (log_min + (log_max - log_min) * (i as f64) / (n_energy as f64)).exp(),
+                (log_min + (log_max - log_min) * ((i + 1) as f64) / (n_energy as f64)).exp(),
+            );
+            let err = Error::new(ValueError).what("calibration").why(&why);
+            return Err(err.to_err())
+        }
+        for j in 0..n_depth {
+            let k = filled
+                .iter()
+                .min_by_key(|k| k.abs_diff(j))
+                .unwrap();
+            values[row + j] = sums[row + k] / (counts[row + k] as f64);
+        }
+    }
+
+    let table = ffi::FastTable {
+        energy_min,
+        energy_max,
+        depth_max,
+        shape: [n_energy, n_depth],
+        values,
+    };
+    table.dump(path)
+}
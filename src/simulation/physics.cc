@@ -1,6 +1,9 @@
+// fmt library.
+#include <fmt/core.h>
 // User interface.
 #include "physics.h"
 // Geant4 interface.
+#include "G4BiasingProcessInterface.hh"
 #include "G4EmDNAPhysics.hh"
 #include "G4EmLivermorePhysics.hh"
 #include "G4EmStandardPhysics.hh"
@@ -15,10 +18,27 @@
 #include "G4HadronPhysicsQGSP_BERT_HP.hh"
 #include "G4HadronPhysicsQGSP_BIC.hh"
 #include "G4HadronPhysicsQGSP_BIC_HP.hh"
+#include "G4ParticleTable.hh"
+#include "G4PhysicsTable.hh"
+#include "G4ProcessManager.hh"
 #include "G4RunManager.hh"
 #include "G4UImanager.hh"
+#include "G4VEmModel.hh"
+#include "G4VEmProcess.hh"
+#include "G4VEnergyLossProcess.hh"
+#include "G4VMultipleScattering.hh"
+// C++ standard library.
+#include <cstdlib>
+#include <random>
 
 
+void PhysicsImpl::BuildPhysicsTable() {
+    // Physics tables are built (or retrieved) by the first bunch of events of
+    // a run, if needed.
+    TraceScope trace("physics tables");
+    this->G4VUserPhysicsList::BuildPhysicsTable();
+}
+
 void PhysicsImpl::ConstructParticle() {
     if (this->decayPhysics) {
         this->decayPhysics->ConstructParticle();
@@ -41,6 +61,15 @@ void PhysicsImpl::ConstructParticle() {
     if (this->ionPhysics) {
         this->ionPhysics->ConstructParticle();
     }
+    if (this->fastPhysics) {
+        this->fastPhysics->ConstructParticle();
+    }
+    if (this->adjointPhysics) {
+        this->adjointPhysics->ConstructParticle();
+    }
+    if (this->biasingPhysics) {
+        this->biasingPhysics->ConstructParticle();
+    }
 }
 
 void PhysicsImpl::ConstructProcess() {
@@ -66,6 +95,33 @@ void PhysicsImpl::ConstructProcess() {
     if (this->ionPhysics) {
         this->ionPhysics->ConstructProcess();
     }
+    if (this->fastPhysics) {
+        this->fastPhysics->ConstructProcess();
+    }
+    if (this->adjointPhysics) {
+        // Adjoint processes rely on the forward electromagnetic ones.
+        this->adjointPhysics->ConstructProcess();
+    }
+    if (this->biasingPhysics) {
+        // Biased processes must be wrapped last.
+        this->biasingPhysics->ConstructProcess();
+    }
+    this->constructed = true;
+}
+
+double PhysicsImpl::AdjointEnergyMax() const {
+    return this->adjointPhysics ? this->adjointPhysics->energy_max : 0.0;
+}
+
+void PhysicsImpl::ClearCache() {
+    if (!this->cache_directory.empty()) {
+        std::error_code ec;
+        std::filesystem::remove_all(this->cache_directory, ec);
+        this->cache_directory.clear();
+    }
+    this->cached_tables.clear();
+    this->current_key.clear();
+    this->ResetPhysicsTableRetrieved();
 }
 
 void PhysicsImpl::DisableVerbosity() const
@@ -75,9 +131,48 @@ void PhysicsImpl::DisableVerbosity() const
     UImanager->ApplyCommand("/process/had/verbose 0");
 }
 
+void PhysicsImpl::SetAdjointEnergyMax(double value) {
+    // Note that this only applies if adjoint physics is not yet built.
+    this->adjoint_energy_max = value;
+}
+
 void PhysicsImpl::Update() {
+    TraceScope trace("PhysicsImpl::Update");
     auto && definition = RUN_AGENT->physics();
     bool modified = false;
+    const bool fast = definition.fast || !RUN_AGENT->fast_models().empty() ||
+        this->fastPhysics;
+    const bool adjoint = definition.adjoint || RUN_AGENT->is_adjoint() ||
+        this->adjointPhysics;
+    const double adjoint_energy_max = this->adjointPhysics ?
+        this->adjointPhysics->energy_max : this->adjoint_energy_max;
+    auto biased = this->biased_particles;
+    for (auto && rule: RUN_AGENT->biasing()) {
+        biased.insert(std::string(rule.particle));
+    }
+    std::string biasing;
+    for (auto && particle: biased) {
+        biasing += fmt::format("{}{}", biasing.empty() ? "" : ",", particle);
+    }
+
+    // Rebind cached tables if the configuration changed since the last run.
+    // Note that the key also reflects the set of constructed processes (i.e.
+    // fast simulation, adjoint and biasing wrappers).
+    auto key = fmt::format(
+        "{}/{}/{}/{:.6e}/{}/{:.6e}/{}",
+        RUN_AGENT->geometry().id(),
+        (unsigned int)definition.em_model,
+        (unsigned int)definition.had_model,
+        definition.default_cut,
+        fast ? 1 : 0,
+        adjoint ? adjoint_energy_max : 0.0,
+        biasing
+    );
+    if (this->constructed && (key != this->current_key)) {
+        this->SwitchTables(key);
+    }
+    this->current_key = key;
+
     if (!this->decayPhysics) {
         this->decayPhysics.reset(new G4DecayPhysics());
         modified = true;
@@ -185,6 +280,65 @@ void PhysicsImpl::Update() {
         modified = true;
     }
 
+    // Adjoint physics must also be enabled before the first run.
+    if ((definition.adjoint || RUN_AGENT->is_adjoint()) &&
+        !this->adjointPhysics) {
+        if (this->constructed) {
+            set_error(
+                ErrorType::ValueError,
+                "bad physics (adjoint physics must be enabled before the "
+                "first run)"
+            );
+            return;
+        }
+        this->adjointPhysics.reset(
+            new AdjointPhysics(this->adjoint_energy_max)
+        );
+        modified = true;
+    }
+
+    // Similarly, biased particles must be declared before processes are
+    // constructed.
+    for (auto && rule: RUN_AGENT->biasing()) {
+        std::string particle(rule.particle);
+        if (this->biased_particles.count(particle) > 0) {
+            continue;
+        }
+        if (this->constructed) {
+            auto msg = fmt::format(
+                "bad biasing rule (cannot bias '{}' after the first run)",
+                particle
+            );
+            set_error(ErrorType::ValueError, msg.c_str());
+            return;
+        }
+        if (!this->biasingPhysics) {
+            this->biasingPhysics.reset(new G4GenericBiasingPhysics());
+        }
+        this->biasingPhysics->PhysicsBias(particle);
+        this->biased_particles.insert(particle);
+        modified = true;
+    }
+
+    // The fast simulation process must also be registered before processes
+    // are constructed, while fast models are attached to volumes at run time.
+    // Note that calibration runs register it as well (since they are expected
+    // to precede fast runs).
+    if (fast && !this->fastPhysics) {
+        if (this->constructed) {
+            set_error(
+                ErrorType::ValueError,
+                "bad fast model (fast models must be set before the first "
+                "run, or after a calibration)"
+            );
+            return;
+        }
+        this->fastPhysics.reset(new G4FastSimulationPhysics());
+        this->fastPhysics->ActivateFastSimulation("e-");
+        this->fastPhysics->ActivateFastSimulation("e+");
+        modified = true;
+    }
+
     if (modified) {
         auto manager = G4RunManager::GetRunManager();
         if (manager != nullptr) {
@@ -193,7 +347,148 @@ void PhysicsImpl::Update() {
     }
 }
 
+// Physics tables are cached on disk, per configuration, using Geant4 store and
+// retrieve mechanism. The tables of the previous configuration are stored when
+// switching, and the least recently used ones are evicted once the cache
+// exceeds its budget (in MB, set by the CALZONE_PHYSICS_CACHE variable).
+
+std::uintmax_t PhysicsImpl::CacheBudget() const {
+    constexpr double DEFAULT_BUDGET = 512.0; // MB
+    double budget = DEFAULT_BUDGET;
+    auto value = std::getenv("CALZONE_PHYSICS_CACHE");
+    if (value != nullptr) {
+        char * end = nullptr;
+        double tmp = std::strtod(value, &end);
+        if ((end != value) && (*end == '\0')) {
+            budget = (tmp > 0.0) ? tmp : 0.0;
+        }
+    }
+    return (std::uintmax_t)(budget * 1E+06);
+}
+
+void PhysicsImpl::SwitchTables(const std::string & key) {
+    auto budget = this->CacheBudget();
+    if (budget == 0) {
+        this->ClearCache();
+        return;
+    }
+
+    // Store the tables of the previous configuration, if not already cached.
+    std::error_code ec;
+    if (!this->current_key.empty() &&
+        (this->cached_tables.count(this->current_key) == 0)) {
+        if (this->cache_directory.empty()) {
+            std::random_device device;
+            auto tag = ((std::uint64_t)device() << 32) | device();
+            auto name = fmt::format("calzone-{:016x}", tag);
+            this->cache_directory =
+                std::filesystem::temp_directory_path(ec) / name;
+        }
+        auto directory = this->cache_directory /
+            fmt::format("tables-{}", this->cache_clock);
+        std::filesystem::create_directories(directory, ec);
+        bool stored = !ec && this->StorePhysicsTable(directory.string());
+        std::uintmax_t size = 0;
+        if (stored) {
+            for (auto && entry:
+                 std::filesystem::recursive_directory_iterator(directory, ec)) {
+                if (entry.is_regular_file(ec)) {
+                    size += entry.file_size(ec);
+                }
+            }
+        }
+        if (stored && (size <= budget)) {
+            this->cached_tables[this->current_key] =
+                { directory, size, this->cache_clock++ };
+        } else {
+            std::filesystem::remove_all(directory, ec);
+        }
+    }
+
+    // Evict the least recently used tables, until the budget is met.
+    for (;;) {
+        std::uintmax_t total = 0;
+        auto lru = this->cached_tables.end();
+        for (auto it = this->cached_tables.begin();
+             it != this->cached_tables.end(); it++) {
+            total += it->second.size;
+            if ((lru == this->cached_tables.end()) ||
+                (it->second.last_used < lru->second.last_used)) {
+                lru = it;
+            }
+        }
+        if (total <= budget) break;
+        std::filesystem::remove_all(lru->second.directory, ec);
+        this->cached_tables.erase(lru);
+    }
+
+    // Rebind cached tables, if any.
+    auto cached = this->cached_tables.find(key);
+    if (cached != this->cached_tables.end()) {
+        cached->second.last_used = this->cache_clock++;
+        this->SetPhysicsTableRetrieved(cached->second.directory.string());
+    } else {
+        this->ResetPhysicsTableRetrieved();
+    }
+}
+
 PhysicsImpl * PhysicsImpl::Get() {
     static PhysicsImpl * instance = new PhysicsImpl();
     return instance;
 }
+
+
+// The memory of physics tables is estimated from electromagnetic processes
+// tables (which dominate), by summing the lengths of their physics vectors.
+// Shared tables are accounted for once.
+
+std::size_t physics_memory() {
+    std::set<const void *> visited;
+    std::size_t size = 0;
+    auto add_table = [&](const G4PhysicsTable * table) {
+        if ((table == nullptr) || !visited.insert(table).second) return;
+        size += sizeof(G4PhysicsTable) +
+            table->capacity() * sizeof(G4PhysicsVector *);
+        for (auto vector: *table) {
+            if ((vector == nullptr) || !visited.insert(vector).second) {
+                continue;
+            }
+            size += sizeof(G4PhysicsVector) +
+                3 * vector->GetVectorLength() * sizeof(double);
+        }
+    };
+
+    auto iterator = G4ParticleTable::GetParticleTable()->GetIterator();
+    iterator->reset();
+    while ((*iterator)()) {
+        auto manager = iterator->value()->GetProcessManager();
+        if (manager == nullptr) continue;
+        auto processes = manager->GetProcessList();
+        for (std::size_t i = 0; i < processes->size(); i++) {
+            G4VProcess * process = (*processes)[i];
+            auto biasing = dynamic_cast<G4BiasingProcessInterface *>(process);
+            if (biasing != nullptr) {
+                process = biasing->GetWrappedProcess();
+            }
+            if (auto loss = dynamic_cast<G4VEnergyLossProcess *>(process)) {
+                add_table(loss->DEDXTable());
+                add_table(loss->IonisationTable());
+                add_table(loss->RangeTableForLoss());
+                add_table(loss->InverseRangeTable());
+                add_table(loss->LambdaTable());
+            } else if (auto em = dynamic_cast<G4VEmProcess *>(process)) {
+                add_table(em->LambdaTable());
+                add_table(em->LambdaTablePrim());
+            } else if (auto msc =
+                       dynamic_cast<G4VMultipleScattering *>(process)) {
+                for (G4int j = 0; j < msc->NumberOfModels(); j++) {
+                    auto model = msc->EmModel(j);
+                    if (model != nullptr) {
+                        add_table(model->GetCrossSectionTable());
+                    }
+                }
+            }
+        }
+    }
+    return size;
+}
@@ -2,23 +2,34 @@
 // Geant4 interface.
 #include "G4DecayPhysics.hh"
 #include "G4EmExtraPhysics.hh"
+#include "G4FastSimulationPhysics.hh"
+#include "G4GenericBiasingPhysics.hh"
 #include "G4IonPhysics.hh"
 #include "G4HadronElasticPhysics.hh"
 #include "G4StoppingPhysics.hh"
 #include "G4VUserPhysicsList.hh"
 // User interface.
 #include "calzone.h"
+#include "adjoint.h"
+// C++ standard library.
+#include <filesystem>
+#include <map>
+#include <set>
 
 
 struct PhysicsImpl: public G4VUserPhysicsList {
     PhysicsImpl(const PhysicsImpl &) = delete; // Forbid copy.
 
     // Geant4 interface.
+    void BuildPhysicsTable();
     void ConstructParticle();
     void ConstructProcess();
 
     // User interface.
+    double AdjointEnergyMax() const;
+    void ClearCache();
     void DisableVerbosity() const;
+    void SetAdjointEnergyMax(double);
     void Update();
 
     static PhysicsImpl * Get();
@@ -27,9 +38,12 @@ private:
     PhysicsImpl() = default;
 
     // Geant4 interface.
+    std::unique_ptr<AdjointPhysics> adjointPhysics = nullptr;
+    std::unique_ptr<G4GenericBiasingPhysics> biasingPhysics = nullptr;
     std::unique_ptr<G4DecayPhysics> decayPhysics = nullptr;
     std::unique_ptr<G4VPhysicsConstructor> emPhysics = nullptr;
     std::unique_ptr<G4EmExtraPhysics> extraPhysics = nullptr;
+    std::unique_ptr<G4FastSimulationPhysics> fastPhysics = nullptr;
     std::unique_ptr<G4VPhysicsConstructor> hadPhysics = nullptr;
     std::unique_ptr<G4HadronElasticPhysics> hePhysics = nullptr;
     std::unique_ptr<G4StoppingPhysics> stoppingPhysics = nullptr;
@@ -38,4 +52,22 @@ private:
     // User interface.
     EmPhysicsModel current_em_model = EmPhysicsModel::None;
     HadPhysicsModel current_had_model = HadPhysicsModel::None;
+    std::set<std::string> biased_particles;
+    double adjoint_energy_max = AdjointPhysics::DEFAULT_ENERGY_MAX;
+    bool constructed = false;
+
+    // Tables cache (per physics configuration).
+    struct CachedTables {
+        std::filesystem::path directory;
+        std::uintmax_t size;
+        std::uint64_t last_used;
+    };
+
+    std::map<std::string, CachedTables> cached_tables;
+    std::filesystem::path cache_directory;
+    std::string current_key;
+    std::uint64_t cache_clock = 0;
+
+    std::uintmax_t CacheBudget() const;
+    void SwitchTables(const std::string & key);
 };
@@ -1,7 +1,9 @@
-use crate::utils::error::{Error, variant_error};
+use crate::utils::error::{Error, Failure, variant_failure};
 use crate::utils::error::ErrorKind::ValueError;
+use crate::utils::extract::{Extractor, Property, Tag, TryFromBound};
 use enum_variants_strings::EnumVariantsStrings;
 use pyo3::prelude::*;
+use pyo3::types::{PyDict, PyList};
 use super::ffi;
 
 
@@ -14,30 +16,64 @@ use super::ffi;
 /// Geant4 physics settings.
 #[derive(Default)]
 #[pyclass(module="calzone")]
-pub struct Physics (pub(crate) ffi::Physics);
+pub struct Physics (pub(crate) ffi::Physics, pub(crate) Vec<ffi::BiasingRule>);
 
 impl Physics {
     const DEFAULT_EM_MODEL: ffi::EmPhysicsModel = ffi::EmPhysicsModel::Standard;
     const DEFAULT_HAD_MODEL: ffi::HadPhysicsModel = ffi::HadPhysicsModel::None;
 
+    // Physics lists, without Python (e.g. for the native interface).
+    pub fn with_models(em_model: Option<&str>, had_model: Option<&str>) -> Result<Self, Failure> {
+        let mut physics = Self::default();
+        if let Some(em_model) = em_model {
+            physics.0.em_model = Self::em_model(Some(em_model))?;
+        }
+        if let Some(had_model) = had_model {
+            physics.0.had_model = Self::had_model(Some(had_model))?;
+        }
+        Ok(physics)
+    }
+
+    fn em_model(value: Option<&str>) -> Result<ffi::EmPhysicsModel, Failure> {
+        match value {
+            None => Ok(ffi::EmPhysicsModel::None),
+            Some(value) => EmPhysicsModel::from_str(value)
+                .map(|model| model.into())
+                .map_err(|options| variant_failure("bad model", value, options)),
+        }
+    }
+
+    fn had_model(value: Option<&str>) -> Result<ffi::HadPhysicsModel, Failure> {
+        match value {
+            None => Ok(ffi::HadPhysicsModel::None),
+            Some(value) => HadPhysicsModel::from_str(value)
+                .map(|model| model.into())
+                .map_err(|options| variant_failure("bad model", value, options)),
+        }
+    }
+
     pub fn none() ->  Self {
         let mut physics = ffi::Physics::default();
         physics.em_model = ffi::EmPhysicsModel::None;
         physics.had_model = ffi::HadPhysicsModel::None;
-        Self (physics)
+        Self (physics, Vec::new())
     }
 }
 
 #[pymethods]
 impl Physics {
     #[new]
-    #[pyo3(signature=(em_model=None, *, default_cut=None, had_model=None))]
+    #[pyo3(signature=(
+        em_model=None, *, adjoint=None, biasing=None, default_cut=None, had_model=None
+    ))]
     pub fn new(
         em_model: Option<&str>,
+        adjoint: Option<bool>,
+        biasing: Option<&Bound<PyAny>>,
         default_cut: Option<f64>,
         had_model: Option<&str>,
     ) -> PyResult<Self> {
-        let mut physics = Self (ffi::Physics::default());
+        let mut physics = Self (ffi::Physics::default(), Vec::new());
         if let Some(em_model) = em_model {
             physics.set_em_model(Some(em_model))?;
         }
@@ -47,9 +83,66 @@ impl Physics {
         if let Some(default_cut) = default_cut {
             physics.set_default_cut(default_cut)?;
         }
+        if let Some(adjoint) = adjoint {
+            physics.0.adjoint = adjoint;
+        }
+        if let Some(biasing) = biasing {
+            physics.set_biasing(Some(biasing))?;
+        }
         Ok(physics)
     }
 
+    /// Flag enabling adjoint physics.
+    #[getter]
+    fn get_adjoint(&self) -> bool {
+        self.0.adjoint
+    }
+
+    #[setter]
+    fn set_adjoint(&mut self, value: bool) {
+        self.0.adjoint = value;
+    }
+
+    /// Cross-section biasing rules.
+    #[getter]
+    fn get_biasing<'py>(&self, py: Python<'py>) -> PyResult<Option<Bound<'py, PyList>>> {
+        if self.1.is_empty() {
+            return Ok(None)
+        }
+        let rules = PyList::empty_bound(py);
+        for rule in self.1.iter() {
+            let dict = PyDict::new_bound(py);
+            dict.set_item("particle", rule.particle.as_str())?;
+            if !rule.process.is_empty() {
+                dict.set_item("process", rule.process.as_str())?;
+            }
+            dict.set_item("factor", rule.factor)?;
+            if !rule.volume.is_empty() {
+                dict.set_item("volume", rule.volume.as_str())?;
+            }
+            rules.append(dict)?;
+        }
+        Ok(Some(rules))
+    }
+
+    #[setter]
+    fn set_biasing(&mut self, value: Option<&Bound<PyAny>>) -> PyResult<()> {
+        let tag = Tag::new("", "biasing", None);
+        self.1 = match value {
+            None => Vec::new(),
+            Some(value) => if value.is_instance_of::<PyDict>() {
+                vec![ffi::BiasingRule::try_from_any(&tag, value)?]
+            } else {
+                let mut rules = Vec::new();
+                for item in value.iter()? {
+                    rules.push(ffi::BiasingRule::try_from_any(&tag, &item?)?);
+                }
+                rules
+            },
+        };
+        Ok(())
+    }
+
     /// Physics default cut, in cm.
     #[getter]
     fn get_default_cut(&self) -> f64 {
@@ -77,19 +170,8 @@ impl Physics {
 
     #[setter]
     pub fn set_em_model(&mut self, value: Option<&str>) -> PyResult<()> {
-        match value {
-            None => {
-                self.0.em_model = ffi::EmPhysicsModel::None;
-                Ok(())
-            },
-            Some(value) => match EmPhysicsModel::from_str(value) {
-                Ok(model) => {
-                    self.0.em_model = model.into();
-                    Ok(())
-                },
-                Err(options) => Err(variant_error("bad model", value, options)),
-            },
-        }
+        self.0.em_model = Self::em_model(value)?;
+        Ok(())
     }
 
     /// Hadronic physics list.
@@ -101,19 +183,43 @@ impl Physics {
 
     #[setter]
     pub fn set_had_model(&mut self, value: Option<&str>) -> PyResult<()> {
-        match value {
-            None => {
-                self.0.had_model = ffi::HadPhysicsModel::None;
-                Ok(())
-            },
-            Some(value) => match HadPhysicsModel::from_str(value) {
-                Ok(model) => {
-                    self.0.had_model = model.into();
-                    Ok(())
-                },
-                Err(options) => Err(variant_error("bad model", value, options)),
-            },
+        self.0.had_model = Self::had_model(value)?;
+        Ok(())
+    }
+}
+
+// ===============================================================================================
+//
+// Biasing rules.
+//
+// A rule scales the cross-section of a (wrapped) physics process for a given particle type,
+// optionally restricted to a given volume. An empty process (volume) matches all processes
+// (volumes).
+//
+// ===============================================================================================
+
+impl TryFromBound for ffi::BiasingRule {
+    fn try_from_any<'py>(tag: &Tag, value: &Bound<'py, PyAny>) -> PyResult<Self> {
+        const EXTRACTOR: Extractor<4> = Extractor::new([
+            Property::required_str("particle"),
+            Property::required_f64("factor"),
+            Property::new_str("process", ""),
+            Property::new_str("volume", ""),
+        ]);
+
+        let [particle, factor, process, volume] = EXTRACTOR.extract_any(tag, value, None)?;
+        let factor: f64 = factor.into();
+        if !(factor > 0.0) || !factor.is_finite() {
+            let why = format!("expected a strictly positive value, found {}", factor);
+            return Err(tag.bad().what("factor").why(why).to_err(ValueError));
         }
+        let rule = Self {
+            particle: particle.into(),
+            process: process.into(),
+            factor,
+            volume: volume.into(),
+        };
+        Ok(rule)
     }
 }
 
@@ -210,9 +316,11 @@ impl From<HadPhysicsModel> for ffi::HadPhysicsModel {
 
 impl Default for ffi::Physics {
     fn default() -> Self {
+        let adjoint = false;
         let default_cut = 0.1; // cm
         let em_model = Physics::DEFAULT_EM_MODEL;
+        let fast = false;
         let had_model = Physics::DEFAULT_HAD_MODEL;
-        Self { default_cut, em_model, had_model }
+        Self { adjoint, default_cut, em_model, fast, had_model }
     }
 }
@@ -0,0 +1,318 @@
+use crate::utils::error::Error;
+use crate::utils::error::ErrorKind::ValueError;
+use crate::utils::namespace::Namespace;
+use crate::utils::numpy::{PyArray, PyArrayMethods};
+use pyo3::prelude::*;
+use rand::Rng;
+use rand::distributions::Open01;
+use rand_pcg::Pcg64Mcg;
+use super::random::Random;
+use super::sampler::TotalDeposit;
+
+
+// ===============================================================================================
+//
+// Pile-up synthesis.
+//
+// Detector hits follow a Poisson process, with a rate given by the source activity times the
+// (weighted) fraction of simulated events that have a deposit. Hits occurring within the shaping
+// time of a pulse start are merged into this pulse (i.e. the shaping window is not extended).
+//
+// The time range is split into a fixed number of slices, which are generated in parallel. Since a
+// gap longer than the shaping time always starts a new pulse, only the leading hits of a slice
+// (up to its first such gap) depend on the previous slice. These hits are stitched sequentially.
+//
+// ===============================================================================================
+
+const SLICES: usize = 64;
+
+/// Synthesise a pile-up spectrum from per-event deposits.
+#[pyfunction]
+#[pyo3(signature=(deposits, /, activity, shaping_time, duration, *, bins=None, energy=None,
+                  events=None, random=None))]
+pub fn pileup<'py>(
+    py: Python<'py>,
+    deposits: &PyArray<TotalDeposit>,
+    activity: f64,
+    shaping_time: f64,
+    duration: f64,
+    bins: Option<usize>,
+    energy: Option<[f64; 2]>,
+    events: Option<usize>,
+    random: Option<Bound<'py, Random>>,
+) -> PyResult<PyObject> {
+    let bad_value = |what: &str, why: String| -> PyErr {
+        Error::new(ValueError).what(what).why(&why).to_err()
+    };
+
+    if !(activity > 0.0) {
+        let why = format!("expected a strictly positive value, found {}", activity);
+        return Err(bad_value("activity", why))
+    }
+    if !(shaping_time >= 0.0) {
+        let why = format!("expected a positive value, found {}", shaping_time);
+        return Err(bad_value("shaping_time", why))
+    }
+    if !(duration > 0.0) || !duration.is_finite() {
+        let why = format!("expected a strictly positive value, found {}", duration);
+        return Err(bad_value("duration", why))
+    }
+
+    let deposits = unsafe { deposits.slice()? };
+    if deposits.is_empty() {
+        return Err(bad_value("deposits", "empty array".to_string()))
+    }
+    let table = DepositsTable::new(deposits);
+    let events = events.unwrap_or_else(|| table.events);
+    if events < table.events {
+        let why = format!("expected a value of {} or more, found {}", table.events, events);
+        return Err(bad_value("events", why))
+    }
+
+    let bins = bins.unwrap_or(Shaper::DEFAULT_BINS);
+    if bins == 0 {
+        return Err(bad_value("bins", "expected a strictly positive value, found 0".to_string()))
+    }
+    let energy = energy.unwrap_or_else(|| [0.0, 2.0 * table.max_value]);
+    if !(energy[0] >= 0.0) || !(energy[1] > energy[0]) {
+        let why = format!(
+            "expected an increasing range of positive values, found [{}, {}]",
+            energy[0],
+            energy[1],
+        );
+        return Err(bad_value("energy", why))
+    }
+    let shaper = Shaper { shaping_time, energy, bins };
+
+    // Seed independent streams, per time slice.
+    let rngs: Vec<Pcg64Mcg> = match random {
+        None => {
+            let mut random = Random::new(None, None, None)?;
+            (0..SLICES).map(|_| random.stream()).collect()
+        },
+        Some(random) => {
+            let mut random = random.borrow_mut();
+            (0..SLICES).map(|_| random.stream()).collect()
+        },
+    };
+
+    // Generate time slices (without the GIL).
+    let rate = activity * table.total_weight / (events as f64);
+    let width = duration / (SLICES as f64);
+    let slices: Vec<Pulses> = py.allow_threads(|| {
+        let threads = std::thread::available_parallelism()
+            .map(|n| n.get())
+            .unwrap_or(1)
+            .min(SLICES);
+        let table = &table;
+        let shaper = &shaper;
+        std::thread::scope(|scope| {
+            let handles: Vec<_> = rngs
+                .chunks(SLICES.div_ceil(threads))
+                .enumerate()
+                .map(|(i, chunk)| {
+                    let offset = i * SLICES.div_ceil(threads);
+                    scope.spawn(move || {
+                        chunk
+                            .iter()
+                            .enumerate()
+                            .map(|(j, rng)| {
+                                let t0 = ((offset + j) as f64) * width;
+                                shaper.generate(t0, t0 + width, rate, table, rng.clone())
+                            })
+                            .collect::<Vec<_>>()
+                    })
+                })
+                .collect();
+            handles
+                .into_iter()
+                .flat_map(|handle| handle.join().unwrap())
+                .collect()
+        })
+    });
+
+    // Stitch slices.
+    let mut pulses = Pulses::new(bins);
+    for mut slice in slices.into_iter() {
+        for (time, value) in std::mem::take(&mut slice.leading).into_iter() {
+            pulses.push(time, value, &shaper);
+        }
+        pulses.append(slice, &shaper);
+    }
+    pulses.close(&shaper);
+
+    let counts = PyArray::<u64>::empty(py, &[bins])?;
+    unsafe { counts.slice_mut()? }.copy_from_slice(&pulses.counts);
+    let edges = PyArray::<f64>::empty(py, &[bins + 1])?;
+    {
+        let edges = unsafe { edges.slice_mut()? };
+        for (i, edge) in edges.iter_mut().enumerate() {
+            *edge = energy[0] + (energy[1] - energy[0]) * (i as f64) / (bins as f64);
+        }
+    }
+    let result = Namespace::new(py, &[
+        ("counts", counts.into_any().unbind()),
+        ("energy", edges.into_any().unbind()),
+        ("rate", ((pulses.total as f64) / duration).into_py(py)),
+    ])?;
+    Ok(result.unbind())
+}
+
+
+// ===============================================================================================
+//
+// Deposits table.
+//
+// Deposit values are randomly drawn according to their weight, using a cumulative table.
+//
+// ===============================================================================================
+
+struct DepositsTable {
+    cdf: Vec<f64>,
+    values: Vec<f64>,
+    events: usize,
+    max_value: f64,
+    total_weight: f64,
+}
+
+impl DepositsTable {
+    fn new(deposits: &[TotalDeposit]) -> Self {
+        let mut cdf = Vec::with_capacity(deposits.len());
+        let mut values = Vec::with_capacity(deposits.len());
+        let mut events = 0;
+        let mut max_value = 0.0;
+        let mut total_weight = 0.0;
+        for deposit in deposits.iter() {
+            total_weight += deposit.weight;
+            cdf.push(total_weight);
+            values.push(deposit.value);
+            events = events.max(deposit.event + 1);
+            max_value = f64::max(max_value, deposit.value);
+        }
+        Self { cdf, values, events, max_value, total_weight }
+    }
+
+    #[inline]
+    fn sample(&self, rng: &mut Pcg64Mcg) -> f64 {
+        let u: f64 = rng.sample(Open01);
+        let x = u * self.total_weight;
+        let i = self.cdf
+            .partition_point(|c| *c <= x)
+            .min(self.values.len() - 1);
+        self.values[i]
+    }
+}
+
+
+// ===============================================================================================
+//
+// Pulses shaping.
+//
+// ===============================================================================================
+
+struct Shaper {
+    shaping_time: f64,
+    energy: [f64; 2],
+    bins: usize,
+}
+
+impl Shaper {
+    const DEFAULT_BINS: usize = 100;
+
+    fn generate(
+        &self,
+        t0: f64,
+        t1: f64,
+        rate: f64,
+        table: &DepositsTable,
+        mut rng: Pcg64Mcg,
+    ) -> Pulses {
+        // Leading hits are stored unshaped, since they might belong to a previous pulse.
+        let mut pulses = Pulses::new(self.bins);
+        let mut leading = Vec::<(f64, f64)>::new();
+        let mut head = true;
+        let mut time = t0;
+        loop {
+            let u: f64 = rng.sample(Open01);
+            time -= u.ln() / rate;
+            if time >= t1 {
+                break
+            }
+            let value = table.sample(&mut rng);
+            if head {
+                let gap = leading
+                    .last()
+                    .map(|(last, _)| time - last >= self.shaping_time)
+                    .unwrap_or(false);
+                if gap {
+                    head = false;
+                } else {
+                    leading.push((time, value));
+                    continue
+                }
+            }
+            pulses.push(time, value, self);
+        }
+        pulses.leading = leading;
+        pulses
+    }
+
+    #[inline]
+    fn index(&self, value: f64) -> Option<usize> {
+        let u = (value - self.energy[0]) / (self.energy[1] - self.energy[0]);
+        if (u >= 0.0) && (u < 1.0) {
+            Some(((u * self.bins as f64) as usize).min(self.bins - 1))
+        } else {
+            None
+        }
+    }
+}
+
+struct Pulses {
+    counts: Vec<u64>,
+    leading: Vec<(f64, f64)>,
+    open: Option<(f64, f64)>,
+    total: u64,
+}
+
+impl Pulses {
+    fn new(bins: usize) -> Self {
+        let counts = vec![0; bins];
+        let leading = Vec::new();
+        let open = None;
+        let total = 0;
+        Self { counts, leading, open, total }
+    }
+
+    fn append(&mut self, mut other: Self, shaper: &Shaper) {
+        if other.open.is_some() {
+            // The other pulses start after a gap, i.e. the current pulse is over.
+            self.close(shaper);
+            self.open = other.open.take();
+        }
+        for (count, other) in self.counts.iter_mut().zip(other.counts.iter()) {
+            *count += other;
+        }
+        self.total += other.total;
+    }
+
+    fn close(&mut self, shaper: &Shaper) {
+        let Some((_, value)) = self.open.take() else { return };
+        self.total += 1;
+        if let Some(i) = shaper.index(value) {
+            self.counts[i] += 1;
+        }
+    }
+
+    #[inline]
+    fn push(&mut self, time: f64, value: f64, shaper: &Shaper) {
+        if let Some((start, sum)) = self.open.as_mut() {
+            if time < *start + shaper.shaping_time {
+                *sum += value;
+                return
+            }
+        }
+        self.close(shaper);
+        self.open = Some((time, value));
+    }
+}
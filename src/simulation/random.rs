@@ -1,8 +1,10 @@
-use crate::utils::numpy::{PyArray, ShapeArg};
+use crate::utils::error::{Error, Failure, variant_error};
+use crate::utils::error::ErrorKind::{Exception, ValueError};
+use crate::utils::numpy::{Dtype, PyArray, PyArrayMethods, ShapeArg};
+use enum_variants_strings::EnumVariantsStrings;
 use getrandom::getrandom;
 use pyo3::prelude::*;
-use pyo3::exceptions::PySystemError;
-use rand::Rng;
+use rand::{Rng, RngCore};
 use rand::distributions::Open01;
 use rand::SeedableRng;
 use rand_pcg::Pcg64Mcg;
@@ -20,7 +22,10 @@ use super::ffi;
 #[derive(Clone)]
 #[pyclass(module = "calzone")]
 pub struct Random {
-    rng: Pcg64Mcg,
+    rng: Prng,
+    /// Prng engine.
+    #[pyo3(get)]
+    engine: Engine,
     /// Prng stream index.
     #[pyo3(get)]
     index: u128,
@@ -32,11 +37,14 @@ pub struct Random {
 #[pymethods]
 impl Random {
     #[new]
-    #[pyo3(signature=(seed=None, *, index=None))]
-    pub fn new(seed: Option<u128>, index: Option<Index>) -> PyResult<Self> {
-        let rng = Pcg64Mcg::new(0xCAFEF00DD15EA5E5);
-        let mut random = Self { rng, seed: 0, index: 0 };
-        random.initialise(seed)?;
+    #[pyo3(signature=(seed=None, *, engine=None, index=None))]
+    pub fn new(
+        seed: Option<u128>,
+        engine: Option<Engine>,
+        index: Option<Index>,
+    ) -> PyResult<Self> {
+        let engine = engine.unwrap_or(Engine::Pcg64Mcg);
+        let mut random = Self::with_engine(engine, seed)?;
         if index.is_some() {
             random.set_index(index)?;
         }
@@ -59,7 +67,70 @@ impl Random {
 
     #[setter]
     fn set_seed(&mut self, seed: Option<u128>) -> PyResult<()> {
-        self.initialise(seed)
+        self.initialise(seed)?;
+        Ok(())
+    }
+
+    /// Generate pseudo-random index(es) according to the given probabilities.
+    #[pyo3(signature=(p, /, shape=None))]
+    fn choice(
+        &mut self,
+        py: Python,
+        p: Vec<f64>,
+        shape: Option<ShapeArg>,
+    ) -> PyResult<PyObject> {
+        let table = AliasTable::new(&p)?;
+        self.bulk(py, shape, 1, |rng, values: &mut [u64]| {
+            for value in values.iter_mut() {
+                *value = table.sample(rng.sample(Open01)) as u64;
+            }
+            values.len() as u128
+        })
+    }
+
+    /// Generate pseudo-random number(s) following an exponential distribution.
+    #[pyo3(signature=(shape=None, *, scale=None))]
+    fn exponential(
+        &mut self,
+        py: Python,
+        shape: Option<ShapeArg>,
+        scale: Option<f64>,
+    ) -> PyResult<PyObject> {
+        let scale = check_scale(scale)?;
+        self.bulk(py, shape, 1, |rng, values: &mut [f64]| {
+            for value in values.iter_mut() {
+                let u: f64 = rng.sample(Open01);
+                *value = -scale * u.ln();
+            }
+            values.len() as u128
+        })
+    }
+
+    /// Generate pseudo-random number(s) following a normal distribution.
+    #[pyo3(signature=(shape=None, *, loc=None, scale=None))]
+    fn normal(
+        &mut self,
+        py: Python,
+        shape: Option<ShapeArg>,
+        loc: Option<f64>,
+        scale: Option<f64>,
+    ) -> PyResult<PyObject> {
+        // Values are generated by pairs, using the Box-Muller transform.
+        let loc = loc.unwrap_or(0.0);
+        let scale = check_scale(scale)?;
+        self.bulk(py, shape, 1, |rng, values: &mut [f64]| {
+            for pair in values.chunks_mut(2) {
+                let u1: f64 = rng.sample(Open01);
+                let u2: f64 = rng.sample(Open01);
+                let r = scale * (-2.0 * u1.ln()).sqrt();
+                let phi = 2.0 * std::f64::consts::PI * u2;
+                pair[0] = loc + r * phi.cos();
+                if let Some(value) = pair.get_mut(1) {
+                    *value = loc + r * phi.sin();
+                }
+            }
+            (2 * values.len().div_ceil(2)) as u128
+        })
     }
 
     /// Generate pseudo-random number(s) uniformly distributed over (0,1).
@@ -68,19 +139,12 @@ impl Random {
         py: Python,
         shape: Option<ShapeArg>,
     ) -> PyResult<PyObject> {
-        match shape {
-            None => {
-                let value = self.open01();
-                Ok(value.into_py(py))
-            },
-            Some(shape) => {
-                let shape: Vec<usize> = shape.into();
-                let n = shape.iter().product();
-                let iter = (0..n).map(|_| self.open01());
-                let array = PyArray::<f64>::from_iter(py, &shape, iter)?;
-                Ok(array.into_any().unbind())
-            },
-        }
+        self.bulk(py, shape, 1, |rng, values: &mut [f64]| {
+            for value in values.iter_mut() {
+                *value = rng.sample(Open01);
+            }
+            values.len() as u128
+        })
     }
 }
 
@@ -92,19 +156,45 @@ impl Random {
         ]
     }
 
-    fn initialise(&mut self, seed: Option<u128>) -> PyResult<()> {
+    pub(super) fn fork(&self) -> Pcg64Mcg {
+        let seed = u128::to_ne_bytes(self.seed ^ self.index);
+        Pcg64Mcg::from_seed(seed)
+    }
+
+    pub(super) fn stream(&mut self) -> Pcg64Mcg {
+        // Seed an independent generator from the current stream (using two draws).
+        let hi = self.rng.next_u64() as u128;
+        let lo = self.rng.next_u64() as u128;
+        self.index += 2;
+        Pcg64Mcg::from_seed(u128::to_ne_bytes((hi << 64) + lo))
+    }
+
+    // Default generator, without Python (e.g. for the native interface).
+    pub(crate) fn from_seed(seed: Option<u128>) -> Result<Self, Failure> {
+        Self::with_engine(Engine::Pcg64Mcg, seed)
+    }
+
+    fn with_engine(engine: Engine, seed: Option<u128>) -> Result<Self, Failure> {
+        let rng = Prng::new(engine, 0xCAFEF00DD15EA5E5);
+        let mut random = Self { rng, engine, seed: 0, index: 0 };
+        random.initialise(seed)?;
+        Ok(random)
+    }
+
+    fn initialise(&mut self, seed: Option<u128>) -> Result<(), Failure> {
         match seed {
             None => {
                 let mut seed = [0_u8; 16];
                 getrandom(&mut seed)
-                    .map_err(|_| PySystemError::new_err("could not seed random engine"))?;
-                self.rng = Pcg64Mcg::from_seed(seed);
+                    .map_err(|_| {
+                        Error::new(Exception).why("could not seed random engine").to_failure()
+                    })?;
                 self.seed = u128::from_ne_bytes(seed);
+                self.rng = Prng::new(self.engine, self.seed);
             },
             Some(seed) => {
                 self.seed = seed;
-                let seed = u128::to_ne_bytes(seed);
-                self.rng = Pcg64Mcg::from_seed(seed);
+                self.rng = Prng::new(self.engine, seed);
             },
         }
         self.index = 0;
@@ -141,6 +231,309 @@ impl From<Index> for u128 {
 }
 
 
+// ===============================================================================================
+//
+// Bulk generation.
+//
+// Arrays are generated by blocks of values. Each value consumes a fixed number of draws (pairs of
+// values, for normal deviates), such that any block maps to a known offset of the stream. Thus,
+// large arrays are generated in parallel, with the same result as a sequential generation.
+//
+// ===============================================================================================
+
+const BLOCK_SIZE: usize = 4096;
+const PARALLEL_SIZE: usize = 16 * BLOCK_SIZE;
+
+impl Random {
+    fn bulk<T, F>(
+        &mut self,
+        py: Python,
+        shape: Option<ShapeArg>,
+        draws: u128,
+        generate: F,
+    ) -> PyResult<PyObject>
+    where
+        T: Copy + Default + Dtype + IntoPy<PyObject> + Send,
+        F: Fn(&mut Prng, &mut [T]) -> u128 + Sync,
+    {
+        match shape {
+            None => {
+                let mut value = [T::default()];
+                self.index += generate(&mut self.rng, &mut value);
+                Ok(value[0].into_py(py))
+            },
+            Some(shape) => {
+                let shape: Vec<usize> = shape.into();
+                let array = PyArray::<T>::empty(py, &shape)?;
+                let values = unsafe { array.slice_mut()? };
+                let total: u128 = if values.len() < PARALLEL_SIZE {
+                    values
+                        .chunks_mut(BLOCK_SIZE)
+                        .map(|block| generate(&mut self.rng, block))
+                        .sum()
+                } else {
+                    let rng = &self.rng;
+                    let generate = &generate;
+                    let total = py.allow_threads(|| {
+                        let blocks = values.len().div_ceil(BLOCK_SIZE);
+                        let threads = std::thread::available_parallelism()
+                            .map(|n| n.get())
+                            .unwrap_or(1)
+                            .min(blocks);
+                        let size = blocks.div_ceil(threads) * BLOCK_SIZE;
+                        std::thread::scope(|scope| {
+                            let handles: Vec<_> = values
+                                .chunks_mut(size)
+                                .enumerate()
+                                .map(|(i, chunk)| {
+                                    let mut rng = rng.clone();
+                                    rng.advance(((i * size) as u128) * draws);
+                                    scope.spawn(move || {
+                                        chunk
+                                            .chunks_mut(BLOCK_SIZE)
+                                            .map(|block| generate(&mut rng, block))
+                                            .sum::<u128>()
+                                    })
+                                })
+                                .collect();
+                            handles
+                                .into_iter()
+                                .map(|handle| handle.join().unwrap())
+                                .sum()
+                        })
+                    });
+                    self.rng.advance(total);
+                    total
+                };
+                self.index += total;
+                Ok(array.into_any().unbind())
+            },
+        }
+    }
+}
+
+fn check_scale(scale: Option<f64>) -> PyResult<f64> {
+    let scale = scale.unwrap_or(1.0);
+    if !(scale > 0.0) || !scale.is_finite() {
+        let why = format!("expected a strictly positive value, found {}", scale);
+        let err = Error::new(ValueError).what("scale").why(&why);
+        return Err(err.to_err())
+    }
+    Ok(scale)
+}
+
+
+// ===============================================================================================
+//
+// Alias table (Vose's method).
+//
+// A discrete distribution is sampled in constant time, using a single uniform draw (for both the
+// bin index and the acceptance test).
+//
+// ===============================================================================================
+
+pub struct AliasTable {
+    probabilities: Vec<f64>,
+    aliases: Vec<usize>,
+}
+
+impl AliasTable {
+    pub fn new(weights: &[f64]) -> PyResult<Self> {
+        let bad_weights = |why: String| -> PyErr {
+            Error::new(ValueError).what("p").why(&why).to_err()
+        };
+        if weights.is_empty() {
+            return Err(bad_weights("empty array".to_string()))
+        }
+        let mut total = 0.0;
+        for weight in weights.iter() {
+            if !(*weight >= 0.0) || !weight.is_finite() {
+                let why = format!("expected positive values, found {}", weight);
+                return Err(bad_weights(why))
+            }
+            total += weight;
+        }
+        if !(total > 0.0) {
+            return Err(bad_weights("expected a strictly positive sum, found 0".to_string()))
+        }
+
+        let n = weights.len();
+        let mut probabilities: Vec<f64> = weights
+            .iter()
+            .map(|weight| weight * (n as f64) / total)
+            .collect();
+        let mut aliases: Vec<usize> = (0..n).collect();
+        let (mut small, mut large): (Vec<usize>, Vec<usize>) = (0..n)
+            .partition(|i| probabilities[*i] < 1.0);
+        while let (Some(s), Some(l)) = (small.last().copied(), large.last().copied()) {
+            small.pop();
+            aliases[s] = l;
+            probabilities[l] -= 1.0 - probabilities[s];
+            if probabilities[l] < 1.0 {
+                large.pop();
+                small.push(l);
+            }
+        }
+        for i in small.into_iter().chain(large.into_iter()) {
+            probabilities[i] = 1.0; // Rounding leftovers.
+        }
+        Ok(Self { probabilities, aliases })
+    }
+
+    #[inline]
+    pub fn sample(&self, u: f64) -> usize {
+        let n = self.probabilities.len();
+        let x = u * (n as f64);
+        let i = (x as usize).min(n - 1);
+        if x - (i as f64) < self.probabilities[i] { i } else { self.aliases[i] }
+    }
+}
+
+
+// ===============================================================================================
+//
+// Prng engines.
+//
+// Pcg64Mcg is a fast sequential generator, for which jumping to a given stream index takes
+// O(log n) steps. Philox4x64-10 is a counter-based generator, i.e. a stream index directly maps
+// to a counter value (with 4 draws per counter). Thus, any stream index is reached in O(1).
+//
+// ===============================================================================================
+
+#[derive(Clone, Copy, EnumVariantsStrings, PartialEq)]
+#[enum_variants_strings_transform(transform="lower_case")]
+pub enum Engine {
+    Pcg64Mcg,
+    Philox,
+}
+
+impl<'py> FromPyObject<'py> for Engine {
+    fn extract(obj: &'py PyAny) -> PyResult<Self> {
+        let engine: String = obj.extract()?;
+        let engine = Engine::from_str(engine.as_str())
+            .map_err(|options| variant_error("bad engine", engine.as_str(), options))?;
+        Ok(engine)
+    }
+}
+
+impl IntoPy<PyObject> for Engine {
+    fn into_py(self, py: Python) -> PyObject {
+        self.to_str().into_py(py)
+    }
+}
+
+#[derive(Clone)]
+enum Prng {
+    Pcg64Mcg(Pcg64Mcg),
+    Philox(Philox),
+}
+
+impl Prng {
+    fn new(engine: Engine, seed: u128) -> Self {
+        match engine {
+            Engine::Pcg64Mcg => Self::Pcg64Mcg(Pcg64Mcg::from_seed(u128::to_ne_bytes(seed))),
+            Engine::Philox => Self::Philox(Philox::new(seed)),
+        }
+    }
+
+    fn advance(&mut self, delta: u128) {
+        match self {
+            Self::Pcg64Mcg(rng) => rng.advance(delta),
+            Self::Philox(rng) => rng.seek(rng.position.wrapping_add(delta)),
+        }
+    }
+
+    fn name(&self) -> &'static str {
+        match self {
+            Self::Pcg64Mcg(_) => "Pcg64Mcg",
+            Self::Philox(_) => "Philox4x64",
+        }
+    }
+}
+
+impl RngCore for Prng {
+    #[inline]
+    fn next_u32(&mut self) -> u32 {
+        self.next_u64() as u32
+    }
+
+    #[inline]
+    fn next_u64(&mut self) -> u64 {
+        match self {
+            Self::Pcg64Mcg(rng) => rng.next_u64(),
+            Self::Philox(rng) => rng.next_u64(),
+        }
+    }
+
+    fn fill_bytes(&mut self, dest: &mut [u8]) {
+        for chunk in dest.chunks_mut(8) {
+            let bytes = self.next_u64().to_le_bytes();
+            chunk.copy_from_slice(&bytes[..chunk.len()]);
+        }
+    }
+
+    fn try_fill_bytes(&mut self, dest: &mut [u8]) -> Result<(), rand::Error> {
+        self.fill_bytes(dest);
+        Ok(())
+    }
+}
+
+#[derive(Clone)]
+pub struct Philox {
+    key: [u64; 2],
+    position: u128,
+    block: [u64; 4],
+}
+
+impl Philox {
+    const MULTIPLIERS: [u64; 2] = [0xD2E7470EE14C6C93, 0xCA5A826395121157];
+    const WEYL: [u64; 2] = [0x9E3779B97F4A7C15, 0xBB67AE8584CAA73B];
+    const ROUNDS: usize = 10;
+
+    pub fn new(seed: u128) -> Self {
+        let key = [(seed >> 64) as u64, seed as u64];
+        let mut philox = Self { key, position: 0, block: [0; 4] };
+        philox.seek(0);
+        philox
+    }
+
+    pub fn generate(&self, counter: u128) -> [u64; 4] {
+        let mut x = [counter as u64, (counter >> 64) as u64, 0, 0];
+        let mut k = self.key;
+        for round in 0..Self::ROUNDS {
+            let p0 = (Self::MULTIPLIERS[0] as u128) * (x[0] as u128);
+            let p1 = (Self::MULTIPLIERS[1] as u128) * (x[2] as u128);
+            x = [
+                ((p1 >> 64) as u64) ^ x[1] ^ k[0],
+                p1 as u64,
+                ((p0 >> 64) as u64) ^ x[3] ^ k[1],
+                p0 as u64,
+            ];
+            if round + 1 < Self::ROUNDS {
+                k[0] = k[0].wrapping_add(Self::WEYL[0]);
+                k[1] = k[1].wrapping_add(Self::WEYL[1]);
+            }
+        }
+        x
+    }
+
+    #[inline]
+    pub fn next_u64(&mut self) -> u64 {
+        let value = self.block[(self.position & 3) as usize];
+        self.position = self.position.wrapping_add(1);
+        if (self.position & 3) == 0 {
+            self.block = self.generate(self.position >> 2);
+        }
+        value
+    }
+
+    pub fn seek(&mut self, position: u128) {
+        self.position = position;
+        self.block = self.generate(position >> 2);
+    }
+}
+
+
 // ===============================================================================================
 //
 // Random context.
@@ -174,7 +567,7 @@ impl<'a> RandomContext<'a> {
     }
 
     pub fn prng_name(&self) -> &'static str {
-        "Pcg64Mcg"
+        self.0.rng.name()
     }
 }
 
@@ -1,7 +1,11 @@
 #include "calzone.h"
 #include "sampler.h"
 // Geant4 interface.
+#include "G4NavigationHistory.hh"
 #include "G4SDManager.hh"
+#include "G4VSolid.hh"
+// C++ standard library.
+#include <algorithm>
 
 SamplerImpl::SamplerImpl(const std::string & name, Roles r) :
     G4VSensitiveDetector(name) {
@@ -26,14 +30,19 @@ G4bool SamplerImpl::ProcessHits(G4Step * step, G4TouchableHistory *) {
             double energy = pre->GetKineticEnergy();
             auto start = pre->GetPosition() / CLHEP::cm;
             auto end = post->GetPosition() / CLHEP::cm;
+            double weight = track->GetWeight();
 
             RUN_AGENT->push_deposit(
-                volume, tid, pid, energy, deposit, point_deposit, start, end
+                volume, tid, pid, energy, deposit, point_deposit, start, end,
+                weight
             );
         }
     }
 
-    bool outgoing = RUN_AGENT->is_particles() && step->IsLastStepInVolume();
+    // Boundary actions require particles sampling, except for tallies.
+    auto && action = this->roles.outgoing;
+    bool outgoing = ((action == Action::Tally) || RUN_AGENT->is_particles()) &&
+        step->IsLastStepInVolume();
     if (outgoing) {
         // Check that the next volume is not a daughter of the current one.
         auto pre = step->GetPreStepPoint()->GetPhysicalVolume();
@@ -44,9 +53,12 @@ G4bool SamplerImpl::ProcessHits(G4Step * step, G4TouchableHistory *) {
             }
         }
     }
+    if (outgoing &&
+        !SamplerImpl::Filter(step, this->roles.outgoing_filter)) {
+        outgoing = false;
+    }
     if (outgoing) {
         auto && track = step->GetTrack();
-        auto && action = this->roles.outgoing;
         if ((action == Action::Catch) ||
             (action == Action::Record)) {
             auto && volume = step->GetPreStepPoint()->GetPhysicalVolume();
@@ -63,7 +75,11 @@ G4bool SamplerImpl::ProcessHits(G4Step * step, G4TouchableHistory *) {
                 { r.x(), r.y(), r.z() },
                 { u.x(), u.y(), u.z() },
             };
-            RUN_AGENT->push_particle(volume, tid, std::move(particle));
+            RUN_AGENT->push_particle(
+                volume, tid, std::move(particle), track->GetWeight()
+            );
+        } else if (action == Action::Tally) {
+            this->Tally(step, false);
         }
         if ((action == Action::Catch) ||
             (action == Action::Kill)) {
@@ -110,3 +126,53 @@ G4bool SamplerImpl::ProcessHits(G4Step * step, G4TouchableHistory *) {
 
     return true;
 }
+
+bool SamplerImpl::Filter(
+    const G4Step * step,
+    const ParticleFilter & filter
+) {
+    // Particles actions are conditioned by the kinetic energy and by the type
+    // of the crossing particle. Note that the set of PDG codes is zero
+    // terminated.
+    double energy = step->GetPostStepPoint()->GetKineticEnergy() / CLHEP::MeV;
+    if ((energy < filter.energy[0]) || (energy > filter.energy[1])) {
+        return false;
+    }
+    if (filter.pids[0] == 0) {
+        return true;
+    }
+    int pid = step->GetTrack()->GetParticleDefinition()->GetPDGEncoding();
+    for (auto && pi: filter.pids) {
+        if (pi == 0) {
+            break;
+        } else if (pi == pid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SamplerImpl::Tally(const G4Step * step, bool ingoing) {
+    // The surface normal is computed in the frame of the crossed volume, i.e.
+    // the post-step volume for ingoing particles, or the pre-step one
+    // otherwise.
+    auto && point = step->GetPostStepPoint();
+    auto && touchable = ingoing ?
+        point->GetTouchableHandle() :
+        step->GetPreStepPoint()->GetTouchableHandle();
+    auto && transform = touchable->GetHistory()->GetTopTransform();
+    auto && r = transform.TransformPoint(point->GetPosition());
+    auto && u = transform.TransformAxis(point->GetMomentumDirection());
+    double cos_theta = u.dot(touchable->GetSolid()->SurfaceNormal(r));
+    if (ingoing) {
+        cos_theta = -cos_theta;
+    }
+    auto && track = step->GetTrack();
+    RUN_AGENT->push_tally(
+        touchable->GetVolume(),
+        track->GetParticleDefinition()->GetPDGEncoding(),
+        point->GetKineticEnergy() / CLHEP::MeV,
+        std::clamp(cos_theta, 0.0, 1.0),
+        track->GetWeight()
+    );
+}
@@ -11,5 +11,8 @@ struct SamplerImpl : public G4VSensitiveDetector {
     G4bool ProcessHits(G4Step *, G4TouchableHistory *);
 
     // User interface.
+    static bool Filter(const G4Step *, const ParticleFilter &);
+    void Tally(const G4Step *, bool ingoing);
+
     Roles roles;
 };
@@ -1,5 +1,8 @@
-use crate::utils::error::{variant_error, variant_explain};
+use crate::utils::error::{variant_error, variant_explain, Error};
+use crate::utils::error::ErrorKind::ValueError;
 use crate::utils::export::Export;
+use crate::utils::extract::{Extractor, Property, Tag, TryFromBound};
+use crate::utils::memory::{map_size, vec_size};
 use crate::utils::namespace::Namespace;
 use crate::utils::numpy::{PyArray, PyArrayMethods};
 use derive_more::{AsMut, AsRef, From};
@@ -7,7 +10,12 @@ use enum_variants_strings::EnumVariantsStrings;
 use indexmap::IndexMap;
 use pyo3::prelude::*;
 use pyo3::types::PyDict;
+use rand::Rng;
+use rand_pcg::Pcg64Mcg;
+use std::collections::HashMap;
+use super::coincidence::Coincidences;
 use super::ffi;
+use super::source::PidArg;
 
 
 // ===========================================================================================
@@ -22,6 +30,7 @@ pub enum RoleVerb {
     Catch,
     Kill,
     Record,
+    Tally,
 }
 
 #[derive(EnumVariantsStrings)]
@@ -60,6 +69,7 @@ impl From<RoleVerb> for ffi::Action {
             RoleVerb::Catch => Self::Catch,
             RoleVerb::Kill => Self::Kill,
             RoleVerb::Record => Self::Record,
+            RoleVerb::Tally => Self::Tally,
         }
     }
 }
@@ -70,6 +80,7 @@ impl From<ffi::Action> for &'static str {
             ffi::Action::Catch => "catch",
             ffi::Action::Kill => "kill",
             ffi::Action::Record => "record",
+            ffi::Action::Tally => "tally",
             _ => unreachable!(),
         }
     }
@@ -88,7 +99,9 @@ impl Default for ffi::Roles {
         let deposits = ffi::Action::None;
         let ingoing = ffi::Action::None;
         let outgoing = ffi::Action::None;
-        Self { deposits, ingoing, outgoing }
+        let ingoing_filter = ffi::ParticleFilter::default();
+        let outgoing_filter = ffi::ParticleFilter::default();
+        Self { deposits, ingoing, outgoing, ingoing_filter, outgoing_filter }
     }
 }
 
@@ -151,6 +164,172 @@ impl From<ffi::Roles> for Vec<String> {
 }
 
 
+// ===========================================================================================
+//
+// Particles filter.
+//
+// The filters condition the particles actions (i.e. catch, kill, record or tally) of a volume,
+// for ingoing and outgoing particles respectively. The set of PDG codes of a filter is zero
+// terminated, an empty set matching any particle.
+//
+// ===========================================================================================
+
+impl ffi::Roles {
+    pub fn copy_filters(&mut self, other: &Self) {
+        self.ingoing_filter = other.ingoing_filter;
+        self.outgoing_filter = other.outgoing_filter;
+    }
+
+    pub fn filters_to_dict<'py>(&self, py: Python<'py>) -> PyResult<Option<Bound<'py, PyDict>>> {
+        if self.ingoing_filter == self.outgoing_filter {
+            return self.ingoing_filter.to_dict(py)
+        }
+        let dict = PyDict::new_bound(py);
+        if let Some(filter) = self.ingoing_filter.to_dict(py)? {
+            dict.set_item("ingoing", filter)?;
+        }
+        if let Some(filter) = self.outgoing_filter.to_dict(py)? {
+            dict.set_item("outgoing", filter)?;
+        }
+        Ok(Some(dict))
+    }
+
+    pub fn is_filtered(&self) -> bool {
+        !self.ingoing_filter.is_default() || !self.outgoing_filter.is_default()
+    }
+
+    // Set the filters from a single filter (applying to both ingoing and outgoing particles), or
+    // from a dict of filters, per direction.
+    pub fn set_filters(&mut self, tag: &Tag, value: Option<&Bound<PyAny>>) -> PyResult<()> {
+        const EXTRACTOR: Extractor<2> = Extractor::new([
+            Property::optional_any("ingoing"),
+            Property::optional_any("outgoing"),
+        ]);
+
+        let Some(value) = value else {
+            self.ingoing_filter = ffi::ParticleFilter::default();
+            self.outgoing_filter = ffi::ParticleFilter::default();
+            return Ok(())
+        };
+        let directed = match value.downcast::<PyDict>() {
+            Ok(dict) => dict.contains("ingoing")? || dict.contains("outgoing")?,
+            Err(_) => false,
+        };
+        if directed {
+            let [ingoing, outgoing] = EXTRACTOR.extract_any(tag, value, None)?;
+            let extract = |filter: Option<Bound<PyAny>>| match filter {
+                None => Ok(ffi::ParticleFilter::default()),
+                Some(filter) => ffi::ParticleFilter::try_from_any(tag, &filter),
+            };
+            self.ingoing_filter = extract(ingoing.into())?;
+            self.outgoing_filter = extract(outgoing.into())?;
+        } else {
+            let filter = ffi::ParticleFilter::try_from_any(tag, value)?;
+            self.ingoing_filter = filter;
+            self.outgoing_filter = filter;
+        }
+        Ok(())
+    }
+}
+
+impl ffi::ParticleFilter {
+    pub const MAX_PIDS: usize = 8;
+
+    pub fn is_default(&self) -> bool {
+        (self.pids[0] == 0) && (self.energy[0] <= 0.0) && (self.energy[1] == f64::INFINITY)
+    }
+
+    pub fn to_dict<'py>(&self, py: Python<'py>) -> PyResult<Option<Bound<'py, PyDict>>> {
+        if self.is_default() {
+            return Ok(None)
+        }
+        let dict = PyDict::new_bound(py);
+        let pids: Vec<i32> = self.pids
+            .iter()
+            .take_while(|pid| **pid != 0)
+            .copied()
+            .collect();
+        if !pids.is_empty() {
+            dict.set_item("pid", pids)?;
+        }
+        if (self.energy[0] > 0.0) || (self.energy[1] < f64::INFINITY) {
+            dict.set_item("energy", self.energy)?;
+        }
+        Ok(Some(dict))
+    }
+}
+
+impl Default for ffi::ParticleFilter {
+    fn default() -> Self {
+        let pids = [0; Self::MAX_PIDS];
+        let energy = [0.0, f64::INFINITY];
+        Self { pids, energy }
+    }
+}
+
+impl TryFromBound for ffi::ParticleFilter {
+    fn try_from_any<'py>(tag: &Tag, value: &Bound<'py, PyAny>) -> PyResult<Self> {
+        const EXTRACTOR: Extractor<2> = Extractor::new([
+            Property::optional_any("pid"),
+            Property::new_interval("energy", [0.0, f64::INFINITY]),
+        ]);
+
+        let [pid, energy] = EXTRACTOR.extract_any(tag, value, None)?;
+        let mut filter = Self::default();
+
+        let pid: Option<Bound<PyAny>> = pid.into();
+        if let Some(pid) = pid {
+            let pids: PidsArg = pid.extract().map_err(|_| {
+                let why = format!(
+                    "expected an 'int', a 'str' or a sequence of these, found '{}'",
+                    pid,
+                );
+                tag.bad().what("pid").why(why).to_err(ValueError)
+            })?;
+            let pids = match pids {
+                PidsArg::Scalar(pid) => vec![pid],
+                PidsArg::Vec(pids) => pids,
+            };
+            if pids.len() > Self::MAX_PIDS {
+                let why = format!(
+                    "expected at most {} particles, found {}",
+                    Self::MAX_PIDS,
+                    pids.len(),
+                );
+                return Err(tag.bad().what("pid").why(why).to_err(ValueError));
+            }
+            for (i, pid) in pids.into_iter().enumerate() {
+                let pid: i32 = pid.try_into()?;
+                if pid == 0 {
+                    let why = "expected a valid PDG code, found 0".to_string();
+                    return Err(tag.bad().what("pid").why(why).to_err(ValueError));
+                }
+                filter.pids[i] = pid;
+            }
+        }
+
+        let energy: [f64; 2] = energy.into();
+        if !(energy[0] >= 0.0) || !(energy[1] > energy[0]) {
+            let why = format!(
+                "expected an increasing range of non-negative values, found [{}, {}]",
+                energy[0],
+                energy[1],
+            );
+            return Err(tag.bad().what("energy").why(why).to_err(ValueError));
+        }
+        filter.energy = energy;
+
+        Ok(filter)
+    }
+}
+
+#[derive(FromPyObject)]
+enum PidsArg {
+    Scalar(PidArg),
+    Vec(Vec<PidArg>),
+}
+
+
 // ===============================================================================================
 //
 // Deposits sampler interface.
@@ -162,6 +341,7 @@ impl From<ffi::Roles> for Vec<String> {
 pub enum SamplerMode {
     Brief,
     Detailed,
+    Tracks,
 }
 
 impl<'py> FromPyObject<'py> for SamplerMode {
@@ -182,15 +362,71 @@ impl IntoPy<PyObject> for SamplerMode {
 pub struct Deposits {
     mode: SamplerMode,
     values: IndexMap<*const ffi::G4VPhysicalVolume, DepositsCell>,
+    coincidences: Option<Coincidences>,
+    max_samples: Option<MaxSamples>,
+    summaries: Option<Summaries>,
+    rng: Pcg64Mcg,
+    current_track: Option<(usize, i32)>,
 }
 
 impl Deposits {
-    pub fn new(mode: SamplerMode) -> Self {
+    pub fn new(
+        mode: SamplerMode,
+        coincidences: Option<Coincidences>,
+        max_samples: Option<MaxSamples>,
+        rng: Pcg64Mcg,
+    ) -> Self {
         let values = IndexMap::new();
-        Self { mode, values }
+        let summaries = max_samples.as_ref().map(|_| IndexMap::new());
+        let current_track = None;
+        Self { mode, values, coincidences, max_samples, summaries, rng, current_track }
+    }
+
+    pub fn close_event(&mut self, event: usize) {
+        self.close_track();
+
+        // Close brief deposits. If coincidence rules apply, then the event deposits are
+        // evaluated against the rules, instead of being sampled. Note that coincidences require
+        // brief deposits.
+        let mut deposits = Vec::<(&str, f64)>::new();
+        let mut info = None;
+        for (volume, cell) in self.values.iter_mut() {
+            let DepositsCell::Brief(cell) = cell else { continue };
+            let Some(deposit) = cell.current.take() else { continue };
+            if let Some(summary) = summary_mut(&mut self.summaries, *volume) {
+                summary.push(deposit.value, deposit.weight);
+            }
+            if self.coincidences.is_some() {
+                let volume: &ffi::G4VPhysicalVolume = unsafe { &**volume };
+                deposits.push((ffi::as_str(volume.GetName()), deposit.value));
+                info = Some((deposit.weight, deposit.random_index));
+            } else {
+                cell.total.push(deposit, &mut self.rng);
+            }
+        }
+        if let (Some(coincidences), Some((weight, random_index))) =
+            (self.coincidences.as_mut(), info) {
+            coincidences.push(event, &deposits, weight, random_index);
+        }
+    }
+
+    fn close_track(&mut self) {
+        // Geant4 transports tracks one at a time. Thus, a track is over as soon as deposits from
+        // another track are received, or when the event closes. Note that a suspended track
+        // would result in distinct records.
+        if self.current_track.take().is_none() {
+            return
+        }
+        for (volume, cell) in self.values.iter_mut() {
+            let summary = summary_mut(&mut self.summaries, *volume);
+            cell.close_track(&mut self.rng, summary);
+        }
     }
 
     pub fn export(mut self, py: Python) -> PyResult<PyObject> {
+        if let Some(coincidences) = self.coincidences {
+            return coincidences.export(py)
+        }
         let data = PyDict::new_bound(py);
         for (volume, deposits) in self.values.drain(..) {
             let volume: &ffi::G4VPhysicalVolume = unsafe { &*volume };
@@ -201,6 +437,25 @@ impl Deposits {
         Ok(data.into_any().unbind())
     }
 
+    // Export brief deposits, per volume (native interface).
+    pub fn export_native(mut self, mut callback: impl FnMut(&str, &[TotalDeposit])) {
+        for (volume, deposits) in self.values.drain(..) {
+            let DepositsCell::Brief(deposits) = deposits else { unreachable!() };
+            let volume: &ffi::G4VPhysicalVolume = unsafe { &*volume };
+            callback(ffi::as_str(volume.GetName()), &deposits.into_vec());
+        }
+    }
+
+    pub fn memory(&self) -> usize {
+        let values: usize = self.values.values().map(|cell| cell.memory()).sum();
+        let coincidences = self.coincidences
+            .as_ref()
+            .map(|coincidences| coincidences.memory())
+            .unwrap_or(0);
+        let summaries = self.summaries.as_ref().map(map_size).unwrap_or(0);
+        map_size(&self.values) + values + coincidences + summaries
+    }
+
     pub fn push(
         &mut self,
         volume: *const ffi::G4VPhysicalVolume,
@@ -213,21 +468,34 @@ impl Deposits {
         start: &ffi::G4ThreeVector,
         end: &ffi::G4ThreeVector,
         weight: f64,
+        track_weight: f64,
         random_index: &[u64; 2],
     ) {
+        if let SamplerMode::Tracks = self.mode {
+            if self.current_track != Some((event, tid)) {
+                self.close_track();
+                self.current_track = Some((event, tid));
+            }
+        }
         self.values.entry(volume)
-            .and_modify(|e| e.push(
-                event, tid, pid, energy, total_deposit, point_deposit, start, end, weight,
-                random_index
-            ))
             .or_insert_with(|| {
-                let mut cell = DepositsCell::new(self.mode);
-                cell.push(
-                    event, tid, pid, energy, total_deposit, point_deposit, start, end, weight,
-                    random_index
-                );
-                cell
-            });
+                let capacity = self.max_samples
+                    .as_ref()
+                    .and_then(|max_samples| max_samples.get(volume));
+                DepositsCell::new(self.mode, capacity)
+            })
+            .push(
+                event, tid, pid, energy, total_deposit, point_deposit, start, end, weight,
+                track_weight, random_index, &mut self.rng,
+                summary_mut(&mut self.summaries, volume),
+            );
+    }
+
+    pub fn summary(&self, py: Python) -> PyResult<Option<PyObject>> {
+        self.summaries
+            .as_ref()
+            .map(|summaries| summaries_export(py, summaries))
+            .transpose()
     }
 }
 
@@ -241,51 +509,98 @@ impl Deposits {
 enum DepositsCell {
     Brief(BriefDeposits),
     Detailed(DetailedDeposits),
+    Tracks(TrackDeposits),
 }
 
-#[derive(Default)]
+// Brief deposits are summed over the current event, which enters the reservoir (or not) as a
+// whole, when the event closes.
 struct BriefDeposits {
-    total: IndexMap<usize, (f64, f64, [u64; 2])>,
+    total: Reservoir<TotalDeposit>,
+    current: Option<TotalDeposit>,
+}
+
+impl BriefDeposits {
+    fn into_vec(self) -> Vec<TotalDeposit> {
+        self.total.into_vec(|deposit, scale| deposit.weight *= scale)
+    }
 }
 
-#[derive(Default)]
 struct DetailedDeposits {
-    line: Vec<LineDeposit>,
-    point: Vec<PointDeposit>,
+    line: Reservoir<LineDeposit>,
+    point: Reservoir<PointDeposit>,
+}
+
+struct TrackDeposits {
+    current: Option<TrackDeposit>,
+    samples: Reservoir<TrackDeposit>,
 }
 
 impl DepositsCell {
-    fn new(mode: SamplerMode) -> Self {
+    fn new(mode: SamplerMode, capacity: Option<usize>) -> Self {
         match mode {
-            SamplerMode::Brief => Self::Brief(BriefDeposits::default()),
-            SamplerMode::Detailed => Self::Detailed(DetailedDeposits::default()),
+            SamplerMode::Brief => Self::Brief(BriefDeposits {
+                total: Reservoir::new(capacity),
+                current: None,
+            }),
+            SamplerMode::Detailed => Self::Detailed(DetailedDeposits {
+                line: Reservoir::new(capacity),
+                point: Reservoir::new(capacity),
+            }),
+            SamplerMode::Tracks => Self::Tracks(TrackDeposits {
+                current: None,
+                samples: Reservoir::new(capacity),
+            }),
+        }
+    }
+
+    fn close_track(&mut self, rng: &mut Pcg64Mcg, summary: Option<&mut Summary>) {
+        let Self::Tracks(deposits) = self else { return };
+        let Some(mut deposit) = deposits.current.take() else { return };
+        for i in 0..3 {
+            deposit.centroid[i] /= deposit.value;
+        }
+        if let Some(summary) = summary {
+            summary.push(deposit.value, deposit.weight);
         }
+        deposits.samples.push(deposit, rng);
     }
 
     fn export(self, py: Python) -> PyResult<PyObject> {
         let deposits = match self {
-            Self::Brief(mut deposits) => {
-                let array = PyArray::<TotalDeposit>::empty(py, &[deposits.total.len()])?;
-                for (i, (event, (value, weight, random_index))) in deposits.total
-                    .drain(..)
-                    .enumerate() {
-                    let deposit = TotalDeposit { event, value, weight, random_index };
+            Self::Brief(deposits) => {
+                let deposits = deposits.into_vec();
+                let array = PyArray::<TotalDeposit>::empty(py, &[deposits.len()])?;
+                for (i, deposit) in deposits.into_iter().enumerate() {
                     array.set(i, deposit)?;
                 }
                 array.into_any().unbind()
             },
             Self::Detailed(deposits) => {
-                let line = Export::export::<LineDepositsExport>(py, deposits.line)?;
-                let point = Export::export::<PointDepositsExport>(py, deposits.point)?;
+                let line = deposits.line.into_vec(|deposit, scale| deposit.weight *= scale);
+                let point = deposits.point.into_vec(|deposit, scale| deposit.weight *= scale);
+                let line = Export::export::<LineDepositsExport>(py, line)?;
+                let point = Export::export::<PointDepositsExport>(py, point)?;
                 Namespace::new(py, &[
                     ("line", line),
                     ("point", point),
                 ])?.unbind()
             },
+            Self::Tracks(deposits) => {
+                let tracks = deposits.samples.into_vec(|deposit, scale| deposit.weight *= scale);
+                Export::export::<TrackDepositsExport>(py, tracks)?
+            },
         };
         Ok(deposits)
     }
 
+    fn memory(&self) -> usize {
+        match self {
+            Self::Brief(deposits) => deposits.total.memory(),
+            Self::Detailed(deposits) => deposits.line.memory() + deposits.point.memory(),
+            Self::Tracks(deposits) => deposits.samples.memory(),
+        }
+    }
+
     fn push(
         &mut self,
         event: usize,
@@ -297,15 +612,29 @@ impl DepositsCell {
         start: &ffi::G4ThreeVector,
         end: &ffi::G4ThreeVector,
         weight: f64,
+        track_weight: f64,
         random_index: &[u64; 2],
+        rng: &mut Pcg64Mcg,
+        mut summary: Option<&mut Summary>,
     ) {
         match self {
             Self::Brief(ref mut deposits) => {
-                deposits.total.entry(event)
-                    .and_modify(|e| { e.0 += total_deposit })
-                    .or_insert((total_deposit, weight, *random_index));
+                // Biasing weights are folded into the event total, while the primary weight is
+                // reported separately.
+                let total_deposit = total_deposit * track_weight;
+                match deposits.current.as_mut() {
+                    Some(deposit) if deposit.event == event => deposit.value += total_deposit,
+                    _ => {
+                        let random_index = *random_index;
+                        let value = total_deposit;
+                        deposits.current = Some(TotalDeposit {
+                            event, value, weight, random_index
+                        });
+                    },
+                }
             },
             Self::Detailed(ref mut deposits) => {
+                let weight = weight * track_weight;
                 let start = ffi::to_vec(start);
                 let end = ffi::to_vec(end);
                 let line_deposit = total_deposit - point_deposit;
@@ -315,15 +644,40 @@ impl DepositsCell {
                         event, tid, pid, energy, start, end, value: line_deposit, weight,
                         random_index
                     };
-                    deposits.line.push(deposit);
+                    if let Some(summary) = summary.as_mut() {
+                        summary.push(line_deposit, weight);
+                    }
+                    deposits.line.push(deposit, rng);
                 }
                 if point_deposit > 0.0 {
                     let deposit = PointDeposit {
                         event, tid, pid, energy, position: end, value: point_deposit, weight,
                         random_index
                     };
-                    deposits.point.push(deposit);
+                    if let Some(summary) = summary.as_mut() {
+                        summary.push(point_deposit, weight);
+                    }
+                    deposits.point.push(deposit, rng);
+                }
+            },
+            Self::Tracks(ref mut deposits) => {
+                // Deposits are aggregated until the track ends. Meanwhile, the centroid holds
+                // the energy-weighted sum of positions.
+                let start = ffi::to_vec(start);
+                let end = ffi::to_vec(end);
+                let line_deposit = total_deposit - point_deposit;
+                let deposit = deposits.current.get_or_insert_with(|| TrackDeposit {
+                    event, tid, pid, energy, value: 0.0, centroid: [0.0; 3], first: start,
+                    last: end, steps: 0, weight: weight * track_weight,
+                    random_index: *random_index,
+                });
+                for i in 0..3 {
+                    deposit.centroid[i] +=
+                        0.5 * line_deposit * (start[i] + end[i]) + point_deposit * end[i];
                 }
+                deposit.value += total_deposit;
+                deposit.last = end;
+                deposit.steps += 1;
             },
         }
     }
@@ -366,19 +720,39 @@ pub struct PointDeposit {
 #[derive(Clone, Copy)]
 #[repr(C)]
 pub struct TotalDeposit {
+    pub event: usize,
+    pub value: f64,
+    pub weight: f64,
+    pub random_index: [u64; 2],
+}
+
+#[derive(AsMut, AsRef, From)]
+#[pyclass(module="calzone")]
+struct LineDepositsExport (Export<LineDeposit>);
+
+#[derive(Clone, Copy)]
+#[repr(C)]
+pub struct TrackDeposit {
     event: usize,
+    tid: i32,
+    pid: i32,
+    energy: f64,
     value: f64,
+    centroid: [f64; 3],
+    first: [f64; 3],
+    last: [f64; 3],
+    steps: usize,
     weight: f64,
     random_index: [u64; 2],
 }
 
 #[derive(AsMut, AsRef, From)]
 #[pyclass(module="calzone")]
-struct LineDepositsExport (Export<LineDeposit>);
+struct PointDepositsExport (Export<PointDeposit>);
 
 #[derive(AsMut, AsRef, From)]
 #[pyclass(module="calzone")]
-struct PointDepositsExport (Export<PointDeposit>);
+struct TrackDepositsExport (Export<TrackDeposit>);
 
 
 // ===============================================================================================
@@ -389,12 +763,16 @@ struct PointDepositsExport (Export<PointDeposit>);
 
 pub struct ParticlesSampler {
     samples: IndexMap<*const ffi::G4VPhysicalVolume, ParticlesCell>,
+    max_samples: Option<MaxSamples>,
+    summaries: Option<Summaries>,
+    rng: Pcg64Mcg,
 }
 
 impl ParticlesSampler {
-    pub fn new() -> Self {
+    pub fn new(max_samples: Option<MaxSamples>, rng: Pcg64Mcg) -> Self {
         let samples = IndexMap::new();
-        Self { samples }
+        let summaries = max_samples.as_ref().map(|_| IndexMap::new());
+        Self { samples, max_samples, summaries, rng }
     }
 
     pub fn export(mut self, py: Python) -> PyResult<PyObject> {
@@ -408,6 +786,24 @@ impl ParticlesSampler {
         Ok(data.into_any().unbind())
     }
 
+    // Export sampled particles, per volume (native interface).
+    pub fn export_native(
+        mut self,
+        mut callback: impl FnMut(&str, &[ffi::SampledParticle]),
+    ) {
+        for (volume, samples) in self.samples.drain(..) {
+            let volume: &ffi::G4VPhysicalVolume = unsafe { &*volume };
+            let samples = samples.samples.into_vec(|sample, scale| sample.weight *= scale);
+            callback(ffi::as_str(volume.GetName()), &samples);
+        }
+    }
+
+    pub fn memory(&self) -> usize {
+        let samples: usize = self.samples.values().map(|cell| cell.samples.memory()).sum();
+        let summaries = self.summaries.as_ref().map(map_size).unwrap_or(0);
+        map_size(&self.samples) + samples + summaries
+    }
+
     pub fn push(
         &mut self,
         volume: *const ffi::G4VPhysicalVolume,
@@ -417,13 +813,26 @@ impl ParticlesSampler {
         weight: f64,
         random_index: &[u64; 2],
     ) {
+        if let Some(summaries) = self.summaries.as_mut() {
+            summaries.entry(volume)
+                .or_default()
+                .push(particle.energy, weight);
+        }
         self.samples.entry(volume)
-            .and_modify(|e| e.push(event, tid, particle, weight, random_index))
             .or_insert_with(|| {
-                let mut cell = ParticlesCell::new();
-                cell.push(event, tid, particle, weight, random_index);
-                cell
-            });
+                let capacity = self.max_samples
+                    .as_ref()
+                    .and_then(|max_samples| max_samples.get(volume));
+                ParticlesCell::new(capacity)
+            })
+            .push(event, tid, particle, weight, random_index, &mut self.rng);
+    }
+
+    pub fn summary(&self, py: Python) -> PyResult<Option<PyObject>> {
+        self.summaries
+            .as_ref()
+            .map(|summaries| summaries_export(py, summaries))
+            .transpose()
     }
 }
 
@@ -434,18 +843,19 @@ impl ParticlesSampler {
 //
 // ===========================================================================================
 
-#[derive(Default)]
 struct ParticlesCell {
-    samples: Vec<ffi::SampledParticle>,
+    samples: Reservoir<ffi::SampledParticle>,
 }
 
 impl ParticlesCell {
-    fn new() -> Self {
-        Self::default()
+    fn new(capacity: Option<usize>) -> Self {
+        let samples = Reservoir::new(capacity);
+        Self { samples }
     }
 
     fn export(self, py: Python) -> PyResult<PyObject> {
-        let samples = Export::export::<SampledParticlesExport>(py, self.samples)?;
+        let samples = self.samples.into_vec(|sample, scale| sample.weight *= scale);
+        let samples = Export::export::<SampledParticlesExport>(py, samples)?;
         Ok(samples)
     }
 
@@ -455,11 +865,12 @@ impl ParticlesCell {
         tid: i32,
         state: ffi::Particle,
         weight: f64,
-        random_index: &[u64; 2]
+        random_index: &[u64; 2],
+        rng: &mut Pcg64Mcg,
     ) {
         let random_index = *random_index;
         let sample = ffi::SampledParticle { event, tid, state, weight, random_index };
-        self.samples.push(sample);
+        self.samples.push(sample, rng);
     }
 }
 
@@ -472,4 +883,181 @@ impl ParticlesCell {
 
 #[derive(AsMut, AsRef, From)]
 #[pyclass(module="calzone")]
-struct SampledParticlesExport (Export<ffi::SampledParticle>);
+pub(crate) struct SampledParticlesExport (Export<ffi::SampledParticle>);
+
+
+// ===========================================================================================
+//
+// Capped sampling.
+//
+// Samples are capped per volume using a uniform reservoir (i.e. Algorithm R). At export, the
+// weights of retained samples are rescaled by the ratio of seen to retained samples, such that
+// weighted sums remain unbiased. Retained samples are exported in their arrival order. In
+// addition, running summaries are collected over all samples, i.e. over the same population as
+// the reservoir (events, steps, tracks or particles, depending on the sampling mode).
+//
+// ===========================================================================================
+
+#[derive(Clone, FromPyObject)]
+pub enum MaxSamples {
+    #[pyo3(transparent, annotation = "int")]
+    Global(usize),
+    #[pyo3(transparent, annotation = "dict")]
+    Volumes(HashMap<String, usize>),
+}
+
+impl MaxSamples {
+    fn get(&self, volume: *const ffi::G4VPhysicalVolume) -> Option<usize> {
+        match self {
+            Self::Global(capacity) => Some(*capacity),
+            Self::Volumes(capacities) => {
+                let volume: &ffi::G4VPhysicalVolume = unsafe { &*volume };
+                capacities.get(ffi::as_str(volume.GetName())).copied()
+            },
+        }
+    }
+
+    pub fn validate(self) -> PyResult<Self> {
+        let is_valid = match &self {
+            Self::Global(capacity) => *capacity > 0,
+            Self::Volumes(capacities) => capacities.values().all(|capacity| *capacity > 0),
+        };
+        if is_valid {
+            Ok(self)
+        } else {
+            let why = "expected strictly positive value(s)";
+            let err = Error::new(ValueError).what("max_samples").why(why);
+            Err(err.to_err())
+        }
+    }
+}
+
+impl IntoPy<PyObject> for MaxSamples {
+    fn into_py(self, py: Python) -> PyObject {
+        match self {
+            Self::Global(capacity) => capacity.into_py(py),
+            Self::Volumes(capacities) => capacities.into_py(py),
+        }
+    }
+}
+
+struct Reservoir<T> {
+    samples: Vec<T>,
+    ranks: Vec<usize>, // Arrival ranks of capped samples.
+    capacity: Option<usize>,
+    seen: usize,
+}
+
+impl<T> Reservoir<T> {
+    fn new(capacity: Option<usize>) -> Self {
+        Self { samples: Vec::new(), ranks: Vec::new(), capacity, seen: 0 }
+    }
+
+    fn into_vec(self, rescale: impl Fn(&mut T, f64)) -> Vec<T> {
+        let Self { mut samples, ranks, seen, .. } = self;
+        let scale = reservoir_scale(samples.len(), seen);
+        if scale != 1.0 {
+            // Some samples were replaced. Thus, the arrival order must be restored.
+            samples.iter_mut().for_each(|sample| rescale(sample, scale));
+            let mut ranked: Vec<_> = ranks.into_iter().zip(samples).collect();
+            ranked.sort_unstable_by_key(|(rank, _)| *rank);
+            samples = ranked.into_iter().map(|(_, sample)| sample).collect();
+        }
+        samples
+    }
+
+    fn memory(&self) -> usize {
+        vec_size(&self.samples) + vec_size(&self.ranks)
+    }
+
+    fn push(&mut self, sample: T, rng: &mut Pcg64Mcg) {
+        let rank = self.seen;
+        self.seen += 1;
+        let n = self.samples.len();
+        match reservoir_slot(n, self.seen, self.capacity, rng) {
+            Some(i) if i < n => {
+                self.samples[i] = sample;
+                self.ranks[i] = rank;
+            },
+            Some(_) => {
+                self.samples.push(sample);
+                if self.capacity.is_some() {
+                    self.ranks.push(rank);
+                }
+            },
+            None => (),
+        }
+    }
+}
+
+// Returns the reservoir slot of a new sample, or `None` if the sample is rejected. Note that
+// `seen` includes the new sample.
+fn reservoir_slot(
+    n: usize,
+    seen: usize,
+    capacity: Option<usize>,
+    rng: &mut Pcg64Mcg,
+) -> Option<usize> {
+    match capacity {
+        Some(capacity) if n >= capacity => {
+            let i = rng.gen_range(0..seen);
+            if i < capacity { Some(i) } else { None }
+        },
+        _ => Some(n),
+    }
+}
+
+fn reservoir_scale(n: usize, seen: usize) -> f64 {
+    if (n > 0) && (n < seen) {
+        (seen as f64) / (n as f64)
+    } else {
+        1.0
+    }
+}
+
+type Summaries = IndexMap<*const ffi::G4VPhysicalVolume, Summary>;
+
+fn summary_mut(
+    summaries: &mut Option<Summaries>,
+    volume: *const ffi::G4VPhysicalVolume,
+) -> Option<&mut Summary> {
+    summaries
+        .as_mut()
+        .map(|summaries| summaries.entry(volume).or_default())
+}
+
+#[derive(Default)]
+struct Summary {
+    count: usize,
+    sum_w: f64,
+    sum_wx: f64,
+    sum_wx2: f64,
+}
+
+impl Summary {
+    fn export(&self, py: Python) -> PyResult<PyObject> {
+        let summary = Namespace::new(py, &[
+            ("count", self.count.into_py(py)),
+            ("sum_w", self.sum_w.into_py(py)),
+            ("sum_wx", self.sum_wx.into_py(py)),
+            ("sum_wx2", self.sum_wx2.into_py(py)),
+        ])?;
+        Ok(summary.unbind())
+    }
+
+    fn push(&mut self, x: f64, weight: f64) {
+        self.count += 1;
+        self.sum_w += weight;
+        self.sum_wx += weight * x;
+        self.sum_wx2 += weight * x * x;
+    }
+}
+
+fn summaries_export(py: Python, summaries: &Summaries) -> PyResult<PyObject> {
+    let data = PyDict::new_bound(py);
+    for (volume, summary) in summaries.iter() {
+        let volume: &ffi::G4VPhysicalVolume = unsafe { &**volume };
+        data.set_item(ffi::as_str(volume.GetName()), summary.export(py)?)?;
+    }
+    Ok(data.into_any().unbind())
+}
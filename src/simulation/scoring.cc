@@ -0,0 +1,199 @@
+// fmt library.
+#include <fmt/core.h>
+// User interface.
+#include "scoring.h"
+// Geant4 interface.
+#include "G4Step.hh"
+// C++ standard library.
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+
+// ============================================================================
+//
+// Scoring meshes.
+//
+// Steps are expressed in the frame of each mesh, then split over the crossed
+// voxels using a 3D DDA (Amanatides & Woo). Continuous quantities are shared
+// in proportion of the crossed length, while the deposits of neutral
+// particles are located at the step end.
+//
+// ============================================================================
+
+void ScoringImpl::Score(const G4Step * step) {
+    auto && track = step->GetTrack();
+    auto && weight = track->GetWeight();
+    const double deposit =
+        weight * step->GetTotalEnergyDeposit() / CLHEP::MeV;
+    const double length = weight * step->GetStepLength() / CLHEP::cm;
+    if ((deposit <= 0.0) && (length <= 0.0)) {
+        return;
+    }
+    const bool charged =
+        track->GetParticleDefinition()->GetPDGCharge() != 0.0;
+    auto && pre = step->GetPreStepPoint()->GetPosition();
+    auto && post = step->GetPostStepPoint()->GetPosition();
+
+    for (size_t i = 0; i < this->meshes.size(); i++) {
+        auto && mesh = this->meshes[i];
+        const G4ThreeVector r0 = mesh.transform.TransformPoint(pre) /
+            CLHEP::cm;
+        const G4ThreeVector r1 = mesh.transform.TransformPoint(post) /
+            CLHEP::cm;
+        if (charged) {
+            mesh.Traverse(i, r0, r1, deposit, length);
+        } else {
+            mesh.Traverse(i, r0, r1, 0.0, length);
+            if (deposit > 0.0) {
+                mesh.Deposit(i, r1, deposit);
+            }
+        }
+    }
+}
+
+void ScoringImpl::Mesh::Deposit(
+    size_t index,
+    const G4ThreeVector & r,
+    double deposit
+) const {
+    size_t voxel = 0;
+    for (size_t k = 0; k < 3; k++) {
+        if ((r[k] < this->lower[k]) || (r[k] >= this->upper[k])) {
+            return;
+        }
+        const size_t n = this->shape[k];
+        auto && i = std::min(
+            (size_t)((r[k] - this->lower[k]) / this->delta[k]),
+            n - 1
+        );
+        voxel = voxel * n + i;
+    }
+    RUN_AGENT->push_score(index, voxel, deposit, 0.0);
+}
+
+void ScoringImpl::Mesh::Traverse(
+    size_t index,
+    const G4ThreeVector & r0,
+    const G4ThreeVector & r1,
+    double deposit,
+    double length
+) const {
+    // Clip the segment to the mesh bounds, using the slabs method. The
+    // segment is parametrised as r0 + t * (r1 - r0), with t in [0, 1].
+    const G4ThreeVector d = r1 - r0;
+    double t0 = 0.0, t1 = 1.0;
+    for (size_t k = 0; k < 3; k++) {
+        if (d[k] == 0.0) {
+            if ((r0[k] < this->lower[k]) || (r0[k] >= this->upper[k])) {
+                return;
+            }
+        } else {
+            double ta = (this->lower[k] - r0[k]) / d[k];
+            double tb = (this->upper[k] - r0[k]) / d[k];
+            if (ta > tb) std::swap(ta, tb);
+            t0 = std::max(t0, ta);
+            t1 = std::min(t1, tb);
+        }
+    }
+    if (t0 >= t1) {
+        return;
+    }
+
+    // Initialise the traversal, from the entry point.
+    constexpr double infinity = std::numeric_limits<double>::infinity();
+    long i[3], step[3], n[3];
+    double t_max[3], t_delta[3];
+    for (size_t k = 0; k < 3; k++) {
+        n[k] = (long)this->shape[k];
+        const double x = r0[k] + t0 * d[k];
+        i[k] = std::clamp(
+            (long)std::floor((x - this->lower[k]) / this->delta[k]),
+            0L,
+            n[k] - 1
+        );
+        if (d[k] > 0.0) {
+            step[k] = 1;
+            t_max[k] = (this->lower[k] + (i[k] + 1) * this->delta[k] - r0[k]) /
+                d[k];
+            t_delta[k] = this->delta[k] / d[k];
+        } else if (d[k] < 0.0) {
+            step[k] = -1;
+            t_max[k] = (this->lower[k] + i[k] * this->delta[k] - r0[k]) /
+                d[k];
+            t_delta[k] = -this->delta[k] / d[k];
+        } else {
+            step[k] = 0;
+            t_max[k] = infinity;
+            t_delta[k] = infinity;
+        }
+    }
+
+    // Walk through voxels, sharing quantities w.r.t. the crossed fraction.
+    double t = t0;
+    for (;;) {
+        size_t k = (t_max[0] < t_max[1]) ?
+            ((t_max[0] < t_max[2]) ? 0 : 2) :
+            ((t_max[1] < t_max[2]) ? 1 : 2);
+        const double t_next = std::min(t_max[k], t1);
+        const double fraction = t_next - t;
+        if (fraction > 0.0) {
+            const size_t voxel = (i[0] * n[1] + i[1]) * n[2] + i[2];
+            RUN_AGENT->push_score(
+                index,
+                voxel,
+                deposit * fraction,
+                length * fraction
+            );
+        }
+        if (t_next >= t1) {
+            break;
+        }
+        t = t_next;
+        i[k] += step[k];
+        if ((i[k] < 0) || (i[k] >= n[k])) {
+            break;
+        }
+        t_max[k] += t_delta[k];
+    }
+}
+
+void ScoringImpl::Update() {
+    this->meshes.clear();
+    if (!RUN_AGENT->is_scoring()) {
+        return;
+    }
+
+    auto && geometry = RUN_AGENT->geometry();
+    for (auto && mesh: RUN_AGENT->scoring_meshes()) {
+        Mesh value;
+        if (!mesh.frame.empty()) {
+            auto volume = geometry.borrow_volume(mesh.frame);
+            if (volume == nullptr) {
+                auto msg = fmt::format(
+                    "bad scoring mesh (unknown volume '{}')",
+                    std::string(mesh.frame)
+                );
+                set_error(ErrorType::ValueError, msg.c_str());
+                return;
+            }
+            auto transform = volume->compute_transform("");
+            if (transform == nullptr) {
+                return;
+            }
+            value.transform = transform->Inverse();
+        }
+        for (size_t k = 0; k < 3; k++) {
+            value.lower[k] = mesh.lower[k];
+            value.upper[k] = mesh.upper[k];
+            value.shape[k] = mesh.shape[k];
+            value.delta[k] = (mesh.upper[k] - mesh.lower[k]) / mesh.shape[k];
+        }
+        this->meshes.push_back(std::move(value));
+    }
+}
+
+ScoringImpl * ScoringImpl::Get() {
+    static ScoringImpl * instance = new ScoringImpl();
+    return instance;
+}
@@ -0,0 +1,47 @@
+#pragma once
+// Geant4 interface.
+#include "G4AffineTransform.hh"
+// User interface.
+#include "calzone.h"
+// C++ standard library.
+#include <array>
+
+class G4Step;
+
+
+struct ScoringImpl {
+    ScoringImpl(const ScoringImpl &) = delete; // Forbid copy.
+
+    // User interface.
+    void Score(const G4Step *);
+    void Update();
+
+    static ScoringImpl * Get();
+
+private:
+    ScoringImpl() = default;
+
+    struct Mesh {
+        void Deposit(
+            size_t index,
+            const G4ThreeVector & r,
+            double deposit
+        ) const;
+        void Traverse(
+            size_t index,
+            const G4ThreeVector & r0,
+            const G4ThreeVector & r1,
+            double deposit,
+            double length
+        ) const;
+
+        G4AffineTransform transform;
+        std::array<double, 3> lower;
+        std::array<double, 3> upper;
+        std::array<double, 3> delta;
+        std::array<size_t, 3> shape;
+    };
+
+    // User interface.
+    std::vector<Mesh> meshes;
+};
@@ -0,0 +1,148 @@
+use crate::utils::error::ErrorKind::ValueError;
+use crate::utils::extract::{extract, Extractor, Property, Tag, TryFromBound};
+use crate::utils::float::f64x3;
+use crate::utils::memory::vec_size;
+use crate::utils::namespace::Namespace;
+use crate::utils::numpy::{PyArray, PyArrayMethods};
+use indexmap::IndexMap;
+use pyo3::prelude::*;
+use pyo3::types::PyDict;
+use super::ffi;
+
+
+// ===============================================================================================
+//
+// Scoring meshes.
+//
+// A mesh is a regular grid of voxels, defined in the frame of a volume. Steps are split over the
+// crossed voxels on the C++ side. Values are accumulated in place, such that the memory footprint
+// only depends on the grid size.
+//
+// ===============================================================================================
+
+impl ffi::ScoringMesh {
+    pub fn size(&self) -> usize {
+        self.shape.iter().product()
+    }
+
+    pub fn to_dict<'py>(&self, py: Python<'py>) -> PyResult<Bound<'py, PyDict>> {
+        let dict = PyDict::new_bound(py);
+        if !self.frame.is_empty() {
+            dict.set_item("frame", &self.frame)?;
+        }
+        dict.set_item("lower", self.lower)?;
+        dict.set_item("upper", self.upper)?;
+        dict.set_item("shape", self.shape)?;
+        Ok(dict)
+    }
+}
+
+impl TryFromBound for ffi::ScoringMesh {
+    fn try_from_any<'py>(tag: &Tag, value: &Bound<'py, PyAny>) -> PyResult<Self> {
+        const EXTRACTOR: Extractor<4> = Extractor::new([
+            Property::optional_str("frame"),
+            Property::required_vec("lower"),
+            Property::required_vec("upper"),
+            Property::required_any("shape"),
+        ]);
+
+        let [frame, lower, upper, shape] = EXTRACTOR.extract_any(tag, value, None)?;
+        let frame: Option<String> = frame.into();
+        let lower: f64x3 = lower.into();
+        let upper: f64x3 = upper.into();
+        let lower: [f64; 3] = lower.into();
+        let upper: [f64; 3] = upper.into();
+        for i in 0..3 {
+            if !(upper[i] > lower[i]) {
+                let why = format!(
+                    "expected upper > lower, found [{}, {}, {}] <= [{}, {}, {}]",
+                    upper[0], upper[1], upper[2], lower[0], lower[1], lower[2],
+                );
+                return Err(tag.bad().what("bounds").why(why).to_err(ValueError));
+            }
+        }
+        let shape: Bound<PyAny> = shape.into();
+        let shape: [usize; 3] = extract(&shape)
+            .or_else(|| tag.bad().what("shape").into())?;
+        if shape.iter().any(|n| *n == 0) {
+            let why = format!(
+                "expected strictly positive values, found [{}, {}, {}]",
+                shape[0], shape[1], shape[2],
+            );
+            return Err(tag.bad().what("shape").why(why).to_err(ValueError));
+        }
+
+        let mesh = Self {
+            frame: frame.unwrap_or_else(|| String::new()),
+            lower,
+            upper,
+            shape,
+        };
+        Ok(mesh)
+    }
+}
+
+
+// ===============================================================================================
+//
+// Scoring sampler.
+//
+// Deposits (in MeV) and track lengths (in cm) are weighted, and stored per voxel.
+//
+// ===============================================================================================
+
+pub struct Scorer {
+    meshes: Vec<ffi::ScoringMesh>,
+    names: Vec<String>,
+    grids: Vec<Vec<[f64; 2]>>,
+}
+
+impl Scorer {
+    pub fn new(meshes: &IndexMap<String, ffi::ScoringMesh>) -> Self {
+        let names = meshes.keys().cloned().collect();
+        let meshes: Vec<_> = meshes.values().cloned().collect();
+        let grids = meshes
+            .iter()
+            .map(|mesh| vec![[0.0; 2]; mesh.size()])
+            .collect();
+        Self { meshes, names, grids }
+    }
+
+    pub fn export(self, py: Python) -> PyResult<PyObject> {
+        let data = PyDict::new_bound(py);
+        for ((name, mesh), grid) in self.names.iter().zip(self.meshes.iter()).zip(self.grids) {
+            let deposit = PyArray::<f64>::empty(py, &mesh.shape)?;
+            let length = PyArray::<f64>::empty(py, &mesh.shape)?;
+            {
+                let deposit = unsafe { deposit.slice_mut()? };
+                let length = unsafe { length.slice_mut()? };
+                for (i, [di, li]) in grid.into_iter().enumerate() {
+                    deposit[i] = di;
+                    length[i] = li;
+                }
+            }
+            let grid = Namespace::new(py, &[
+                ("deposit", deposit.into_any().unbind()),
+                ("length", length.into_any().unbind()),
+            ])?;
+            data.set_item(name, grid)?;
+        }
+        Ok(data.into_any().unbind())
+    }
+
+    pub fn memory(&self) -> usize {
+        let grids: usize = self.grids.iter().map(vec_size).sum();
+        vec_size(&self.meshes) + vec_size(&self.names) + vec_size(&self.grids) + grids
+    }
+
+    pub fn meshes<'b>(&'b self) -> &'b [ffi::ScoringMesh] {
+        &self.meshes
+    }
+
+    #[inline]
+    pub fn push(&mut self, mesh: usize, voxel: usize, deposit: f64, length: f64) {
+        let value = &mut self.grids[mesh][voxel];
+        value[0] += deposit;
+        value[1] += length;
+    }
+}
@@ -15,39 +15,48 @@ void SourceImpl::GeneratePrimaries(G4Event * event) {
         RandomImpl::Get()->SetIndex(RUN_AGENT->next_random_index());
     }
     auto random_index = RandomImpl::Get()->GetIndex();
-    auto primary = RUN_AGENT->next_primary(random_index);
-    G4ParticleDefinition * definition;
-    if (primary.pid != 0) {
-        definition = G4ParticleTable::GetParticleTable()->FindParticle(
-            primary.pid
-        );
-    } else {
-        definition = G4Geantino::Definition();
-    }
-    if (definition == nullptr) {
+    // Note that an event might have several primaries (e.g. a decay cascade),
+    // each one resulting in a distinct vertex.
+    auto primaries = RUN_AGENT->next_primaries(random_index);
+    if (RUN_AGENT->is_aborted()) {
         event->SetEventAborted();
-        auto manager = G4RunManager::GetRunManager();
-        manager->AbortRun(true);
-        auto msg = fmt::format(
-            "bad pid (expected a valid PDG encoding, found '{}')",
-            primary.pid
-        );
-        set_error(ErrorType::ValueError, msg.c_str());
+        G4RunManager::GetRunManager()->AbortRun(true);
         return;
     }
-    gun.SetParticleDefinition(definition);
-    gun.SetParticleEnergy(primary.energy * CLHEP::MeV);
-    gun.SetParticlePosition(G4ThreeVector(
-        primary.position[0] * CLHEP::cm,
-        primary.position[1] * CLHEP::cm,
-        primary.position[2] * CLHEP::cm
-    ));
-    gun.SetParticleMomentumDirection(G4ThreeVector(
-        primary.direction[0],
-        primary.direction[1],
-        primary.direction[2]
-    ));
-    gun.GeneratePrimaryVertex(event);
+    for (auto && primary: primaries) {
+        G4ParticleDefinition * definition;
+        if (primary.pid != 0) {
+            definition = G4ParticleTable::GetParticleTable()->FindParticle(
+                primary.pid
+            );
+        } else {
+            definition = G4Geantino::Definition();
+        }
+        if (definition == nullptr) {
+            event->SetEventAborted();
+            auto manager = G4RunManager::GetRunManager();
+            manager->AbortRun(true);
+            auto msg = fmt::format(
+                "bad pid (expected a valid PDG encoding, found '{}')",
+                primary.pid
+            );
+            set_error(ErrorType::ValueError, msg.c_str());
+            return;
+        }
+        gun.SetParticleDefinition(definition);
+        gun.SetParticleEnergy(primary.energy * CLHEP::MeV);
+        gun.SetParticlePosition(G4ThreeVector(
+            primary.position[0] * CLHEP::cm,
+            primary.position[1] * CLHEP::cm,
+            primary.position[2] * CLHEP::cm
+        ));
+        gun.SetParticleMomentumDirection(G4ThreeVector(
+            primary.direction[0],
+            primary.direction[1],
+            primary.direction[2]
+        ));
+        gun.GeneratePrimaryVertex(event);
+    }
 }
 
 SourceImpl * SourceImpl::Get() {
@@ -1,16 +1,17 @@
 use crate::geometry::{Geometry, Volume};
-use crate::utils::error::{ctrlc_catched, Error, variant_explain};
+use crate::utils::error::{ctrlc_catched, Error, Failure, variant_explain};
 use crate::utils::error::ErrorKind::{KeyboardInterrupt, KeyError, NotImplementedError, TypeError,
                                      ValueError};
 use crate::utils::float::f64x3;
-use crate::utils::numpy::{Dtype, PyArray, PyArrayMethods, ShapeArg};
+use crate::utils::numpy::{Dtype, PyArray, PyArrayMethods, PyUntypedArray, ShapeArg};
 use cxx::{SharedPtr, UniquePtr};
 use enum_variants_strings::EnumVariantsStrings;
 use pyo3::prelude::*;
-use pyo3::types::{PyDict, PyString, PyType};
-use pyo3::exceptions::PyKeyError;
+use pyo3::types::{PyDict, PyIterator, PyString, PyType};
+use pyo3::exceptions::{PyKeyError, PyTypeError};
 use super::ffi;
-use super::random::{Random, RandomContext};
+use super::random::{AliasTable, Random, RandomContext};
+use std::thread::JoinHandle;
 
 
 const DEFAULT_PID: i32 = 22; // A photon.
@@ -86,17 +87,29 @@ pub struct ParticlesIterator<'a> {
     direction: &'a PyArray<f64>,
     pid: Option<Property<'a, i32>>,
     weight: Option<Property<'a, f64>>,
+    event: Option<Property<'a, u64>>,
     size: usize,
+    events: usize,
     index: usize,
+    count: usize,
 }
 
 impl<'a> ParticlesIterator<'a> {
-    pub fn new<'py: 'a>(elements: &'a Bound<'py, PyAny>) -> PyResult<Self> {
+    pub fn new<'py: 'a>(
+        elements: &'a Bound<'py, PyAny>,
+        events: Option<usize>,
+        group_events: bool,
+    ) -> PyResult<Self> {
         let energy = Property::new(elements, "energy")?;
         let position = extract(elements, "position")?;
         let direction = extract(elements, "direction")?;
         let pid = Property::maybe_new(elements, "pid")?;
         let weight = Property::maybe_new(elements, "weight")?;
+        let event = if group_events {
+            Some(Property::new(elements, "event")?)
+        } else {
+            None
+        };
         if *position.shape().last().unwrap_or(&0) != 3 {
             let why = format!("expected a shape '[..,3]' array, found '{:?}'", position.shape());
             let err = Error::new(ValueError)
@@ -119,6 +132,7 @@ impl<'a> ParticlesIterator<'a> {
             direction.size() / 3,
             pid.map(|a| a.size()).unwrap_or(size),
             weight.map(|a| a.size()).unwrap_or(size),
+            event.map(|a| a.size()).unwrap_or(size),
         ];
         if others.iter().any(|x| *x != size) {
             let err = Error::new(ValueError)
@@ -127,13 +141,55 @@ impl<'a> ParticlesIterator<'a> {
                 .to_err();
             return Err(err);
         }
+
+        // Count events, i.e. groups of consecutive particles sharing the same event key. Note that
+        // this scan is skipped if the number of events is provided (e.g. for memory mapped data).
+        // In this case, the number of events is checked as events are consumed.
+        let events = match (event, events) {
+            (None, Some(events)) if events != size => {
+                let why = format!("expected {} events, found {}", size, events);
+                let err = Error::new(ValueError)
+                    .what("events")
+                    .why(&why)
+                    .to_err();
+                return Err(err);
+            },
+            (None, _) => size,
+            (Some(_), Some(events)) if events > size => {
+                let why = format!("expected at most {} events, found {}", size, events);
+                let err = Error::new(ValueError)
+                    .what("events")
+                    .why(&why)
+                    .to_err();
+                return Err(err);
+            },
+            (Some(_), Some(events)) => events,
+            (Some(event), None) => {
+                let mut events = 0;
+                let mut previous = None;
+                for i in 0..size {
+                    let key = event.get(i)?;
+                    if previous != Some(key) {
+                        events += 1;
+                        previous = Some(key);
+                    }
+                }
+                events
+            },
+        };
+
         let index = 0;
+        let count = 0;
         let iter = Self {
-            energy, position, direction, pid, weight, size, index
+            energy, position, direction, pid, weight, event, size, events, index, count
         };
         Ok(iter)
     }
 
+    pub fn events(&self) -> usize {
+        self.events
+    }
+
     fn get(&self, index: usize) -> PyResult<(ffi::Particle, f64)> {
         let pid = match self.pid {
             None => DEFAULT_PID,
@@ -160,11 +216,324 @@ impl<'a> ParticlesIterator<'a> {
         Ok((particle, weight))
     }
 
+    pub fn next_event(&mut self, primaries: &mut Vec<ffi::Particle>) -> PyResult<f64> {
+        // The particles of an event must share the same weight.
+        primaries.clear();
+        if self.index >= self.size {
+            return Err(events_mismatch(self.events, Some(self.count)).into())
+        }
+        let (particle, weight) = self.get(self.index)?;
+        primaries.push(particle);
+        self.index += 1;
+        if let Some(event) = self.event {
+            let key = event.get(self.index - 1)?;
+            while (self.index < self.size) && (event.get(self.index)? == key) {
+                let (particle, w) = self.get(self.index)?;
+                if w != weight {
+                    return Err(mixed_weights(key).into())
+                }
+                primaries.push(particle);
+                self.index += 1;
+            }
+        }
+        self.count += 1;
+        if (self.count == self.events) && (self.index < self.size) {
+            return Err(events_mismatch(self.events, None).into())
+        }
+        Ok(weight)
+    }
+
     pub fn size(&self) -> usize {
         self.size
     }
 }
 
+
+// ===============================================================================================
+//
+// Primaries buffer.
+//
+// Particles are read from contiguous memory (e.g. provided by a native caller), with optional
+// per particle weights and event keys, following the same conventions as for arrays.
+//
+// ===============================================================================================
+
+pub struct ParticlesBuffer<'a> {
+    particles: &'a [ffi::Particle],
+    weight: Option<&'a [f64]>,
+    event: Option<&'a [u64]>,
+    events: usize,
+    index: usize,
+}
+
+impl<'a> ParticlesBuffer<'a> {
+    pub fn new(
+        particles: &'a [ffi::Particle],
+        weight: Option<&'a [f64]>,
+        event: Option<&'a [u64]>,
+    ) -> Self {
+        let events = match event {
+            None => particles.len(),
+            Some(event) => {
+                let mut events = 0;
+                let mut previous = None;
+                for key in event.iter() {
+                    if previous != Some(key) {
+                        events += 1;
+                        previous = Some(key);
+                    }
+                }
+                events
+            },
+        };
+        Self { particles, weight, event, events, index: 0 }
+    }
+
+    fn next_event(&mut self, primaries: &mut Vec<ffi::Particle>) -> Result<f64, Failure> {
+        // The particles of an event must share the same weight.
+        primaries.clear();
+        let size = self.particles.len();
+        if self.index >= size {
+            let err = Error::new(ValueError)
+                .what("particles")
+                .why("no more events");
+            return Err(err.to_failure())
+        }
+        let start = self.index;
+        self.index += 1;
+        if let Some(event) = self.event {
+            while (self.index < size) && (event[self.index] == event[start]) {
+                self.index += 1;
+            }
+        }
+        let weight = match self.weight {
+            None => 1.0,
+            Some(weight) => {
+                if weight[start + 1..self.index].iter().any(|w| *w != weight[start]) {
+                    return Err(mixed_weights(self.event.unwrap()[start]))
+                }
+                weight[start]
+            },
+        };
+        primaries.extend_from_slice(&self.particles[start..self.index]);
+        Ok(weight)
+    }
+}
+
+
+// ===============================================================================================
+//
+// Primaries stream.
+//
+// Primaries are read from an iterable of chunks (e.g. slices of a memory mapped array). Chunks are
+// decoded one at a time, such that the input does not need to fit in memory. While a chunk is
+// being simulated, the memory of the next one is prefetched (i.e. paged in) by a background
+// thread. Note that an event must not span over several chunks, and that the expected number of
+// events is checked as events are consumed.
+//
+// ===============================================================================================
+
+pub enum Primaries<'a> {
+    Array(ParticlesIterator<'a>),
+    Buffer(ParticlesBuffer<'a>),
+    Stream(ParticlesStream<'a>),
+}
+
+impl<'a> Primaries<'a> {
+    pub fn new<'py: 'a>(
+        particles: &'a Bound<'py, PyAny>,
+        events: Option<usize>,
+        group_events: bool,
+    ) -> PyResult<Self> {
+        let py = particles.py();
+        let is_stream = match particles.get_item("energy") {
+            Ok(_) => false,
+            Err(err) => err.is_instance_of::<PyTypeError>(py),
+        };
+        if is_stream {
+            let events = events.ok_or_else(|| {
+                Error::new(ValueError)
+                    .what("events")
+                    .why("undefined (required for an iterable of particles)")
+                    .to_err()
+            })?;
+            let stream = ParticlesStream::new(particles, events, group_events)?;
+            Ok(Self::Stream(stream))
+        } else {
+            let iter = ParticlesIterator::new(particles, events, group_events)?;
+            Ok(Self::Array(iter))
+        }
+    }
+
+    pub fn events(&self) -> usize {
+        match self {
+            Self::Array(iter) => iter.events(),
+            Self::Buffer(buffer) => buffer.events,
+            Self::Stream(stream) => stream.events,
+        }
+    }
+
+    pub fn next_event(&mut self, primaries: &mut Vec<ffi::Particle>) -> Result<f64, Failure> {
+        match self {
+            Self::Array(iter) => Ok(iter.next_event(primaries)?),
+            Self::Buffer(buffer) => buffer.next_event(primaries),
+            Self::Stream(stream) => Ok(stream.next_event(primaries)?),
+        }
+    }
+}
+
+pub struct ParticlesStream<'a> {
+    iter: Bound<'a, PyIterator>,
+    events: usize,
+    group_events: bool,
+    count: usize,
+    // Current chunk.
+    particles: Vec<ffi::Particle>,
+    groups: Vec<(usize, usize, f64)>,
+    group: usize,
+    last_key: Option<u64>,
+    // Next chunk.
+    next: Option<(Bound<'a, PyAny>, JoinHandle<()>)>,
+}
+
+impl<'a> ParticlesStream<'a> {
+    const PAGE_SIZE: usize = 4096;
+
+    fn new<'py: 'a>(
+        particles: &'a Bound<'py, PyAny>,
+        events: usize,
+        group_events: bool,
+    ) -> PyResult<Self> {
+        let iter = particles.iter()?;
+        let mut stream = Self {
+            iter,
+            events,
+            group_events,
+            count: 0,
+            particles: Vec::new(),
+            groups: Vec::new(),
+            group: 0,
+            last_key: None,
+            next: None,
+        };
+        stream.next = stream.fetch()?;
+        Ok(stream)
+    }
+
+    fn decode(&mut self, chunk: &Bound<PyAny>) -> PyResult<()> {
+        // Gil-refs created by the extraction are released along with the chunk.
+        let pool = unsafe { chunk.py().new_pool() };
+        self.particles.clear();
+        self.groups.clear();
+        self.group = 0;
+        let result = (|| -> PyResult<()> {
+            let mut iter = ParticlesIterator::new(chunk, None, self.group_events)?;
+            if let (Some(event), true) = (iter.event, iter.size > 0) {
+                // Check that the first event of this chunk does not continue the last event of
+                // the previous chunk.
+                let key = event.get(0)?;
+                if self.last_key == Some(key) {
+                    let why = format!("event {} spans over several chunks", key);
+                    let err = Error::new(ValueError)
+                        .what("particles")
+                        .why(&why)
+                        .to_err();
+                    return Err(err)
+                }
+                self.last_key = Some(event.get(iter.size - 1)?);
+            }
+            let mut primaries = Vec::new();
+            for _ in 0..iter.events() {
+                let weight = iter.next_event(&mut primaries)?;
+                let start = self.particles.len();
+                self.particles.extend_from_slice(&primaries);
+                self.groups.push((start, self.particles.len(), weight));
+            }
+            Ok(())
+        })();
+        drop(pool);
+        result
+    }
+
+    fn fetch(&mut self) -> PyResult<Option<(Bound<'a, PyAny>, JoinHandle<()>)>> {
+        let Some(chunk) = self.iter.next() else { return Ok(None) };
+        let chunk = chunk?;
+
+        // Locate the chunk memory, and page it in from a background thread.
+        let pool = unsafe { chunk.py().new_pool() };
+        let mut ranges = Vec::<(usize, usize)>::new();
+        for key in ["energy", "position", "direction", "pid", "weight", "event"] {
+            let Ok(value) = chunk.get_item(key) else { continue };
+            let Ok(array) = value.extract::<&PyUntypedArray>() else { continue };
+            let size = array.size();
+            if size == 0 {
+                continue
+            }
+            let first = array.data(0)? as usize;
+            let last = array.data(size - 1)? as usize;
+            ranges.push((first.min(last), first.max(last) + 1));
+        }
+        drop(pool);
+        let handle = std::thread::spawn(move || {
+            for (start, end) in ranges.into_iter() {
+                for address in (start..end).step_by(Self::PAGE_SIZE) {
+                    let _ = unsafe { std::ptr::read_volatile(address as *const u8) };
+                }
+            }
+        });
+        Ok(Some((chunk, handle)))
+    }
+
+    fn next_event(&mut self, primaries: &mut Vec<ffi::Particle>) -> PyResult<f64> {
+        while self.group >= self.groups.len() {
+            let Some((chunk, handle)) = self.next.take() else {
+                return Err(events_mismatch(self.events, Some(self.count)).into())
+            };
+            let _ = handle.join();
+            self.decode(&chunk)?;
+            self.next = self.fetch()?;
+        }
+        let (start, end, weight) = self.groups[self.group];
+        self.group += 1;
+        primaries.clear();
+        primaries.extend_from_slice(&self.particles[start..end]);
+        self.count += 1;
+        if (self.count == self.events) &&
+           ((self.group < self.groups.len()) || self.next.is_some()) {
+            return Err(events_mismatch(self.events, None).into())
+        }
+        Ok(weight)
+    }
+}
+
+impl<'a> Drop for ParticlesStream<'a> {
+    fn drop(&mut self) {
+        // Wait for the prefetch thread before releasing the chunk memory.
+        if let Some((_, handle)) = self.next.take() {
+            let _ = handle.join();
+        }
+    }
+}
+
+fn events_mismatch(expected: usize, found: Option<usize>) -> Failure {
+    let why = match found {
+        Some(found) => format!("expected {} events, found {}", expected, found),
+        None => format!("expected {} events, found more", expected),
+    };
+    Error::new(ValueError)
+        .what("events")
+        .why(&why)
+        .to_failure()
+}
+
+fn mixed_weights(event: u64) -> Failure {
+    let why = format!("mixed weights for event {}", event);
+    Error::new(ValueError)
+        .what("particles")
+        .why(&why)
+        .to_failure()
+}
+
 fn extract<'a, 'py, T>(elements: &'a Bound<'py, PyAny>, key: &str) -> PyResult<&'a PyArray<T>>
 where
     'py: 'a,
@@ -185,20 +554,6 @@ where
         })
 }
 
-impl<'a> Iterator for ParticlesIterator<'a> {
-    type Item = PyResult<(ffi::Particle, f64)>;
-
-    fn next(&mut self) -> Option<Self::Item> {
-        if self.index < self.size {
-            let item = Some(self.get(self.index));
-            self.index += 1;
-            item
-        } else {
-            None
-        }
-    }
-}
-
 #[derive(Clone, Copy)]
 enum Property<'a, T>
 where
@@ -276,7 +631,8 @@ pub struct ParticlesGenerator {
     geometry: Option<SharedPtr<ffi::GeometryBorrow>>,
     // Configuration.
     direction: Direction,
-    energy: Energy,
+    energy: Emission,
+    importance: Importance,
     pid: Option<i32>,
     position: Position,
     // Weight flags.
@@ -294,6 +650,19 @@ enum Direction {
     SolidAngle { phi: [f64; 2], cos_theta: [f64; 2] },
 }
 
+// Particles are emitted either one at a time, with a distributed kinetic energy, or as a cascade,
+// with fixed kinetic energies.
+enum Emission {
+    Cascade(Vec<f64>),
+    Single(Energy),
+}
+
+impl Default for Emission {
+    fn default() -> Self {
+        Self::Single(Energy::default())
+    }
+}
+
 #[derive(Default)]
 enum Energy {
     #[default]
@@ -308,12 +677,25 @@ struct EmissionLine {
     intensity: f64,
 }
 
+struct Grid<const N: usize> {
+    shape: [usize; N],
+    values: Vec<f64>,
+}
+
+#[derive(Default)]
+enum Importance {
+    Grid(Grid<3>),
+    #[default]
+    None,
+    Target { center: [f64; 3], radius: f64, attenuation: f64, shape: [usize; 3] },
+}
+
 #[derive(Default)]
 enum Position {
-    Inside { volume: Volume, include_daughters: bool },
+    Inside { volume: Volume, include_daughters: bool, activity: Option<Grid<3>> },
     #[default]
     None,
-    Onto { volume: Volume, direction: Option<DirectionArg> },
+    Onto { volume: Volume, direction: Option<DirectionArg>, activity: Option<Grid<2>> },
     Point([f64; 3]),
 }
 
@@ -329,7 +711,7 @@ impl ParticlesGenerator {
     ) -> PyResult<Self> {
         let weight = weight.unwrap_or(false);
         let random = match random {
-            None => Py::new(py, Random::new(None, None)?)?,
+            None => Py::new(py, Random::new(None, None, None)?)?,
             Some(random) => random.unbind(),
         };
         let geometry = geometry.map(|geometry| geometry.borrow().0.clone());
@@ -337,7 +719,8 @@ impl ParticlesGenerator {
             random,
             geometry,
             direction: Direction::default(),
-            energy: Energy::default(),
+            energy: Emission::default(),
+            importance: Importance::default(),
             pid: None,
             position: Position::default(),
             weight,
@@ -348,6 +731,24 @@ impl ParticlesGenerator {
         Ok(generator)
     }
 
+    /// Emit a cascade of particles per event, with fixed kinetic energies.
+    #[pyo3(signature=(energies, /))]
+    fn cascade<'py>(
+        slf: Bound<'py, Self>,
+        energies: Vec<f64>,
+    ) -> PyResult<Bound<'py, Self>> {
+        if energies.is_empty() {
+            let err = Error::new(ValueError)
+                .what("energies")
+                .why("empty cascade");
+            return Err(err.to_err());
+        }
+        let mut generator = slf.borrow_mut();
+        generator.energy = Emission::Cascade(energies);
+        generator.weight_energy = Some(false);
+        Ok(slf)
+    }
+
     /// Fix the Monte Carlo particles direction.
     #[pyo3(signature=(value, /))]
     fn direction<'py>(
@@ -367,7 +768,7 @@ impl ParticlesGenerator {
         value: f64,
     ) -> PyResult<Bound<'py, Self>> {
         let mut generator = slf.borrow_mut();
-        generator.energy = Energy::Point(value);
+        generator.energy = Emission::Single(Energy::Point(value));
         generator.weight_energy = Some(false);
         Ok(slf)
     }
@@ -376,8 +777,15 @@ impl ParticlesGenerator {
     #[pyo3(signature=(shape=None, /))]
     fn generate<'py>(&self, py: Python<'py>, shape: Option<ShapeArg>) -> PyResult<PyObject> {
         // Check configuration.
-        if let Position::Onto { direction, .. } = self.position {
+        if let Position::Onto { direction, activity, .. } = &self.position {
             if let Some(direction) = direction {
+                if activity.is_some() {
+                    let why = format!("'activity' conflicts with 'on/{}'", direction.to_str());
+                    let err = Error::new(ValueError)
+                        .what("configuration")
+                        .why(&why);
+                    return Err(err.to_err())
+                }
                 match &self.direction {
                     Direction::None => (),
                     _ => {
@@ -392,32 +800,71 @@ impl ParticlesGenerator {
                         return Err(err.to_err())
                     },
                 }
+                if let Emission::Cascade(_) = self.energy {
+                    let why = format!("'cascade' conflicts with 'on/{}'", direction.to_str());
+                    let err = Error::new(ValueError)
+                        .what("configuration")
+                        .why(&why);
+                    return Err(err.to_err())
+                }
+            }
+        }
+
+        if !matches!(self.importance, Importance::None) {
+            if !matches!(self.position, Position::Inside { .. }) {
+                let err = Error::new(ValueError)
+                    .what("configuration")
+                    .why("'importance' requires 'inside'");
+                return Err(err.to_err())
+            }
+            if self.weight_position == Some(false) {
+                let err = Error::new(ValueError)
+                    .what("configuration")
+                    .why("'importance' conflicts with 'inside/weight=False'");
+                return Err(err.to_err())
+            }
+            if let Position::Inside { activity: Some(_), .. } = self.position {
+                let err = Error::new(ValueError)
+                    .what("configuration")
+                    .why("'importance' conflicts with 'inside/activity'");
+                return Err(err.to_err())
             }
         }
 
         // Create particles container.
-        let shape: Vec<usize> = match shape {
+        let mut shape: Vec<usize> = match shape {
             Some(shape) => shape.into(),
             None => Vec::new(),
         };
+        let multiplicity = match &self.energy {
+            Emission::Cascade(energies) => {
+                shape.push(energies.len());
+                energies.len()
+            },
+            _ => 1,
+        };
         let array = PyArray::<ffi::SampledParticle>::zeros(py, &shape)?;
         let particles = unsafe { array.slice_mut()? };
         let any_weight = {
             let direction = self.weight_direction.unwrap_or(self.weight);
             let energy = self.weight_energy.unwrap_or(self.weight);
-            let position = self.weight_position.unwrap_or(self.weight);
-            direction || energy || position
+            direction || energy || self.weight_position()
         };
 
         // Prepare specific generators.
-        let (mut inside, onto) = match &self.position {
-            Position::Inside { volume, include_daughters } => {
-                let inside = InsideGenerator::new(volume, *include_daughters);
+        let (mut inside, mut onto) = match &self.position {
+            Position::Inside { volume, include_daughters, activity } => {
+                let inside = InsideGenerator::new(
+                    volume,
+                    *include_daughters,
+                    &self.importance,
+                    activity.as_ref(),
+                )?;
                 (Some(inside), None)
             },
-            Position::Onto { volume, direction } => {
-                let weight = self.weight_position.unwrap_or(self.weight);
-                let onto = OntoGenerator::new(volume, *direction, weight);
+            Position::Onto { volume, direction, activity } => {
+                let weight = self.weight_position();
+                let onto = OntoGenerator::new(volume, *direction, weight, activity.as_ref())?;
                 (None, Some(onto))
             },
             _ => (None, None),
@@ -427,57 +874,84 @@ impl ParticlesGenerator {
         let mut binding = self.random.bind(py).borrow_mut();
         let mut random = RandomContext::new(&mut binding);
 
-        // Loop over events.
-        for (event, primary) in particles.iter_mut().enumerate() {
-            primary.event = event;
-            primary.tid = 1;
-            primary.random_index = random.index();
-            let particle = &mut primary.state;
-
+        // Loop over events. Note that the particles of a cascade share the same position.
+        for (event, cascade) in particles.chunks_mut(multiplicity).enumerate() {
             if (event % 1000) == 0 && ctrlc_catched() {
                 return Err(Error::new(KeyboardInterrupt).to_err())
             }
-            particle.pid = match self.pid {
-                None => DEFAULT_PID,
-                Some(pid) => pid,
-            };
+            let random_index = random.index();
+            let mut position = [0.0; 3];
+            let mut position_weight = 1.0;
 
-            let mut weight = 1.0;
+            for (i, primary) in cascade.iter_mut().enumerate() {
+                primary.event = event;
+                primary.tid = (i + 1) as i32;
+                primary.random_index = random_index;
+                let particle = &mut primary.state;
 
-            let direction = match self.position {
-                Position::Inside { .. } => {
-                    particle.position = inside.as_mut().unwrap().generate(random.get())?;
-                    false
-                },
-                Position::None => false,
-                Position::Point(position) => {
+                particle.pid = match self.pid {
+                    None => DEFAULT_PID,
+                    Some(pid) => pid,
+                };
+
+                let mut weight = position_weight;
+
+                let direction = if i > 0 {
                     particle.position = position;
                     false
-                },
-                Position::Onto { .. } => onto.as_ref().unwrap().generate(
-                    &mut random,
-                    particle,
-                    &mut weight,
-                ),
-            };
+                } else {
+                    let direction = match self.position {
+                        Position::Inside { .. } => {
+                            let (r, w) = inside.as_mut().unwrap().generate(random.get())?;
+                            particle.position = r;
+                            if self.weight_position() {
+                                weight *= w;
+                            }
+                            false
+                        },
+                        Position::None => false,
+                        Position::Point(position) => {
+                            particle.position = position;
+                            false
+                        },
+                        Position::Onto { .. } => onto.as_mut().unwrap().generate(
+                            &mut random,
+                            particle,
+                            &mut weight,
+                        )?,
+                    };
+                    position = particle.position;
+                    position_weight = weight;
+                    direction
+                };
 
-            if !direction {
-                self.generate_direction(random.get(), particle, &mut weight);
-            }
-            self.generate_energy(random.get(), particle, &mut weight);
+                if !direction {
+                    self.generate_direction(random.get(), particle, &mut weight);
+                }
+                match &self.energy {
+                    Emission::Cascade(energies) => particle.energy = energies[i],
+                    Emission::Single(energy) => {
+                        self.generate_energy(energy, random.get(), particle, &mut weight)
+                    },
+                }
 
-            primary.weight = if any_weight {
-                 weight
-            } else {
-                1.0
-            };
+                primary.weight = if any_weight {
+                     weight
+                } else {
+                    1.0
+                };
+            }
         }
 
-        // Apply volume weight, if needed.
+        // Apply volume weight, if needed. Note that with an importance map (or an activity grid),
+        // the normalisation factor is estimated from the acceptance rate of the generation.
         if any_weight {
-            if self.weight_position.unwrap_or(self.weight) {
-                if let Position::Inside { volume, include_daughters } = &self.position {
-                    let has_volume = if *include_daughters {
+            if self.weight_position() {
+                if let Position::Inside { volume, include_daughters, activity } = &self.position {
+                    let has_volume = if !matches!(self.importance, Importance::None) ||
+                                        activity.is_some() {
+                        false
+                    } else if *include_daughters {
                         volume.properties.has_cubic_volume
                     } else {
                         volume.properties.has_exclusive_volume
@@ -489,6 +963,10 @@ impl ParticlesGenerator {
                     for primary in particles.iter_mut() {
                         primary.weight *= cubic_volume;
                     }
+                } else if let Some(activity) = onto.as_ref().and_then(|onto| onto.activity()) {
+                    for primary in particles.iter_mut() {
+                        primary.weight *= activity;
+                    }
                 }
             }
         }
@@ -497,31 +975,96 @@ impl ParticlesGenerator {
         Ok(array.into_any().unbind())
     }
 
+    /// Bias particles positions (inside a volume) according to an importance map.
+    #[pyo3(signature=(grid=None, /, *, target=None, attenuation=None, shape=None))]
+    fn importance<'py>(
+        slf: Bound<'py, Self>,
+        grid: Option<Bound<'py, PyAny>>,
+        target: Option<TargetArg<'py>>,
+        attenuation: Option<f64>,
+        shape: Option<[usize; 3]>,
+    ) -> PyResult<Bound<'py, Self>> {
+        let bad_importance = |what: &str, why: String| -> PyErr {
+            Error::new(ValueError).what(what).why(&why).to_err()
+        };
+        let mut generator = slf.borrow_mut();
+        let importance = match (grid, target) {
+            (Some(grid), None) => {
+                if attenuation.is_some() || shape.is_some() {
+                    let why = "'attenuation' and 'shape' require a 'target'".to_string();
+                    return Err(bad_importance("importance", why))
+                }
+                Importance::Grid(Grid::extract(grid, "grid")?)
+            },
+            (None, Some(target)) => {
+                let (center, radius) = match target {
+                    TargetArg::Point(point) => (point, 0.0),
+                    TargetArg::Volume(volume) => {
+                        let volume = volume.resolve(generator.geometry.as_ref())?;
+                        let [x0, x1, y0, y1, z0, z1] = volume.volume.compute_box("");
+                        let center = [0.5 * (x0 + x1), 0.5 * (y0 + y1), 0.5 * (z0 + z1)];
+                        let radius = 0.5 * f64x3::new(x1 - x0, y1 - y0, z1 - z0).norm();
+                        (center, radius)
+                    },
+                };
+                let attenuation = attenuation.unwrap_or(0.0);
+                if !(attenuation >= 0.0) || !attenuation.is_finite() {
+                    let why = format!("expected a positive value, found {}", attenuation);
+                    return Err(bad_importance("attenuation", why))
+                }
+                let shape = shape.unwrap_or(VoxelTable::DEFAULT_SHAPE);
+                if shape.iter().any(|n| *n == 0) {
+                    let why = format!(
+                        "expected strictly positive values, found [{}, {}, {}]",
+                        shape[0], shape[1], shape[2],
+                    );
+                    return Err(bad_importance("shape", why))
+                }
+                Importance::Target { center, radius, attenuation, shape }
+            },
+            (None, None) => Importance::None,
+            (Some(_), Some(_)) => {
+                let why = "'grid' conflicts with 'target'".to_string();
+                return Err(bad_importance("importance", why))
+            },
+        };
+        generator.importance = importance;
+        Ok(slf)
+    }
+
     /// Set particles positions to be distributed inside a volume.
-    #[pyo3(signature=(volume, /, *, include_daughters=None, weight=None))]
-    #[pyo3(text_signature="(volume, /, *, include_daughters=False, weight=None)")]
+    #[pyo3(signature=(volume, /, *, activity=None, include_daughters=None, weight=None))]
+    #[pyo3(text_signature="(volume, /, *, activity=None, include_daughters=False, weight=None)")]
     fn inside<'py>(
         slf: Bound<'py, Self>,
         volume: VolumeArg,
+        activity: Option<Bound<'py, PyAny>>,
         include_daughters: Option<bool>,
         weight: Option<bool>,
     ) -> PyResult<Bound<'py, Self>> {
         let include_daughters = include_daughters.unwrap_or(false);
+        let activity = activity
+            .map(|activity| Grid::extract(activity, "activity"))
+            .transpose()?;
         let mut generator = slf.borrow_mut();
         let volume = volume.resolve(generator.geometry.as_ref())?;
         generator.weight_position = weight;
-        generator.position = Position::Inside { volume, include_daughters };
+        generator.position = Position::Inside { volume, include_daughters, activity };
         Ok(slf)
     }
 
     /// Set particles positions to be distributed on a volume surface.
-    #[pyo3(signature=(volume, /, direction=None, *, weight=None))]
+    #[pyo3(signature=(volume, /, direction=None, *, activity=None, weight=None))]
     fn on<'py>(
         slf: Bound<'py, Self>,
         volume: VolumeArg,
         direction: Option<String>,
+        activity: Option<Bound<'py, PyAny>>,
         weight: Option<bool>,
     ) -> PyResult<Bound<'py, Self>> {
+        let activity = activity
+            .map(|activity| Grid::extract(activity, "activity"))
+            .transpose()?;
         let direction = direction
             .map(|direction| DirectionArg::from_str(direction.as_str())
                 .map_err(|options| {
@@ -533,8 +1076,8 @@ impl ParticlesGenerator {
         let mut generator = slf.borrow_mut();
         let volume = volume.resolve(generator.geometry.as_ref())?;
         let weight_position = generator.weight_position.unwrap_or(generator.weight);
-        if !volume.properties.has_surface_generation ||
-            (weight_position && !volume.properties.has_surface_area) {
+        if activity.is_none() && (!volume.properties.has_surface_generation ||
+            (weight_position && !volume.properties.has_surface_area)) {
             let why = format!("not implemented for '{}'", volume.solid);
             let err = Error::new(NotImplementedError)
                 .what("'on' operation")
@@ -542,7 +1085,7 @@ impl ParticlesGenerator {
             return Err(err.to_err());
         }
         generator.weight_position = weight;
-        generator.position = Position::Onto { volume, direction };
+        generator.position = Position::Onto { volume, direction, activity };
         Ok(slf)
     }
 
@@ -586,7 +1129,7 @@ impl ParticlesGenerator {
         let exponent = exponent.unwrap_or(-1.0);
         let mut generator = slf.borrow_mut();
         generator.weight_energy = weight;
-        generator.energy = Energy::PowerLaw { energy_min, energy_max, exponent };
+        generator.energy = Emission::Single(Energy::PowerLaw { energy_min, energy_max, exponent });
         Ok(slf)
     }
 
@@ -652,7 +1195,7 @@ impl ParticlesGenerator {
 
         let mut generator = slf.borrow_mut();
         generator.weight_energy = weight;
-        generator.energy = Energy::Spectrum { lines, total_intensity };
+        generator.energy = Emission::Single(Energy::Spectrum { lines, total_intensity });
         Ok(slf)
     }
 }
@@ -674,6 +1217,37 @@ fn check_angle(value: f64, min: f64, max: f64, what: &str) -> PyResult<()> {
     }
 }
 
+impl<const N: usize> Grid<N> {
+    fn extract(value: Bound<PyAny>, what: &str) -> PyResult<Self> {
+        let bad_grid = |why: String| -> PyErr {
+            Error::new(ValueError).what(what).why(&why).to_err()
+        };
+        let py = value.py();
+        let array: &PyArray<f64> = py.import_bound("numpy")?
+            .getattr("ascontiguousarray")
+            .and_then(|f| f.call1((value, "f8")))
+            .and_then(|array| array.extract())?;
+        let shape: [usize; N] = array.shape()
+            .try_into()
+            .map_err(|shape: Vec<usize>| {
+                let why = format!(
+                    "expected a {}d array, found a {}d array",
+                    N,
+                    shape.len(),
+                );
+                bad_grid(why)
+            })?;
+        let values = unsafe { array.slice()? }.to_vec();
+        if values.iter().any(|value| !(*value >= 0.0) || !value.is_finite()) {
+            return Err(bad_grid("expected positive values".to_string()))
+        }
+        if !(values.iter().sum::<f64>() > 0.0) {
+            return Err(bad_grid("expected a strictly positive sum, found 0".to_string()))
+        }
+        Ok(Self { shape, values })
+    }
+}
+
 #[derive(Clone, Copy, EnumVariantsStrings)]
 #[enum_variants_strings_transform(transform="lower_case")]
 enum DirectionArg {
@@ -681,6 +1255,14 @@ enum DirectionArg {
     Outgoing,
 }
 
+#[derive(FromPyObject)]
+enum TargetArg<'py> {
+    #[pyo3(transparent, annotation = "[f64;3]")]
+    Point([f64; 3]),
+    #[pyo3(transparent, annotation = "str | Volume")]
+    Volume(VolumeArg<'py>),
+}
+
 #[derive(FromPyObject)]
 pub enum VolumeArg<'py> {
     #[pyo3(transparent, annotation = "str")]
@@ -715,6 +1297,17 @@ impl<'py> VolumeArg<'py> {
 impl ParticlesGenerator {
     const RAD: f64 = std::f64::consts::PI / 180.0;
 
+    fn weight_position(&self) -> bool {
+        // Importance sampling and activity sources are weighted, by default.
+        let activity = match &self.position {
+            Position::Inside { activity, .. } => activity.is_some(),
+            Position::Onto { activity, .. } => activity.is_some(),
+            _ => false,
+        };
+        let weight = self.weight || activity || !matches!(self.importance, Importance::None);
+        self.weight_position.unwrap_or(weight)
+    }
+
     fn generate_direction(
         &self,
         random: &mut Random,
@@ -730,11 +1323,12 @@ impl ParticlesGenerator {
 
     fn generate_energy(
         &self,
+        energy: &Energy,
         random: &mut Random,
         particle: &mut ffi::Particle,
         weight: &mut f64,
     ) {
-        let (energy, w) = self.energy.generate(random);
+        let (energy, w) = energy.generate(random);
         particle.energy = energy;
         if self.weight_energy.unwrap_or(self.weight) {
             *weight *= w;
@@ -835,6 +1429,7 @@ impl Energy {
 struct InsideGenerator<'a> {
     volume: &'a Volume,
     include_daughters: bool,
+    voxels: Option<VoxelTable>,
     transform: UniquePtr<ffi::G4AffineTransform>,
     xmin: f64,
     xmax: f64,
@@ -847,36 +1442,55 @@ struct InsideGenerator<'a> {
 }
 
 impl <'a> InsideGenerator<'a> {
-    fn new(volume: &'a Volume, include_daughters: bool) -> Self {
-        let [xmin, xmax, ymin, ymax, zmin, zmax] = volume.volume.compute_box("");
+    fn new(
+        volume: &'a Volume,
+        include_daughters: bool,
+        importance: &Importance,
+        activity: Option<&Grid<3>>,
+    ) -> PyResult<Self> {
+        let bounds = volume.volume.compute_box("");
+        let [xmin, xmax, ymin, ymax, zmin, zmax] = bounds;
+        let voxels = VoxelTable::new(importance, activity, &bounds)?;
         let transform = volume.volume.compute_transform("");
         let n = 0;
         let trials = 0;
-        Self {
-            volume, include_daughters, transform, xmin, xmax, ymin, ymax, zmin, zmax, n, trials
-        }
+        let generator = Self {
+            volume, include_daughters, voxels, transform, xmin, xmax, ymin, ymax, zmin, zmax,
+            n, trials
+        };
+        Ok(generator)
     }
 
     fn compute_volume(&self) -> f64 {
         let p = (self.n as f64) / (self.trials as f64);
-        (self.xmax - self.xmin) * (self.ymax - self.ymin) * (self.zmax - self.zmin) * p
+        let scale = self.voxels
+            .as_ref()
+            .map(|voxels| voxels.scale)
+            .unwrap_or(1.0);
+        (self.xmax - self.xmin) * (self.ymax - self.ymin) * (self.zmax - self.zmin) * p * scale
     }
 
-    fn generate(&mut self, random: &mut Random) -> PyResult<[f64; 3]>  {
+    fn generate(&mut self, random: &mut Random) -> PyResult<([f64; 3], f64)>  {
         self.n += 1;
         loop {
             self.trials += 1;
-            let r = [
-                random.uniform(self.xmin, self.xmax),
-                random.uniform(self.ymin, self.ymax),
-                random.uniform(self.zmin, self.zmax),
-            ];
+            let (r, weight) = match self.voxels.as_ref() {
+                None => {
+                    let r = [
+                        random.uniform(self.xmin, self.xmax),
+                        random.uniform(self.ymin, self.ymax),
+                        random.uniform(self.zmin, self.zmax),
+                    ];
+                    (r, 1.0)
+                },
+                Some(voxels) => voxels.generate(random),
+            };
             if self.volume.volume.inside(
                 &r,
                 &self.transform,
                 self.include_daughters
             ) == ffi::EInside::kInside {
-                return Ok(r);
+                return Ok((r, weight));
             } else if ((self.trials % 1000) == 0) && ctrlc_catched() {
                 return Err(Error::new(KeyboardInterrupt).to_err());
             }
@@ -884,17 +1498,112 @@ impl <'a> InsideGenerator<'a> {
     }
 }
 
+// Voxels of the bounding box are drawn from an alias table, and positions uniformly within
+// voxels. For an importance map, the returned weight, mean(importance) / importance, is relative
+// to a uniform sampling of the bounding box. For an activity grid, voxels are drawn according to
+// their activity, and the mean activity is folded into the normalisation (scale), instead.
+struct VoxelTable {
+    lower: [f64; 3],
+    width: [f64; 3],
+    shape: [usize; 3],
+    table: AliasTable,
+    weights: Option<Vec<f64>>,
+    scale: f64,
+}
+
+impl VoxelTable {
+    const DEFAULT_SHAPE: [usize; 3] = [32, 32, 32];
+
+    fn new(
+        importance: &Importance,
+        activity: Option<&Grid<3>>,
+        bounds: &[f64; 6],
+    ) -> PyResult<Option<Self>> {
+        let shape = match (importance, activity) {
+            (Importance::None, None) => return Ok(None),
+            (Importance::None, Some(activity)) => activity.shape,
+            (Importance::Grid(grid), _) => grid.shape,
+            (Importance::Target { shape, .. }, _) => *shape,
+        };
+        let lower = [bounds[0], bounds[2], bounds[4]];
+        let width = [
+            (bounds[1] - bounds[0]) / (shape[0] as f64),
+            (bounds[3] - bounds[2]) / (shape[1] as f64),
+            (bounds[5] - bounds[4]) / (shape[2] as f64),
+        ];
+        let values: Vec<f64> = match importance {
+            Importance::None => activity.unwrap().values.clone(),
+            Importance::Grid(grid) => grid.values.clone(),
+            Importance::Target { center, radius, attenuation, .. } => {
+                let radius = radius.max(0.5 * f64x3::from(&width).norm());
+                let mut values = Vec::with_capacity(shape.iter().product());
+                for i in 0..shape[0] {
+                    for j in 0..shape[1] {
+                        for k in 0..shape[2] {
+                            let r = f64x3::new(
+                                lower[0] + ((i as f64) + 0.5) * width[0] - center[0],
+                                lower[1] + ((j as f64) + 0.5) * width[1] - center[1],
+                                lower[2] + ((k as f64) + 0.5) * width[2] - center[2],
+                            ).norm().max(radius);
+                            values.push((-attenuation * r).exp() / (r * r));
+                        }
+                    }
+                }
+                values
+            },
+        };
+
+        let table = AliasTable::new(&values)?;
+        let mean = values.iter().sum::<f64>() / (values.len() as f64);
+        let (weights, scale) = match importance {
+            Importance::None => (None, mean),
+            _ => {
+                let weights = values
+                    .iter()
+                    .map(|value| if *value > 0.0 { mean / value } else { 0.0 })
+                    .collect();
+                (Some(weights), 1.0)
+            },
+        };
+        Ok(Some(Self { lower, width, shape, table, weights, scale }))
+    }
+
+    fn generate(&self, random: &mut Random) -> ([f64; 3], f64) {
+        let index = self.table.sample(random.open01());
+        let [_, ny, nz] = self.shape;
+        let voxel = [index / (ny * nz), (index / nz) % ny, index % nz];
+        let mut r = [0.0; 3];
+        for i in 0..3 {
+            r[i] = self.lower[i] + ((voxel[i] as f64) + random.open01()) * self.width[i];
+        }
+        let weight = self.weights
+            .as_ref()
+            .map(|weights| weights[index])
+            .unwrap_or(1.0);
+        (r, weight)
+    }
+}
+
 struct OntoGenerator<'a> {
     volume: &'a Volume,
     transform: UniquePtr<ffi::G4AffineTransform>,
     direction: Option<DirectionArg>,
     weight: Option<f64>,
+    cells: Option<CellTable>,
 }
 
 impl <'a> OntoGenerator<'a> {
-    fn new(volume: &'a Volume, direction: Option<DirectionArg>, weight: bool) -> Self {
+    fn new(
+        volume: &'a Volume,
+        direction: Option<DirectionArg>,
+        weight: bool,
+        activity: Option<&Grid<2>>,
+    ) -> PyResult<Self> {
         let transform = volume.volume.compute_transform("");
-        let weight = if weight {
+        let cells = activity
+            .map(|activity| CellTable::new(activity, &volume.volume.compute_box("")))
+            .transpose()?;
+        let weight = if weight && cells.is_none() {
             let surface = volume.volume.compute_surface();
             let solid_angle = if direction.is_some() {
                 std::f64::consts::PI
@@ -906,15 +1615,25 @@ impl <'a> OntoGenerator<'a> {
         } else {
             None
         };
-        Self { volume, transform, direction, weight }
+        let generator = Self { volume, transform, direction, weight, cells };
+        Ok(generator)
+    }
+
+    fn activity(&self) -> Option<f64> {
+        self.cells.as_ref().map(|cells| cells.compute_activity())
     }
 
     fn generate(
-        &self,
+        &mut self,
         random: &mut RandomContext,
         particle: &mut ffi::Particle,
         weight: &mut f64,
-    ) -> bool {
+    ) -> PyResult<bool> {
+        if let Some(cells) = self.cells.as_mut() {
+            particle.position = cells.generate(random, self.volume, &self.transform)?;
+            return Ok(false)
+        }
+
         let data = self.volume.volume.generate_onto(
             random,
             &self.transform,
@@ -937,7 +1656,67 @@ impl <'a> OntoGenerator<'a> {
             *weight *= w;
         }
 
-        self.direction.is_some()
+        Ok(self.direction.is_some())
+    }
+}
+
+// A surface activity map is draped over the volume (e.g. a topography), as seen from above. Map
+// cells span the horizontal extent of the volume, with activities per unit of horizontal area.
+// Like other grids (e.g. density maps), cells are indexed as [x, y]. Cells are drawn from an
+// alias table, and positions uniformly within cells. Then, positions are dropped vertically onto
+// the volume surface. Thus, the total activity is estimated from the fraction of drops that hit
+// the volume.
+struct CellTable {
+    lower: [f64; 2],
+    width: [f64; 2],
+    ny: usize,
+    top: f64,
+    table: AliasTable,
+    total: f64,
+    n: usize,
+    trials: usize,
+}
+
+impl CellTable {
+    fn new(activity: &Grid<2>, bounds: &[f64; 6]) -> PyResult<Self> {
+        let [nx, ny] = activity.shape;
+        let lower = [bounds[0], bounds[2]];
+        let width = [
+            (bounds[1] - bounds[0]) / (nx as f64),
+            (bounds[3] - bounds[2]) / (ny as f64),
+        ];
+        let top = bounds[5] + 1.0;
+        let table = AliasTable::new(&activity.values)?;
+        let total = activity.values.iter().sum::<f64>() * width[0] * width[1];
+        let table = Self { lower, width, ny, top, table, total, n: 0, trials: 0 };
+        Ok(table)
+    }
+
+    fn compute_activity(&self) -> f64 {
+        self.total * (self.n as f64) / (self.trials as f64)
+    }
+
+    fn generate(
+        &mut self,
+        random: &mut RandomContext,
+        volume: &Volume,
+        transform: &ffi::G4AffineTransform,
+    ) -> PyResult<[f64; 3]> {
+        const DOWNWARD: [f64; 3] = [0.0, 0.0, -1.0];
+        self.n += 1;
+        loop {
+            self.trials += 1;
+            let index = self.table.sample(random.next_open01());
+            let (i, j) = (index / self.ny, index % self.ny);
+            let x = self.lower[0] + ((i as f64) + random.next_open01()) * self.width[0];
+            let y = self.lower[1] + ((j as f64) + random.next_open01()) * self.width[1];
+            let distance = volume.volume.distance_to_in(&[x, y, self.top], &DOWNWARD, transform);
+            if distance.is_finite() {
+                return Ok([x, y, self.top - distance]);
+            } else if ((self.trials % 1000) == 0) && ctrlc_catched() {
+                return Err(Error::new(KeyboardInterrupt).to_err());
+            }
+        }
     }
 }
 
@@ -978,7 +1757,7 @@ impl TryFrom<ParticleName> for i32 {
 }
 
 #[derive(FromPyObject)]
-enum PidArg {
+pub(crate) enum PidArg {
     Name(ParticleName),
     Number(i32),
 }
@@ -0,0 +1,183 @@
+use crate::utils::error::ErrorKind::ValueError;
+use crate::utils::extract::{extract, Extractor, Property, Tag, TryFromBound};
+use crate::utils::memory::{map_size, vec_size};
+use crate::utils::namespace::Namespace;
+use crate::utils::numpy::{PyArray, PyArrayMethods};
+use indexmap::IndexMap;
+use pyo3::prelude::*;
+use pyo3::types::PyDict;
+use super::ffi;
+
+
+// ===============================================================================================
+//
+// Tally binning.
+//
+// Histograms are log-spaced w.r.t. the kinetic energy, and linearly spaced w.r.t. the cosine of
+// the angle to the surface normal.
+//
+// ===============================================================================================
+
+#[derive(Clone, Copy)]
+pub struct TallyBinning {
+    energy: [f64; 2],
+    bins: [usize; 2],
+}
+
+impl TallyBinning {
+    const DEFAULT_ENERGY: [f64; 2] = [1E-03, 1E+04];
+    const DEFAULT_BINS: [usize; 2] = [70, 10];
+
+    fn edges<'py>(&self, py: Python<'py>) -> PyResult<(PyObject, PyObject)> {
+        let [n_energy, n_cos] = self.bins;
+        let energy = PyArray::<f64>::empty(py, &[n_energy + 1])?;
+        {
+            let energy = unsafe { energy.slice_mut()? };
+            let log_min = self.energy[0].ln();
+            let log_max = self.energy[1].ln();
+            for (i, edge) in energy.iter_mut().enumerate() {
+                let u = (i as f64) / (n_energy as f64);
+                *edge = (log_min + (log_max - log_min) * u).exp();
+            }
+        }
+        let cos_theta = PyArray::<f64>::empty(py, &[n_cos + 1])?;
+        {
+            let cos_theta = unsafe { cos_theta.slice_mut()? };
+            for (i, edge) in cos_theta.iter_mut().enumerate() {
+                *edge = (i as f64) / (n_cos as f64);
+            }
+        }
+        Ok((energy.into_any().unbind(), cos_theta.into_any().unbind()))
+    }
+
+    pub fn to_dict<'py>(&self, py: Python<'py>) -> PyResult<Bound<'py, PyDict>> {
+        let dict = PyDict::new_bound(py);
+        dict.set_item("energy", self.energy)?;
+        dict.set_item("bins", self.bins)?;
+        Ok(dict)
+    }
+}
+
+impl Default for TallyBinning {
+    fn default() -> Self {
+        Self { energy: Self::DEFAULT_ENERGY, bins: Self::DEFAULT_BINS }
+    }
+}
+
+impl TryFromBound for TallyBinning {
+    fn try_from_any<'py>(tag: &Tag, value: &Bound<'py, PyAny>) -> PyResult<Self> {
+        const EXTRACTOR: Extractor<2> = Extractor::new([
+            Property::new_interval("energy", TallyBinning::DEFAULT_ENERGY),
+            Property::optional_any("bins"),
+        ]);
+
+        let [energy, bins] = EXTRACTOR.extract_any(tag, value, None)?;
+        let energy: [f64; 2] = energy.into();
+        if !(energy[0] > 0.0) || !(energy[1] > energy[0]) {
+            let why = format!(
+                "expected an increasing range of positive values, found [{}, {}]",
+                energy[0],
+                energy[1],
+            );
+            return Err(tag.bad().what("energy").why(why).to_err(ValueError));
+        }
+        let bins: Option<Bound<PyAny>> = bins.into();
+        let bins: [usize; 2] = match bins {
+            None => Self::DEFAULT_BINS,
+            Some(bins) => extract(&bins)
+                .or_else(|| tag.bad().what("bins").into())?,
+        };
+        if (bins[0] == 0) || (bins[1] == 0) {
+            let why = format!(
+                "expected strictly positive values, found [{}, {}]",
+                bins[0],
+                bins[1],
+            );
+            return Err(tag.bad().what("bins").why(why).to_err(ValueError));
+        }
+        Ok(Self { energy, bins })
+    }
+}
+
+
+// ===============================================================================================
+//
+// Tallies sampler.
+//
+// Boundary crossings are accumulated in weighted histograms, per volume and per particle type.
+// Thus, the memory footprint does not depend on the number of crossings.
+//
+// ===============================================================================================
+
+pub struct Tallies {
+    binning: TallyBinning,
+    log_energy: [f64; 2],
+    values: IndexMap<*const ffi::G4VPhysicalVolume, IndexMap<i32, Vec<f64>>>,
+}
+
+impl Tallies {
+    pub fn new(binning: TallyBinning) -> Self {
+        let log_energy = [binning.energy[0].ln(), binning.energy[1].ln()];
+        let values = IndexMap::new();
+        Self { binning, log_energy, values }
+    }
+
+    pub fn export(self, py: Python) -> PyResult<PyObject> {
+        let [n_energy, n_cos] = self.binning.bins;
+        let data = PyDict::new_bound(py);
+        for (volume, histograms) in self.values.into_iter() {
+            let volume: &ffi::G4VPhysicalVolume = unsafe { &*volume };
+            let volume = ffi::as_str(volume.GetName());
+            let weights = PyDict::new_bound(py);
+            for (pid, histogram) in histograms.into_iter() {
+                let array = PyArray::<f64>::empty(py, &[n_energy, n_cos])?;
+                unsafe { array.slice_mut()? }.copy_from_slice(&histogram);
+                weights.set_item(pid, array)?;
+            }
+            let (energy, cos_theta) = self.binning.edges(py)?;
+            let tally = Namespace::new(py, &[
+                ("energy", energy),
+                ("cos_theta", cos_theta),
+                ("weights", weights.into_any().unbind()),
+            ])?;
+            data.set_item(volume, tally)?;
+        }
+        Ok(data.into_any().unbind())
+    }
+
+    pub fn memory(&self) -> usize {
+        let histograms: usize = self.values
+            .values()
+            .map(|histograms| map_size(histograms) + histograms
+                .values()
+                .map(vec_size)
+                .sum::<usize>()
+            )
+            .sum();
+        map_size(&self.values) + histograms
+    }
+
+    pub fn push(
+        &mut self,
+        volume: *const ffi::G4VPhysicalVolume,
+        pid: i32,
+        energy: f64,
+        cos_theta: f64,
+        weight: f64,
+    ) {
+        let [n_energy, n_cos] = self.binning.bins;
+        let [log_min, log_max] = self.log_energy;
+        let u = (energy.ln() - log_min) / (log_max - log_min);
+        if !(u >= 0.0) || (u >= 1.0) {
+            return // Out of range energies are not tallied.
+        }
+        let i = ((u * n_energy as f64) as usize).min(n_energy - 1);
+        let j = ((cos_theta * n_cos as f64) as usize).min(n_cos - 1);
+        let histogram = self.values
+            .entry(volume)
+            .or_insert_with(|| IndexMap::new())
+            .entry(pid)
+            .or_insert_with(|| vec![0.0; n_energy * n_cos]);
+        histogram[i * n_cos + j] += weight;
+    }
+}
@@ -1,5 +1,6 @@
 #include "calzone.h"
 #include "sampler.h"
+#include "scoring.h"
 #include "tracker.h"
 // Geant4 interface.
 #include "G4Step.hh"
@@ -132,14 +133,24 @@ TrackingImpl * TrackingImpl::None() {
 // ============================================================================
 
 void SteppingImpl::UserSteppingAction(const G4Step * step) {
-    if (RUN_AGENT->is_particles() && step->IsLastStepInVolume()) {
+    if (RUN_AGENT->is_scoring()) {
+        ScoringImpl::Get()->Score(step);
+    }
+
+    if (step->IsLastStepInVolume()) {
         auto && point = step->GetPostStepPoint();
         G4VPhysicalVolume * volume = point->GetPhysicalVolume();
         if (volume != nullptr) {
             auto && sensitive = static_cast<SamplerImpl *>(
                 volume->GetLogicalVolume()->GetSensitiveDetector()
             );
-            if (sensitive != nullptr) {
+            // Boundary actions require particles sampling, except for
+            // tallies.
+            if ((sensitive != nullptr) &&
+                ((sensitive->roles.ingoing == Action::Tally) ||
+                 RUN_AGENT->is_particles()) &&
+                SamplerImpl::Filter(
+                    step, sensitive->roles.ingoing_filter)) {
                 auto && track = step->GetTrack();
                 auto && tid = track->GetTrackID();
                 auto && action = sensitive->roles.ingoing;
@@ -156,7 +167,11 @@ void SteppingImpl::UserSteppingAction(const G4Step * step) {
                         { r.x(), r.y(), r.z() },
                         { u.x(), u.y(), u.z() },
                     };
-                    RUN_AGENT->push_particle(volume, tid, std::move(particle));
+                    RUN_AGENT->push_particle(
+                        volume, tid, std::move(particle), track->GetWeight()
+                    );
+                } else if (action == Action::Tally) {
+                    sensitive->Tally(step, true);
                 }
                 if ((action == Action::Catch) ||
                     (action == Action::Kill)) {
@@ -1,4 +1,5 @@
 use crate::utils::export::Export;
+use crate::utils::memory::vec_size;
 use derive_more::{AsMut, AsRef, From};
 use pyo3::prelude::*;
 use super::ffi;
@@ -23,6 +24,10 @@ impl Tracker {
         Ok((tracks, vertices))
     }
 
+    pub fn memory(&self) -> usize {
+        vec_size(&self.tracks) + vec_size(&self.vertices)
+    }
+
     pub fn new() -> Self {
         Self::default()
     }
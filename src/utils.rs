@@ -4,8 +4,10 @@ pub mod export;
 pub mod extract;
 pub mod float;
 pub mod io;
+pub mod memory;
 pub mod namespace;
 pub mod numpy;
+pub mod trace;
 pub mod units;
 
 pub use super::cxx::ffi;
@@ -5,6 +5,7 @@ use pyo3::exceptions::{
     PyMemoryError, PyNotImplementedError, PyTypeError, PyValueError
 };
 use pyo3::ffi::PyErr_CheckSignals;
+use std::cell::Cell;
 use super::ffi;
 
 
@@ -73,6 +74,11 @@ impl<'a> Error<'a> {
         self.into()
     }
 
+    pub fn to_failure(&self) -> Failure {
+        let kind = self.kind.unwrap_or(ErrorKind::Exception);
+        Failure::Calzone(kind, self.to_string())
+    }
+
     pub fn to_string(&self) -> String {
         self.into()
     }
@@ -141,19 +147,7 @@ impl<'a> From<&Error<'a>> for PyErr {
         let msg: String = value.into();
         let kind = value.kind
             .unwrap_or(ErrorKind::Exception);
-        match kind {
-            ErrorKind::Exception => PyErr::new::<PyException, _>(msg),
-            ErrorKind::FileNotFoundError => PyErr::new::<PyFileNotFoundError, _>(msg),
-            ErrorKind::Geant4Exception => PyErr::new::<Geant4Exception, _>(msg),
-            ErrorKind::IndexError => PyErr::new::<PyIndexError, _>(msg),
-            ErrorKind::IOError => PyErr::new::<PyIOError, _>(msg),
-            ErrorKind::KeyboardInterrupt => PyErr::new::<PyKeyboardInterrupt, _>(msg),
-            ErrorKind::KeyError => PyErr::new::<PyKeyError, _>(msg),
-            ErrorKind::MemoryError => PyErr::new::<PyMemoryError, _>(msg),
-            ErrorKind::NotImplementedError => PyErr::new::<PyNotImplementedError, _>(msg),
-            ErrorKind::TypeError => PyErr::new::<PyTypeError, _>(msg),
-            ErrorKind::ValueError => PyErr::new::<PyValueError, _>(msg),
-        }
+        kind.to_err(msg)
     }
 }
 
@@ -163,6 +157,63 @@ impl<'a> From<Error<'a>> for PyErr {
     }
 }
 
+impl ErrorKind {
+    pub fn to_err(self, msg: String) -> PyErr {
+        match self {
+            Self::Exception => PyErr::new::<PyException, _>(msg),
+            Self::FileNotFoundError => PyErr::new::<PyFileNotFoundError, _>(msg),
+            Self::Geant4Exception => PyErr::new::<Geant4Exception, _>(msg),
+            Self::IndexError => PyErr::new::<PyIndexError, _>(msg),
+            Self::IOError => PyErr::new::<PyIOError, _>(msg),
+            Self::KeyboardInterrupt => PyErr::new::<PyKeyboardInterrupt, _>(msg),
+            Self::KeyError => PyErr::new::<PyKeyError, _>(msg),
+            Self::MemoryError => PyErr::new::<PyMemoryError, _>(msg),
+            Self::NotImplementedError => PyErr::new::<PyNotImplementedError, _>(msg),
+            Self::TypeError => PyErr::new::<PyTypeError, _>(msg),
+            Self::ValueError => PyErr::new::<PyValueError, _>(msg),
+        }
+    }
+}
+
+
+// ===============================================================================================
+//
+// Owned errors.
+//
+// Contrary to a PyErr, the message of an error raised by Calzone is available without the Python
+// interpreter (e.g. from the native interface). Python errors are forwarded as is.
+//
+// ===============================================================================================
+
+pub enum Failure {
+    Calzone(ErrorKind, String),
+    Python(PyErr),
+}
+
+impl Failure {
+    pub fn message(&self) -> Option<&str> {
+        match self {
+            Self::Calzone(_, message) => Some(message.as_str()),
+            Self::Python(_) => None,
+        }
+    }
+}
+
+impl From<Failure> for PyErr {
+    fn from(value: Failure) -> Self {
+        match value {
+            Failure::Calzone(kind, message) => kind.to_err(message),
+            Failure::Python(err) => err,
+        }
+    }
+}
+
+impl From<PyErr> for Failure {
+    fn from(value: PyErr) -> Self {
+        Self::Python(value)
+    }
+}
+
 
 // ===============================================================================================
 //
@@ -176,32 +227,19 @@ impl ffi::Error {
     const KEYBOARD_INTERUPT: &'static str = "Ctrl+C catched";
     const MEMORY_ERROR: &'static str = "could not allocate memory";
 
-    pub fn to_result(&self) -> PyResult<()> {
-        match self.tp {
-            ffi::ErrorType::None => Ok(()),
-            ffi::ErrorType::FileNotFoundError => {
-                Err(PyFileNotFoundError::new_err(self.message.clone()))
-            },
-            ffi::ErrorType::Geant4Exception => {
-                Err(Geant4Exception::new_err(self.message.clone()))
-            },
-            ffi::ErrorType::IndexError => {
-                Err(PyIndexError::new_err(self.message.clone()))
-            },
-            ffi::ErrorType::IOError => {
-                Err(PyIOError::new_err(self.message.clone()))
-            },
-            ffi::ErrorType::KeyboardInterrupt => {
-                Err(PyKeyboardInterrupt::new_err(Self::KEYBOARD_INTERUPT))
-            },
-            ffi::ErrorType::MemoryError => {
-                Err(PyMemoryError::new_err(Self::MEMORY_ERROR))
-            },
-            ffi::ErrorType::ValueError => {
-                Err(PyValueError::new_err(self.message.clone()))
-            },
+    pub fn to_result(&self) -> Result<(), Failure> {
+        let kind = match self.tp {
+            ffi::ErrorType::None => return Ok(()),
+            ffi::ErrorType::FileNotFoundError => ErrorKind::FileNotFoundError,
+            ffi::ErrorType::Geant4Exception => ErrorKind::Geant4Exception,
+            ffi::ErrorType::IndexError => ErrorKind::IndexError,
+            ffi::ErrorType::IOError => ErrorKind::IOError,
+            ffi::ErrorType::KeyboardInterrupt => ErrorKind::KeyboardInterrupt,
+            ffi::ErrorType::MemoryError => ErrorKind::MemoryError,
+            ffi::ErrorType::ValueError => ErrorKind::ValueError,
             _ => unreachable!(),
-        }
+        };
+        Err(Failure::Calzone(kind, self.value().unwrap().to_string()))
     }
 
     pub fn value(&self) -> Option<&str> {
@@ -220,9 +258,24 @@ impl ffi::Error {
 }
 
 pub fn ctrlc_catched() -> bool {
+    if !SIGNALS.get() {
+        return false
+    }
     if unsafe { PyErr_CheckSignals() } == -1 { true } else {false}
 }
 
+// Python signals are not checked during native calls, since the interpreter might not run.
+thread_local! {
+    static SIGNALS: Cell<bool> = Cell::new(true);
+}
+
+pub fn without_signals<T>(f: impl FnOnce() -> T) -> T {
+    let previous = SIGNALS.replace(false);
+    let result = f();
+    SIGNALS.set(previous);
+    result
+}
+
 // ===============================================================================================
 //
 // Variants explainers.
@@ -230,13 +283,17 @@ pub fn ctrlc_catched() -> bool {
 // ===============================================================================================
 
 pub fn variant_error(header: &str, value: &str, options: &[&str]) -> PyErr {
+    variant_failure(header, value, options).into()
+}
+
+pub fn variant_failure(header: &str, value: &str, options: &[&str]) -> Failure {
     let explain = variant_explain(value, options);
     let message = format!(
         "{} ({})",
         header,
         explain,
     );
-    PyValueError::new_err(message)
+    Failure::Calzone(ErrorKind::ValueError, message)
 }
 
 pub fn variant_explain(value: &str, options: &[&str]) -> String {
@@ -5,7 +5,7 @@ use pyo3::exceptions::PyValueError;
 use pyo3::types::PyDict;
 use std::borrow::Cow;
 use std::path::Path;
-use super::error::{Error, ErrorKind};
+use super::error::{Error, ErrorKind, Failure};
 use super::float::{f64x3, f64x3x3};
 use super::io::DictLike;
 
@@ -165,6 +165,10 @@ impl<'a, 'b> TaggedBad<'a, 'b> {
     }
 
     pub fn to_err(&self, kind: ErrorKind) -> PyErr {
+        self.to_failure(kind).into()
+    }
+
+    pub fn to_failure(&self, kind: ErrorKind) -> Failure {
         let tag = self.tag.qualified_name();
         let prefix = self.tag.file.as_ref().map(|file| file.to_string_lossy());
         Error::new(kind)
@@ -172,7 +176,7 @@ impl<'a, 'b> TaggedBad<'a, 'b> {
             .who(tag.as_str())
             .maybe_what(self.what)
             .maybe_why(self.why.as_deref())
-            .into()
+            .to_failure()
     }
 
     pub fn what(mut self, what: &'b str) -> Self {
@@ -441,6 +445,12 @@ impl Property {
     }
 
     // Required constructors.
+    pub const fn required_any(name: &'static str) -> Self {
+        let tp = PropertyType::Any;
+        let default = PropertyDefault::Required;
+        Self::new(name, tp, default)
+    }
+
     pub const fn required_dict(name: &'static str) -> Self {
         let tp = PropertyType::Dict;
         let default = PropertyDefault::Required;
@@ -989,3 +999,11 @@ impl TypeName for Strings {
 impl TypeName for u32 {
     fn type_name() -> &'static str { "an 'int'" }
 }
+
+impl TypeName for [usize; 2] {
+    fn type_name() -> &'static str { "a 'pair' of 'int'" }
+}
+
+impl TypeName for [usize; 3] {
+    fn type_name() -> &'static str { "a 'triplet' of 'int'" }
+}
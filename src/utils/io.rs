@@ -1,4 +1,5 @@
 use crate::geometry::materials::gate::load_gate_db;
+use crate::utils::trace;
 use obj::{load_obj as parse_obj, Obj};
 use pyo3::prelude::*;
 use pyo3::exceptions::{PyFileNotFoundError, PyNotImplementedError};
@@ -104,6 +105,7 @@ impl<'py> DictLike<'py> {
                         }
                     },
                 };
+                let _span = trace::span_with("load", || path.display().to_string());
                 let dict = match path.extension().and_then(OsStr::to_str) {
                     Some("db") => load_gate_db(py, &path),
                     Some("json") => Json::load_dict(py, &path),
@@ -0,0 +1,111 @@
+use crate::geometry::mesh::{meshes_memory, tessellated_solids_memory, NamedMesh};
+use crate::utils::namespace::Namespace;
+use indexmap::IndexMap;
+use pyo3::prelude::*;
+use pyo3::types::PyDict;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use super::ffi;
+
+
+// ===============================================================================================
+//
+// Memory accounting.
+//
+// Sizes are accounted for explicitly, by each structure, from the capacity of its containers
+// (i.e. the process RSS is not sampled). Hash tables are estimated from their number of buckets,
+// including control bytes. Thus, reported sizes are lower bounds of the actual allocations.
+//
+// ===============================================================================================
+
+pub fn vec_size<T>(vec: &Vec<T>) -> usize {
+    vec.capacity() * size_of::<T>()
+}
+
+pub fn map_size<K, V>(map: &IndexMap<K, V>) -> usize {
+    map.capacity() * (size_of::<(usize, K, V)>() + size_of::<usize>() + 1)
+}
+
+
+// ===============================================================================================
+//
+// In-flight run statistics.
+//
+// The memory held by the samplers of the current run is updated periodically, at the start of
+// each bunch of events, and at the end of the run. Thus, it can be queried during a run, e.g.
+// from a primaries stream.
+//
+// ===============================================================================================
+
+static RUN_CURRENT: AtomicUsize = AtomicUsize::new(0);
+static RUN_PEAK: AtomicUsize = AtomicUsize::new(0);
+
+pub fn start_run() {
+    RUN_CURRENT.store(0, Ordering::Relaxed);
+    RUN_PEAK.store(0, Ordering::Relaxed);
+}
+
+pub fn update_run(size: usize) {
+    RUN_CURRENT.store(size, Ordering::Relaxed);
+    RUN_PEAK.fetch_max(size, Ordering::Relaxed);
+}
+
+pub fn end_run(size: usize) {
+    RUN_PEAK.fetch_max(size, Ordering::Relaxed);
+    RUN_CURRENT.store(0, Ordering::Relaxed);
+}
+
+
+// ===============================================================================================
+//
+// Python interface.
+//
+// ===============================================================================================
+
+/// Report the memory held by Calzone data structures (in bytes).
+#[pyfunction]
+pub fn memory(py: Python) -> PyResult<PyObject> {
+    let to_dict = |usage: Vec<(String, usize)>| -> PyResult<(PyObject, usize)> {
+        let mut sizes = IndexMap::<String, usize>::new();
+        for (name, size) in usage.into_iter() {
+            *sizes.entry(name).or_insert(0) += size;
+        }
+        sizes.sort_keys();
+        let total = sizes.values().sum();
+        let dict = PyDict::new_bound(py);
+        for (name, size) in sizes.into_iter() {
+            dict.set_item(name, size)?;
+        }
+        Ok((dict.into_any().unbind(), total))
+    };
+
+    let mut geometries = Vec::<ffi::MemoryUsage>::new();
+    ffi::geometries_memory(&mut geometries);
+    let geometries = geometries
+        .into_iter()
+        .map(|usage| (usage.name, usage.bytes))
+        .collect();
+    let (geometries, geometries_total) = to_dict(geometries)?;
+    let (meshes, meshes_total) = to_dict(meshes_memory())?;
+    let (named_meshes, named_meshes_total) = to_dict(NamedMesh::memory())?;
+    let (tessellated_solids, tessellated_solids_total) = to_dict(tessellated_solids_memory())?;
+    let [materials, elements] = ffi::materials_memory();
+    let physics = ffi::physics_memory();
+    let run = RUN_CURRENT.load(Ordering::Relaxed);
+    let run_peak = RUN_PEAK.load(Ordering::Relaxed);
+    let total = elements + geometries_total + materials + meshes_total + named_meshes_total +
+        physics + run + tessellated_solids_total;
+
+    let result = Namespace::new(py, &[
+        ("elements", elements.into_py(py)),
+        ("geometries", geometries),
+        ("materials", materials.into_py(py)),
+        ("meshes", meshes),
+        ("named_meshes", named_meshes),
+        ("physics", physics.into_py(py)),
+        ("run", run.into_py(py)),
+        ("run_peak", run_peak.into_py(py)),
+        ("tessellated_solids", tessellated_solids),
+        ("total", total.into_py(py)),
+    ])?;
+    Ok(result.unbind())
+}
@@ -1,6 +1,6 @@
 // Calzone interface.
-use crate::cxx::ffi::{Particle, SampledParticle, Track, Vertex};
-use crate::simulation::sampler::{LineDeposit, PointDeposit, TotalDeposit};
+use crate::cxx::ffi::{Particle, SampledParticle, TraceSegment, Track, Vertex};
+use crate::simulation::sampler::{LineDeposit, PointDeposit, TotalDeposit, TrackDeposit};
 // PyO3 interface.
 use pyo3::prelude::*;
 use pyo3::{ffi, pyobject_native_type_extract, pyobject_native_type_named, PyTypeInfo};
@@ -33,7 +33,9 @@ struct ArrayInterface {
     dtype_point_deposit: PyObject,
     dtype_sampled_particle: PyObject,
     dtype_total_deposit: PyObject,
+    dtype_trace_segment: PyObject,
     dtype_track: PyObject,
+    dtype_track_deposit: PyObject,
     dtype_u16: PyObject,
     dtype_vertex: PyObject,
     type_ndarray: PyObject,
@@ -201,6 +203,18 @@ pub fn initialise(py: Python) -> PyResult<()> {
             .into_py(py)
     };
 
+    let dtype_trace_segment: PyObject = {
+        let arg = [
+            ("ray", "u8"),
+            ("volume", "u8"),
+            ("distance", "f8"),
+            ("length", "f8"),
+        ];
+        dtype
+            .call1((arg, true))?
+            .into_py(py)
+    };
+
     let dtype_track: PyObject = {
         let arg: [PyObject; 5] = [
             ("event", "u8").into_py(py),
@@ -214,6 +228,25 @@ pub fn initialise(py: Python) -> PyResult<()> {
             .into_py(py)
     };
 
+    let dtype_track_deposit: PyObject = {
+        let arg = [
+            ("event", "u8"),
+            ("tid", "i4"),
+            ("pid", "i4"),
+            ("energy", "f8"),
+            ("value", "f8"),
+            ("centroid", "3f8"),
+            ("first", "3f8"),
+            ("last", "3f8"),
+            ("steps", "u8"),
+            ("weight", "f8"),
+            ("random_index", "2u8"),
+        ];
+        dtype
+            .call1((arg, true))?
+            .into_py(py)
+    };
+
     let dtype_u16: PyObject = dtype
         .call1(("u2",))?
         .into_py(py);
@@ -262,7 +295,9 @@ pub fn initialise(py: Python) -> PyResult<()> {
         dtype_point_deposit,
         dtype_sampled_particle,
         dtype_total_deposit,
+        dtype_trace_segment,
         dtype_track,
+        dtype_track_deposit,
         dtype_u16,
         dtype_vertex,
         type_ndarray: object(2),
@@ -840,6 +875,13 @@ impl Dtype for TotalDeposit {
     }
 }
 
+impl Dtype for TraceSegment {
+    #[inline]
+    fn dtype(py: Python) -> PyResult<PyObject> {
+        Ok(api(py).dtype_trace_segment.clone_ref(py))
+    }
+}
+
 impl Dtype for Track {
     #[inline]
     fn dtype(py: Python) -> PyResult<PyObject> {
@@ -847,6 +889,13 @@ impl Dtype for Track {
     }
 }
 
+impl Dtype for TrackDeposit {
+    #[inline]
+    fn dtype(py: Python) -> PyResult<PyObject> {
+        Ok(api(py).dtype_track_deposit.clone_ref(py))
+    }
+}
+
 impl Dtype for u16 {
     #[inline]
     fn dtype(py: Python) -> PyResult<PyObject> {
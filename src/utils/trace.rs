@@ -0,0 +1,127 @@
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::sync::{LazyLock, Mutex};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Instant;
+
+
+// ===============================================================================================
+//
+// Timeline tracing.
+//
+// When the CALZONE_TRACE variable is set, the phases of a job are recorded as complete events,
+// in Chrome trace format, to the corresponding file. Events are written as they complete, in
+// JSON array format, which might be left unterminated (as allowed by this format). Otherwise,
+// spans reduce to the check of a static flag.
+//
+// ===============================================================================================
+
+struct Tracer {
+    epoch: Instant,
+    pid: u32,
+    file: Mutex<BufWriter<File>>,
+}
+
+static TRACER: LazyLock<Option<Tracer>> = LazyLock::new(|| {
+    let path = std::env::var_os("CALZONE_TRACE")?;
+    if path.is_empty() {
+        return None
+    }
+    let mut file = BufWriter::new(File::create(path).ok()?);
+    file.write_all(b"[\n").and_then(|_| file.flush()).ok()?;
+    let epoch = Instant::now();
+    let pid = std::process::id();
+    let file = Mutex::new(file);
+    Some(Tracer { epoch, pid, file })
+});
+
+static THREADS: AtomicU64 = AtomicU64::new(0);
+
+thread_local! {
+    static TID: u64 = THREADS.fetch_add(1, Ordering::Relaxed) + 1;
+}
+
+impl Tracer {
+    fn now(&self) -> f64 {
+        self.epoch.elapsed().as_secs_f64() * 1E+06 // us.
+    }
+
+    fn write(&self, name: &str, detail: Option<&str>, start: f64) {
+        let end = self.now();
+        let tid = TID.with(|tid| *tid);
+        let mut event = format!(
+            "{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":{},\"tid\":{},\"ts\":{:.3},\"dur\":{:.3}",
+            escape(name),
+            self.pid,
+            tid,
+            start,
+            end - start,
+        );
+        if let Some(detail) = detail {
+            event.push_str(&format!(",\"args\":{{\"detail\":\"{}\"}}", escape(detail)));
+        }
+        event.push_str("},\n");
+        let mut file = self.file.lock().unwrap();
+        let _ = file.write_all(event.as_bytes()).and_then(|_| file.flush());
+    }
+}
+
+fn escape(s: &str) -> String {
+    let mut escaped = String::with_capacity(s.len());
+    for c in s.chars() {
+        match c {
+            '"' => escaped.push_str("\\\""),
+            '\\' => escaped.push_str("\\\\"),
+            c if (c as u32) < 0x20 => escaped.push_str(&format!("\\u{:04x}", c as u32)),
+            c => escaped.push(c),
+        }
+    }
+    escaped
+}
+
+/// Scoped timer, recording an event when dropped.
+pub struct Span {
+    name: &'static str,
+    detail: Option<String>,
+    start: f64,
+}
+
+impl Drop for Span {
+    fn drop(&mut self) {
+        if let Some(tracer) = TRACER.as_ref() {
+            tracer.write(self.name, self.detail.as_deref(), self.start)
+        }
+    }
+}
+
+pub fn span(name: &'static str) -> Option<Span> {
+    TRACER
+        .as_ref()
+        .map(|tracer| Span { name, detail: None, start: tracer.now() })
+}
+
+pub fn span_with(name: &'static str, detail: impl FnOnce() -> String) -> Option<Span> {
+    TRACER
+        .as_ref()
+        .map(|tracer| Span { name, detail: Some(detail()), start: tracer.now() })
+}
+
+
+// ===============================================================================================
+//
+// C++ interface.
+//
+// ===============================================================================================
+
+pub fn trace_now() -> f64 {
+    match TRACER.as_ref() {
+        Some(tracer) => tracer.now(),
+        None => -1.0,
+    }
+}
+
+pub fn trace_event(name: &str, start: f64) {
+    if let Some(tracer) = TRACER.as_ref() {
+        tracer.write(name, None, start)
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * Test harness for the native (C) interface.
+ *
+ * Usage: native GEOMETRY PRIMARIES
+ *
+ * The geometry file contains a serialised geometry builder, and the primaries
+ * file an array of calzone_particle. Deposits in volume "A" are printed to
+ * stdout, as "event value" lines.
+ *
+ * Note that the harness is linked against libpython, since the extension
+ * module references (but does not initialise) the Python runtime. The harness
+ * checks that the interpreter is never started, including on errors.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native.h"
+
+/* From the Python C API. */
+int Py_IsInitialized(void);
+
+
+static void * load(const char * path, size_t * size)
+{
+    FILE * stream = fopen(path, "rb");
+    if (stream == NULL) return NULL;
+    fseek(stream, 0, SEEK_END);
+    *size = ftell(stream);
+    rewind(stream);
+    void * data = malloc(*size);
+    if ((data != NULL) && (fread(data, 1, *size, stream) != *size)) {
+        free(data);
+        data = NULL;
+    }
+    fclose(stream);
+    return data;
+}
+
+static void on_deposits(
+    void * user,
+    const char * volume,
+    const struct calzone_deposit * deposits,
+    size_t size)
+{
+    int * calls = user;
+    (*calls)++;
+    if (strcmp(volume, "A") != 0) return;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        printf("%zu %.17g\n", deposits[i].event, deposits[i].value);
+    }
+}
+
+#define CHECK(expr)                                                            \
+    if (!(expr)) {                                                             \
+        fprintf(stderr, "%s:%d: %s (%s)\n", __FILE__, __LINE__, #expr,         \
+            calzone_error());                                                  \
+        exit(EXIT_FAILURE);                                                    \
+    }
+
+int main(int argc, char * argv[])
+{
+    CHECK(argc == 3);
+
+    /* Create a simulation from a serialised geometry. */
+    size_t size;
+    uint8_t * geometry = load(argv[1], &size);
+    CHECK(geometry != NULL);
+    struct calzone_simulation * simulation = calzone_simulation_create(
+        geometry, size);
+    free(geometry);
+    CHECK(simulation != NULL);
+
+    /* Configure the simulation. */
+    CHECK(calzone_simulation_role(simulation, "A", "record_deposits") == 0);
+    CHECK(calzone_simulation_seed(simulation, 0) == 0);
+
+    /* Run from a buffer of primaries. */
+    struct calzone_primaries primaries = { 0 };
+    primaries.particles = load(argv[2], &size);
+    CHECK(primaries.particles != NULL);
+    primaries.size = size / sizeof(*primaries.particles);
+    int calls = 0;
+    struct calzone_results results = { &calls, &on_deposits, NULL };
+    CHECK(calzone_simulation_run(simulation, &primaries, &results) == 0);
+    CHECK(calls > 0);
+    free((void *)primaries.particles);
+
+    /* Check that errors are reported. */
+    CHECK(calzone_simulation_role(simulation, "B", "record_deposits") == -1);
+    CHECK(strstr(calzone_error(), "volume") != NULL);
+    CHECK(calzone_simulation_physics(simulation, "bad_model", NULL) == -1);
+    CHECK(strstr(calzone_error(), "bad model") != NULL);
+    CHECK(!Py_IsInitialized());
+
+    calzone_simulation_destroy(simulation);
+    calzone_finalise();
+    return EXIT_SUCCESS;
+}
@@ -6,6 +6,7 @@ import xml.etree.ElementTree as ET
 
 import numpy
 from numpy.testing import assert_allclose
+import pytest
 
 
 PREFIX = Path(__file__).parent
@@ -62,6 +63,47 @@ def test_Box():
     assert_allclose(A.aabb(), [-expected, expected])
 
 
+def test_cache(monkeypatch):
+    """Test the meshes cache."""
+
+    monkeypatch.setenv("CALZONE_MESH_CACHE", "512")
+    calzone.cache.clear()
+    stats = calzone.cache.stats()
+    assert(stats.hits == 0)
+    assert(stats.misses == 0)
+    assert(stats.budget == 512E+06)
+
+    data = { "A": { "box": 100.0, "B": { "mesh": {
+        "path": str(PREFIX / "assets/cube.obj"), "algorithm": "bvh"
+    }}}}
+    geometry = calzone.Geometry(data)
+    stats = calzone.cache.stats()
+    assert(stats.hits + stats.misses == 1)
+    assert(stats.referenced >= 1)
+    assert(stats.size > 0)
+
+    # Unreferenced meshes are kept, within the budget.
+    del geometry
+    entries = calzone.cache.stats().entries
+    geometry = calzone.Geometry(data)
+    stats = calzone.cache.stats()
+    assert(stats.hits + stats.misses == 2)
+    assert(stats.hits >= 1)
+    assert(stats.entries == entries)
+
+    # Referenced meshes are never evicted.
+    calzone.cache.clear()
+    stats = calzone.cache.stats()
+    assert(stats.entries == stats.referenced)
+    assert(stats.entries >= 1)
+    del geometry
+
+    monkeypatch.setenv("CALZONE_MESH_CACHE", "0")
+    geometry = calzone.Geometry(data)
+    del geometry
+    assert(calzone.cache.stats().referenced == calzone.cache.stats().entries)
+
+
 def test_Cylinder():
     """Test the cylinder shape."""
 
@@ -89,6 +131,49 @@ def test_Cylinder():
     assert(A.side(r0) == -1)
 
 
+def test_density_map():
+    """Test voxelised density maps."""
+
+    values = [[[1.0], [2.0]]] # shape (nx, ny, nz) = (1, 2, 1).
+    data = { "A": {
+        "box": 10.0,
+        "material": "G4_WATER",
+        "density_map": values,
+    }}
+    geometry = calzone.Geometry(data)
+    A = geometry["A"]
+    assert A.daughters == tuple()
+    assert A.material == "G4_WATER"
+
+    positions = numpy.array([[0.0, -2.5, -10.0], [0.0, 2.5, -10.0]])
+    directions = numpy.array([[0.0, 0.0, 1.0], [0.0, 0.0, 1.0]])
+    result = geometry.trace(positions, directions)
+    assert set(result.volumes) == { "A" }
+    assert_allclose(sum(result.grammage.values()), [10.0, 20.0])
+
+    # 2D map with a depth law.
+    data["A"]["density_map"] = {
+        "values": [[1.0]], "gradient": 0.1, "layers": 10, "bins": 10
+    }
+    geometry = calzone.Geometry(data)
+    result = geometry.trace(positions[:1], directions[:1])
+    assert_allclose(sum(result.grammage.values()), [15.0])
+
+    # Single layer (default), with the depth law at the layer centre.
+    data["A"]["density_map"] = { "values": [[1.0]], "gradient": 0.1 }
+    geometry = calzone.Geometry(data)
+    result = geometry.trace(positions[:1], directions[:1])
+    assert_allclose(sum(result.grammage.values()), [15.0])
+
+    data["A"]["density_map"] = [[[-1.0]]]
+    with pytest.raises(ValueError):
+        calzone.Geometry(data)
+
+    data["A"] = { "sphere": 5.0, "density_map": values }
+    with pytest.raises(NotImplementedError):
+        calzone.Geometry(data)
+
+
 def test_Envelope():
     """Test the envelope shape."""
 
@@ -250,6 +335,57 @@ def test_Mesh():
     A = geometry["A"]
     assert_allclose(A.surface_area, 6 * 4.0)
 
+    # Test concurrent building of multiple meshes.
+    data = { "A": {
+        "box": 100.0,
+        "B": { "mesh": str(PREFIX / "assets/cube.stl"), "position": [-10, 0, 0] },
+        "C": { "mesh": {
+            "path": str(PREFIX / "assets/cube.obj"), "algorithm": "bvh"
+        }, "position": [10, 0, 0] },
+        "D": { "mesh": {
+            "path": str(PREFIX / "assets/cube.stl"), "units": "mm"
+        }, "position": [0, 30, 0] },
+    }}
+    geometry = calzone.Geometry(data)
+    assert(geometry["A.B"].solid == "G4TessellatedSolid")
+    assert(geometry["A.C"].solid == "Mesh")
+    assert_allclose(geometry["A.B"].surface_area, 6 * 4.0)
+    assert_allclose(geometry["A.C"].surface_area, 6 * 4.0)
+    assert_allclose(geometry["A.D"].surface_area, 6 * 4E-02)
+
+
+def test_memory():
+    """Test the memory report."""
+
+    data = { "A": {
+        "box": 100.0,
+        "B": { "mesh": str(PREFIX / "assets/cube.stl"), "position": [-10, 0, 0] },
+        "C": { "mesh": {
+            "path": str(PREFIX / "assets/cube.obj"), "algorithm": "bvh"
+        }, "position": [10, 0, 0] },
+    }}
+    geometry = calzone.Geometry(data)
+    memory = calzone.memory()
+    assert(memory.geometries["A"] > 0)
+    assert(any(path.endswith("cube.obj") for path in memory.meshes))
+    assert(any(path.endswith("cube.stl") for path in memory.tessellated_solids))
+    assert(all(size > 0 for size in memory.meshes.values()))
+    assert(memory.materials > 0)
+    assert(memory.elements > 0)
+    assert(memory.run == 0)
+    total = memory.elements + memory.materials + memory.physics + memory.run
+    for field in ("geometries", "meshes", "named_meshes", "tessellated_solids"):
+        total += sum(getattr(memory, field).values())
+    assert(memory.total == total)
+
+    # Density maps are accounted for by their container.
+    data = { "A": { "box": 10.0, "material": "G4_WATER" }}
+    geometry = calzone.Geometry(data)
+    size = calzone.memory().geometries["A"]
+    data["A"]["density_map"] = numpy.ones((10, 10, 10)).tolist()
+    geometry = calzone.Geometry(data)
+    assert(calzone.memory().geometries["A"] > size)
+
 
 def test_meshes():
     """Test named meshes."""
@@ -320,6 +456,37 @@ def test_Sphere():
     assert(A.side(r0) == -1)
 
 
+def test_trace():
+    """Test the ray tracing interface."""
+
+    data = { "A": {
+        "box": 10.0,
+        "material": "G4_WATER",
+        "B": { "box": 2.0, "material": "G4_Pb" },
+    }}
+    geometry = calzone.Geometry(data)
+
+    positions = numpy.array([[0.0, 0.0, -10.0], [3.0, 0.0, -10.0]])
+    directions = numpy.array([[0.0, 0.0, 1.0], [0.0, 0.0, 1.0]])
+    result = geometry.trace(positions, directions)
+
+    segments = result.segments
+    volumes = [result.volumes[i] for i in segments["volume"]]
+    assert_allclose(segments["ray"], [0, 0, 0, 1])
+    assert volumes == ["A", "A.B", "A", "A"]
+    assert_allclose(segments["distance"], [5.0, 9.0, 11.0, 5.0])
+    assert_allclose(segments["length"], [4.0, 2.0, 4.0, 10.0])
+
+    rho_water = calzone.describe(material="G4_WATER").density
+    rho_lead = calzone.describe(material="G4_Pb").density
+    assert_allclose(result.grammage["G4_WATER"], [8 * rho_water, 10 * rho_water])
+    assert_allclose(result.grammage["G4_Pb"], [2 * rho_lead, 0.0])
+
+    result = geometry.trace(numpy.array([0.0, 0.0, 10.0]), numpy.array([0.0, 0.0, 1.0]))
+    assert result.segments.size == 0
+    assert result.grammage == {}
+
+
 def test_Volume():
     """Test the Volume interface."""
 
@@ -334,6 +501,7 @@ def test_Volume():
     assert A.mother == None
     assert A.solid == "G4Box"
     assert A.role == None
+    assert A.filter == None
     assert A.name == "A"
     assert A.path == "A"
     assert (A.origin() == numpy.zeros(3)).all()
@@ -1,7 +1,394 @@
 import calzone
+import json
 import numpy
 from numpy.testing import assert_allclose
+import os
+from pathlib import Path
 import pytest
+import subprocess
+import sys
+from tempfile import TemporaryDirectory
+
+
+@pytest.mark.requires_data
+def test_adjoint():
+    """Test the adjoint simulation mode."""
+
+    # Adjoint physics must be enabled before the first run. Thus, the test runs
+    # in a fresh process.
+    script = """
+import calzone
+data = {"A": {"box": 1E+03, "B": {
+    "box": 1E+02, "material": "G4_WATER", "D": {"box": 1E+01}
+}}}
+simulation = calzone.Simulation(data)
+simulation.random.seed = 0
+kwargs = { "detector": "A.B.D", "source": "A.B" }
+result = simulation.run_adjoint(100, energy=(1E-01, 2E+02), **kwargs)
+primaries = result.primaries
+assert primaries.size > 0
+assert (primaries["energy"] >= 1E-01).all()
+assert (primaries["energy"] <= 2E+02).all()
+assert (primaries["weight"] > 0.0).all()
+assert (result.particles["weight"] > 0.0).all()
+
+try:
+    simulation.run_adjoint(100, energy=(1E-01, 3E+02), **kwargs)
+except ValueError:
+    pass
+else:
+    assert False
+"""
+    subprocess.run([sys.executable, "-c", script], check=True)
+
+
+@pytest.mark.requires_data
+def test_biasing():
+    """Test the cross-section biasing."""
+
+    # Biased particles must be declared before the first run. Thus, the test
+    # runs in a fresh process.
+    script = """
+import calzone
+data = {"A": {"box": 1E+03, "B": {
+    "box": 1E+02, "material": "G4_WATER", "role": "catch_outgoing"
+}}}
+physics = calzone.Physics(biasing={
+    "particle": "gamma", "process": "compt", "factor": 1.0, "volume": "A.B"
+})
+simulation = calzone.Simulation(data, physics=physics)
+simulation.random.seed = 0
+particles = simulation.particles().pid("gamma").energy(1.0).generate(100)
+result = simulation.run(particles).particles["B"]
+assert result.size > 0
+assert (result["weight"] == 1.0).all()
+
+physics.biasing = {
+    "particle": "gamma", "process": "compt", "factor": 2.0, "volume": "A.B"
+}
+result = simulation.run(particles).particles["B"]
+assert result.size > 0
+assert (result["weight"] > 0.0).all()
+assert (result["weight"] != 1.0).any()
+"""
+    subprocess.run([sys.executable, "-c", script], check=True)
+
+
+@pytest.mark.requires_data
+def test_cascade():
+    """Test the grouping of primaries per event."""
+
+    data = {"A": {"box": 1E+03, "B": {
+        "box": 1E+02, "material": "G4_WATER", "role": "record_deposits"
+    }}}
+    simulation = calzone.Simulation(data, sample_particles=False)
+    particles = simulation.particles() \
+        .inside("A.B")                 \
+        .pid("gamma")                  \
+        .cascade((1.173, 1.332))       \
+        .generate(100)
+
+    # Particles are not grouped by default.
+    simulation.random.seed = 0
+    deposits = simulation.run(particles)["A.B"]
+    assert deposits["event"].max() >= 100
+
+    simulation.random.seed = 0
+    deposits = simulation.run(particles, group_events=True)["A.B"]
+    assert deposits.size > 0
+    assert deposits["event"].max() < 100
+
+    # Grouped events must not span over several chunks.
+    simulation.random.seed = 0
+    chunks = (particles[i:i+10] for i in range(0, particles.shape[0], 10))
+    result = simulation.run(chunks, events=100, group_events=True)["A.B"]
+    assert (result == deposits).all()
+    flat = particles.flatten()
+    chunks = (flat[i:i+15] for i in range(0, flat.size, 15))
+    with pytest.raises(ValueError):
+        simulation.run(chunks, events=100, group_events=True)
+
+    # The particles of an event must share the same weight.
+    particles["weight"][:,1] = 2.0
+    with pytest.raises(ValueError):
+        simulation.run(particles, group_events=True)
+
+
+@pytest.mark.requires_data
+def test_coincidences():
+    """Test the coincidence rules."""
+
+    data = {"A": {"box": 1E+03, "S": {
+        "box": 3E+01, "material": "G4_WATER", "role": "record_deposits",
+        "D": {"box": 1E+01, "material": "G4_WATER", "role": "record_deposits"}
+    }}}
+    simulation = calzone.Simulation(data, sample_particles=False)
+    simulation.coincidences = {
+        "all": { "volumes": "A.S.D" },
+        "suppressed": { "volumes": "A.S.D", "veto": { "A.S": 0.0 } },
+    }
+    simulation.random.seed = 0
+    particles = simulation.particles() \
+        .inside("A.S.D")               \
+        .pid("gamma")                  \
+        .energy(1.0)                   \
+        .generate(1000)
+    result = simulation.run(particles)
+    accepted, suppressed = result["all"], result["suppressed"]
+    assert accepted.size > 0
+    assert 0 < suppressed.size < accepted.size
+    assert numpy.isin(suppressed["event"], accepted["event"]).all()
+
+    simulation.coincidences = { "C": { "volumes": "A.S.X" } }
+    with pytest.raises(ValueError):
+        simulation.run(particles)
+
+    simulation.coincidences = { "C": { "volumes": "A.S.D", "veto": { "A": 0 } } }
+    with pytest.raises(ValueError):
+        simulation.run(particles)
+
+
+@pytest.mark.requires_data
+def test_fast():
+    """Test the fast simulation models."""
+
+    # The fast simulation process must be registered before the first run.
+    # Thus, the test runs in a fresh process.
+    script = """
+import calzone
+import sys
+data = {"A": {"box": 1E+03, "D": {
+    "box": 1E+02, "material": "G4_WATER", "role": "record_deposits"
+}}}
+simulation = calzone.Simulation(data, sample_particles=False)
+simulation.random.seed = 0
+simulation.calibrate("A.D", sys.argv[1], bins=(4, 8), energy=(1E-01, 1E+01),
+                     events=10000)
+
+particles = simulation.particles() \\
+    .inside("A.D")                 \\
+    .pid("e-")                     \\
+    .energy(1.0)                   \\
+    .generate(1000)
+full = simulation.run(particles)["A.D"]
+
+simulation.fast_models = { "A.D": sys.argv[1] }
+fast = simulation.run(particles)["A.D"]
+assert fast.size > 0
+assert (fast["value"] > 0.0).all()
+assert (fast["value"] <= 1.0).all()
+assert abs(fast["value"].sum() / full["value"].sum() - 1.0) < 0.2
+"""
+    with TemporaryDirectory() as tmpdir:
+        path = Path(tmpdir) / "D.table"
+        subprocess.run([sys.executable, "-c", script, str(path)], check=True)
+
+
+@pytest.mark.requires_data
+def test_filter():
+    """Test the particles filters."""
+
+    data = {"A": {"box": 1E+03, "B": {
+        "box": 1E+02, "material": "G4_WATER", "role": "record_outgoing"
+    }}}
+    simulation = calzone.Simulation(data)
+    simulation.random.seed = 0
+    particles = simulation.particles() \
+        .inside("A.B")                 \
+        .pid("gamma")                  \
+        .energy(1.0)                   \
+        .generate(1000)
+    recorded = simulation.run(particles).particles["A.B"]
+    sel = (recorded["pid"] == 22) & (recorded["energy"] >= 0.5)
+    assert 0 < sum(sel) < recorded.size
+
+    # Outgoing particles are filtered.
+    B = simulation.geometry["A.B"]
+    B.filter = { "outgoing": { "pid": "gamma", "energy": [0.5, 2.0] } }
+    assert B.filter == { "outgoing": { "pid": [22], "energy": [0.5, 2.0] } }
+    simulation.random.seed = 0
+    filtered = simulation.run(particles).particles["A.B"]
+    assert (filtered == recorded[sel]).all()
+
+    # An ingoing filter does not condition outgoing particles.
+    B.filter = { "ingoing": { "pid": "gamma", "energy": [0.5, 2.0] } }
+    simulation.random.seed = 0
+    unfiltered = simulation.run(particles).particles["A.B"]
+    assert (unfiltered == recorded).all()
+
+    # A single filter applies to both directions.
+    B.filter = { "pid": "gamma", "energy": [0.5, 2.0] }
+    assert B.filter == { "pid": [22], "energy": [0.5, 2.0] }
+    simulation.random.seed = 0
+    filtered = simulation.run(particles).particles["A.B"]
+    assert (filtered == recorded[sel]).all()
+
+
+@pytest.mark.requires_data
+def test_max_samples():
+    """Test the capped sampling of deposits."""
+
+    data = {"A": {"box": 1E+03, "B": {
+        "box": 1E+02, "material": "G4_WATER", "role": "record_deposits"
+    }}}
+    simulation = calzone.Simulation(data, sample_particles=False)
+    simulation.random.seed = 0
+    particles = simulation.particles() \
+        .inside("A.B")                 \
+        .pid("gamma")                  \
+        .energy(1.0)                   \
+        .generate(1000)
+    deposits = simulation.run(particles)["A.B"]
+    assert deposits.size > 100
+
+    # Capped deposits are a chronological subset of all events, while the summary covers all
+    # events.
+    simulation.max_samples = 100
+    simulation.random.seed = 0
+    result = simulation.run(particles)
+    capped, summary = result.deposits["A.B"], result.summary.deposits["A.B"]
+    assert capped.size == 100
+    assert (numpy.diff(capped["event"]) > 0).all()
+    assert numpy.isin(capped["event"], deposits["event"]).all()
+    assert_allclose(capped["weight"], deposits.size / capped.size)
+    assert summary.count == deposits.size
+    assert_allclose(summary.sum_w, deposits["weight"].sum())
+    assert_allclose(summary.sum_wx, (deposits["weight"] * deposits["value"]).sum())
+
+
+@pytest.mark.requires_data
+def test_native():
+    """Test the native (C) interface."""
+
+    import ctypes
+
+    class Deposit(ctypes.Structure):
+        _fields_ = [
+            ("event", ctypes.c_size_t),
+            ("value", ctypes.c_double),
+            ("weight", ctypes.c_double),
+            ("random_index", ctypes.c_uint64 * 2),
+        ]
+
+    class Primaries(ctypes.Structure):
+        _fields_ = [
+            ("particles", ctypes.c_void_p),
+            ("size", ctypes.c_size_t),
+            ("weight", ctypes.c_void_p),
+            ("event", ctypes.c_void_p),
+        ]
+
+    DepositsCallback = ctypes.CFUNCTYPE(
+        None, ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(Deposit),
+        ctypes.c_size_t
+    )
+    ParticlesCallback = ctypes.CFUNCTYPE(
+        None, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_void_p, ctypes.c_size_t
+    )
+
+    class Results(ctypes.Structure):
+        _fields_ = [
+            ("user", ctypes.c_void_p),
+            ("deposits", DepositsCallback),
+            ("particles", ParticlesCallback),
+        ]
+
+    lib = ctypes.CDLL(calzone._DLL)
+    lib.calzone_error.restype = ctypes.c_char_p
+    lib.calzone_simulation_create.restype = ctypes.c_void_p
+    lib.calzone_simulation_create.argtypes = (ctypes.c_char_p, ctypes.c_size_t)
+    lib.calzone_simulation_destroy.argtypes = (ctypes.c_void_p,)
+    lib.calzone_simulation_role.argtypes = (
+        ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p
+    )
+    lib.calzone_simulation_run.argtypes = (
+        ctypes.c_void_p, ctypes.POINTER(Primaries), ctypes.POINTER(Results)
+    )
+    lib.calzone_simulation_seed.argtypes = (ctypes.c_void_p, ctypes.c_uint64)
+
+    # Create a simulation from a serialised geometry.
+    data = { "A": { "box": 10.0, "material": "G4_WATER" }}
+    state = calzone.GeometryBuilder(data).__getstate__()
+    simulation = lib.calzone_simulation_create(state, len(state))
+    assert simulation
+    assert lib.calzone_simulation_create(b"", 0) is None
+    assert b"serialisation" in lib.calzone_error()
+
+    role = b"record_deposits"
+    assert lib.calzone_simulation_role(simulation, b"A", role) == 0
+    assert lib.calzone_simulation_role(simulation, b"B", role) == -1
+    assert lib.calzone_simulation_role(simulation, b"A", b"bad_role") == -1
+    assert b"role" in lib.calzone_error()
+    assert lib.calzone_simulation_seed(simulation, 0) == 0
+
+    # Run from a buffer of primaries, and compare to the Python interface.
+    particles = calzone.particles(100, energy=1.0)
+    primaries = Primaries(particles.ctypes.data, particles.size, None, None)
+    deposits = {}
+    def on_deposits(user, volume, data, size):
+        deposits[volume.decode()] = [
+            (data[i].event, data[i].value) for i in range(size)
+        ]
+    results = Results(None, DepositsCallback(on_deposits), ParticlesCallback())
+    assert lib.calzone_simulation_run(simulation, primaries, results) == 0
+    lib.calzone_simulation_destroy(simulation)
+
+    python = calzone.Simulation(data, sample_particles=False)
+    python.geometry["A"].role = "record_deposits"
+    python.random.seed = 0
+    expected = python.run(particles)["A"]
+    assert len(deposits["A"]) == expected.size
+    assert_allclose([d[0] for d in deposits["A"]], expected["event"])
+    assert_allclose([d[1] for d in deposits["A"]], expected["value"])
+
+
+
+@pytest.mark.requires_data
+def test_native_harness():
+    """Test the native (C) interface from a C program."""
+
+    import shutil
+    import sysconfig
+
+    cc = shutil.which("cc")
+    libdir = sysconfig.get_config_var("LIBDIR")
+    libpython = sysconfig.get_config_var("LDLIBRARY")
+    if (cc is None) or (libdir is None) or not str(libpython).endswith(".so"):
+        pytest.skip("missing C compiler or shared libpython")
+
+    tests = Path(__file__).parent
+    with TemporaryDirectory() as tmpdir:
+        tmpdir = Path(tmpdir)
+        program = tmpdir / "native"
+        libpython = libpython[3:-3] # Strip the lib prefix and the .so suffix.
+        subprocess.run([
+            cc, "-o", str(program), str(tests / "native.c"),
+            f"-I{tests.parent / 'src'}", calzone._DLL, f"-L{libdir}",
+            f"-l{libpython}", f"-Wl,-rpath,{libdir}"
+        ], check=True)
+
+        data = { "A": { "box": 10.0, "material": "G4_WATER" }}
+        geometry = tmpdir / "geometry.bin"
+        geometry.write_bytes(calzone.GeometryBuilder(data).__getstate__())
+        particles = calzone.particles(100, energy=1.0)
+        primaries = tmpdir / "primaries.bin"
+        primaries.write_bytes(particles.tobytes())
+
+        result = subprocess.run(
+            [str(program), str(geometry), str(primaries)],
+            check=True,
+            capture_output=True,
+            text=True,
+        )
+        deposits = numpy.loadtxt(result.stdout.splitlines(), ndmin=2)
+
+    python = calzone.Simulation(data, sample_particles=False)
+    python.geometry["A"].role = "record_deposits"
+    python.random.seed = 0
+    expected = python.run(particles)["A"]
+    assert deposits.shape[0] == expected.size
+    assert_allclose(deposits[:,0], expected["event"])
+    assert_allclose(deposits[:,1], expected["value"])
 
 
 def test_particles():
@@ -41,6 +428,17 @@ def test_ParticlesGenerator():
     assert_allclose(particles["tid"], (1,))
     assert_allclose(particles["event"], (0,))
 
+    particles = simulation.particles() \
+        .inside("A")                   \
+        .cascade((1.173, 1.332))       \
+        .generate(3)
+
+    assert particles.shape == (3, 2)
+    assert_allclose(particles["energy"], ((1.173, 1.332),) * 3)
+    assert_allclose(particles["tid"], ((1, 2),) * 3)
+    assert_allclose(particles["event"], ((0, 0), (1, 1), (2, 2)))
+    assert_allclose(particles["position"][:,0], particles["position"][:,1])
+
     particles = simulation.particles() \
         .on("A", direction="ingoing")  \
         .generate(1)
@@ -60,6 +458,44 @@ def test_ParticlesGenerator():
         .generate(100000)
     assert (B.side(particles) == 1).any()
 
+    simulation.random.seed = 0
+    particles = simulation.particles()       \
+        .inside("A", include_daughters=True) \
+        .importance(target="A.B")            \
+        .generate(100000)
+    p0 = sum(B.side(particles) == 1) / particles.size
+    assert p0 > 0.125 * 2
+    assert abs(particles["weight"].mean() - 1.0) < 0.02
+
+    particles = simulation.particles()       \
+        .inside("A", include_daughters=True) \
+        .importance(numpy.ones((2, 2, 2)))   \
+        .generate(10)
+    assert_allclose(particles["weight"], 1.0)
+
+    with pytest.raises(ValueError):
+        simulation.particles().importance(target=(0, 0, 0)).generate(1)
+
+    particles = simulation.particles()       \
+        .inside("A", activity=numpy.full((2, 2, 2), 2.0),
+                include_daughters=True)      \
+        .generate(10)
+    assert_allclose(particles["weight"], 2.0)
+
+    particles = simulation.particles()       \
+        .on("A", activity=numpy.ones((4, 4))) \
+        .generate(10)
+    assert_allclose(particles["position"][:,2], 0.5)
+    assert_allclose(particles["weight"], 1.0)
+
+    activity = numpy.zeros((2, 2))
+    activity[1, 0] = 4.0 # Indexed as [x, y].
+    particles = simulation.particles() \
+        .on("A", activity=activity)     \
+        .generate(10)
+    assert (particles["position"][:,0] > 0.0).all()
+    assert (particles["position"][:,1] < 0.0).all()
+
     simulation.random.seed = 0
     particles = simulation.particles()       \
         .spectrum(((0.5, 0.2), (1.5, 0.8)))  \
@@ -68,10 +504,36 @@ def test_ParticlesGenerator():
     assert abs(p0 - 0.2) <= 3.0 * (p0 * (1 - p0) / particles.size)**0.5
 
 
+@pytest.mark.requires_data
+def test_pileup():
+    """Test the pileup function."""
+
+    data = {"A": {
+        "box": 10.0, "material": "G4_WATER", "role": "record_deposits"
+    }}
+    simulation = calzone.Simulation(data, sample_particles=False)
+    simulation.random.seed = 0
+    particles = simulation.particles() \
+        .inside("A")                   \
+        .pid("gamma")                  \
+        .energy(1.0)                   \
+        .generate(100)
+    deposits = simulation.run(particles)["A"]
+
+    kwargs = { "activity": 1E+03, "duration": 10.0, "events": particles.size }
+    r0 = calzone.pileup(deposits, shaping_time=0.0, **kwargs)
+    assert r0.energy.size == r0.counts.size + 1
+    r1 = calzone.pileup(deposits, shaping_time=1E-03, **kwargs)
+    assert r1.rate < r0.rate
+    with pytest.raises(ValueError):
+        calzone.pileup(deposits, shaping_time=-1.0, **kwargs)
+
+
 def test_Physics():
     """Test the Physics interface."""
 
     physics = calzone.Physics()
+    assert physics.adjoint == False
     assert physics.default_cut == 0.1
     assert physics.em_model == "standard"
     assert physics.had_model == None
@@ -86,6 +548,46 @@ def test_Physics():
     simulation.physics = "dna"
     assert simulation.physics.em_model == "dna"
 
+    physics = calzone.Physics(biasing={"particle": "gamma", "factor": 10.0})
+    assert physics.biasing == [{"particle": "gamma", "factor": 10.0}]
+
+    physics.biasing = [
+        {"particle": "mu-", "process": "muIoni", "factor": 0.5},
+        {"particle": "gamma", "factor": 2.0, "volume": "Environment"},
+    ]
+    assert len(physics.biasing) == 2
+    assert physics.biasing[0]["process"] == "muIoni"
+    assert physics.biasing[1]["volume"] == "Environment"
+
+    physics.biasing = None
+    assert physics.biasing == None
+
+    physics = calzone.Physics(adjoint=True)
+    assert physics.adjoint == True
+
+
+@pytest.mark.requires_data
+def test_physics_tables():
+    """Test the switching of cached physics tables."""
+
+    data = {"A": {"box": 1E+02, "material": "G4_WATER", "role": "record_deposits"}}
+    simulation = calzone.Simulation(data, sample_particles=False)
+    simulation.random.seed = 0
+    particles = simulation.particles() \
+        .inside("A")                   \
+        .pid("gamma")                  \
+        .energy(1.0)                   \
+        .generate(100)
+
+    results = []
+    for em_model in ("standard", "livermore", "standard"):
+        simulation.physics = em_model
+        simulation.random.seed = 0
+        results.append(simulation.run(particles)["A"])
+    assert results[0].size > 0
+    assert results[0].size == results[2].size
+    assert (results[0] == results[2]).all()
+
 
 def test_Random():
     """Test the Random interface."""
@@ -109,6 +611,43 @@ def test_Random():
     rng.index = 5
     assert (rng.uniform01(5) == v[5:]).all()
 
+    rng = calzone.Random(1, engine="philox")
+    assert rng.engine == "philox"
+    v = rng.uniform01(10)
+    assert (v != calzone.Random(1).uniform01(10)).all()
+
+    rng.index = 3
+    assert (rng.uniform01(7) == v[3:]).all()
+    rng.index = 2**100
+    assert rng.index == 2**100
+
+    with pytest.raises(ValueError):
+        calzone.Random(engine="mt19937")
+
+    for engine in ("pcg64mcg", "philox"):
+        rng = calzone.Random(2, engine=engine)
+        v = rng.uniform01(100000)
+        assert rng.index == 100000
+        rng.index = 70000
+        assert (rng.uniform01(30000) == v[70000:]).all()
+
+        rng.index = 0
+        n = rng.normal(5)
+        assert n.shape == (5,)
+        assert rng.index == 6
+        e = rng.exponential((2, 3), scale=2.0)
+        assert e.shape == (2, 3)
+        assert (e > 0.0).all()
+        assert rng.index == 12
+        c = rng.choice([0.0, 1.0, 0.0], 10)
+        assert (c == 1).all()
+        assert rng.index == 22
+
+    with pytest.raises(ValueError):
+        rng.choice([])
+    with pytest.raises(ValueError):
+        rng.normal(scale=-1.0)
+
 
 @pytest.mark.requires_data
 def test_Simulation():
@@ -117,6 +656,53 @@ def test_Simulation():
     # Test setters & getters.
     simulation = calzone.Simulation()
     assert simulation.geometry == None
+    assert simulation.fast_models == None
+    simulation.fast_models = { "A": "A.table" }
+    assert simulation.fast_models == { "A": "A.table" }
+    simulation.fast_models = None
+    assert simulation.fast_models == None
+
+    assert simulation.coincidences == None
+    simulation.coincidences = { "C": { "volumes": "A", "veto": { "B": 0.1 } } }
+    assert simulation.coincidences == {
+        "C": { "volumes": ["A"], "threshold": 0.0, "veto": { "B": 0.1 } }
+    }
+    with pytest.raises(TypeError):
+        simulation.coincidences = { "C": { "threshold": 0.1 } }
+    simulation.coincidences = None
+    assert simulation.coincidences == None
+
+    assert simulation.scoring == None
+    mesh = { "lower": [-1, -1, -1], "upper": [1, 1, 1], "shape": [2, 3, 4] }
+    simulation.scoring = { "M": mesh }
+    assert simulation.scoring == { "M": mesh }
+    with pytest.raises(ValueError):
+        simulation.scoring = { "M": { **mesh, "upper": [1, 1, -1] } }
+    simulation.scoring = None
+    assert simulation.scoring == None
+
+    assert simulation.tally == { "energy": [1E-03, 1E+04], "bins": [70, 10] }
+    simulation.tally = { "energy": [1.0, 10.0], "bins": [5, 2] }
+    assert simulation.tally == { "energy": [1.0, 10.0], "bins": [5, 2] }
+    with pytest.raises(ValueError):
+        simulation.tally = { "energy": [10.0, 1.0] }
+    simulation.tally = None
+    assert simulation.tally == { "energy": [1E-03, 1E+04], "bins": [70, 10] }
+
+    assert simulation.sample_deposits == "brief"
+    simulation.sample_deposits = "tracks"
+    assert simulation.sample_deposits == "tracks"
+    simulation.sample_deposits = "brief"
+
+    assert simulation.max_samples == None
+    simulation.max_samples = 10
+    assert simulation.max_samples == 10
+    simulation.max_samples = { "A": 10 }
+    assert simulation.max_samples == { "A": 10 }
+    with pytest.raises(ValueError):
+        simulation.max_samples = 0
+    simulation.max_samples = None
+    assert simulation.max_samples == None
 
     data = {"A": {
         "box": 100.0, "material": "G4_WATER", "role": "catch_outgoing"
@@ -157,3 +743,81 @@ def test_Simulation():
         sel = vertices["event"] == event
         vertex = vertices[sel][0]
         assert vertex["energy"] == primaries[event]["energy"]
+
+    # Test streamed primaries.
+    simulation.tracking = False
+    simulation.random.seed = 1
+    result2 = simulation.run(particles)
+    simulation.random.seed = 1
+    chunks = (particles[i:i+300] for i in range(0, particles.size, 300))
+    result3 = simulation.run(chunks, events=particles.size)
+    assert (result3.particles["A"] == result2.particles["A"]).all()
+
+    with pytest.raises(ValueError):
+        simulation.run(iter((particles,)))
+    with pytest.raises(ValueError):
+        simulation.run(iter((particles,)), events=particles.size + 1)
+    with pytest.raises(ValueError):
+        simulation.run(iter((particles,)), events=particles.size - 1)
+
+
+@pytest.mark.requires_data
+def test_tally():
+    """Test the boundary tallies."""
+
+    data = {"A": {"box": 1E+03, "B": {
+        "box": 1E+02, "material": "G4_WATER", "role": "record_outgoing"
+    }}}
+    simulation = calzone.Simulation(data)
+    simulation.random.seed = 0
+    particles = simulation.particles() \
+        .inside("A.B")                 \
+        .pid("gamma")                  \
+        .energy(1.0)                   \
+        .generate(1000)
+    recorded = simulation.run(particles).particles["A.B"]
+    energy = recorded["energy"]
+    expected = sum((energy >= 1E-03) & (energy <= 1E+04))
+    assert expected > 0
+
+    # Tallies do not depend on particles sampling.
+    simulation.geometry["A.B"].role = "tally_outgoing"
+    simulation.sample_particles = False
+    simulation.random.seed = 0
+    tally = simulation.run(particles).tallies["A.B"]
+    total = sum(weights.sum() for weights in tally.weights.values())
+    assert_allclose(total, expected)
+
+    # Tallies are exported even if nothing was tallied.
+    simulation.geometry["A.B"].role = ("record_deposits", "tally_outgoing")
+    simulation.tally = { "energy": [1E+02, 1E+03] }
+    result = simulation.run(particles)
+    assert result.tallies == {}
+    assert "A.B" in result.deposits
+
+
+@pytest.mark.requires_data
+def test_trace():
+    """Test the timeline tracing."""
+
+    script = """
+import calzone
+simulation = calzone.Simulation({"A": {"box": 1E+02, "role": "record_outgoing"}})
+simulation.sample_particles = True
+particles = simulation.particles().pid("gamma").energy(1.0).generate(10)
+simulation.run(particles)
+"""
+    with TemporaryDirectory() as tmpdir:
+        path = Path(tmpdir) / "trace.json"
+        env = dict(os.environ, CALZONE_TRACE=str(path))
+        subprocess.run([sys.executable, "-c", script], env=env, check=True)
+        data = path.read_text().rstrip().rstrip(",") + "]"
+    events = json.loads(data)
+    names = { event["name"] for event in events }
+    for name in ("GeometryBuilder::build", "create_geometry", "GeometryData",
+                 "Simulation::run", "run_simulation", "PhysicsImpl::Update",
+                 "physics tables", "BeamOn", "RunAgent::export"):
+        assert(name in names)
+    for event in events:
+        assert(event["ph"] == "X")
+        assert(event["dur"] >= 0.0)